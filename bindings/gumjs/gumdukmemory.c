@@ -35,6 +35,7 @@ struct _GumMemoryScanContext
 {
   GumMemoryRange range;
   GumMatchPattern * pattern;
+  GumMatchPatternSet * pattern_set;
   GumDukHeapPtr on_match;
   GumDukHeapPtr on_error;
   GumDukHeapPtr on_complete;
@@ -103,11 +104,18 @@ GUMJS_DECLARE_FUNCTION (gumjs_memory_alloc_utf8_string)
 GUMJS_DECLARE_FUNCTION (gumjs_memory_alloc_utf16_string)
 
 GUMJS_DECLARE_FUNCTION (gumjs_memory_scan)
+GUMJS_DECLARE_FUNCTION (gumjs_memory_scan_many)
 
+static void gum_memory_scan_context_push (GumMemoryScanContext * sc,
+    duk_context * ctx);
 static void gum_memory_scan_context_free (GumMemoryScanContext * ctx);
 static void gum_memory_scan_context_run (GumMemoryScanContext * self);
 static gboolean gum_memory_scan_context_emit_match (GumAddress address,
     gsize size, gpointer user_data);
+static gboolean gum_memory_scan_context_emit_many_match (guint pattern_id,
+    GumAddress address, gsize size, gpointer user_data);
+static gboolean gum_memory_scan_context_emit (GumMemoryScanContext * self,
+    GumAddress address, gsize size, gint pattern_id);
 
 GUMJS_DECLARE_FUNCTION (gumjs_memory_access_monitor_enable)
 GUMJS_DECLARE_FUNCTION (gumjs_memory_access_monitor_disable)
@@ -140,6 +148,7 @@ static const duk_function_list_entry gumjs_memory_functions[] =
   { "allocUtf16String", gumjs_memory_alloc_utf16_string, 1 },
 
   { "scan", gumjs_memory_scan, 4 },
+  { "scanMany", gumjs_memory_scan_many, 4 },
 
   { NULL, NULL, 0 }
 };
@@ -841,38 +850,104 @@ GUMJS_DEFINE_FUNCTION (gumjs_memory_scan)
   sc.range.base_address = GUM_ADDRESS (address);
   sc.range.size = size;
   sc.pattern = gum_match_pattern_new_from_string (match_str);
+  sc.pattern_set = NULL;
   sc.core = core;
 
   if (sc.pattern == NULL)
     goto invalid_match_pattern;
 
-  _gumjs_duk_protect (ctx, sc.on_match);
-  if (sc.on_error != NULL)
-    _gumjs_duk_protect (ctx, sc.on_error);
-  _gumjs_duk_protect (ctx, sc.on_complete);
+  gum_memory_scan_context_push (&sc, ctx);
 
-  _gum_duk_core_push_job (core,
-      (GumScriptJobFunc) gum_memory_scan_context_run,
-      g_slice_dup (GumMemoryScanContext, &sc),
-      (GDestroyNotify) gum_memory_scan_context_free);
+  duk_push_undefined (ctx);
+  return 1;
+
+invalid_match_pattern:
+  {
+    _gumjs_throw (ctx, "invalid match pattern");
+    duk_push_null (ctx);
+    return 1;
+  }
+}
+
+GUMJS_DEFINE_FUNCTION (gumjs_memory_scan_many)
+{
+  GumDukCore * core = args->core;
+  GumMemoryScanContext sc;
+  gpointer address;
+  guint size;
+  GumDukHeapPtr match_strs;
+  guint n, i;
+
+  if (!_gumjs_args_parse (ctx, "puAF{onMatch,onError?,onComplete}", &address,
+      &size, &match_strs, &sc.on_match, &sc.on_error, &sc.on_complete))
+  {
+    duk_push_null (ctx);
+    return 1;
+  }
+
+  sc.range.base_address = GUM_ADDRESS (address);
+  sc.range.size = size;
+  sc.pattern = NULL;
+  sc.pattern_set = gum_match_pattern_set_new ();
+  sc.core = core;
+
+  duk_push_heapptr (ctx, match_strs);
+  n = duk_get_length (ctx, -1);
+  for (i = 0; i != n; i++)
+  {
+    GumMatchPattern * pattern = NULL;
+
+    duk_get_prop_index (ctx, -1, i);
+    if (duk_is_string (ctx, -1))
+      pattern = gum_match_pattern_new_from_string (duk_get_string (ctx, -1));
+    duk_pop (ctx);
+
+    if (pattern == NULL)
+      goto invalid_match_pattern;
+
+    gum_match_pattern_set_add (sc.pattern_set, pattern);
+  }
+  duk_pop (ctx);
+
+  gum_memory_scan_context_push (&sc, ctx);
 
   duk_push_undefined (ctx);
   return 1;
 
 invalid_match_pattern:
   {
+    duk_pop (ctx);
+    gum_match_pattern_set_free (sc.pattern_set);
     _gumjs_throw (ctx, "invalid match pattern");
     duk_push_null (ctx);
     return 1;
   }
 }
 
+static void
+gum_memory_scan_context_push (GumMemoryScanContext * sc,
+                              duk_context * ctx)
+{
+  _gumjs_duk_protect (ctx, sc->on_match);
+  if (sc->on_error != NULL)
+    _gumjs_duk_protect (ctx, sc->on_error);
+  _gumjs_duk_protect (ctx, sc->on_complete);
+
+  _gum_duk_core_push_job (sc->core,
+      (GumScriptJobFunc) gum_memory_scan_context_run,
+      g_slice_dup (GumMemoryScanContext, sc),
+      (GDestroyNotify) gum_memory_scan_context_free);
+}
+
 static void
 gum_memory_scan_context_free (GumMemoryScanContext * ctx)
 {
   duk_context * js_ctx = ctx->core->ctx;
 
-  gum_match_pattern_free (ctx->pattern);
+  if (ctx->pattern != NULL)
+    gum_match_pattern_free (ctx->pattern);
+  if (ctx->pattern_set != NULL)
+    gum_match_pattern_set_free (ctx->pattern_set);
 
   _gumjs_duk_unprotect (js_ctx, ctx->on_match);
   if (ctx->on_error != NULL)
@@ -893,8 +968,16 @@ gum_memory_scan_context_run (GumMemoryScanContext * self)
 
   if (gum_exceptor_try (exceptor, &exceptor_scope))
   {
-    gum_memory_scan (&self->range, self->pattern,
-        gum_memory_scan_context_emit_match, self);
+    if (self->pattern_set != NULL)
+    {
+      gum_memory_scan_many (&self->range, self->pattern_set,
+          gum_memory_scan_context_emit_many_match, self);
+    }
+    else
+    {
+      gum_memory_scan (&self->range, self->pattern,
+          gum_memory_scan_context_emit_match, self);
+    }
   }
 
   _gum_duk_scope_enter (&script_scope, core);
@@ -928,7 +1011,24 @@ gum_memory_scan_context_emit_match (GumAddress address,
                                     gsize size,
                                     gpointer user_data)
 {
-  GumMemoryScanContext * self = user_data;
+  return gum_memory_scan_context_emit (user_data, address, size, -1);
+}
+
+static gboolean
+gum_memory_scan_context_emit_many_match (guint pattern_id,
+                                         GumAddress address,
+                                         gsize size,
+                                         gpointer user_data)
+{
+  return gum_memory_scan_context_emit (user_data, address, size, pattern_id);
+}
+
+static gboolean
+gum_memory_scan_context_emit (GumMemoryScanContext * self,
+                              GumAddress address,
+                              gsize size,
+                              gint pattern_id)
+{
   GumDukCore * core = self->core;
   GumDukScope scope;
   duk_context * ctx = self->core->ctx;
@@ -944,10 +1044,12 @@ gum_memory_scan_context_emit_match (GumAddress address,
   duk_push_heapptr (ctx, match_address);
   _gumjs_duk_release_heapptr (ctx, match_address);
   duk_push_number (ctx, size);
+  if (pattern_id != -1)
+    duk_push_uint (ctx, pattern_id);
 
   proceed = TRUE;
 
-  if (_gum_duk_scope_call (&scope, 2))
+  if (_gum_duk_scope_call (&scope, (pattern_id != -1) ? 3 : 2))
   {
     if (duk_is_string (ctx, -1))
     {
@@ -44,6 +44,7 @@ static const GumDukPropertyEntry gumjs_stalker_values[] =
 static const duk_function_list_entry gumjs_stalker_functions[] =
 {
   { "garbageCollect", gumjs_stalker_throw_not_yet_available, GUMJS_RO },
+  { "flush", gumjs_stalker_throw_not_yet_available, GUMJS_RO },
   { "follow", gumjs_stalker_throw_not_yet_available, GUMJS_RO },
   { "unfollow", gumjs_stalker_throw_not_yet_available, GUMJS_RO },
   { "addCallProbe", gumjs_stalker_throw_not_yet_available, GUMJS_RO },
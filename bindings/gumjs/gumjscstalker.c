@@ -46,6 +46,7 @@ static const JSStaticValue gumjs_stalker_values[] =
 static const JSStaticFunction gumjs_stalker_functions[] =
 {
   { "garbageCollect", gumjs_stalker_throw_not_yet_available, GUMJS_RO },
+  { "flush", gumjs_stalker_throw_not_yet_available, GUMJS_RO },
   { "follow", gumjs_stalker_throw_not_yet_available, GUMJS_RO },
   { "unfollow", gumjs_stalker_throw_not_yet_available, GUMJS_RO },
   { "addCallProbe", gumjs_stalker_throw_not_yet_available, GUMJS_RO },
@@ -21,8 +21,12 @@ static GumEventType gum_v8_event_sink_query_mask (GumEventSink * sink);
 static void gum_v8_event_sink_start (GumEventSink * sink);
 static void gum_v8_event_sink_process (GumEventSink * sink,
     const GumEvent * ev);
+static void gum_v8_event_sink_process_batch (GumEventSink * sink,
+    const GumEvent * events, guint n_events);
 static void gum_v8_event_sink_stop (GumEventSink * sink);
 static gboolean gum_v8_event_sink_stop_idle (gpointer user_data);
+static void gum_v8_event_sink_schedule_drain (GumV8EventSink * self);
+static gboolean gum_v8_event_sink_drain_idle (gpointer user_data);
 static gboolean gum_v8_event_sink_drain (gpointer user_data);
 
 G_DEFINE_TYPE_EXTENDED (GumV8EventSink,
@@ -52,6 +56,7 @@ gum_v8_event_sink_iface_init (gpointer g_iface,
   iface->query_mask = gum_v8_event_sink_query_mask;
   iface->start = gum_v8_event_sink_start;
   iface->process = gum_v8_event_sink_process;
+  iface->process_batch = gum_v8_event_sink_process_batch;
   iface->stop = gum_v8_event_sink_stop;
 }
 
@@ -158,9 +163,63 @@ gum_v8_event_sink_process (GumEventSink * sink,
   gum_spinlock_acquire (&self->lock);
   if (self->queue->len != self->queue_capacity)
     g_array_append_val (self->queue, *ev);
+  else
+    self->dropped_count++;
   gum_spinlock_release (&self->lock);
 }
 
+static void
+gum_v8_event_sink_process_batch (GumEventSink * sink,
+                                 const GumEvent * events,
+                                 guint n_events)
+{
+  GumV8EventSink * self = GUM_V8_EVENT_SINK_CAST (sink);
+  guint n;
+
+  /*
+   * Never wait for the main context to make room, as it might be blocked on
+   * something the instrumented thread holds. Whatever does not fit is
+   * dropped and counted, and a drain is requested so it catches up sooner.
+   */
+  gum_spinlock_acquire (&self->lock);
+  n = MIN (n_events, self->queue_capacity - self->queue->len);
+  g_array_append_vals (self->queue, events, n);
+  self->dropped_count += n_events - n;
+  gum_spinlock_release (&self->lock);
+
+  if (n != n_events && self->core != NULL &&
+      !g_main_context_is_owner (self->main_context))
+  {
+    gum_v8_event_sink_schedule_drain (self);
+  }
+}
+
+static void
+gum_v8_event_sink_schedule_drain (GumV8EventSink * self)
+{
+  GSource * source;
+
+  if (!g_atomic_int_compare_and_exchange (&self->drain_scheduled, FALSE, TRUE))
+    return;
+
+  source = g_idle_source_new ();
+  g_source_set_callback (source, gum_v8_event_sink_drain_idle,
+      g_object_ref (self), g_object_unref);
+  g_source_attach (source, self->main_context);
+  g_source_unref (source);
+}
+
+static gboolean
+gum_v8_event_sink_drain_idle (gpointer user_data)
+{
+  GumV8EventSink * self = GUM_V8_EVENT_SINK (user_data);
+
+  g_atomic_int_set (&self->drain_scheduled, FALSE);
+  gum_v8_event_sink_drain (self);
+
+  return FALSE;
+}
+
 static void
 gum_v8_event_sink_stop (GumEventSink * sink)
 {
@@ -37,6 +37,7 @@ struct _GumV8EventSink
   GArray * queue;
   guint queue_capacity;
   guint queue_drain_interval;
+  guint64 dropped_count;
 
   GumV8Core * core;
   GMainContext * main_context;
@@ -44,6 +45,7 @@ struct _GumV8EventSink
   GumPersistent<v8::Function>::type * on_receive;
   GumPersistent<v8::Function>::type * on_call_summary;
   GSource * source;
+  volatile gint drain_scheduled;
 };
 
 struct _GumV8EventSinkClass
@@ -49,6 +49,7 @@ struct _GumMemoryScanContext
   GumV8Core * core;
   GumMemoryRange range;
   GumMatchPattern * pattern;
+  GumMatchPatternSet * pattern_set;
   GumPersistent<Function>::type * on_match;
   GumPersistent<Function>::type * on_error;
   GumPersistent<Function>::type * on_complete;
@@ -79,10 +80,24 @@ static void gum_v8_memory_do_write (
 
 static void gum_v8_memory_on_scan (
     const FunctionCallbackInfo<Value> & info);
+static void gum_v8_memory_on_scan_many (
+    const FunctionCallbackInfo<Value> & info);
+static gboolean gum_v8_memory_parse_scan_callbacks (GumV8Core * core,
+    const gchar * name, Local<Value> callbacks_value,
+    Local<Function> * on_match, Local<Function> * on_error,
+    Local<Function> * on_complete);
+static void gum_v8_memory_push_scan_job (GumV8Memory * self,
+    GumMemoryScanContext * ctx, const FunctionCallbackInfo<Value> & info,
+    Local<Function> on_match, Local<Function> on_error,
+    Local<Function> on_complete);
 static void gum_memory_scan_context_free (GumMemoryScanContext * ctx);
 static void gum_v8_script_do_memory_scan (gpointer user_data);
 static gboolean gum_v8_process_scan_match (GumAddress address, gsize size,
     gpointer user_data);
+static gboolean gum_v8_process_scan_many_match (guint pattern_id,
+    GumAddress address, gsize size, gpointer user_data);
+static gboolean gum_v8_emit_scan_match (GumMemoryScanContext * ctx,
+    GumAddress address, gsize size, gint pattern_id);
 
 static void gum_v8_memory_access_monitor_on_enable (
     const FunctionCallbackInfo<Value> & info);
@@ -188,6 +203,9 @@ _gum_v8_memory_init (GumV8Memory * self,
   memory->Set (String::NewFromUtf8 (isolate, "scan"),
       FunctionTemplate::New (isolate, gum_v8_memory_on_scan,
           data));
+  memory->Set (String::NewFromUtf8 (isolate, "scanMany"),
+      FunctionTemplate::New (isolate, gum_v8_memory_on_scan_many,
+          data));
   scope->Set (String::NewFromUtf8 (isolate, "Memory"), memory);
 
   Handle<ObjectTemplate> monitor = ObjectTemplate::New ();
@@ -935,41 +953,20 @@ gum_v8_memory_on_scan (const FunctionCallbackInfo<Value> & info)
 
   String::Utf8Value match_str (info[2]);
 
-  Local<Value> callbacks_value = info[3];
-  if (!callbacks_value->IsObject ())
-  {
-    isolate->ThrowException (Exception::TypeError (String::NewFromUtf8 (isolate,
-        "Memory.scan: fourth argument must be a callback object")));
-    return;
-  }
-
-  Local<Object> callbacks = Local<Object>::Cast (callbacks_value);
-  Local<Function> on_match;
-  if (!_gum_v8_callbacks_get (callbacks, "onMatch", &on_match, core))
-    return;
-  Local<Function> on_error;
-  if (!_gum_v8_callbacks_get_opt (callbacks, "onError", &on_error, core))
-    return;
-  Local<Function> on_complete;
-  if (!_gum_v8_callbacks_get (callbacks, "onComplete", &on_complete, core))
+  Local<Function> on_match, on_error, on_complete;
+  if (!gum_v8_memory_parse_scan_callbacks (core, "Memory.scan", info[3],
+      &on_match, &on_error, &on_complete))
     return;
 
   GumMatchPattern * pattern = gum_match_pattern_new_from_string (*match_str);
   if (pattern != NULL)
   {
     GumMemoryScanContext * ctx = g_slice_new0 (GumMemoryScanContext);
-
-    ctx->core = core;
     ctx->range = range;
     ctx->pattern = pattern;
-    ctx->on_match = new GumPersistent<Function>::type (isolate, on_match);
-    if (!on_error.IsEmpty ())
-      ctx->on_error = new GumPersistent<Function>::type (isolate, on_error);
-    ctx->on_complete = new GumPersistent<Function>::type (isolate, on_complete);
-    ctx->receiver = new GumPersistent<Value>::type (isolate, info.This ());
-
-    _gum_v8_core_push_job (self->core, gum_v8_script_do_memory_scan, ctx,
-        reinterpret_cast<GDestroyNotify> (gum_memory_scan_context_free));
+
+    gum_v8_memory_push_scan_job (self, ctx, info, on_match, on_error,
+        on_complete);
   }
   else
   {
@@ -978,13 +975,133 @@ gum_v8_memory_on_scan (const FunctionCallbackInfo<Value> & info)
   }
 }
 
+/*
+ * Prototype:
+ * Memory.scanMany(address, size, match_strs, callback)
+ *
+ * Docs:
+ * Scans a memory region for any of several patterns in a single pass.
+ * onMatch is called with the address, the size and the index of the
+ * pattern within match_strs.
+ *
+ * Example:
+ * TBW
+ */
+static void
+gum_v8_memory_on_scan_many (const FunctionCallbackInfo<Value> & info)
+{
+  GumV8Memory * self = static_cast<GumV8Memory *> (
+      info.Data ().As<External> ()->Value ());
+  GumV8Core * core = self->core;
+  Isolate * isolate = core->isolate;
+
+  gpointer address;
+  if (!_gum_v8_native_pointer_get (info[0], &address, core))
+    return;
+  GumMemoryRange range;
+  range.base_address = GUM_ADDRESS (address);
+  range.size = info[1]->IntegerValue ();
+
+  Local<Value> match_strs_value = info[2];
+  if (!match_strs_value->IsArray ())
+  {
+    isolate->ThrowException (Exception::TypeError (String::NewFromUtf8 (isolate,
+        "Memory.scanMany: third argument must be an array of strings")));
+    return;
+  }
+  Local<Array> match_strs = Local<Array>::Cast (match_strs_value);
+
+  Local<Function> on_match, on_error, on_complete;
+  if (!gum_v8_memory_parse_scan_callbacks (core, "Memory.scanMany", info[3],
+      &on_match, &on_error, &on_complete))
+    return;
+
+  GumMatchPatternSet * pattern_set = gum_match_pattern_set_new ();
+  for (uint32_t i = 0; i != match_strs->Length (); i++)
+  {
+    String::Utf8Value match_str (match_strs->Get (i));
+    GumMatchPattern * pattern = gum_match_pattern_new_from_string (*match_str);
+    if (pattern == NULL)
+    {
+      gum_match_pattern_set_free (pattern_set);
+      isolate->ThrowException (Exception::Error (String::NewFromUtf8 (isolate,
+          "invalid match pattern")));
+      return;
+    }
+    gum_match_pattern_set_add (pattern_set, pattern);
+  }
+
+  GumMemoryScanContext * ctx = g_slice_new0 (GumMemoryScanContext);
+  ctx->range = range;
+  ctx->pattern_set = pattern_set;
+
+  gum_v8_memory_push_scan_job (self, ctx, info, on_match, on_error,
+      on_complete);
+}
+
+static gboolean
+gum_v8_memory_parse_scan_callbacks (GumV8Core * core,
+                                    const gchar * name,
+                                    Local<Value> callbacks_value,
+                                    Local<Function> * on_match,
+                                    Local<Function> * on_error,
+                                    Local<Function> * on_complete)
+{
+  Isolate * isolate = core->isolate;
+
+  if (!callbacks_value->IsObject ())
+  {
+    gchar * message = g_strdup_printf (
+        "%s: fourth argument must be a callback object", name);
+    isolate->ThrowException (Exception::TypeError (String::NewFromUtf8 (isolate,
+        message)));
+    g_free (message);
+    return FALSE;
+  }
+
+  Local<Object> callbacks = Local<Object>::Cast (callbacks_value);
+  if (!_gum_v8_callbacks_get (callbacks, "onMatch", on_match, core))
+    return FALSE;
+  if (!_gum_v8_callbacks_get_opt (callbacks, "onError", on_error, core))
+    return FALSE;
+  if (!_gum_v8_callbacks_get (callbacks, "onComplete", on_complete, core))
+    return FALSE;
+
+  return TRUE;
+}
+
+static void
+gum_v8_memory_push_scan_job (GumV8Memory * self,
+                             GumMemoryScanContext * ctx,
+                             const FunctionCallbackInfo<Value> & info,
+                             Local<Function> on_match,
+                             Local<Function> on_error,
+                             Local<Function> on_complete)
+{
+  GumV8Core * core = self->core;
+  Isolate * isolate = core->isolate;
+
+  ctx->core = core;
+  ctx->on_match = new GumPersistent<Function>::type (isolate, on_match);
+  if (!on_error.IsEmpty ())
+    ctx->on_error = new GumPersistent<Function>::type (isolate, on_error);
+  ctx->on_complete = new GumPersistent<Function>::type (isolate, on_complete);
+  ctx->receiver = new GumPersistent<Value>::type (isolate, info.This ());
+
+  _gum_v8_core_push_job (core, gum_v8_script_do_memory_scan, ctx,
+      reinterpret_cast<GDestroyNotify> (gum_memory_scan_context_free));
+}
+
 static void
 gum_memory_scan_context_free (GumMemoryScanContext * ctx)
 {
   if (ctx == NULL)
     return;
 
-  gum_match_pattern_free (ctx->pattern);
+  if (ctx->pattern != NULL)
+    gum_match_pattern_free (ctx->pattern);
+  if (ctx->pattern_set != NULL)
+    gum_match_pattern_set_free (ctx->pattern_set);
 
   {
     ScriptScope script_scope (ctx->core->script);
@@ -1012,8 +1129,16 @@ gum_v8_script_do_memory_scan (gpointer user_data)
 
   if (gum_exceptor_try (exceptor, &scope))
   {
-    gum_memory_scan (&ctx->range, ctx->pattern, gum_v8_process_scan_match,
-        ctx);
+    if (ctx->pattern_set != NULL)
+    {
+      gum_memory_scan_many (&ctx->range, ctx->pattern_set,
+          gum_v8_process_scan_many_match, ctx);
+    }
+    else
+    {
+      gum_memory_scan (&ctx->range, ctx->pattern, gum_v8_process_scan_match,
+          ctx);
+    }
   }
 
   {
@@ -1051,7 +1176,27 @@ gum_v8_process_scan_match (GumAddress address,
                            gsize size,
                            gpointer user_data)
 {
-  GumMemoryScanContext * ctx = static_cast<GumMemoryScanContext *> (user_data);
+  return gum_v8_emit_scan_match (
+      static_cast<GumMemoryScanContext *> (user_data), address, size, -1);
+}
+
+static gboolean
+gum_v8_process_scan_many_match (guint pattern_id,
+                                GumAddress address,
+                                gsize size,
+                                gpointer user_data)
+{
+  return gum_v8_emit_scan_match (
+      static_cast<GumMemoryScanContext *> (user_data), address, size,
+      pattern_id);
+}
+
+static gboolean
+gum_v8_emit_scan_match (GumMemoryScanContext * ctx,
+                        GumAddress address,
+                        gsize size,
+                        gint pattern_id)
+{
   ScriptScope scope (ctx->core->script);
   Isolate * isolate = ctx->core->isolate;
 
@@ -1059,9 +1204,11 @@ gum_v8_process_scan_match (GumAddress address,
   Local<Value> receiver (Local<Value>::New (isolate, *ctx->receiver));
   Handle<Value> argv[] = {
     _gum_v8_native_pointer_new (GSIZE_TO_POINTER (address), ctx->core),
-    Integer::NewFromUnsigned (isolate, size)
+    Integer::NewFromUnsigned (isolate, size),
+    Integer::New (isolate, pattern_id)
   };
-  Local<Value> result = on_match->Call (receiver, 2, argv);
+  Local<Value> result = on_match->Call (receiver,
+      (pattern_id != -1) ? 3 : 2, argv);
 
   gboolean proceed = TRUE;
   if (!result.IsEmpty () && result->IsString ())
@@ -36,6 +36,8 @@ static void gum_v8_stalker_on_set_queue_drain_interval (
     const PropertyCallbackInfo<void> & info);
 static void gum_v8_stalker_on_garbage_collect (
     const FunctionCallbackInfo<Value> & info);
+static void gum_v8_stalker_on_flush (
+    const FunctionCallbackInfo<Value> & info);
 static void gum_v8_stalker_on_follow (
     const FunctionCallbackInfo<Value> & info);
 static void gum_v8_stalker_on_unfollow (
@@ -85,6 +87,9 @@ _gum_v8_stalker_init (GumV8Stalker * self,
   stalker->Set (String::NewFromUtf8 (isolate, "garbageCollect"),
       FunctionTemplate::New (isolate, gum_v8_stalker_on_garbage_collect,
       data));
+  stalker->Set (String::NewFromUtf8 (isolate, "flush"),
+      FunctionTemplate::New (isolate, gum_v8_stalker_on_flush,
+      data));
   stalker->Set (String::NewFromUtf8 (isolate, "follow"),
       FunctionTemplate::New (isolate, gum_v8_stalker_on_follow,
       data));
@@ -259,6 +264,25 @@ gum_v8_stalker_on_garbage_collect (const FunctionCallbackInfo<Value> & info)
   gum_stalker_garbage_collect (_gum_v8_stalker_get (self));
 }
 
+/*
+ * Prototype:
+ * Stalker.flush()
+ *
+ * Docs:
+ * TBW
+ *
+ * Example:
+ * TBW
+ */
+static void
+gum_v8_stalker_on_flush (const FunctionCallbackInfo<Value> & info)
+{
+  GumV8Stalker * self = static_cast<GumV8Stalker *> (
+      info.Data ().As<External> ()->Value ());
+
+  gum_stalker_flush (_gum_v8_stalker_get (self));
+}
+
 /*
  * Prototype:
  * TBW
@@ -964,8 +964,17 @@ gum_x86_writer_put_sub_reg_reg (GumX86Writer * self,
                                 GumCpuReg dst_reg,
                                 GumCpuReg src_reg)
 {
+  GumCpuRegInfo dst, src;
+
+  gum_x86_writer_describe_cpu_reg (self, dst_reg, &dst);
+  gum_x86_writer_describe_cpu_reg (self, src_reg, &src);
+
+  g_return_if_fail (src.width == dst.width);
+
+  gum_x86_writer_put_prefix_for_registers (self, &dst, 32, &dst, &src, NULL);
+
   self->code[0] = 0x29;
-  self->code[1] = 0xc0 | (src_reg << 3) | dst_reg;
+  self->code[1] = 0xc0 | (src.index << 3) | dst.index;
   self->code += 2;
 }
 
@@ -2068,6 +2077,25 @@ gum_x86_writer_put_cmp_reg_i32 (GumX86Writer * self,
   self->code += 4;
 }
 
+void
+gum_x86_writer_put_cmp_reg_reg (GumX86Writer * self,
+                                GumCpuReg reg_a,
+                                GumCpuReg reg_b)
+{
+  GumCpuRegInfo a, b;
+
+  gum_x86_writer_describe_cpu_reg (self, reg_a, &a);
+  gum_x86_writer_describe_cpu_reg (self, reg_b, &b);
+
+  g_return_if_fail (a.width == b.width);
+
+  gum_x86_writer_put_prefix_for_registers (self, &a, 32, &a, &b, NULL);
+
+  self->code[0] = 0x39;
+  self->code[1] = 0xc0 | (b.index << 3) | a.index;
+  self->code += 2;
+}
+
 void
 gum_x86_writer_put_cmp_reg_offset_ptr_reg (GumX86Writer * self,
                                            GumCpuReg reg_a,
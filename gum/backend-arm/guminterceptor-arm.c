@@ -160,6 +160,10 @@ _gum_interceptor_backend_create_trampoline (GumInterceptorBackend * self,
       &ctx->backend_data;
   guint reloc_bytes;
 
+  /* inline probes are not yet implemented for this architecture */
+  if (ctx->probe_counter != NULL)
+    return FALSE;
+
   function_address = FUNCTION_CONTEXT_ADDRESS (ctx);
   is_thumb = FUNCTION_CONTEXT_ADDRESS_IS_THUMB (ctx);
 
@@ -361,6 +365,25 @@ _gum_interceptor_backend_commit_trampoline (GumInterceptorBackend * self,
       ctx->overwritten_prologue_len);
 }
 
+void
+_gum_interceptor_backend_update_requirements (GumInterceptorBackend * self,
+                                              GumFunctionContext * ctx)
+{
+  /* we always save the full CPU context */
+  (void) self;
+  (void) ctx;
+}
+
+gboolean
+_gum_interceptor_backend_is_using_minimal_thunks (GumInterceptorBackend * self,
+                                                  GumFunctionContext * ctx)
+{
+  (void) self;
+  (void) ctx;
+
+  return FALSE;
+}
+
 gpointer
 _gum_interceptor_backend_resolve_redirect (GumInterceptorBackend * self,
                                            gpointer address)
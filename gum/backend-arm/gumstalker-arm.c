@@ -72,6 +72,18 @@ gum_stalker_set_trust_threshold (GumStalker * self,
 {
 }
 
+gboolean
+gum_stalker_get_shared_cache (GumStalker * self)
+{
+  return FALSE;
+}
+
+void
+gum_stalker_set_shared_cache (GumStalker * self,
+                              gboolean shared_cache)
+{
+}
+
 void
 gum_stalker_stop (GumStalker * self)
 {
@@ -83,6 +95,11 @@ gum_stalker_garbage_collect (GumStalker * self)
   return FALSE;
 }
 
+void
+gum_stalker_flush (GumStalker * self)
+{
+}
+
 void
 gum_stalker_follow_me (GumStalker * self,
                        GumEventSink * sink)
@@ -148,6 +148,10 @@ _gum_interceptor_backend_create_trampoline (GumInterceptorBackend * self,
       &ctx->backend_data;
   guint reloc_bytes;
 
+  /* inline probes are not yet implemented for this architecture */
+  if (ctx->probe_counter != NULL)
+    return FALSE;
+
   if (!gum_interceptor_backend_prepare_trampoline (self, ctx))
     return FALSE;
 
@@ -256,6 +260,25 @@ _gum_interceptor_backend_commit_trampoline (GumInterceptorBackend * self,
   gum_clear_cache (ctx->function_address, ctx->overwritten_prologue_len);
 }
 
+void
+_gum_interceptor_backend_update_requirements (GumInterceptorBackend * self,
+                                              GumFunctionContext * ctx)
+{
+  /* we always save the full CPU context */
+  (void) self;
+  (void) ctx;
+}
+
+gboolean
+_gum_interceptor_backend_is_using_minimal_thunks (GumInterceptorBackend * self,
+                                                  GumFunctionContext * ctx)
+{
+  (void) self;
+  (void) ctx;
+
+  return FALSE;
+}
+
 gpointer
 _gum_interceptor_backend_resolve_redirect (GumInterceptorBackend * self,
                                            gpointer address)
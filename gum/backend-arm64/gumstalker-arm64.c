@@ -71,6 +71,18 @@ gum_stalker_set_trust_threshold (GumStalker * self,
 {
 }
 
+gboolean
+gum_stalker_get_shared_cache (GumStalker * self)
+{
+  return FALSE;
+}
+
+void
+gum_stalker_set_shared_cache (GumStalker * self,
+                              gboolean shared_cache)
+{
+}
+
 void
 gum_stalker_stop (GumStalker * self)
 {
@@ -82,6 +94,11 @@ gum_stalker_garbage_collect (GumStalker * self)
   return FALSE;
 }
 
+void
+gum_stalker_flush (GumStalker * self)
+{
+}
+
 void
 gum_stalker_follow_me (GumStalker * self,
                        GumEventSink * sink)
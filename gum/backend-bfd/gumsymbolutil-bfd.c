@@ -12,6 +12,10 @@
 
 #include <bfd.h>
 #include <dlfcn.h>
+#include <glib/gstdio.h>
+#if defined (HAVE_LINUX) && !defined (HAVE_ANDROID)
+# include <link.h>
+#endif
 #include <string.h>
 #include <strings.h>
 #if defined (HAVE_ELF_H)
@@ -20,7 +24,19 @@
 # include <sys/elf.h>
 #endif
 
+#define GUM_SYMBOL_INDEX_MAGIC   0x58444953
+#define GUM_SYMBOL_INDEX_VERSION 2
+
+#define GUM_SYMBOL_INDEX_ENTRY_THUMB (1 << 0)
+
+#ifndef NT_GNU_BUILD_ID
+# define NT_GNU_BUILD_ID 3
+#endif
+
 typedef struct _GumSymbolCollection GumSymbolCollection;
+typedef struct _GumSymbolIndex GumSymbolIndex;
+typedef struct _GumSymbolIndexEntry GumSymbolIndexEntry;
+typedef struct _GumSymbolIndexHeader GumSymbolIndexHeader;
 
 struct _GumSymbolCollection
 {
@@ -30,23 +46,96 @@ struct _GumSymbolCollection
   guint num_dynamic_symbols;
 };
 
+/*
+ * Function starts of one module, sorted by their link-time address, so that
+ * lookups are a binary search rather than a fresh bfd_canonicalize_symtab().
+ * The bfd is only opened again if file and line information is requested,
+ * and is then kept open along with its symbols. The on-disk copy is keyed on
+ * the module's build-id when it has one, and on its path otherwise.
+ */
+struct _GumSymbolIndex
+{
+  gchar * path;
+  gchar * build_id;
+  gint64 mtime;
+  gint64 size;
+  gboolean is_dynamic;
+
+  GumSymbolIndexEntry * entries;
+  guint num_entries;
+  gchar * names;
+  gsize names_size;
+
+  bfd * abfd;
+  GumSymbolCollection sc;
+  gboolean bfd_loaded;
+};
+
+struct _GumSymbolIndexEntry
+{
+  guint64 offset;
+  guint64 size;
+  guint32 name_offset;
+  guint32 flags;
+};
+
+struct _GumSymbolIndexHeader
+{
+  guint32 magic;
+  guint32 version;
+  gint64 mtime;
+  gint64 size;
+  guint32 is_dynamic;
+  guint32 num_entries;
+  guint64 names_size;
+};
+
 static gpointer do_init (gpointer data);
 static void do_deinit (void);
 
+static void gum_symbol_util_refresh (gboolean need_database);
+static guint64 gum_query_module_generation (void);
+#if defined (HAVE_LINUX) && !defined (HAVE_ANDROID)
+static int gum_collect_module_generation (struct dl_phdr_info * info,
+    size_t size, void * data);
+#endif
 static void gum_build_symbols_database (void);
 static gboolean gum_consume_symbols_from_range (const GumRangeDetails * details,
     gpointer user_data);
-static void gum_consume_symbols_from_file (const gchar * path,
-    gpointer base_address);
-static void gum_consume_symbols (bfd * abfd, asymbol ** symbols,
-    long num_symbols, gpointer base_address);
+
+static GumSymbolIndex * gum_symbol_index_get (const gchar * path);
+static GumSymbolIndex * gum_symbol_index_new (const gchar * path,
+    const GStatBuf * st);
+static void gum_symbol_index_free (GumSymbolIndex * index);
+static gboolean gum_symbol_index_is_stale (GumSymbolIndex * index,
+    gpointer user_data);
+static void gum_symbol_index_build (GumSymbolIndex * self);
+static void gum_symbol_index_collect (bfd * abfd, asymbol ** symbols,
+    long num_symbols, GArray * entries, GString * names);
+static gchar * gum_symbol_index_read_build_id (const gchar * path);
+static gint gum_symbol_index_entry_compare (const GumSymbolIndexEntry * a,
+    const GumSymbolIndexEntry * b, const gchar * names);
+static const GumSymbolIndexEntry * gum_symbol_index_lookup (
+    const GumSymbolIndex * self, guint64 offset);
+static gboolean gum_symbol_index_find_nearest_line (GumSymbolIndex * self,
+    guint64 offset, const gchar ** file_name, const gchar ** symbol_name,
+    guint * line_number);
+static gchar * gum_symbol_index_get_cache_path (const GumSymbolIndex * self);
+static gboolean gum_symbol_index_load (GumSymbolIndex * self);
+static void gum_symbol_index_save (const GumSymbolIndex * self);
 
 static bfd * gum_open_bfd_and_load_symbols (const gchar * path,
     GumSymbolCollection * sc);
 static void gum_close_bfd_and_release_symbols (bfd * abfd,
     GumSymbolCollection * sc);
 
+G_LOCK_DEFINE_STATIC (gum_symbol_util);
 static GHashTable * gum_function_address_by_name = NULL;
+static GHashTable * gum_symbol_indexes = NULL;
+static gchar * gum_symbol_cache_directory = NULL;
+static guint64 gum_symbol_indexes_generation = 0;
+static guint64 gum_function_address_by_name_generation = 0;
+static gboolean gum_function_address_by_name_valid = FALSE;
 
 static void
 gum_symbol_util_init (void)
@@ -61,8 +150,9 @@ do_init (gpointer data)
 {
   gum_function_address_by_name = g_hash_table_new_full (g_str_hash,
       g_str_equal, g_free, NULL);
-
-  gum_build_symbols_database ();
+  gum_symbol_indexes = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+      (GDestroyNotify) gum_symbol_index_free);
+  gum_symbol_indexes_generation = gum_query_module_generation ();
 
   _gum_register_destructor (do_deinit);
 
@@ -72,8 +162,30 @@ do_init (gpointer data)
 static void
 do_deinit (void)
 {
+  g_hash_table_unref (gum_symbol_indexes);
+  gum_symbol_indexes = NULL;
+
   g_hash_table_unref (gum_function_address_by_name);
   gum_function_address_by_name = NULL;
+  gum_function_address_by_name_valid = FALSE;
+
+  g_free (gum_symbol_cache_directory);
+  gum_symbol_cache_directory = NULL;
+}
+
+void
+gum_symbol_util_set_cache_directory (const gchar * path)
+{
+  gum_symbol_util_init ();
+
+  G_LOCK (gum_symbol_util);
+
+  g_free (gum_symbol_cache_directory);
+  gum_symbol_cache_directory = g_strdup (path);
+
+  g_hash_table_remove_all (gum_symbol_indexes);
+
+  G_UNLOCK (gum_symbol_util);
 }
 
 gboolean
@@ -83,15 +195,16 @@ gum_symbol_details_from_address (gpointer address,
   gboolean result = FALSE;
   Dl_info dl_info;
   const gchar * module_name;
-  bfd * abfd = NULL;
-  GumSymbolCollection sc = { 0, };
-  bfd_vma offset;
-  asection * section;
+  GumSymbolIndex * index;
+  guint64 offset;
+  const GumSymbolIndexEntry * entry;
+  const gchar * file_name, * symbol_name;
+  guint line_number;
 
   gum_symbol_util_init ();
 
   if (!dladdr (address, &dl_info))
-    goto beach;
+    return FALSE;
 
   memset (details, 0, sizeof (GumSymbolDetails));
 
@@ -104,54 +217,50 @@ gum_symbol_details_from_address (gpointer address,
     module_name = dl_info.dli_fname;
   g_strlcpy (details->module_name, module_name, sizeof (details->module_name));
 
-  result = TRUE;
+  G_LOCK (gum_symbol_util);
 
-  abfd = gum_open_bfd_and_load_symbols (dl_info.dli_fname, &sc);
-  if (abfd == NULL)
+  gum_symbol_util_refresh (FALSE);
+
+  index = gum_symbol_index_get (dl_info.dli_fname);
+  if (index == NULL)
     goto beach;
 
   offset = GPOINTER_TO_SIZE (address);
-  if (abfd->flags & BSF_KEEP_G)
+  if (index->is_dynamic)
     offset -= GPOINTER_TO_SIZE (dl_info.dli_fbase);
 
-  for (section = abfd->sections; section != NULL; section = section->next)
+  entry = gum_symbol_index_lookup (index, offset);
+  if (entry != NULL)
   {
-    bfd_vma section_start;
-    bfd_size_type section_size;
-    const gchar * file_name;
-    const gchar * symbol_name;
-    guint line_number;
-
-    section_start = bfd_get_section_vma (abfd, section);
-    if (offset < section_start)
-      continue;
-
-    section_size = bfd_get_section_size (section);
-    if (offset >= section_start + section_size)
-      continue;
+    g_strlcpy (details->symbol_name, index->names + entry->name_offset,
+        sizeof (details->symbol_name));
+    result = TRUE;
+  }
 
-    if (bfd_find_nearest_line (abfd, section, sc.static_symbols,
-        offset - section_start, &file_name, &symbol_name, &line_number) ||
-        bfd_find_nearest_line (abfd, section, sc.dynamic_symbols,
-        offset - section_start, &file_name, &symbol_name, &line_number))
+  if (gum_symbol_index_find_nearest_line (index, offset, &file_name,
+      &symbol_name, &line_number))
+  {
+    /*
+     * Without line info the name is just bfd's nearest preceding symbol,
+     * which is no better than what the index already refused.
+     */
+    if (file_name == NULL)
+      goto beach;
+
+    if (entry == NULL && symbol_name != NULL)
     {
-      if (symbol_name != NULL)
-      {
-        g_strlcpy (details->symbol_name, symbol_name,
-            sizeof (details->symbol_name));
-      }
-
-      if (file_name != NULL)
-        g_strlcpy (details->file_name, file_name, sizeof (details->file_name));
-
-      details->line_number = line_number;
-
-      break;
+      g_strlcpy (details->symbol_name, symbol_name,
+          sizeof (details->symbol_name));
+      result = TRUE;
     }
+
+    g_strlcpy (details->file_name, file_name, sizeof (details->file_name));
+    details->line_number = line_number;
   }
 
 beach:
-  gum_close_bfd_and_release_symbols (abfd, &sc);
+  G_UNLOCK (gum_symbol_util);
+
   return result;
 }
 
@@ -169,9 +278,16 @@ gum_symbol_name_from_address (gpointer address)
 gpointer
 gum_find_function (const gchar * name)
 {
+  gpointer address;
+
   gum_symbol_util_init ();
 
-  return g_hash_table_lookup (gum_function_address_by_name, name);
+  G_LOCK (gum_symbol_util);
+  gum_symbol_util_refresh (TRUE);
+  address = g_hash_table_lookup (gum_function_address_by_name, name);
+  G_UNLOCK (gum_symbol_util);
+
+  return address;
 }
 
 GArray *
@@ -203,6 +319,9 @@ gum_find_functions_matching (const gchar * str)
 
   pspec = g_pattern_spec_new (str);
 
+  G_LOCK (gum_symbol_util);
+  gum_symbol_util_refresh (TRUE);
+
   g_hash_table_iter_init (&iter, gum_function_address_by_name);
   while (g_hash_table_iter_next (&iter, (gpointer *) &function_name,
       &function_address))
@@ -211,11 +330,73 @@ gum_find_functions_matching (const gchar * str)
       g_array_append_val (matches, function_address);
   }
 
+  G_UNLOCK (gum_symbol_util);
+
   g_pattern_spec_free (pspec);
 
   return matches;
 }
 
+/*
+ * Called with the lock held. Indexes are keyed by path, so when modules have
+ * been loaded or unloaded since the last call we only drop the ones whose
+ * file changed on disk, whereas the name database is rebuilt from scratch.
+ */
+static void
+gum_symbol_util_refresh (gboolean need_database)
+{
+  guint64 generation;
+
+  generation = gum_query_module_generation ();
+
+  if (generation != gum_symbol_indexes_generation)
+  {
+    g_hash_table_foreach_remove (gum_symbol_indexes,
+        (GHRFunc) gum_symbol_index_is_stale, NULL);
+    gum_symbol_indexes_generation = generation;
+  }
+
+  if (need_database && (!gum_function_address_by_name_valid ||
+      generation != gum_function_address_by_name_generation))
+  {
+    gum_build_symbols_database ();
+    gum_function_address_by_name_generation = generation;
+    gum_function_address_by_name_valid = TRUE;
+  }
+}
+
+static guint64
+gum_query_module_generation (void)
+{
+  guint64 generation = 0;
+
+#if defined (HAVE_LINUX) && !defined (HAVE_ANDROID)
+  dl_iterate_phdr (gum_collect_module_generation, &generation);
+#endif
+
+  return generation;
+}
+
+#if defined (HAVE_LINUX) && !defined (HAVE_ANDROID)
+
+static int
+gum_collect_module_generation (struct dl_phdr_info * info,
+                               size_t size,
+                               void * data)
+{
+  guint64 * generation = data;
+
+  if (size >= G_STRUCT_OFFSET (struct dl_phdr_info, dlpi_subs) +
+      sizeof (info->dlpi_subs))
+  {
+    *generation = info->dlpi_adds + info->dlpi_subs;
+  }
+
+  return 1;
+}
+
+#endif
+
 static void
 gum_build_symbols_database (void)
 {
@@ -231,7 +412,9 @@ gum_consume_symbols_from_range (const GumRangeDetails * details,
 {
   gpointer header;
   guint16 type;
-  gpointer base_address;
+  guint8 * base_address;
+  GumSymbolIndex * index;
+  guint i;
 
   if (details->file == NULL || details->file->offset != 0)
     return TRUE;
@@ -248,38 +431,180 @@ gum_consume_symbols_from_range (const GumRangeDetails * details,
     base_address = GSIZE_TO_POINTER (details->range->base_address);
   else
     base_address = NULL;
-  gum_consume_symbols_from_file (details->file->path, base_address);
+
+  index = gum_symbol_index_get (details->file->path);
+  if (index == NULL)
+    return TRUE;
+
+  for (i = 0; i != index->num_entries; i++)
+  {
+    const GumSymbolIndexEntry * entry = &index->entries[i];
+    guint8 * address;
+
+    address = base_address + entry->offset;
+    if (address == NULL)
+      continue;
+    if ((entry->flags & GUM_SYMBOL_INDEX_ENTRY_THUMB) != 0)
+      address++;
+
+    g_hash_table_insert (gum_function_address_by_name,
+        g_strdup (index->names + entry->name_offset), address);
+  }
 
   return TRUE;
 }
 
-static void
-gum_consume_symbols_from_file (const gchar * path,
-                               gpointer base_address)
+static GumSymbolIndex *
+gum_symbol_index_get (const gchar * path)
 {
-  bfd * abfd = NULL;
-  GumSymbolCollection sc = { 0, };
+  GumSymbolIndex * index;
+  GStatBuf st;
 
-  abfd = gum_open_bfd_and_load_symbols (path, &sc);
-  if (abfd != NULL)
+  index = g_hash_table_lookup (gum_symbol_indexes, path);
+  if (index != NULL)
+    return index;
+
+  if (g_stat (path, &st) != 0)
+    return NULL;
+
+  index = gum_symbol_index_new (path, &st);
+  if (!gum_symbol_index_load (index))
   {
-    gum_consume_symbols (abfd, sc.static_symbols, sc.num_static_symbols,
-        base_address);
-    gum_consume_symbols (abfd, sc.dynamic_symbols, sc.num_dynamic_symbols,
-        base_address);
+    gum_symbol_index_build (index);
+    gum_symbol_index_save (index);
   }
 
+  g_hash_table_insert (gum_symbol_indexes, index->path, index);
+
+  return index;
+}
+
+static GumSymbolIndex *
+gum_symbol_index_new (const gchar * path,
+                      const GStatBuf * st)
+{
+  GumSymbolIndex * index;
+
+  index = g_slice_new0 (GumSymbolIndex);
+  index->path = g_strdup (path);
+  index->build_id = gum_symbol_index_read_build_id (path);
+  index->mtime = st->st_mtime;
+  index->size = st->st_size;
+
+  return index;
+}
+
+static void
+gum_symbol_index_free (GumSymbolIndex * index)
+{
+  gum_close_bfd_and_release_symbols (index->abfd, &index->sc);
+
+  g_free (index->names);
+  g_free (index->entries);
+  g_free (index->build_id);
+  g_free (index->path);
+
+  g_slice_free (GumSymbolIndex, index);
+}
+
+static gboolean
+gum_symbol_index_is_stale (GumSymbolIndex * index,
+                           gpointer user_data)
+{
+  GStatBuf st;
+
+  if (g_stat (index->path, &st) != 0)
+    return TRUE;
+
+  return st.st_mtime != index->mtime || st.st_size != index->size;
+}
+
+static void
+gum_symbol_index_build (GumSymbolIndex * self)
+{
+  bfd * abfd;
+  GumSymbolCollection sc;
+  GArray * entries;
+  GString * names;
+  guint i, n;
+
+  abfd = gum_open_bfd_and_load_symbols (self->path, &sc);
+  if (abfd == NULL)
+    return;
+
+  self->is_dynamic = (abfd->flags & DYNAMIC) != 0;
+
+  entries = g_array_new (FALSE, FALSE, sizeof (GumSymbolIndexEntry));
+  names = g_string_new ("");
+
+  gum_symbol_index_collect (abfd, sc.static_symbols, sc.num_static_symbols,
+      entries, names);
+  gum_symbol_index_collect (abfd, sc.dynamic_symbols, sc.num_dynamic_symbols,
+      entries, names);
+
+  /*
+   * The name database indexes every module, so don't hold on to the bfd and
+   * its symbols here; it's reopened on demand for file and line lookups.
+   */
   gum_close_bfd_and_release_symbols (abfd, &sc);
+
+  g_array_sort_with_data (entries,
+      (GCompareDataFunc) gum_symbol_index_entry_compare, names->str);
+
+  /* The static and dynamic tables mostly overlap. */
+  for (i = 0, n = 0; i != entries->len; i++)
+  {
+    GumSymbolIndexEntry * entry =
+        &g_array_index (entries, GumSymbolIndexEntry, i);
+
+    if (n != 0 && gum_symbol_index_entry_compare (
+        &g_array_index (entries, GumSymbolIndexEntry, n - 1), entry,
+        names->str) == 0)
+    {
+      continue;
+    }
+
+    g_array_index (entries, GumSymbolIndexEntry, n++) = *entry;
+  }
+  g_array_set_size (entries, n);
+
+  /*
+   * Entries come out of collect() sized up to the end of their section; a
+   * function also ends where the next one starts.
+   */
+  for (i = n; i != 0; i--)
+  {
+    GumSymbolIndexEntry * entry =
+        &g_array_index (entries, GumSymbolIndexEntry, i - 1);
+    guint j;
+
+    for (j = i; j != n; j++)
+    {
+      const GumSymbolIndexEntry * next =
+          &g_array_index (entries, GumSymbolIndexEntry, j);
+
+      if (next->offset != entry->offset)
+      {
+        entry->size = MIN (entry->size, next->offset - entry->offset);
+        break;
+      }
+    }
+  }
+
+  self->num_entries = entries->len;
+  self->entries = (GumSymbolIndexEntry *) g_array_free (entries, FALSE);
+  self->names_size = names->len + 1;
+  self->names = g_string_free (names, FALSE);
 }
 
 static void
-gum_consume_symbols (bfd * abfd,
-                     asymbol ** symbols,
-                     long num_symbols,
-                     gpointer base_address)
+gum_symbol_index_collect (bfd * abfd,
+                          asymbol ** symbols,
+                          long num_symbols,
+                          GArray * entries,
+                          GString * names)
 {
   long i;
-  gpointer address;
 #ifdef HAVE_ARM
   GHashTable * thumb_symbols;
 
@@ -292,8 +617,8 @@ gum_consume_symbols (bfd * abfd,
     if (bfd_is_target_special_symbol (abfd, sym) &&
         sym->name[0] == '$' && sym->name[1] == 't')
     {
-      address = base_address + bfd_asymbol_value (sym);
-      g_hash_table_insert (thumb_symbols, address, address);
+      gpointer offset = GSIZE_TO_POINTER (bfd_asymbol_value (sym));
+      g_hash_table_insert (thumb_symbols, offset, offset);
     }
   }
 #endif
@@ -301,6 +626,8 @@ gum_consume_symbols (bfd * abfd,
   for (i = 0; i != num_symbols; i++)
   {
     asymbol * sym = symbols[i];
+    GumSymbolIndexEntry entry;
+    bfd_vma section_end;
 
     if (sym->name == NULL || sym->name[0] == '\0')
       continue;
@@ -309,16 +636,25 @@ gum_consume_symbols (bfd * abfd,
     else if ((sym->flags & (BSF_LOCAL | BSF_GLOBAL)) == 0)
       continue;
 
-    address = (guint8 *) base_address + bfd_asymbol_value (sym);
-    if (address == NULL)
-      continue;
+    entry.offset = bfd_asymbol_value (sym);
+    /* st_size isn't exposed through the public bfd API. */
+    section_end = bfd_get_section_vma (abfd, sym->section) +
+        bfd_get_section_size (sym->section);
+    entry.size = (section_end > entry.offset)
+        ? section_end - entry.offset
+        : 0;
+    entry.name_offset = names->len;
+    entry.flags = 0;
 #ifdef HAVE_ARM
-    if (g_hash_table_contains (thumb_symbols, address))
-      address++;
+    if (g_hash_table_contains (thumb_symbols,
+        GSIZE_TO_POINTER (entry.offset)))
+    {
+      entry.flags |= GUM_SYMBOL_INDEX_ENTRY_THUMB;
+    }
 #endif
 
-    g_hash_table_insert (gum_function_address_by_name, g_strdup (sym->name),
-        address);
+    g_string_append_len (names, sym->name, strlen (sym->name) + 1);
+    g_array_append_val (entries, entry);
   }
 
 #ifdef HAVE_ARM
@@ -326,6 +662,275 @@ gum_consume_symbols (bfd * abfd,
 #endif
 }
 
+static gint
+gum_symbol_index_entry_compare (const GumSymbolIndexEntry * a,
+                                const GumSymbolIndexEntry * b,
+                                const gchar * names)
+{
+  if (a->offset != b->offset)
+    return (a->offset < b->offset) ? -1 : 1;
+
+  return strcmp (names + a->name_offset, names + b->name_offset);
+}
+
+static const GumSymbolIndexEntry *
+gum_symbol_index_lookup (const GumSymbolIndex * self,
+                         guint64 offset)
+{
+  const GumSymbolIndexEntry * entry;
+  guint lo, hi;
+
+  lo = 0;
+  hi = self->num_entries;
+  while (lo != hi)
+  {
+    guint mid = lo + ((hi - lo) / 2);
+
+    if (self->entries[mid].offset <= offset)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  if (lo == 0)
+    return NULL;
+
+  entry = &self->entries[lo - 1];
+  while (entry != self->entries && (entry - 1)->offset == entry->offset)
+    entry--;
+
+  if (offset - entry->offset >= entry->size)
+    return NULL;
+
+  return entry;
+}
+
+static gchar *
+gum_symbol_index_read_build_id (const gchar * path)
+{
+  gchar * result = NULL;
+  bfd * abfd;
+  asection * section;
+  bfd_size_type size;
+  guint8 * note = NULL;
+  guint32 name_size, desc_size, type, i;
+  const guint8 * desc;
+
+  abfd = bfd_openr (path, NULL);
+  if (abfd == NULL || !bfd_check_format (abfd, bfd_object))
+    goto beach;
+
+  section = bfd_get_section_by_name (abfd, ".note.gnu.build-id");
+  if (section == NULL)
+    goto beach;
+
+  size = bfd_get_section_size (section);
+  if (size < 12)
+    goto beach;
+
+  note = g_malloc (size);
+  if (!bfd_get_section_contents (abfd, section, note, 0, size))
+    goto beach;
+
+  name_size = bfd_get_32 (abfd, note);
+  desc_size = bfd_get_32 (abfd, note + 4);
+  type = bfd_get_32 (abfd, note + 8);
+  if (type != NT_GNU_BUILD_ID || desc_size == 0 || name_size > size ||
+      desc_size > size || 12 + GUM_ALIGN_SIZE (name_size, 4) + desc_size > size)
+  {
+    goto beach;
+  }
+  desc = note + 12 + GUM_ALIGN_SIZE (name_size, 4);
+
+  result = g_malloc ((desc_size * 2) + 1);
+  for (i = 0; i != desc_size; i++)
+    g_snprintf (result + (i * 2), 3, "%02x", desc[i]);
+
+beach:
+  g_free (note);
+  if (abfd != NULL)
+    bfd_close (abfd);
+
+  return result;
+}
+
+static gboolean
+gum_symbol_index_find_nearest_line (GumSymbolIndex * self,
+                                    guint64 offset,
+                                    const gchar ** file_name,
+                                    const gchar ** symbol_name,
+                                    guint * line_number)
+{
+  bfd * abfd;
+  asection * section;
+
+  if (!self->bfd_loaded)
+  {
+    self->abfd = gum_open_bfd_and_load_symbols (self->path, &self->sc);
+    self->bfd_loaded = TRUE;
+  }
+
+  abfd = self->abfd;
+  if (abfd == NULL)
+    return FALSE;
+
+  for (section = abfd->sections; section != NULL; section = section->next)
+  {
+    bfd_vma section_start;
+    bfd_size_type section_size;
+
+    section_start = bfd_get_section_vma (abfd, section);
+    if (offset < section_start)
+      continue;
+
+    section_size = bfd_get_section_size (section);
+    if (offset >= section_start + section_size)
+      continue;
+
+    if (bfd_find_nearest_line (abfd, section, self->sc.static_symbols,
+        offset - section_start, file_name, symbol_name, line_number) ||
+        bfd_find_nearest_line (abfd, section, self->sc.dynamic_symbols,
+        offset - section_start, file_name, symbol_name, line_number))
+    {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+static gchar *
+gum_symbol_index_get_cache_path (const GumSymbolIndex * self)
+{
+  gchar * checksum, * filename, * result;
+
+  if (gum_symbol_cache_directory == NULL)
+    return NULL;
+
+  if (self->build_id != NULL)
+  {
+    checksum = g_strdup (self->build_id);
+  }
+  else
+  {
+    checksum = g_compute_checksum_for_string (G_CHECKSUM_SHA1, self->path,
+        -1);
+  }
+  filename = g_strconcat (checksum, ".symbols", NULL);
+  result = g_build_filename (gum_symbol_cache_directory, filename, NULL);
+  g_free (filename);
+  g_free (checksum);
+
+  return result;
+}
+
+static gboolean
+gum_symbol_index_load (GumSymbolIndex * self)
+{
+  gboolean success = FALSE;
+  gchar * cache_path, * data = NULL;
+  gsize length;
+  GumSymbolIndexHeader header;
+  const gchar * entries, * names;
+  guint i;
+
+  cache_path = gum_symbol_index_get_cache_path (self);
+  if (cache_path == NULL)
+    return FALSE;
+
+  if (!g_file_get_contents (cache_path, &data, &length, NULL))
+    goto beach;
+
+  if (length < sizeof (header))
+    goto beach;
+  memcpy (&header, data, sizeof (header));
+
+  if (header.magic != GUM_SYMBOL_INDEX_MAGIC ||
+      header.version != GUM_SYMBOL_INDEX_VERSION ||
+      (self->build_id == NULL &&
+          (header.mtime != self->mtime || header.size != self->size)) ||
+      header.names_size == 0)
+  {
+    goto beach;
+  }
+
+  if (length != sizeof (header) +
+      (header.num_entries * sizeof (GumSymbolIndexEntry)) + header.names_size)
+  {
+    goto beach;
+  }
+
+  entries = data + sizeof (header);
+  names = entries + (header.num_entries * sizeof (GumSymbolIndexEntry));
+  if (names[header.names_size - 1] != '\0')
+    goto beach;
+
+  self->is_dynamic = header.is_dynamic;
+  self->num_entries = header.num_entries;
+  self->entries = g_memdup (entries,
+      header.num_entries * sizeof (GumSymbolIndexEntry));
+  self->names_size = header.names_size;
+  self->names = g_memdup (names, header.names_size);
+
+  for (i = 0; i != self->num_entries; i++)
+  {
+    if (self->entries[i].name_offset >= self->names_size)
+    {
+      g_clear_pointer (&self->entries, g_free);
+      g_clear_pointer (&self->names, g_free);
+      self->num_entries = 0;
+      self->names_size = 0;
+      goto beach;
+    }
+  }
+
+  success = TRUE;
+
+beach:
+  g_free (data);
+  g_free (cache_path);
+
+  return success;
+}
+
+static void
+gum_symbol_index_save (const GumSymbolIndex * self)
+{
+  gchar * cache_path;
+  GumSymbolIndexHeader header;
+  GByteArray * data;
+
+  if (self->names == NULL)
+    return;
+
+  cache_path = gum_symbol_index_get_cache_path (self);
+  if (cache_path == NULL)
+    return;
+
+  memset (&header, 0, sizeof (header));
+  header.magic = GUM_SYMBOL_INDEX_MAGIC;
+  header.version = GUM_SYMBOL_INDEX_VERSION;
+  header.mtime = self->mtime;
+  header.size = self->size;
+  header.is_dynamic = self->is_dynamic;
+  header.num_entries = self->num_entries;
+  header.names_size = self->names_size;
+
+  data = g_byte_array_sized_new (sizeof (header) +
+      (self->num_entries * sizeof (GumSymbolIndexEntry)) + self->names_size);
+  g_byte_array_append (data, (const guint8 *) &header, sizeof (header));
+  g_byte_array_append (data, (const guint8 *) self->entries,
+      self->num_entries * sizeof (GumSymbolIndexEntry));
+  g_byte_array_append (data, (const guint8 *) self->names, self->names_size);
+
+  g_mkdir_with_parents (gum_symbol_cache_directory, 0700);
+  g_file_set_contents (cache_path, (const gchar *) data->data, data->len,
+      NULL);
+
+  g_byte_array_unref (data);
+  g_free (cache_path);
+}
+
 static bfd *
 gum_open_bfd_and_load_symbols (const gchar * path,
                                GumSymbolCollection * sc)
@@ -337,6 +337,13 @@ gum_find_functions_matching (const gchar * str)
   return result;
 }
 
+void
+gum_symbol_util_set_cache_directory (const gchar * path)
+{
+  /* Symbols are resolved by the OS, which does its own caching. */
+  (void) path;
+}
+
 static gpointer
 gum_cs_symbol_address (CSSymbolRef symbol)
 {
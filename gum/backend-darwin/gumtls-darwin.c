@@ -6,6 +6,8 @@
 
 #include "gumtls.h"
 
+#include "gumtls-priv.h"
+
 #include <pthread.h>
 
 void
@@ -15,11 +17,17 @@ _gum_tls_init (void)
 
 GumTlsKey
 gum_tls_key_new (void)
+{
+  return _gum_tls_key_new_full (NULL);
+}
+
+GumTlsKey
+_gum_tls_key_new_full (GDestroyNotify destroy)
 {
   pthread_key_t key;
   gint res;
 
-  res = pthread_key_create (&key, NULL);
+  res = pthread_key_create (&key, destroy);
   g_assert_cmpint (res, ==, 0);
 
   return key;
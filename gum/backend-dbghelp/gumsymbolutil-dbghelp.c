@@ -193,6 +193,13 @@ gum_find_functions_matching (const gchar * str)
   return matches;
 }
 
+void
+gum_symbol_util_set_cache_directory (const gchar * path)
+{
+  /* Symbols are resolved by the OS, which does its own caching. */
+  (void) path;
+}
+
 static BOOL CALLBACK
 enum_functions_callback (SYMBOL_INFO * sym_info,
                          gulong symbol_size,
@@ -6,6 +6,8 @@
 
 #include "gummemory.h"
 
+#include "gum-init.h"
+#include "gumlinux.h"
 #include "gummemory-priv.h"
 
 #include <stdio.h>
@@ -13,9 +15,33 @@
 #include <sys/mman.h>
 #include <unistd.h>
 
+typedef struct _GumMapsEntry GumMapsEntry;
+
+struct _GumMapsEntry
+{
+  GumAddress start;
+  GumAddress end;
+  GumPageProtection prot;
+};
+
 static gboolean gum_memory_get_protection (GumAddress address, gsize n,
     gsize * size, GumPageProtection * prot);
 
+static void gum_maps_index_do_deinit (void);
+static gboolean gum_maps_index_update (gboolean force);
+static gint gum_maps_index_find (GumAddress address);
+
+G_LOCK_DEFINE_STATIC (gum_maps_index);
+static GArray * gum_maps_entries = NULL;
+static gint gum_maps_entries_generation = -1;
+static volatile gint gum_maps_generation = 0;
+
+void
+gum_linux_invalidate_maps_cache (void)
+{
+  g_atomic_int_inc (&gum_maps_generation);
+}
+
 gboolean
 gum_memory_is_readable (GumAddress address,
                         gsize len)
@@ -102,6 +128,8 @@ gum_try_mprotect (gpointer address,
   posix_page_prot = _gum_page_protection_to_posix (page_prot);
 
   result = mprotect (aligned_address, aligned_size, posix_page_prot);
+  if (result == 0)
+    gum_linux_invalidate_maps_cache ();
 
   return result == 0;
 }
@@ -121,9 +149,11 @@ gum_memory_get_protection (GumAddress address,
                            gsize * size,
                            GumPageProtection * prot)
 {
-  gboolean success;
-  FILE * fp;
-  gchar line[1024 + 1];
+  gboolean rebuilt;
+  gint index;
+  const GumMapsEntry * entry;
+  GumAddress end;
+  guint i;
 
   if (size == NULL || prot == NULL)
   {
@@ -135,45 +165,80 @@ gum_memory_get_protection (GumAddress address,
         (prot != NULL) ? prot : &ignored_prot);
   }
 
-  if (n > 1)
+  *size = 0;
+  *prot = GUM_PAGE_NO_ACCESS;
+
+  G_LOCK (gum_maps_index);
+
+  if (gum_maps_entries == NULL)
   {
-    GumAddress page_size, start_page, end_page, cur_page;
+    gum_maps_entries = g_array_new (FALSE, FALSE, sizeof (GumMapsEntry));
 
-    page_size = gum_query_page_size ();
+    _gum_register_destructor (gum_maps_index_do_deinit);
+  }
 
-    start_page = address & ~(page_size - 1);
-    end_page = (address + n - 1) & ~(page_size - 1);
+  /*
+   * Mappings created behind our back are picked up by re-reading the
+   * maps on a miss, unless we just did so.
+   */
+  rebuilt = gum_maps_index_update (FALSE);
+  index = gum_maps_index_find (address);
+  if (index == -1 && !rebuilt)
+  {
+    gum_maps_index_update (TRUE);
+    index = gum_maps_index_find (address);
+  }
 
-    success = gum_memory_get_protection (start_page, 1, NULL, prot);
-    if (success)
-    {
-      *size = page_size - (address - start_page);
-      for (cur_page = start_page + page_size;
-          cur_page != end_page + page_size;
-          cur_page += page_size)
-      {
-        GumPageProtection cur_prot;
-
-        if (gum_memory_get_protection (cur_page, 1, NULL, &cur_prot)
-            && (cur_prot != GUM_PAGE_NO_ACCESS || *prot == GUM_PAGE_NO_ACCESS))
-        {
-          *size += page_size;
-          *prot &= cur_prot;
-        }
-        else
-        {
-          break;
-        }
-      }
-      *size = MIN (*size, n);
-    }
+  if (index == -1)
+  {
+    G_UNLOCK (gum_maps_index);
+    return FALSE;
+  }
 
-    return success;
+  entry = &g_array_index (gum_maps_entries, GumMapsEntry, index);
+  *prot = entry->prot;
+  end = entry->end;
+
+  for (i = index + 1; i != gum_maps_entries->len && end < address + n; i++)
+  {
+    entry = &g_array_index (gum_maps_entries, GumMapsEntry, i);
+
+    if (entry->start != end)
+      break;
+    if (entry->prot == GUM_PAGE_NO_ACCESS && *prot != GUM_PAGE_NO_ACCESS)
+      break;
+
+    *prot &= entry->prot;
+    end = entry->end;
   }
 
-  success = FALSE;
-  *size = 0;
-  *prot = GUM_PAGE_NO_ACCESS;
+  G_UNLOCK (gum_maps_index);
+
+  *size = MIN (end - address, n);
+
+  return TRUE;
+}
+
+static void
+gum_maps_index_do_deinit (void)
+{
+  g_array_free (gum_maps_entries, TRUE);
+  gum_maps_entries = NULL;
+  gum_maps_entries_generation = -1;
+}
+
+static gboolean
+gum_maps_index_update (gboolean force)
+{
+  gint generation;
+  FILE * fp;
+  gchar line[1024 + 1];
+
+  generation = g_atomic_int_get (&gum_maps_generation);
+  if (!force && generation == gum_maps_entries_generation)
+    return FALSE;
+
+  g_array_set_size (gum_maps_entries, 0);
 
   fp = fopen ("/proc/self/maps", "r");
   g_assert (fp != NULL);
@@ -183,29 +248,64 @@ gum_memory_get_protection (GumAddress address,
     gint n_items;
     gpointer start, end;
     gchar protection[16];
+    GumMapsEntry entry;
 
-    n_items = sscanf (line, "%p-%p %s ", &start, &end, protection);
-    g_assert_cmpint (n_items, ==, 3);
-
-    if (GUM_ADDRESS (start) > address)
-      break;
-    else if (address >= GUM_ADDRESS (start) &&
-        address + n - 1 < GUM_ADDRESS (end))
+    if (strchr (line, '\n') == NULL && !feof (fp))
     {
-      success = TRUE;
-      *size = 1;
-      if (protection[0] == 'r')
-        *prot |= GUM_PAGE_READ;
-      if (protection[1] == 'w')
-        *prot |= GUM_PAGE_WRITE;
-      if (protection[2] == 'x')
-        *prot |= GUM_PAGE_EXECUTE;
-      break;
+      gint c;
+
+      /* skip the remainder of an overly long pathname */
+      do
+        c = fgetc (fp);
+      while (c != '\n' && c != EOF);
     }
+
+    n_items = sscanf (line, "%p-%p %15s ", &start, &end, protection);
+    g_assert_cmpint (n_items, ==, 3);
+
+    entry.start = GUM_ADDRESS (start);
+    entry.end = GUM_ADDRESS (end);
+    entry.prot = GUM_PAGE_NO_ACCESS;
+    if (protection[0] == 'r')
+      entry.prot |= GUM_PAGE_READ;
+    if (protection[1] == 'w')
+      entry.prot |= GUM_PAGE_WRITE;
+    if (protection[2] == 'x')
+      entry.prot |= GUM_PAGE_EXECUTE;
+
+    g_array_append_val (gum_maps_entries, entry);
   }
 
   fclose (fp);
 
-  return success;
+  gum_maps_entries_generation = generation;
+
+  return TRUE;
 }
 
+static gint
+gum_maps_index_find (GumAddress address)
+{
+  guint lower, upper;
+
+  /* the kernel lists mappings sorted by address and without overlaps */
+  lower = 0;
+  upper = gum_maps_entries->len;
+  while (lower != upper)
+  {
+    guint mid;
+    const GumMapsEntry * entry;
+
+    mid = lower + ((upper - lower) / 2);
+    entry = &g_array_index (gum_maps_entries, GumMapsEntry, mid);
+
+    if (address < entry->start)
+      upper = mid;
+    else if (address >= entry->end)
+      lower = mid + 1;
+    else
+      return mid;
+  }
+
+  return -1;
+}
@@ -0,0 +1,1092 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "gummemoryaccessmonitor.h"
+
+#include "gumexceptor.h"
+#include "gumlinux.h"
+#include "gummemory-priv.h"
+#include "gumprocess.h"
+#include "gumtls.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <gio/gio.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#ifdef HAVE_LINUX_USERFAULTFD_H
+# include <linux/userfaultfd.h>
+#endif
+
+#if defined (UFFDIO_WRITEPROTECT) && defined (__NR_userfaultfd)
+# define GUM_HAVE_USERFAULTFD_WP 1
+#endif
+
+#define GUM_X86_TRAP_FLAG 0x100
+#define GUM_UFFD_BATCH_SIZE 64
+#define GUM_MAX_STEPPING_PAGES 8
+
+typedef struct _GumRangeEntry GumRangeEntry;
+typedef struct _GumPageDetails GumPageDetails;
+typedef struct _GumSteppingPages GumSteppingPages;
+typedef guint GumPageState;
+
+typedef gboolean (* GumPageRunFunc) (GumMemoryAccessMonitor * self,
+    gpointer address, gsize size, GumPageProtection prot);
+
+struct _GumMemoryAccessMonitorPrivate
+{
+  guint page_size;
+
+  gboolean enabled;
+  GumExceptor * exceptor;
+  GumTlsKey stepping_pages;
+  GumSteppingPages * stepping_pool;
+
+  GumMemoryRange * ranges;
+  guint num_ranges;
+  GumRangeEntry * entries;
+  volatile gint pages_remaining;
+  gint pages_total;
+
+  GumPageProtection access_mask;
+  GumPageDetails * pages_details;
+  gboolean auto_reset;
+
+  gint uffd;
+  gint uffd_wakeup[2];
+  GThread * uffd_thread;
+
+  GumMemoryAccessNotify notify_func;
+  gpointer notify_data;
+  GDestroyNotify notify_data_destroy;
+};
+
+/*
+ * The ranges sorted by address, so that a faulting address can be mapped
+ * to its page in O(log n) no matter how many ranges are being monitored.
+ */
+struct _GumRangeEntry
+{
+  GumAddress start;
+  GumAddress end;
+  guint range_index;
+  guint first_page;
+};
+
+struct _GumPageDetails
+{
+  gpointer address;
+  gboolean is_mapped;
+  GumPageProtection original_protection;
+  GumPageProtection armed_protection;
+  volatile gint state;
+  volatile gint steppers;
+  volatile guint completed;
+};
+
+/*
+ * The pages a thread has opened up for the instruction it is single-stepping,
+ * which may touch several of them, e.g. a movs whose source and destination
+ * both straddle a page boundary. Claimed from a preallocated pool, as the
+ * fault handler must not allocate. A slot is only held from the first fault
+ * of an instruction until its single-step trap, so the pool has to cover the
+ * threads stepping at the same time rather than every thread that faults.
+ * GUM_MAX_THREADS is plenty for that, and should it still run dry the page
+ * stops being monitored instead.
+ */
+struct _GumSteppingPages
+{
+  volatile gint in_use;
+  guint count;
+  GumPageDetails * items[GUM_MAX_STEPPING_PAGES];
+};
+
+enum _GumPageState
+{
+  GUM_PAGE_STATE_IDLE,
+  GUM_PAGE_STATE_ARMED,
+  GUM_PAGE_STATE_FIRING,
+  GUM_PAGE_STATE_FIRED
+};
+
+static void gum_memory_access_monitor_dispose (GObject * object);
+static void gum_memory_access_monitor_finalize (GObject * object);
+
+static gint gum_range_entry_compare (gconstpointer a, gconstpointer b);
+static gboolean gum_collect_page_protection (const GumRangeDetails * details,
+    gpointer user_data);
+
+static void gum_memory_access_monitor_protect_pages (
+    GumMemoryAccessMonitor * self, gboolean arm);
+static gboolean gum_memory_access_monitor_mprotect (
+    GumMemoryAccessMonitor * self, gpointer address, gsize size,
+    GumPageProtection prot);
+static gint gum_memory_access_monitor_find_page (
+    GumMemoryAccessMonitor * self, gpointer address,
+    const GumRangeEntry ** entry);
+static void gum_memory_access_monitor_report (GumMemoryAccessMonitor * self,
+    const GumRangeEntry * entry, GumPageDetails * page,
+    GumMemoryOperation operation, gpointer from, gpointer address);
+
+static gboolean gum_memory_access_monitor_on_exception (
+    GumExceptionDetails * details, gpointer user_data);
+static gboolean gum_memory_access_monitor_handle_fault (
+    GumMemoryAccessMonitor * self, GumExceptionDetails * details);
+#ifdef HAVE_I386
+static gboolean gum_memory_access_monitor_handle_step (
+    GumMemoryAccessMonitor * self, GumExceptionDetails * details);
+static gboolean gum_memory_access_monitor_end_step (
+    GumMemoryAccessMonitor * self, ucontext_t * uc);
+static GumSteppingPages * gum_memory_access_monitor_get_stepping_pages (
+    GumMemoryAccessMonitor * self);
+static gboolean gum_stepping_pages_contain (const GumSteppingPages * self,
+    const GumPageDetails * page);
+#endif
+static gboolean gum_page_protection_permits (GumPageProtection prot,
+    GumMemoryOperation operation);
+static void gum_page_restore_protection (gpointer address, gsize size,
+    GumPageProtection prot);
+
+static gboolean gum_memory_access_monitor_try_enable_uffd (
+    GumMemoryAccessMonitor * self);
+static void gum_memory_access_monitor_disable_uffd (
+    GumMemoryAccessMonitor * self);
+#ifdef GUM_HAVE_USERFAULTFD_WP
+static gboolean gum_memory_access_monitor_write_protect (
+    GumMemoryAccessMonitor * self, gpointer address, gsize size,
+    GumPageProtection prot);
+static gpointer gum_memory_access_monitor_process_faults (gpointer data);
+static void gum_memory_access_monitor_handle_uffd_batch (
+    GumMemoryAccessMonitor * self, const struct uffd_msg * messages,
+    guint count);
+#endif
+
+G_DEFINE_TYPE (GumMemoryAccessMonitor, gum_memory_access_monitor,
+    G_TYPE_OBJECT);
+
+static void
+gum_memory_access_monitor_class_init (GumMemoryAccessMonitorClass * klass)
+{
+  GObjectClass * object_class = G_OBJECT_CLASS (klass);
+
+  g_type_class_add_private (klass, sizeof (GumMemoryAccessMonitorPrivate));
+
+  object_class->dispose = gum_memory_access_monitor_dispose;
+  object_class->finalize = gum_memory_access_monitor_finalize;
+}
+
+static void
+gum_memory_access_monitor_init (GumMemoryAccessMonitor * self)
+{
+  GumMemoryAccessMonitorPrivate * priv;
+
+  self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
+      GUM_TYPE_MEMORY_ACCESS_MONITOR, GumMemoryAccessMonitorPrivate);
+  priv = self->priv;
+
+  priv->page_size = gum_query_page_size ();
+  priv->stepping_pages = gum_tls_key_new ();
+  priv->stepping_pool = g_new0 (GumSteppingPages, GUM_MAX_THREADS);
+
+  priv->uffd = -1;
+  priv->uffd_wakeup[0] = -1;
+  priv->uffd_wakeup[1] = -1;
+}
+
+static void
+gum_memory_access_monitor_dispose (GObject * object)
+{
+  GumMemoryAccessMonitor * self = GUM_MEMORY_ACCESS_MONITOR_CAST (object);
+  GumMemoryAccessMonitorPrivate * priv = self->priv;
+
+  gum_memory_access_monitor_disable (self);
+
+  if (priv->notify_data_destroy != NULL)
+  {
+    priv->notify_data_destroy (priv->notify_data);
+    priv->notify_data_destroy = NULL;
+  }
+  priv->notify_data = NULL;
+  priv->notify_func = NULL;
+
+  G_OBJECT_CLASS (gum_memory_access_monitor_parent_class)->dispose (object);
+}
+
+static void
+gum_memory_access_monitor_finalize (GObject * object)
+{
+  GumMemoryAccessMonitor * self = GUM_MEMORY_ACCESS_MONITOR_CAST (object);
+  GumMemoryAccessMonitorPrivate * priv = self->priv;
+
+  g_free (priv->pages_details);
+  g_free (priv->entries);
+  g_free (priv->ranges);
+
+  g_free (priv->stepping_pool);
+  gum_tls_key_free (priv->stepping_pages);
+
+  G_OBJECT_CLASS (gum_memory_access_monitor_parent_class)->finalize (object);
+}
+
+GumMemoryAccessMonitor *
+gum_memory_access_monitor_new (const GumMemoryRange * ranges,
+                               guint num_ranges,
+                               GumPageProtection access_mask,
+                               gboolean auto_reset,
+                               GumMemoryAccessNotify func,
+                               gpointer data,
+                               GDestroyNotify data_destroy)
+{
+  GumMemoryAccessMonitor * monitor;
+  GumMemoryAccessMonitorPrivate * priv;
+  guint i, page_index;
+
+  monitor = GUM_MEMORY_ACCESS_MONITOR_CAST (
+      g_object_new (GUM_TYPE_MEMORY_ACCESS_MONITOR, NULL));
+  priv = monitor->priv;
+
+  priv->ranges = g_memdup (ranges, num_ranges * sizeof (GumMemoryRange));
+  priv->num_ranges = num_ranges;
+  priv->entries = g_new (GumRangeEntry, num_ranges);
+  priv->access_mask = access_mask;
+  priv->auto_reset = auto_reset;
+  for (i = 0; i != num_ranges; i++)
+  {
+    GumMemoryRange * r = &priv->ranges[i];
+    GumRangeEntry * entry = &priv->entries[i];
+    gsize aligned_start, aligned_end;
+
+    aligned_start = r->base_address & ~((gsize) priv->page_size - 1);
+    aligned_end = (r->base_address + r->size + priv->page_size - 1) &
+        ~((gsize) priv->page_size - 1);
+    r->base_address = aligned_start;
+    r->size = aligned_end - aligned_start;
+
+    entry->start = aligned_start;
+    entry->end = aligned_end;
+    entry->range_index = i;
+
+    priv->pages_total += r->size / priv->page_size;
+  }
+  priv->pages_remaining = priv->pages_total;
+
+  qsort (priv->entries, num_ranges, sizeof (GumRangeEntry),
+      gum_range_entry_compare);
+
+  priv->pages_details = g_new0 (GumPageDetails, priv->pages_total);
+  for (i = 0, page_index = 0; i != num_ranges; i++)
+  {
+    GumRangeEntry * entry = &priv->entries[i];
+    GumAddress cur;
+
+    entry->first_page = page_index;
+    for (cur = entry->start; cur != entry->end; cur += priv->page_size)
+      priv->pages_details[page_index++].address = GSIZE_TO_POINTER (cur);
+  }
+
+  priv->notify_func = func;
+  priv->notify_data = data;
+  priv->notify_data_destroy = data_destroy;
+
+  return monitor;
+}
+
+/*
+ * Write-only monitoring with auto-reset is handed to userfaultfd when the
+ * kernel supports write-protect mode for the ranges, which avoids the
+ * signal round-trip entirely. Everything else is done by revoking access
+ * through mprotect() and catching the faults through GumExceptor.
+ */
+gboolean
+gum_memory_access_monitor_enable (GumMemoryAccessMonitor * self,
+                                  GError ** error)
+{
+  GumMemoryAccessMonitorPrivate * priv = self->priv;
+  guint i;
+
+  if (priv->enabled)
+    return TRUE;
+
+#ifndef HAVE_I386
+  /* Re-arming after each access relies on single-stepping. */
+  if (!priv->auto_reset)
+    goto error_not_supported;
+#endif
+
+  for (i = 1; i < priv->num_ranges; i++)
+  {
+    if (priv->entries[i].start < priv->entries[i - 1].end)
+      goto error_overlapping_ranges;
+  }
+
+  for (i = 0; i != (guint) priv->pages_total; i++)
+  {
+    GumPageDetails * page = &priv->pages_details[i];
+
+    page->is_mapped = FALSE;
+    page->state = GUM_PAGE_STATE_IDLE;
+    page->steppers = 0;
+    page->completed = 0;
+  }
+  priv->pages_remaining = priv->pages_total;
+
+  gum_process_enumerate_ranges (GUM_PAGE_NO_ACCESS,
+      gum_collect_page_protection, self);
+
+  for (i = 0; i != (guint) priv->pages_total; i++)
+  {
+    GumPageDetails * page = &priv->pages_details[i];
+    GumPageProtection armed;
+
+    if (!page->is_mapped)
+      goto error_invalid_pages;
+
+    /* There is no such thing as a page that is writable but not readable. */
+    if ((priv->access_mask & GUM_PAGE_READ) != 0)
+      armed = GUM_PAGE_NO_ACCESS;
+    else
+      armed = page->original_protection & ~priv->access_mask;
+
+    page->armed_protection = armed;
+    if (armed != page->original_protection)
+      page->state = GUM_PAGE_STATE_ARMED;
+  }
+
+  if (!gum_memory_access_monitor_try_enable_uffd (self))
+  {
+    priv->exceptor = gum_exceptor_obtain ();
+    gum_exceptor_add (priv->exceptor, gum_memory_access_monitor_on_exception,
+        self);
+
+    gum_memory_access_monitor_protect_pages (self, TRUE);
+  }
+
+  priv->enabled = TRUE;
+
+  return TRUE;
+
+#ifndef HAVE_I386
+error_not_supported:
+  {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+        "monitoring without auto-reset is not supported on this "
+        "architecture");
+    return FALSE;
+  }
+#endif
+error_overlapping_ranges:
+  {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+        "one or more ranges overlap");
+    return FALSE;
+  }
+error_invalid_pages:
+  {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+        "one or more pages are unallocated");
+    return FALSE;
+  }
+}
+
+void
+gum_memory_access_monitor_disable (GumMemoryAccessMonitor * self)
+{
+  GumMemoryAccessMonitorPrivate * priv = self->priv;
+
+  if (!priv->enabled)
+    return;
+
+  if (priv->uffd != -1)
+  {
+    gum_memory_access_monitor_disable_uffd (self);
+  }
+  else
+  {
+    gum_memory_access_monitor_protect_pages (self, FALSE);
+
+    gum_exceptor_remove (priv->exceptor,
+        gum_memory_access_monitor_on_exception, self);
+    g_object_unref (priv->exceptor);
+    priv->exceptor = NULL;
+  }
+
+  priv->enabled = FALSE;
+}
+
+static gint
+gum_range_entry_compare (gconstpointer a,
+                         gconstpointer b)
+{
+  const GumRangeEntry * entry_a = a;
+  const GumRangeEntry * entry_b = b;
+
+  if (entry_a->start < entry_b->start)
+    return -1;
+  else if (entry_a->start > entry_b->start)
+    return 1;
+  else
+    return 0;
+}
+
+static gboolean
+gum_collect_page_protection (const GumRangeDetails * details,
+                             gpointer user_data)
+{
+  GumMemoryAccessMonitor * self = GUM_MEMORY_ACCESS_MONITOR_CAST (user_data);
+  GumMemoryAccessMonitorPrivate * priv = self->priv;
+  GumAddress start, end;
+  guint lower, upper;
+
+  start = details->range->base_address;
+  end = start + details->range->size;
+
+  lower = 0;
+  upper = priv->num_ranges;
+  while (lower != upper)
+  {
+    guint mid = lower + ((upper - lower) / 2);
+
+    if (priv->entries[mid].end <= start)
+      lower = mid + 1;
+    else
+      upper = mid;
+  }
+
+  for (; lower != priv->num_ranges && priv->entries[lower].start < end;
+      lower++)
+  {
+    const GumRangeEntry * entry = &priv->entries[lower];
+    GumAddress cur, overlap_end;
+
+    cur = MAX (entry->start, start);
+    overlap_end = MIN (entry->end, end);
+    for (; cur < overlap_end; cur += priv->page_size)
+    {
+      GumPageDetails * page = &priv->pages_details[entry->first_page +
+          ((cur - entry->start) / priv->page_size)];
+
+      page->is_mapped = TRUE;
+      page->original_protection = details->prot;
+    }
+  }
+
+  return TRUE;
+}
+
+/*
+ * Walks the armed pages in address order and applies the new protection to
+ * each run of adjacent pages that end up with the same protection, so that
+ * large contiguous ranges cost a single call rather than one per page.
+ */
+static void
+gum_memory_access_monitor_protect_pages (GumMemoryAccessMonitor * self,
+                                         gboolean arm)
+{
+  GumMemoryAccessMonitorPrivate * priv = self->priv;
+  GumPageRunFunc apply = gum_memory_access_monitor_mprotect;
+  guint8 * run_start = NULL;
+  gsize run_size = 0;
+  GumPageProtection run_prot = GUM_PAGE_NO_ACCESS;
+  guint run_first_page = 0;
+  guint i;
+
+#ifdef GUM_HAVE_USERFAULTFD_WP
+  if (priv->uffd != -1)
+    apply = gum_memory_access_monitor_write_protect;
+#endif
+
+  for (i = 0; i <= (guint) priv->pages_total; i++)
+  {
+    GumPageDetails * page = NULL;
+    GumPageProtection prot = GUM_PAGE_NO_ACCESS;
+
+    if (i != (guint) priv->pages_total)
+    {
+      page = &priv->pages_details[i];
+      if (page->state == GUM_PAGE_STATE_ARMED)
+        prot = arm ? page->armed_protection : page->original_protection;
+      else
+        page = NULL;
+    }
+
+    if (run_size != 0 && (page == NULL || prot != run_prot ||
+        (guint8 *) page->address != run_start + run_size))
+    {
+      if (!apply (self, run_start, run_size, run_prot) && arm)
+      {
+        guint j;
+
+        for (j = run_first_page; j != i; j++)
+        {
+          if (priv->pages_details[j].state == GUM_PAGE_STATE_ARMED)
+          {
+            priv->pages_details[j].state = GUM_PAGE_STATE_IDLE;
+            g_atomic_int_add (&priv->pages_remaining, -1);
+          }
+        }
+      }
+      run_size = 0;
+    }
+
+    if (page != NULL)
+    {
+      if (run_size == 0)
+      {
+        run_start = page->address;
+        run_prot = prot;
+        run_first_page = i;
+      }
+      run_size += priv->page_size;
+    }
+  }
+}
+
+static gboolean
+gum_memory_access_monitor_mprotect (GumMemoryAccessMonitor * self,
+                                    gpointer address,
+                                    gsize size,
+                                    GumPageProtection prot)
+{
+  return gum_try_mprotect (address, size, prot);
+}
+
+static gint
+gum_memory_access_monitor_find_page (GumMemoryAccessMonitor * self,
+                                     gpointer address,
+                                     const GumRangeEntry ** entry)
+{
+  GumMemoryAccessMonitorPrivate * priv = self->priv;
+  GumAddress addr = GUM_ADDRESS (address);
+  guint lower, upper;
+
+  lower = 0;
+  upper = priv->num_ranges;
+  while (lower != upper)
+  {
+    guint mid = lower + ((upper - lower) / 2);
+    const GumRangeEntry * e = &priv->entries[mid];
+
+    if (addr < e->start)
+    {
+      upper = mid;
+    }
+    else if (addr >= e->end)
+    {
+      lower = mid + 1;
+    }
+    else
+    {
+      *entry = e;
+      return e->first_page + ((addr - e->start) / priv->page_size);
+    }
+  }
+
+  return -1;
+}
+
+static void
+gum_memory_access_monitor_report (GumMemoryAccessMonitor * self,
+                                  const GumRangeEntry * entry,
+                                  GumPageDetails * page,
+                                  GumMemoryOperation operation,
+                                  gpointer from,
+                                  gpointer address)
+{
+  GumMemoryAccessMonitorPrivate * priv = self->priv;
+  GumMemoryAccessDetails d;
+  guint operations_reported;
+  gint pages_remaining;
+
+  operations_reported = g_atomic_int_or (&page->completed, 1 << operation);
+  if (operations_reported == 0)
+    pages_remaining = g_atomic_int_add (&priv->pages_remaining, -1) - 1;
+  else
+    pages_remaining = g_atomic_int_get (&priv->pages_remaining);
+
+  d.operation = operation;
+  d.from = from;
+  d.address = address;
+
+  d.range_index = entry->range_index;
+  d.page_index = (GUM_ADDRESS (page->address) - entry->start) /
+      priv->page_size;
+  d.pages_completed = priv->pages_total - pages_remaining;
+  d.pages_total = priv->pages_total;
+
+  priv->notify_func (self, &d, priv->notify_data);
+}
+
+static gboolean
+gum_memory_access_monitor_on_exception (GumExceptionDetails * details,
+                                        gpointer user_data)
+{
+  GumMemoryAccessMonitor * self = GUM_MEMORY_ACCESS_MONITOR_CAST (user_data);
+
+  switch (details->type)
+  {
+    case GUM_EXCEPTION_ACCESS_VIOLATION:
+      return gum_memory_access_monitor_handle_fault (self, details);
+#ifdef HAVE_I386
+    case GUM_EXCEPTION_SINGLE_STEP:
+      return gum_memory_access_monitor_handle_step (self, details);
+#endif
+    default:
+      return FALSE;
+  }
+}
+
+static gboolean
+gum_memory_access_monitor_handle_fault (GumMemoryAccessMonitor * self,
+                                        GumExceptionDetails * details)
+{
+  GumMemoryAccessMonitorPrivate * priv = self->priv;
+  const GumRangeEntry * entry;
+  gint page_index;
+  GumPageDetails * page;
+
+  page_index = gum_memory_access_monitor_find_page (self,
+      details->memory.address, &entry);
+  if (page_index == -1)
+    return FALSE;
+  page = &priv->pages_details[page_index];
+
+  if (priv->auto_reset)
+  {
+    if (!g_atomic_int_compare_and_exchange (&page->state,
+        GUM_PAGE_STATE_ARMED, GUM_PAGE_STATE_FIRING))
+    {
+      /*
+       * Another thread got here first, so just retry once it has restored
+       * the page, unless this is a genuine access violation.
+       */
+      switch (g_atomic_int_get (&page->state))
+      {
+        case GUM_PAGE_STATE_FIRING:
+          return TRUE;
+        case GUM_PAGE_STATE_FIRED:
+          return gum_page_protection_permits (page->original_protection,
+              details->memory.operation);
+        default:
+          return FALSE;
+      }
+    }
+
+    gum_page_restore_protection (page->address, priv->page_size,
+        page->original_protection);
+    g_atomic_int_set (&page->state, GUM_PAGE_STATE_FIRED);
+
+    gum_memory_access_monitor_report (self, entry, page,
+        details->memory.operation, details->address, details->memory.address);
+
+    return TRUE;
+  }
+
+#ifdef HAVE_I386
+  {
+    ucontext_t * uc = details->native_context;
+    GumSteppingPages * stepping;
+
+    /*
+     * The page's own protection would not have allowed it either, so let
+     * the application see it rather than open the page up for an access
+     * that just faults again. Pages already opened up for the instruction
+     * are re-armed on the way out.
+     */
+    if (!gum_page_protection_permits (page->original_protection,
+        details->memory.operation))
+    {
+      gum_memory_access_monitor_end_step (self, uc);
+      return FALSE;
+    }
+
+    /*
+     * No longer monitored, but a thread that was stepping through it may
+     * still have re-armed it on its way out.
+     */
+    if (g_atomic_int_get (&page->state) != GUM_PAGE_STATE_ARMED)
+    {
+      gum_page_restore_protection (page->address, priv->page_size,
+          page->original_protection);
+      return TRUE;
+    }
+
+    /*
+     * Let the faulting instruction through with the original protection
+     * and trap right after it, so the pages it touched can be re-armed.
+     * Other threads touching them during this window will go unnoticed.
+     */
+    stepping = gum_memory_access_monitor_get_stepping_pages (self);
+
+    if (stepping != NULL && gum_stepping_pages_contain (stepping, page))
+    {
+      /* Re-armed by another thread before we got to run, try again. */
+      gum_page_restore_protection (page->address, priv->page_size,
+          page->original_protection);
+      return TRUE;
+    }
+
+    if (stepping != NULL && stepping->count != GUM_MAX_STEPPING_PAGES)
+    {
+      g_atomic_int_inc (&page->steppers);
+      stepping->items[stepping->count++] = page;
+      uc->uc_mcontext.gregs[REG_EFL] |= GUM_X86_TRAP_FLAG;
+    }
+    else
+    {
+      /*
+       * Without room to track it the page could never be re-armed, so stop
+       * monitoring it. The report below still counts it as completed.
+       */
+      g_atomic_int_set (&page->state, GUM_PAGE_STATE_IDLE);
+    }
+
+    gum_page_restore_protection (page->address, priv->page_size,
+        page->original_protection);
+
+    gum_memory_access_monitor_report (self, entry, page,
+        details->memory.operation, details->address, details->memory.address);
+
+    return TRUE;
+  }
+#else
+  return FALSE;
+#endif
+}
+
+#ifdef HAVE_I386
+
+static gboolean
+gum_memory_access_monitor_handle_step (GumMemoryAccessMonitor * self,
+                                       GumExceptionDetails * details)
+{
+  return gum_memory_access_monitor_end_step (self, details->native_context);
+}
+
+static gboolean
+gum_memory_access_monitor_end_step (GumMemoryAccessMonitor * self,
+                                    ucontext_t * uc)
+{
+  GumMemoryAccessMonitorPrivate * priv = self->priv;
+  GumSteppingPages * stepping;
+  guint i;
+
+  stepping = gum_tls_key_get_value (priv->stepping_pages);
+  if (stepping == NULL)
+    return FALSE;
+  gum_tls_key_set_value (priv->stepping_pages, NULL);
+
+  uc->uc_mcontext.gregs[REG_EFL] &= ~GUM_X86_TRAP_FLAG;
+
+  for (i = 0; i != stepping->count; i++)
+  {
+    GumPageDetails * page = stepping->items[i];
+
+    if (g_atomic_int_dec_and_test (&page->steppers) &&
+        g_atomic_int_get (&page->state) == GUM_PAGE_STATE_ARMED)
+    {
+      gum_page_restore_protection (page->address, priv->page_size,
+          page->armed_protection);
+    }
+  }
+
+  stepping->count = 0;
+  g_atomic_int_set (&stepping->in_use, FALSE);
+
+  return TRUE;
+}
+
+static GumSteppingPages *
+gum_memory_access_monitor_get_stepping_pages (GumMemoryAccessMonitor * self)
+{
+  GumMemoryAccessMonitorPrivate * priv = self->priv;
+  GumSteppingPages * stepping;
+  guint i;
+
+  stepping = gum_tls_key_get_value (priv->stepping_pages);
+  if (stepping != NULL)
+    return stepping;
+
+  for (i = 0; i != GUM_MAX_THREADS; i++)
+  {
+    stepping = &priv->stepping_pool[i];
+
+    if (g_atomic_int_compare_and_exchange (&stepping->in_use, FALSE, TRUE))
+    {
+      gum_tls_key_set_value (priv->stepping_pages, stepping);
+      return stepping;
+    }
+  }
+
+  return NULL;
+}
+
+static gboolean
+gum_stepping_pages_contain (const GumSteppingPages * self,
+                            const GumPageDetails * page)
+{
+  guint i;
+
+  for (i = 0; i != self->count; i++)
+  {
+    if (self->items[i] == page)
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+#endif
+
+static gboolean
+gum_page_protection_permits (GumPageProtection prot,
+                             GumMemoryOperation operation)
+{
+  switch (operation)
+  {
+    case GUM_MEMOP_READ:
+      return (prot & GUM_PAGE_READ) != 0;
+    case GUM_MEMOP_WRITE:
+      return (prot & GUM_PAGE_WRITE) != 0;
+    case GUM_MEMOP_EXECUTE:
+      return (prot & GUM_PAGE_EXECUTE) != 0;
+    default:
+      return FALSE;
+  }
+}
+
+/* Called from the signal handler, so no allocations and no locks. */
+static void
+gum_page_restore_protection (gpointer address,
+                             gsize size,
+                             GumPageProtection prot)
+{
+  mprotect (address, size, _gum_page_protection_to_posix (prot));
+  gum_linux_invalidate_maps_cache ();
+}
+
+static gboolean
+gum_memory_access_monitor_try_enable_uffd (GumMemoryAccessMonitor * self)
+{
+#ifdef GUM_HAVE_USERFAULTFD_WP
+  GumMemoryAccessMonitorPrivate * priv = self->priv;
+  gint fd;
+  struct uffdio_api api;
+  guint i;
+
+  if (priv->access_mask != GUM_PAGE_WRITE || !priv->auto_reset)
+    return FALSE;
+
+  fd = syscall (__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+  if (fd == -1)
+    return FALSE;
+
+  api.api = UFFD_API;
+  api.features = UFFD_FEATURE_PAGEFAULT_FLAG_WP;
+  api.ioctls = 0;
+  if (ioctl (fd, UFFDIO_API, &api) != 0 ||
+      (api.features & UFFD_FEATURE_PAGEFAULT_FLAG_WP) == 0)
+    goto fallback;
+
+  for (i = 0; i != priv->num_ranges; i++)
+  {
+    const GumRangeEntry * entry = &priv->entries[i];
+    struct uffdio_register reg;
+    GumAddress cur;
+
+    /* Write-protection only sticks to pages that are populated. */
+    for (cur = entry->start; cur != entry->end; cur += priv->page_size)
+    {
+      GumPageDetails * page = &priv->pages_details[entry->first_page +
+          ((cur - entry->start) / priv->page_size)];
+
+      if ((page->original_protection & GUM_PAGE_READ) == 0)
+        goto fallback;
+      (void) *((volatile guint8 *) GSIZE_TO_POINTER (cur));
+    }
+
+    reg.range.start = entry->start;
+    reg.range.len = entry->end - entry->start;
+    reg.mode = UFFDIO_REGISTER_MODE_WP;
+    if (ioctl (fd, UFFDIO_REGISTER, &reg) != 0 ||
+        (reg.ioctls & ((guint64) 1 << _UFFDIO_WRITEPROTECT)) == 0)
+      goto fallback;
+  }
+
+  if (pipe (priv->uffd_wakeup) != 0)
+    goto fallback;
+
+  priv->uffd = fd;
+  gum_memory_access_monitor_protect_pages (self, TRUE);
+
+  priv->uffd_thread = g_thread_new ("gum-memory-access-monitor",
+      gum_memory_access_monitor_process_faults, self);
+
+  return TRUE;
+
+fallback:
+  {
+    /* Closing the descriptor drops any registrations made above. */
+    close (fd);
+    return FALSE;
+  }
+#else
+  return FALSE;
+#endif
+}
+
+static void
+gum_memory_access_monitor_disable_uffd (GumMemoryAccessMonitor * self)
+{
+#ifdef GUM_HAVE_USERFAULTFD_WP
+  GumMemoryAccessMonitorPrivate * priv = self->priv;
+  guint i;
+
+  while (write (priv->uffd_wakeup[1], "x", 1) == -1 && errno == EINTR)
+    ;
+  g_thread_join (priv->uffd_thread);
+  priv->uffd_thread = NULL;
+
+  for (i = 0; i != priv->num_ranges; i++)
+  {
+    const GumRangeEntry * entry = &priv->entries[i];
+    struct uffdio_range range;
+
+    gum_memory_access_monitor_write_protect (self,
+        GSIZE_TO_POINTER (entry->start), entry->end - entry->start,
+        GUM_PAGE_RW);
+
+    range.start = entry->start;
+    range.len = entry->end - entry->start;
+    ioctl (priv->uffd, UFFDIO_UNREGISTER, &range);
+  }
+
+  close (priv->uffd_wakeup[0]);
+  close (priv->uffd_wakeup[1]);
+  priv->uffd_wakeup[0] = -1;
+  priv->uffd_wakeup[1] = -1;
+
+  close (priv->uffd);
+  priv->uffd = -1;
+#endif
+}
+
+#ifdef GUM_HAVE_USERFAULTFD_WP
+
+static gboolean
+gum_memory_access_monitor_write_protect (GumMemoryAccessMonitor * self,
+                                         gpointer address,
+                                         gsize size,
+                                         GumPageProtection prot)
+{
+  struct uffdio_writeprotect wp;
+
+  wp.range.start = GPOINTER_TO_SIZE (address);
+  wp.range.len = size;
+  wp.mode = ((prot & GUM_PAGE_WRITE) == 0) ? UFFDIO_WRITEPROTECT_MODE_WP : 0;
+
+  return ioctl (self->priv->uffd, UFFDIO_WRITEPROTECT, &wp) == 0;
+}
+
+/*
+ * Faults are read off the descriptor in batches. Each batch is reported in
+ * one go, on this thread, before any of the faulting threads are woken up.
+ * The faulting instruction is not known here, so `from` is always NULL, and
+ * the reported address is only accurate down to the page.
+ */
+static gpointer
+gum_memory_access_monitor_process_faults (gpointer data)
+{
+  GumMemoryAccessMonitor * self = GUM_MEMORY_ACCESS_MONITOR_CAST (data);
+  GumMemoryAccessMonitorPrivate * priv = self->priv;
+  struct uffd_msg messages[GUM_UFFD_BATCH_SIZE];
+
+  while (TRUE)
+  {
+    struct pollfd fds[2];
+    gssize n;
+
+    fds[0].fd = priv->uffd;
+    fds[0].events = POLLIN;
+    fds[0].revents = 0;
+    fds[1].fd = priv->uffd_wakeup[0];
+    fds[1].events = POLLIN;
+    fds[1].revents = 0;
+
+    if (poll (fds, G_N_ELEMENTS (fds), -1) == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+
+    if (fds[1].revents != 0)
+      break;
+
+    n = read (priv->uffd, messages, sizeof (messages));
+    if (n <= 0)
+      continue;
+
+    gum_memory_access_monitor_handle_uffd_batch (self, messages,
+        n / sizeof (struct uffd_msg));
+  }
+
+  return NULL;
+}
+
+static void
+gum_memory_access_monitor_handle_uffd_batch (GumMemoryAccessMonitor * self,
+                                             const struct uffd_msg * messages,
+                                             guint count)
+{
+  GumMemoryAccessMonitorPrivate * priv = self->priv;
+  guint i;
+
+  for (i = 0; i != count; i++)
+  {
+    const struct uffd_msg * msg = &messages[i];
+    gpointer address;
+    const GumRangeEntry * entry;
+    gint page_index;
+    GumPageDetails * page;
+
+    if (msg->event != UFFD_EVENT_PAGEFAULT ||
+        (msg->arg.pagefault.flags & UFFD_PAGEFAULT_FLAG_WP) == 0)
+      continue;
+
+    address = GSIZE_TO_POINTER (msg->arg.pagefault.address);
+    page_index = gum_memory_access_monitor_find_page (self, address, &entry);
+    if (page_index == -1)
+      continue;
+    page = &priv->pages_details[page_index];
+
+    if (g_atomic_int_compare_and_exchange (&page->state,
+        GUM_PAGE_STATE_ARMED, GUM_PAGE_STATE_FIRED))
+    {
+      gum_memory_access_monitor_report (self, entry, page, GUM_MEMOP_WRITE,
+          NULL, address);
+    }
+  }
+
+  for (i = 0; i != count; i++)
+  {
+    const struct uffd_msg * msg = &messages[i];
+
+    if (msg->event != UFFD_EVENT_PAGEFAULT)
+      continue;
+
+    /* Lifting the protection also wakes up the faulting thread. */
+    gum_memory_access_monitor_write_protect (self,
+        GSIZE_TO_POINTER (msg->arg.pagefault.address &
+        ~((guint64) priv->page_size - 1)), priv->page_size, GUM_PAGE_RW);
+  }
+}
+
+#endif
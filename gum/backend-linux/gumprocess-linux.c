@@ -6,6 +6,7 @@
 
 #include "gumprocess.h"
 
+#include "gum-init.h"
 #include "gumlinux.h"
 #include "gummodulemap.h"
 
@@ -18,8 +19,9 @@
 #include <string.h>
 #include <unistd.h>
 #include <gio/gio.h>
-#include <sys/mman.h>
-#include <sys/stat.h>
+#ifndef HAVE_ANDROID
+# include <linux/futex.h>
+#endif
 #include <sys/syscall.h>
 #include <sys/types.h>
 #ifndef HAVE_ANDROID
@@ -29,9 +31,20 @@
 #define GUM_HIJACK_SIGNAL (SIGRTMIN + 7)
 #define GUM_MAPS_LINE_SIZE (1024 + PATH_MAX)
 #define GUM_PSR_THUMB 0x20
+#define GUM_THREAD_CAPTURE_TIMEOUT G_USEC_PER_SEC
+#define GUM_MODULE_GENERATION_UNKNOWN G_MAXUINT64
+
+#ifndef DT_GNU_HASH
+# define DT_GNU_HASH 0x6ffffef5
+#endif
+#ifndef DT_VERSYM
+# define DT_VERSYM 0x6ffffff0
+#endif
+#define GUM_ELF_VERSYM_HIDDEN 0x8000
 
+typedef struct _GumThreadSnapshot GumThreadSnapshot;
+typedef struct _GumThreadCaptureSession GumThreadCaptureSession;
 typedef struct _GumEnumerateImportsContext GumEnumerateImportsContext;
-typedef struct _GumDependencyExport GumDependencyExport;
 typedef struct _GumEnumerateModuleRangesContext GumEnumerateModuleRangesContext;
 typedef struct _GumResolveModuleNameContext GumResolveModuleNameContext;
 
@@ -47,41 +60,47 @@ typedef gboolean (* GumElfFoundSymbolFunc) (const GumElfSymbolDetails * details,
     gpointer user_data);
 
 typedef guint GumElfSHeaderIndex;
-typedef guint GumElfSHeaderType;
 typedef guint GumElfSymbolType;
 typedef guint GumElfSymbolBind;
 #if GLIB_SIZEOF_VOID_P == 4
 typedef Elf32_Ehdr GumElfEHeader;
-typedef Elf32_Shdr GumElfSHeader;
+typedef Elf32_Phdr GumElfPHeader;
 typedef Elf32_Dyn GumElfDynamic;
 typedef Elf32_Sym GumElfSymbol;
 # define GUM_ELF_ST_BIND(val) ELF32_ST_BIND(val)
 # define GUM_ELF_ST_TYPE(val) ELF32_ST_TYPE(val)
 #else
 typedef Elf64_Ehdr GumElfEHeader;
-typedef Elf64_Shdr GumElfSHeader;
+typedef Elf64_Phdr GumElfPHeader;
 typedef Elf64_Dyn GumElfDynamic;
 typedef Elf64_Sym GumElfSymbol;
 # define GUM_ELF_ST_BIND(val) ELF64_ST_BIND(val)
 # define GUM_ELF_ST_TYPE(val) ELF64_ST_TYPE(val)
 #endif
 
+struct _GumThreadSnapshot
+{
+  GumThreadDetails details;
+  volatile gint captured;
+};
+
+struct _GumThreadCaptureSession
+{
+  gint id;
+  GumThreadSnapshot * threads;
+  guint thread_count;
+  volatile gint pending;
+};
+
 struct _GumEnumerateImportsContext
 {
   GumFoundImportFunc func;
   gpointer user_data;
 
-  GHashTable * dependency_exports;
-  GumElfModule * current_dependency;
+  GPtrArray * dependencies;
   GumModuleMap * module_map;
 };
 
-struct _GumDependencyExport
-{
-  gchar * module;
-  GumAddress address;
-};
-
 struct _GumEnumerateModuleRangesContext
 {
   gchar * module_name;
@@ -96,14 +115,26 @@ struct _GumResolveModuleNameContext
   GumAddress base;
 };
 
+/*
+ * Parsed straight from the loaded image, so lookups never touch the file on
+ * disk. Instances are cached per module name until a module gets loaded or
+ * unloaded.
+ */
 struct _GumElfModule
 {
+  volatile gint ref_count;
+
   gchar * path;
-  gint fd;
-  gsize file_size;
-  gpointer data;
-  GumElfEHeader * ehdr;
-  gpointer address;
+  GumAddress bias;
+  const GumElfDynamic * dynamic;
+
+  const GumElfSymbol * symbols;
+  guint symbol_count;
+  const gchar * strings;
+  const guint16 * versions;
+
+  const guint32 * hash;
+  const guint32 * gnu_hash;
 };
 
 struct _GumElfDependencyDetails
@@ -135,19 +166,26 @@ struct _GumElfSymbolDetails
 #ifndef HAVE_ANDROID
 static void gum_do_modify_thread (int sig, siginfo_t * siginfo,
     void * context);
-static void gum_store_cpu_context (GumThreadId thread_id,
-    GumCpuContext * cpu_context, gpointer user_data);
+static GArray * gum_collect_threads (void);
+static gboolean gum_read_thread_state (GumThreadId thread_id,
+    GumThreadState * state);
+static gint gum_compare_thread_snapshots (const GumThreadSnapshot * a,
+    const GumThreadSnapshot * b);
+static void gum_capture_thread_contexts (GArray * threads);
+static void gum_do_capture_thread (int sig, siginfo_t * siginfo,
+    void * context);
+static GumThreadSnapshot * gum_thread_capture_session_find (
+    GumThreadCaptureSession * self, GumThreadId thread_id);
+static gboolean gum_thread_capture_session_signal (
+    GumThreadCaptureSession * self, pid_t pid, GumThreadId thread_id);
 #endif
 
 static gboolean gum_emit_import (const GumImportDetails * details,
     gpointer user_data);
-static gboolean gum_collect_dependency_exports (
-    const GumElfDependencyDetails * details, gpointer user_data);
-static gboolean gum_collect_dependency_export (const GumExportDetails * details,
+static gboolean gum_collect_dependency (const GumElfDependencyDetails * details,
     gpointer user_data);
-static GumDependencyExport * gum_dependency_export_new (const gchar * module,
-    GumAddress address);
-static void gum_dependency_export_free (GumDependencyExport * export);
+static GumAddress gum_module_find_export_by_name_using_dlsym (
+    const gchar * module_name, const gchar * symbol_name);
 static gboolean gum_emit_range_if_module_name_matches (
     const GumRangeDetails * details, gpointer user_data);
 
@@ -157,9 +195,29 @@ static gboolean gum_store_module_path_and_base_if_name_matches (
 static gboolean gum_module_path_equals (const gchar * path,
     const gchar * name_or_path);
 
-static gboolean gum_elf_module_open (GumElfModule * module,
-    const gchar * module_name);
-static void gum_elf_module_close (GumElfModule * module);
+static GumElfModule * gum_elf_module_obtain (const gchar * module_name);
+static void gum_elf_module_cache_do_deinit (void);
+static guint64 gum_query_module_generation (void);
+#ifndef HAVE_ANDROID
+static int gum_store_module_generation (struct dl_phdr_info * info,
+    size_t size, void * data);
+#endif
+static GumElfModule * gum_elf_module_new (const gchar * module_name);
+static GumElfModule * gum_elf_module_ref (GumElfModule * self);
+static void gum_elf_module_unref (GumElfModule * self);
+static gboolean gum_elf_module_locate_dynamic (const gchar * module_name,
+    gchar ** path, GumAddress * bias, const GumElfDynamic ** dynamic);
+static gpointer gum_elf_module_resolve_dynamic_address (GumElfModule * self,
+    GumAddress address);
+static guint gum_elf_module_count_symbols (GumElfModule * self);
+static const GumElfSymbol * gum_elf_module_find_symbol (GumElfModule * self,
+    const gchar * name);
+static const GumElfSymbol * gum_elf_module_find_symbol_using_gnu_hash (
+    GumElfModule * self, const gchar * name);
+static const GumElfSymbol * gum_elf_module_find_symbol_using_hash (
+    GumElfModule * self, const gchar * name);
+static gboolean gum_elf_module_symbol_is_export (GumElfModule * self,
+    const GumElfSymbol * sym);
 static void gum_elf_module_enumerate_dependencies (GumElfModule * self,
     GumElfFoundDependencyFunc func, gpointer user_data);
 static void gum_elf_module_enumerate_imports (GumElfModule * self,
@@ -172,8 +230,6 @@ static gboolean gum_emit_elf_export (const GumElfSymbolDetails * details,
     gpointer user_data);
 static void gum_elf_module_enumerate_dynamic_symbols (GumElfModule * self,
     GumElfFoundSymbolFunc func, gpointer user_data);
-static GumElfSHeader * gum_elf_module_find_section_header (GumElfModule * self,
-    GumElfSHeaderType type);
 
 #ifndef HAVE_ANDROID
 static GumThreadState gum_thread_state_from_proc_status_character (gchar c);
@@ -187,8 +243,16 @@ static volatile gboolean gum_modify_thread_did_load_cpu_context;
 static volatile gboolean gum_modify_thread_did_modify_cpu_context;
 static volatile gboolean gum_modify_thread_did_store_cpu_context;
 static GumCpuContext gum_modify_thread_cpu_context;
+
+static GumThreadCaptureSession * volatile gum_capture_session = NULL;
+static gint gum_capture_next_session_id = 1;
+static volatile gint gum_capture_active_handlers = 0;
 #endif
 
+G_LOCK_DEFINE_STATIC (gum_elf_module_cache);
+static GHashTable * gum_elf_module_cache = NULL;
+static guint64 gum_elf_module_cache_generation = GUM_MODULE_GENERATION_UNKNOWN;
+
 gboolean
 gum_process_is_debugger_attached (void)
 {
@@ -299,52 +363,294 @@ gum_do_modify_thread (int sig,
 void
 gum_process_enumerate_threads (GumFoundThreadFunc func,
                                gpointer user_data)
+{
+  gum_process_enumerate_threads_full (GUM_THREAD_FLAGS_CPU_CONTEXT, func,
+      user_data);
+}
+
+void
+gum_process_enumerate_threads_full (GumThreadFlags flags,
+                                    GumFoundThreadFunc func,
+                                    gpointer user_data)
 {
 #ifndef HAVE_ANDROID
+  gboolean want_cpu_context;
+  GArray * threads;
+  guint i;
+  gboolean carry_on = TRUE;
+
+  want_cpu_context = (flags & GUM_THREAD_FLAGS_CPU_CONTEXT) != 0;
+
+  threads = gum_collect_threads ();
+
+  if (want_cpu_context)
+    gum_capture_thread_contexts (threads);
+
+  for (i = 0; carry_on && i != threads->len; i++)
+  {
+    GumThreadSnapshot * thread;
+
+    thread = &g_array_index (threads, GumThreadSnapshot, i);
+    if (want_cpu_context && !thread->captured)
+      continue;
+
+    carry_on = func (&thread->details, user_data);
+  }
+
+  g_array_free (threads, TRUE);
+#endif
+}
+
+#ifndef HAVE_ANDROID
+
+static GArray *
+gum_collect_threads (void)
+{
+  GArray * threads;
   GDir * dir;
   const gchar * name;
-  gboolean carry_on = TRUE;
+
+  threads = g_array_new (FALSE, TRUE, sizeof (GumThreadSnapshot));
 
   dir = g_dir_open ("/proc/self/task", 0, NULL);
   g_assert (dir != NULL);
 
-  while (carry_on && (name = g_dir_read_name (dir)) != NULL)
+  while ((name = g_dir_read_name (dir)) != NULL)
+  {
+    GumThreadSnapshot * thread;
+
+    g_array_set_size (threads, threads->len + 1);
+    thread = &g_array_index (threads, GumThreadSnapshot, threads->len - 1);
+
+    thread->details.id = atoi (name);
+    if (!gum_read_thread_state (thread->details.id, &thread->details.state))
+      g_array_set_size (threads, threads->len - 1);
+  }
+
+  g_dir_close (dir);
+
+  g_array_sort (threads, (GCompareFunc) gum_compare_thread_snapshots);
+
+  return threads;
+}
+
+static gboolean
+gum_read_thread_state (GumThreadId thread_id,
+                       GumThreadState * state)
+{
+  gchar path[64], buf[512];
+  gint fd;
+  gssize n;
+  gchar * p;
+
+  g_snprintf (path, sizeof (path), "/proc/self/task/%" G_GSIZE_FORMAT "/stat",
+      thread_id);
+
+  fd = open (path, O_RDONLY);
+  if (fd == -1)
+    return FALSE;
+  n = read (fd, buf, sizeof (buf) - 1);
+  close (fd);
+  if (n <= 0)
+    return FALSE;
+  buf[n] = '\0';
+
+  p = strrchr (buf, ')');
+  if (p == NULL || p[1] != ' ' || p[2] == '\0')
+    return FALSE;
+
+  *state = gum_thread_state_from_proc_status_character (p[2]);
+
+  return TRUE;
+}
+
+static gint
+gum_compare_thread_snapshots (const GumThreadSnapshot * a,
+                              const GumThreadSnapshot * b)
+{
+  if (a->details.id < b->details.id)
+    return -1;
+  else if (a->details.id > b->details.id)
+    return 1;
+  else
+    return 0;
+}
+
+/*
+ * Signals every thread up front and lets each one store its own context and
+ * carry on, instead of rendezvousing with one thread at a time. Threads that
+ * don't respond before the timeout are left out of the results.
+ *
+ * Each signal carries the id of the session that sent it, so one that is only
+ * handled after its session has ended is recognized as stale and ignored.
+ */
+static void
+gum_capture_thread_contexts (GArray * threads)
+{
+  GumThreadCaptureSession session;
+  GumThreadId self_id;
+  pid_t pid;
+  struct sigaction action, old_action;
+  guint i;
+  gint64 deadline;
+  gint pending;
+
+  session.threads = (GumThreadSnapshot *) threads->data;
+  session.thread_count = threads->len;
+
+  self_id = gum_process_get_current_thread_id ();
+  pid = getpid ();
+
+  G_LOCK (gum_modify_thread);
+
+  session.id = gum_capture_next_session_id++;
+  session.pending = session.thread_count;
+  if (gum_thread_capture_session_find (&session, self_id) != NULL)
+    session.pending--;
+
+  action.sa_sigaction = gum_do_capture_thread;
+  sigemptyset (&action.sa_mask);
+  action.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigaction (GUM_HIJACK_SIGNAL, &action, &old_action);
+
+  g_atomic_pointer_set (&gum_capture_session, &session);
+
+  for (i = 0; i != session.thread_count; i++)
   {
-    gchar * path, * info = NULL;
+    GumThreadSnapshot * thread = &session.threads[i];
 
-    path = g_strconcat ("/proc/self/task/", name, "/stat", NULL);
-    if (g_file_get_contents (path, &info, NULL, NULL))
+    if (thread->details.id == self_id)
     {
-      gchar * state;
-      GumThreadDetails details;
+      ucontext_t uc;
+
+      getcontext (&uc);
+      gum_linux_parse_ucontext (&uc, &thread->details.cpu_context);
+      thread->captured = TRUE;
+
+      continue;
+    }
+
+    if (!gum_thread_capture_session_signal (&session, pid, thread->details.id))
+      g_atomic_int_dec_and_test (&session.pending);
+  }
+
+  deadline = g_get_monotonic_time () + GUM_THREAD_CAPTURE_TIMEOUT;
+  while ((pending = g_atomic_int_get (&session.pending)) != 0)
+  {
+    gint64 remaining;
+    struct timespec timeout;
 
-      state = strrchr (info, ')') + 2;
+    remaining = deadline - g_get_monotonic_time ();
+    if (remaining <= 0)
+      break;
+    timeout.tv_sec = remaining / G_USEC_PER_SEC;
+    timeout.tv_nsec = (remaining % G_USEC_PER_SEC) * 1000;
+
+    syscall (__NR_futex, &session.pending, FUTEX_WAIT_PRIVATE, pending,
+        &timeout, NULL, 0);
+  }
+
+  g_atomic_pointer_set (&gum_capture_session, NULL);
+  while (g_atomic_int_get (&gum_capture_active_handlers) != 0)
+    g_thread_yield ();
+
+  /*
+   * Ignoring the signal discards any that stragglers have yet to handle, so
+   * restoring the previous action can't have them take down the process.
+   */
+  if (g_atomic_int_get (&session.pending) != 0)
+  {
+    struct sigaction ignore_action;
 
-      details.id = atoi (name);
-      details.state = gum_thread_state_from_proc_status_character (*state);
-      if (gum_process_modify_thread (details.id, gum_store_cpu_context,
-            &details.cpu_context))
+    ignore_action.sa_handler = SIG_IGN;
+    sigemptyset (&ignore_action.sa_mask);
+    ignore_action.sa_flags = 0;
+    sigaction (GUM_HIJACK_SIGNAL, &ignore_action, NULL);
+  }
+  sigaction (GUM_HIJACK_SIGNAL, &old_action, NULL);
+
+  G_UNLOCK (gum_modify_thread);
+}
+
+static void
+gum_do_capture_thread (int sig,
+                       siginfo_t * siginfo,
+                       void * context)
+{
+  gint old_errno = errno;
+  GumThreadCaptureSession * session;
+
+  g_atomic_int_inc (&gum_capture_active_handlers);
+
+  session = g_atomic_pointer_get (&gum_capture_session);
+  if (session != NULL && siginfo->si_code == SI_QUEUE &&
+      siginfo->si_value.sival_int == session->id)
+  {
+    GumThreadSnapshot * thread;
+
+    thread = gum_thread_capture_session_find (session,
+        syscall (__NR_gettid));
+    if (thread != NULL && !g_atomic_int_get (&thread->captured))
+    {
+      gum_linux_parse_ucontext ((ucontext_t *) context,
+          &thread->details.cpu_context);
+      g_atomic_int_set (&thread->captured, TRUE);
+
+      if (g_atomic_int_dec_and_test (&session->pending))
       {
-        carry_on = func (&details, user_data);
+        syscall (__NR_futex, &session->pending, FUTEX_WAKE_PRIVATE, 1, NULL,
+            NULL, 0);
       }
     }
+  }
 
-    g_free (info);
-    g_free (path);
+  g_atomic_int_dec_and_test (&gum_capture_active_handlers);
+
+  errno = old_errno;
+}
+
+static GumThreadSnapshot *
+gum_thread_capture_session_find (GumThreadCaptureSession * self,
+                                 GumThreadId thread_id)
+{
+  guint lower, upper;
+
+  lower = 0;
+  upper = self->thread_count;
+  while (lower != upper)
+  {
+    guint mid = lower + ((upper - lower) / 2);
+    GumThreadSnapshot * thread = &self->threads[mid];
+
+    if (thread->details.id == thread_id)
+      return thread;
+    else if (thread->details.id < thread_id)
+      lower = mid + 1;
+    else
+      upper = mid;
   }
 
-  g_dir_close (dir);
-#endif
+  return NULL;
 }
 
-#ifndef HAVE_ANDROID
-static void
-gum_store_cpu_context (GumThreadId thread_id,
-                       GumCpuContext * cpu_context,
-                       gpointer user_data)
+static gboolean
+gum_thread_capture_session_signal (GumThreadCaptureSession * self,
+                                   pid_t pid,
+                                   GumThreadId thread_id)
 {
-  memcpy (user_data, cpu_context, sizeof (GumCpuContext));
+  siginfo_t info;
+
+  memset (&info, 0, sizeof (info));
+  info.si_signo = GUM_HIJACK_SIGNAL;
+  info.si_code = SI_QUEUE;
+  info.si_pid = pid;
+  info.si_uid = getuid ();
+  info.si_value.sival_int = self->id;
+
+  return syscall (SYS_rt_tgsigqueueinfo, pid, thread_id, GUM_HIJACK_SIGNAL,
+      &info) == 0;
 }
+
 #endif
 
 void
@@ -517,30 +823,29 @@ gum_module_enumerate_imports (const gchar * module_name,
                               GumFoundImportFunc func,
                               gpointer user_data)
 {
-  GumElfModule module;
+  GumElfModule * module;
   GumEnumerateImportsContext ctx;
 
-  if (!gum_elf_module_open (&module, module_name))
+  module = gum_elf_module_obtain (module_name);
+  if (module == NULL)
     return;
 
   ctx.func = func;
   ctx.user_data = user_data;
 
-  ctx.dependency_exports = g_hash_table_new_full (g_str_hash, g_str_equal,
-      g_free, (GDestroyNotify) gum_dependency_export_free);
-  ctx.current_dependency = NULL;
+  ctx.dependencies = g_ptr_array_new_with_free_func (
+      (GDestroyNotify) gum_elf_module_unref);
   ctx.module_map = NULL;
 
-  gum_elf_module_enumerate_dependencies (&module,
-      gum_collect_dependency_exports, &ctx);
+  gum_elf_module_enumerate_dependencies (module, gum_collect_dependency, &ctx);
 
-  gum_elf_module_enumerate_imports (&module, gum_emit_import, &ctx);
+  gum_elf_module_enumerate_imports (module, gum_emit_import, &ctx);
 
   if (ctx.module_map != NULL)
     g_object_unref (ctx.module_map);
-  g_hash_table_unref (ctx.dependency_exports);
+  g_ptr_array_unref (ctx.dependencies);
 
-  gum_elf_module_close (&module);
+  gum_elf_module_unref (module);
 }
 
 static gboolean
@@ -549,20 +854,29 @@ gum_emit_import (const GumImportDetails * details,
 {
   GumEnumerateImportsContext * ctx = user_data;
   GumImportDetails d;
-  GumDependencyExport * exp;
+  guint i;
 
   d.type = details->type;
   d.name = details->name;
+  d.module = NULL;
+  d.address = 0;
 
-  exp = g_hash_table_lookup (ctx->dependency_exports, details->name);
-  if (exp != NULL)
+  for (i = 0; i != ctx->dependencies->len; i++)
   {
-    d.module = exp->module;
-    d.address = exp->address;
+    GumElfModule * dependency = g_ptr_array_index (ctx->dependencies, i);
+    const GumElfSymbol * sym;
+
+    sym = gum_elf_module_find_symbol (dependency, details->name);
+    if (sym != NULL && gum_elf_module_symbol_is_export (dependency, sym))
+    {
+      d.module = dependency->path;
+      d.address = dependency->bias + sym->st_value;
+      break;
+    }
   }
-  else
+
+  if (d.module == NULL)
   {
-    d.module = NULL;
     d.address = GUM_ADDRESS (dlsym (RTLD_DEFAULT, details->name));
 
     if (d.address != 0)
@@ -581,68 +895,31 @@ gum_emit_import (const GumImportDetails * details,
 }
 
 static gboolean
-gum_collect_dependency_exports (const GumElfDependencyDetails * details,
-                                gpointer user_data)
+gum_collect_dependency (const GumElfDependencyDetails * details,
+                        gpointer user_data)
 {
   GumEnumerateImportsContext * ctx = user_data;
-  GumElfModule module;
+  GumElfModule * module;
 
-  if (!gum_elf_module_open (&module, details->name))
-    return TRUE;
-  ctx->current_dependency = &module;
-  gum_elf_module_enumerate_exports (&module, gum_collect_dependency_export,
-      ctx);
-  ctx->current_dependency = NULL;
-  gum_elf_module_close (&module);
-
-  return TRUE;
-}
-
-static gboolean
-gum_collect_dependency_export (const GumExportDetails * details,
-                               gpointer user_data)
-{
-  GumEnumerateImportsContext * ctx = user_data;
-  GumElfModule * module = ctx->current_dependency;
-
-  g_hash_table_insert (ctx->dependency_exports,
-      g_strdup (details->name),
-      gum_dependency_export_new (module->path, details->address));
+  module = gum_elf_module_obtain (details->name);
+  if (module != NULL)
+    g_ptr_array_add (ctx->dependencies, module);
 
   return TRUE;
 }
 
-static GumDependencyExport *
-gum_dependency_export_new (const gchar * module,
-                           GumAddress address)
-{
-  GumDependencyExport * export;
-
-  export = g_slice_new (GumDependencyExport);
-  export->module = g_strdup (module);
-  export->address = address;
-
-  return export;
-}
-
-static void
-gum_dependency_export_free (GumDependencyExport * export)
-{
-  g_free (export->module);
-  g_slice_free (GumDependencyExport, export);
-}
-
 void
 gum_module_enumerate_exports (const gchar * module_name,
                               GumFoundExportFunc func,
                               gpointer user_data)
 {
-  GumElfModule module;
+  GumElfModule * module;
 
-  if (!gum_elf_module_open (&module, module_name))
+  module = gum_elf_module_obtain (module_name);
+  if (module == NULL)
     return;
-  gum_elf_module_enumerate_exports (&module, func, user_data);
-  gum_elf_module_close (&module);
+  gum_elf_module_enumerate_exports (module, func, user_data);
+  gum_elf_module_unref (module);
 }
 
 void
@@ -696,32 +973,55 @@ gum_module_find_base_address (const gchar * module_name)
 GumAddress
 gum_module_find_export_by_name (const gchar * module_name,
                                 const gchar * symbol_name)
+{
+  GumAddress result = 0;
+  GumElfModule * module;
+  const GumElfSymbol * sym;
+
+  if (module_name == NULL)
+    return GUM_ADDRESS (dlsym (RTLD_DEFAULT, symbol_name));
+
+  module = gum_elf_module_obtain (module_name);
+  if (module == NULL)
+    return 0;
+
+  sym = gum_elf_module_find_symbol (module, symbol_name);
+  if (sym != NULL && gum_elf_module_symbol_is_export (module, sym))
+    result = module->bias + sym->st_value;
+
+  gum_elf_module_unref (module);
+
+  /*
+   * Anything our own lookup can't answer, like IFUNCs and symbols that come
+   * from the module's dependencies, is left to the dynamic linker.
+   */
+  if (result == 0)
+    result = gum_module_find_export_by_name_using_dlsym (module_name,
+        symbol_name);
+
+  return result;
+}
+
+static GumAddress
+gum_module_find_export_by_name_using_dlsym (const gchar * module_name,
+                                            const gchar * symbol_name)
 {
   GumAddress result;
+  gchar * name;
   void * module;
 
-  if (module_name != NULL)
-  {
-    gchar * name;
-
-    name = gum_resolve_module_name (module_name, NULL);
-    if (name == NULL)
-      return 0;
-    module = dlopen (name, RTLD_LAZY | RTLD_GLOBAL);
-    g_free (name);
+  name = gum_resolve_module_name (module_name, NULL);
+  if (name == NULL)
+    return 0;
+  module = dlopen (name, RTLD_LAZY | RTLD_GLOBAL);
+  g_free (name);
 
-    if (module == NULL)
-      return 0;
-  }
-  else
-  {
-    module = RTLD_DEFAULT;
-  }
+  if (module == NULL)
+    return 0;
 
   result = GUM_ADDRESS (dlsym (module, symbol_name));
 
-  if (module != RTLD_DEFAULT)
-    dlclose (module);
+  dlclose (module);
 
   return result;
 }
@@ -896,58 +1196,377 @@ gum_module_path_equals (const gchar * path,
   return strcmp (name_or_path, path) == 0;
 }
 
+static GumElfModule *
+gum_elf_module_obtain (const gchar * module_name)
+{
+  GumElfModule * module;
+  guint64 generation;
+
+  generation = gum_query_module_generation ();
+
+  G_LOCK (gum_elf_module_cache);
+
+  if (gum_elf_module_cache == NULL)
+  {
+    gum_elf_module_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, (GDestroyNotify) gum_elf_module_unref);
+
+    _gum_register_destructor (gum_elf_module_cache_do_deinit);
+  }
+
+  if (generation != gum_elf_module_cache_generation ||
+      generation == GUM_MODULE_GENERATION_UNKNOWN)
+  {
+    g_hash_table_remove_all (gum_elf_module_cache);
+    gum_elf_module_cache_generation = generation;
+  }
+
+  module = g_hash_table_lookup (gum_elf_module_cache, module_name);
+  if (module == NULL)
+  {
+    module = gum_elf_module_new (module_name);
+    if (module != NULL)
+    {
+      g_hash_table_insert (gum_elf_module_cache, g_strdup (module_name),
+          module);
+    }
+  }
+
+  if (module != NULL)
+    gum_elf_module_ref (module);
+
+  G_UNLOCK (gum_elf_module_cache);
+
+  return module;
+}
+
+static void
+gum_elf_module_cache_do_deinit (void)
+{
+  g_hash_table_unref (gum_elf_module_cache);
+  gum_elf_module_cache = NULL;
+}
+
+static guint64
+gum_query_module_generation (void)
+{
+  guint64 generation = GUM_MODULE_GENERATION_UNKNOWN;
+
+#ifndef HAVE_ANDROID
+  dl_iterate_phdr (gum_store_module_generation, &generation);
+#endif
+
+  return generation;
+}
+
+#ifndef HAVE_ANDROID
+
+static int
+gum_store_module_generation (struct dl_phdr_info * info,
+                             size_t size,
+                             void * data)
+{
+  guint64 * generation = data;
+
+  if (size >= G_STRUCT_OFFSET (struct dl_phdr_info, dlpi_subs) +
+      sizeof (info->dlpi_subs))
+  {
+    *generation = info->dlpi_adds + info->dlpi_subs;
+  }
+
+  return 1;
+}
+
+#endif
+
+static GumElfModule *
+gum_elf_module_new (const gchar * module_name)
+{
+  GumElfModule * module;
+  gchar * path;
+  GumAddress bias;
+  const GumElfDynamic * dynamic, * entry;
+
+  if (!gum_elf_module_locate_dynamic (module_name, &path, &bias, &dynamic))
+    return NULL;
+
+  module = g_slice_new0 (GumElfModule);
+  module->ref_count = 1;
+  module->path = path;
+  module->bias = bias;
+  module->dynamic = dynamic;
+
+  for (entry = dynamic; entry->d_tag != DT_NULL; entry++)
+  {
+    switch (entry->d_tag)
+    {
+      case DT_SYMTAB:
+        module->symbols = gum_elf_module_resolve_dynamic_address (module,
+            entry->d_un.d_ptr);
+        break;
+      case DT_STRTAB:
+        module->strings = gum_elf_module_resolve_dynamic_address (module,
+            entry->d_un.d_ptr);
+        break;
+      case DT_VERSYM:
+        module->versions = gum_elf_module_resolve_dynamic_address (module,
+            entry->d_un.d_ptr);
+        break;
+      case DT_HASH:
+        module->hash = gum_elf_module_resolve_dynamic_address (module,
+            entry->d_un.d_ptr);
+        break;
+      case DT_GNU_HASH:
+        module->gnu_hash = gum_elf_module_resolve_dynamic_address (module,
+            entry->d_un.d_ptr);
+        break;
+      default:
+        break;
+    }
+  }
+
+  module->symbol_count = gum_elf_module_count_symbols (module);
+
+  return module;
+}
+
+static GumElfModule *
+gum_elf_module_ref (GumElfModule * self)
+{
+  g_atomic_int_inc (&self->ref_count);
+
+  return self;
+}
+
+static void
+gum_elf_module_unref (GumElfModule * self)
+{
+  if (!g_atomic_int_dec_and_test (&self->ref_count))
+    return;
+
+  g_free (self->path);
+
+  g_slice_free (GumElfModule, self);
+}
+
 static gboolean
-gum_elf_module_open (GumElfModule * module,
-                     const gchar * module_name)
+gum_elf_module_locate_dynamic (const gchar * module_name,
+                               gchar ** path,
+                               GumAddress * bias,
+                               const GumElfDynamic ** dynamic)
 {
-  gboolean success = FALSE;
   GumAddress base;
-  guint type;
-
-  module->fd = -1;
-  module->file_size = 0;
-  module->data = NULL;
-  module->ehdr = NULL;
-  module->address = 0;
-  module->path = gum_resolve_module_name (module_name, &base);
-  if (module->path == NULL)
-    goto beach;
-  module->address = GSIZE_TO_POINTER (base);
+  const GumElfEHeader * ehdr;
+  const GumElfPHeader * load = NULL, * dyn = NULL;
+  guint i;
 
-  module->fd = open (module->path, O_RDONLY);
-  if (module->fd == -1)
-    goto beach;
+  *path = gum_resolve_module_name (module_name, &base);
+  if (*path == NULL)
+    return FALSE;
 
-  module->file_size = lseek (module->fd, 0, SEEK_END);
-  lseek (module->fd, 0, SEEK_SET);
+  ehdr = GSIZE_TO_POINTER (base);
+  if (ehdr->e_type != ET_EXEC && ehdr->e_type != ET_DYN)
+    goto not_dynamic;
 
-  module->data = mmap (NULL, module->file_size, PROT_READ, MAP_PRIVATE,
-      module->fd, 0);
-  g_assert (module->data != MAP_FAILED);
+  for (i = 0; i != ehdr->e_phnum; i++)
+  {
+    const GumElfPHeader * phdr;
 
-  module->ehdr = module->data;
-  type = module->ehdr->e_type;
-  if (type != ET_EXEC && type != ET_DYN)
-    goto beach;
-  success = TRUE;
+    phdr = GSIZE_TO_POINTER (base + ehdr->e_phoff + (i * ehdr->e_phentsize));
+    if (phdr->p_type == PT_LOAD && load == NULL)
+      load = phdr;
+    else if (phdr->p_type == PT_DYNAMIC)
+      dyn = phdr;
+  }
 
-beach:
-  if (!success)
-    gum_elf_module_close (module);
+  if (load == NULL || dyn == NULL)
+    goto not_dynamic;
 
-  return success;
+  /* the first mapping holds the ELF header, so it's the first PT_LOAD */
+  *bias = base - (load->p_vaddr & ~((GumAddress) gum_query_page_size () - 1));
+  *dynamic = GSIZE_TO_POINTER (*bias + dyn->p_vaddr);
+
+  return TRUE;
+
+not_dynamic:
+  {
+    g_free (*path);
+    *path = NULL;
+
+    return FALSE;
+  }
 }
 
-static void
-gum_elf_module_close (GumElfModule * module)
+static gpointer
+gum_elf_module_resolve_dynamic_address (GumElfModule * self,
+                                        GumAddress address)
+{
+  /* glibc relocates these entries in place, other dynamic linkers don't */
+  if (address < self->bias)
+    address += self->bias;
+
+  return GSIZE_TO_POINTER (address);
+}
+
+static guint
+gum_elf_module_count_symbols (GumElfModule * self)
+{
+  const guint32 * gnu_hash = self->gnu_hash;
+  guint32 bucket_count, symbol_offset, bloom_size, max_index, i;
+  const guint32 * buckets, * chain;
+
+  if (self->symbols == NULL || self->strings == NULL)
+    return 0;
+
+  if (self->hash != NULL)
+    return self->hash[1];
+
+  if (gnu_hash == NULL)
+    return 0;
+
+  /*
+   * DT_GNU_HASH doesn't record the number of symbols, so find the highest
+   * index any bucket points to and follow its chain to the end.
+   */
+  bucket_count = gnu_hash[0];
+  symbol_offset = gnu_hash[1];
+  bloom_size = gnu_hash[2];
+  buckets = (const guint32 *) ((const gsize *) (gnu_hash + 4) + bloom_size);
+  chain = buckets + bucket_count;
+
+  max_index = 0;
+  for (i = 0; i != bucket_count; i++)
+    max_index = MAX (max_index, buckets[i]);
+  if (max_index < symbol_offset)
+    return symbol_offset;
+
+  while ((chain[max_index - symbol_offset] & 1) == 0)
+    max_index++;
+
+  return max_index + 1;
+}
+
+static const GumElfSymbol *
+gum_elf_module_find_symbol (GumElfModule * self,
+                            const gchar * name)
+{
+  if (self->symbol_count == 0)
+    return NULL;
+
+  if (self->gnu_hash != NULL)
+    return gum_elf_module_find_symbol_using_gnu_hash (self, name);
+  else if (self->hash != NULL)
+    return gum_elf_module_find_symbol_using_hash (self, name);
+
+  return NULL;
+}
+
+static const GumElfSymbol *
+gum_elf_module_find_symbol_using_gnu_hash (GumElfModule * self,
+                                           const gchar * name)
 {
-  if (module->data != NULL)
-    munmap (module->data, module->file_size);
+  const guint32 * gnu_hash = self->gnu_hash;
+  guint32 bucket_count, symbol_offset, bloom_size, bloom_shift;
+  const gsize * bloom;
+  const guint32 * buckets, * chain;
+  const guint bloom_bits = GLIB_SIZEOF_SIZE_T * 8;
+  guint32 h1, h2, i;
+  const guchar * p;
+  gsize word, mask;
+
+  bucket_count = gnu_hash[0];
+  symbol_offset = gnu_hash[1];
+  bloom_size = gnu_hash[2];
+  bloom_shift = gnu_hash[3];
+  bloom = (const gsize *) (gnu_hash + 4);
+  buckets = (const guint32 *) (bloom + bloom_size);
+  chain = buckets + bucket_count;
+
+  h1 = 5381;
+  for (p = (const guchar *) name; *p != '\0'; p++)
+    h1 = (h1 << 5) + h1 + *p;
+
+  word = bloom[(h1 / bloom_bits) % bloom_size];
+  mask = ((gsize) 1 << (h1 % bloom_bits)) |
+      ((gsize) 1 << ((h1 >> bloom_shift) % bloom_bits));
+  if ((word & mask) != mask)
+    return NULL;
+
+  i = buckets[h1 % bucket_count];
+  if (i < symbol_offset)
+    return NULL;
+
+  do
+  {
+    const GumElfSymbol * sym = &self->symbols[i];
+
+    h2 = chain[i - symbol_offset];
+    if ((h1 | 1) == (h2 | 1) &&
+        sym->st_shndx != SHN_UNDEF &&
+        (self->versions == NULL ||
+            (self->versions[i] & GUM_ELF_VERSYM_HIDDEN) == 0) &&
+        strcmp (self->strings + sym->st_name, name) == 0)
+    {
+      return sym;
+    }
 
-  if (module->fd != -1)
-    close (module->fd);
+    i++;
+  }
+  while ((h2 & 1) == 0);
 
-  g_free (module->path);
+  return NULL;
+}
+
+static const GumElfSymbol *
+gum_elf_module_find_symbol_using_hash (GumElfModule * self,
+                                       const gchar * name)
+{
+  const guint32 * hash = self->hash;
+  guint32 bucket_count, h, g, i;
+  const guint32 * buckets, * chain;
+  const guchar * p;
+
+  bucket_count = hash[0];
+  buckets = hash + 2;
+  chain = buckets + bucket_count;
+
+  h = 0;
+  for (p = (const guchar *) name; *p != '\0'; p++)
+  {
+    h = (h << 4) + *p;
+    g = h & 0xf0000000;
+    if (g != 0)
+      h ^= g >> 24;
+    h &= ~g;
+  }
+
+  for (i = buckets[h % bucket_count]; i != STN_UNDEF; i = chain[i])
+  {
+    const GumElfSymbol * sym = &self->symbols[i];
+
+    if (sym->st_shndx != SHN_UNDEF &&
+        (self->versions == NULL ||
+            (self->versions[i] & GUM_ELF_VERSYM_HIDDEN) == 0) &&
+        strcmp (self->strings + sym->st_name, name) == 0)
+    {
+      return sym;
+    }
+  }
+
+  return NULL;
+}
+
+static gboolean
+gum_elf_module_symbol_is_export (GumElfModule * self,
+                                 const GumElfSymbol * sym)
+{
+  GumElfSymbolType type = GUM_ELF_ST_TYPE (sym->st_info);
+  GumElfSymbolBind bind = GUM_ELF_ST_BIND (sym->st_info);
+
+  (void) self;
+
+  return (type == STT_FUNC || type == STT_OBJECT) &&
+      (bind == STB_GLOBAL || bind == STB_WEAK);
 }
 
 static void
@@ -955,30 +1574,20 @@ gum_elf_module_enumerate_dependencies (GumElfModule * self,
                                        GumElfFoundDependencyFunc func,
                                        gpointer user_data)
 {
-  gpointer data = self->data;
-  GumElfEHeader * ehdr = self->ehdr;
-  GumElfSHeader * dyn, * strtab_header;
-  const gchar * strtab;
+  const GumElfDynamic * entry;
   gboolean carry_on;
-  guint i;
 
-  dyn = gum_elf_module_find_section_header (self, SHT_DYNAMIC);
-  if (dyn == NULL)
+  if (self->strings == NULL)
     return;
-  strtab_header = data + ehdr->e_shoff + (dyn->sh_link * ehdr->e_shentsize);
-  strtab = data + strtab_header->sh_offset;
 
   carry_on = TRUE;
-  for (i = 0; i != dyn->sh_size / dyn->sh_entsize && carry_on; i++)
+  for (entry = self->dynamic; entry->d_tag != DT_NULL && carry_on; entry++)
   {
-    GumElfDynamic * entry;
-
-    entry = data + dyn->sh_offset + (i * dyn->sh_entsize);
     if (entry->d_tag == DT_NEEDED)
     {
       GumElfDependencyDetails details;
 
-      details.name = strtab + entry->d_un.d_val;
+      details.name = self->strings + entry->d_un.d_val;
       carry_on = func (&details, user_data);
     }
   }
@@ -1065,29 +1674,21 @@ gum_elf_module_enumerate_dynamic_symbols (GumElfModule * self,
                                           GumElfFoundSymbolFunc func,
                                           gpointer user_data)
 {
-  gpointer data = self->data;
-  GumElfEHeader * ehdr = self->ehdr;
-  GumElfSHeader * dynsym, * strtab_header;
-  const gchar * strtab;
   gboolean carry_on;
   guint i;
 
-  dynsym = gum_elf_module_find_section_header (self, SHT_DYNSYM);
-  if (dynsym == NULL)
-    return;
-  strtab_header = data + ehdr->e_shoff + (dynsym->sh_link * ehdr->e_shentsize);
-  strtab = data + strtab_header->sh_offset;
-
   carry_on = TRUE;
-  for (i = 0; i != dynsym->sh_size / dynsym->sh_entsize && carry_on; i++)
+  for (i = 0; i != self->symbol_count && carry_on; i++)
   {
-    GumElfSymbol * sym;
+    const GumElfSymbol * sym = &self->symbols[i];
     GumElfSymbolDetails details;
 
-    sym = data + dynsym->sh_offset + (i * dynsym->sh_entsize);
+    if (sym->st_shndx != SHN_UNDEF && self->versions != NULL &&
+        (self->versions[i] & GUM_ELF_VERSYM_HIDDEN) != 0)
+      continue;
 
-    details.name = strtab + sym->st_name;
-    details.address = GUM_ADDRESS (self->address + sym->st_value);
+    details.name = self->strings + sym->st_name;
+    details.address = self->bias + sym->st_value;
     details.type = GUM_ELF_ST_TYPE (sym->st_info);
     details.bind = GUM_ELF_ST_BIND (sym->st_info);
     details.section_header_index = sym->st_shndx;
@@ -1096,25 +1697,6 @@ gum_elf_module_enumerate_dynamic_symbols (GumElfModule * self,
   }
 }
 
-static GumElfSHeader *
-gum_elf_module_find_section_header (GumElfModule * self,
-                                    GumElfSHeaderType type)
-{
-  GumElfEHeader * ehdr = self->ehdr;
-  guint i;
-
-  for (i = 0; i != ehdr->e_shnum; i++)
-  {
-    GumElfSHeader * shdr;
-
-    shdr = self->data + ehdr->e_shoff + (i * ehdr->e_shentsize);
-    if (shdr->sh_type == type)
-      return shdr;
-  }
-
-  return NULL;
-}
-
 void
 gum_linux_parse_ucontext (const ucontext_t * uc,
                           GumCpuContext * ctx)
@@ -9,6 +9,9 @@
 #include "gummemory-priv.h"
 
 #include "gumprocess.h"
+#ifdef HAVE_LINUX
+# include "gumlinux.h"
+#endif
 
 #include <unistd.h>
 #include <sys/mman.h>
@@ -141,6 +144,10 @@ gum_free_pages (gpointer mem)
 
   result = munmap (start, size);
   g_assert_cmpint (result, ==, 0);
+
+#ifdef HAVE_LINUX
+  gum_linux_invalidate_maps_cache ();
+#endif
 }
 
 static void
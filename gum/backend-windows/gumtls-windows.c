@@ -8,11 +8,39 @@
 #include "gumprocess.h"
 #include "gumspinlock.h"
 #include "gumtls.h"
+#include "gumtls-priv.h"
 
 #ifndef WIN32_LEAN_AND_MEAN
 # define WIN32_LEAN_AND_MEAN
 #endif
 #include <windows.h>
+#include <string.h>
+
+#define GUM_TLS_MAX_KEYS        1088
+#define GUM_TLS_MAX_DESTRUCTORS 8
+
+typedef struct _GumTlsDestructor GumTlsDestructor;
+
+struct _GumTlsDestructor
+{
+  GumTlsKey key;
+  GDestroyNotify destroy;
+};
+
+static void gum_tls_key_arm_destructor (GumTlsKey key, gpointer value);
+static void WINAPI gum_tls_on_thread_exit (PVOID data);
+
+/*
+ * TLS slots have no exit callbacks, so keys with a destructor are tracked
+ * here, and a thread that stores a value in one of them gets a marker in a
+ * fiber-local slot, whose callback runs the destructors when it exits. The
+ * slot is never freed, as FlsFree() would run the callback on the calling
+ * thread for every thread holding a marker.
+ */
+static GumSpinlock gum_tls_destructors_lock;
+static GumTlsDestructor gum_tls_destructors[GUM_TLS_MAX_DESTRUCTORS];
+static volatile guint32 gum_tls_destructor_keys[GUM_TLS_MAX_KEYS / 32];
+static DWORD gum_tls_exit_index = FLS_OUT_OF_INDEXES;
 
 #if defined (HAVE_I386)
 
@@ -47,12 +75,114 @@ gum_tls_key_new (void)
   return res;
 }
 
+GumTlsKey
+_gum_tls_key_new_full (GDestroyNotify destroy)
+{
+  GumTlsKey key;
+  guint i;
+
+  key = gum_tls_key_new ();
+  if (destroy == NULL)
+    return key;
+  g_assert_cmpuint (key, <, GUM_TLS_MAX_KEYS);
+
+  gum_spinlock_acquire (&gum_tls_destructors_lock);
+
+  if (gum_tls_exit_index == FLS_OUT_OF_INDEXES)
+  {
+    gum_tls_exit_index = FlsAlloc (gum_tls_on_thread_exit);
+    g_assert (gum_tls_exit_index != FLS_OUT_OF_INDEXES);
+  }
+
+  for (i = 0; i != GUM_TLS_MAX_DESTRUCTORS; i++)
+  {
+    GumTlsDestructor * d = &gum_tls_destructors[i];
+
+    if (d->destroy == NULL)
+    {
+      d->key = key;
+      d->destroy = destroy;
+      break;
+    }
+  }
+  g_assert_cmpuint (i, <, GUM_TLS_MAX_DESTRUCTORS);
+
+  gum_tls_destructor_keys[key / 32] |= 1U << (key % 32);
+
+  gum_spinlock_release (&gum_tls_destructors_lock);
+
+  return key;
+}
+
 void
 gum_tls_key_free (GumTlsKey key)
 {
+  if (key < GUM_TLS_MAX_KEYS &&
+      (gum_tls_destructor_keys[key / 32] & (1U << (key % 32))) != 0)
+  {
+    guint i;
+
+    gum_spinlock_acquire (&gum_tls_destructors_lock);
+
+    gum_tls_destructor_keys[key / 32] &= ~(1U << (key % 32));
+
+    for (i = 0; i != GUM_TLS_MAX_DESTRUCTORS; i++)
+    {
+      GumTlsDestructor * d = &gum_tls_destructors[i];
+
+      if (d->destroy != NULL && d->key == key)
+      {
+        d->destroy = NULL;
+        break;
+      }
+    }
+
+    gum_spinlock_release (&gum_tls_destructors_lock);
+  }
+
   TlsFree (key);
 }
 
+static void
+gum_tls_key_arm_destructor (GumTlsKey key,
+                            gpointer value)
+{
+  if (value == NULL || key >= GUM_TLS_MAX_KEYS)
+    return;
+
+  if ((gum_tls_destructor_keys[key / 32] & (1U << (key % 32))) != 0)
+    FlsSetValue (gum_tls_exit_index, GSIZE_TO_POINTER (1));
+}
+
+static void WINAPI
+gum_tls_on_thread_exit (PVOID data)
+{
+  GumTlsDestructor destructors[GUM_TLS_MAX_DESTRUCTORS];
+  guint i;
+
+  (void) data;
+
+  gum_spinlock_acquire (&gum_tls_destructors_lock);
+  memcpy (destructors, gum_tls_destructors, sizeof (destructors));
+  gum_spinlock_release (&gum_tls_destructors_lock);
+
+  for (i = 0; i != GUM_TLS_MAX_DESTRUCTORS; i++)
+  {
+    GumTlsDestructor * d = &destructors[i];
+    gpointer value;
+
+    if (d->destroy == NULL)
+      continue;
+
+    value = gum_tls_key_get_value (d->key);
+    if (value != NULL)
+    {
+      gum_tls_key_set_value (d->key, NULL);
+      d->destroy (value);
+    }
+  }
+}
+
 
 void
 _gum_tls_init (void)
@@ -156,6 +286,8 @@ void
 gum_tls_key_set_value (GumTlsKey key,
                        gpointer value)
 {
+  gum_tls_key_arm_destructor (key, value);
+
   if (key < 64)
   {
     __writefsdword (3600 + key * sizeof (gpointer), (DWORD) value);
@@ -197,6 +329,8 @@ void
 gum_tls_key_set_value (GumTlsKey key,
                        gpointer value)
 {
+  gum_tls_key_arm_destructor (key, value);
+
   if (key < 64)
   {
     __writegsqword (0x1480 + key * sizeof (gpointer), (unsigned __int64) value);
@@ -231,6 +365,8 @@ void
 gum_tls_key_set_value (GumTlsKey key,
                        gpointer value)
 {
+  gum_tls_key_arm_destructor (key, value);
+
   TlsSetValue (key, value);
 }
 
@@ -25,6 +25,14 @@
 #define GUM_FRAME_OFFSET_TOP \
     (GUM_FRAME_OFFSET_NEXT_HOP + sizeof (gpointer))
 
+#define GUM_MINIMAL_ENTER_XMM_COUNT 8
+#define GUM_MINIMAL_LEAVE_XMM_COUNT 2
+
+#define GUM_RED_ZONE_SIZE 128
+
+typedef struct _GumTrampolineHeader GumTrampolineHeader;
+typedef struct _GumMinimalContextRegister GumMinimalContextRegister;
+
 struct _GumInterceptorBackend
 {
   GumX86Writer writer;
@@ -34,8 +42,56 @@ struct _GumInterceptorBackend
 
   gpointer enter_thunk;
   gpointer leave_thunk;
+
+  gpointer minimal_enter_thunk;
+  gpointer minimal_leave_thunk;
+
+  gpointer probe_exit_thunk;
 };
 
+/*
+ * Lives at the start of each trampoline slice. The trampolines jump through
+ * the thunk pointers so that a function context can be switched between the
+ * full and the minimal thunks without rewriting any code.
+ */
+struct _GumTrampolineHeader
+{
+  GumFunctionContext * function_ctx;
+  gpointer enter_thunk;
+  gpointer leave_thunk;
+  gpointer probe_exit_thunk;
+  gpointer probe_resume_address;
+};
+
+struct _GumMinimalContextRegister
+{
+  GumCpuReg reg;
+  gsize offset;
+};
+
+#if GLIB_SIZEOF_VOID_P == 8
+
+/*
+ * Everything the C ABI allows a call to clobber, plus the two callee-saved
+ * registers the thunks use as scratch. The remaining callee-saved registers
+ * are preserved by the C code we call into.
+ */
+static const GumMinimalContextRegister gum_minimal_context_registers[] =
+{
+  { GUM_REG_RAX, G_STRUCT_OFFSET (GumCpuContext, rax) },
+  { GUM_REG_RCX, G_STRUCT_OFFSET (GumCpuContext, rcx) },
+  { GUM_REG_RDX, G_STRUCT_OFFSET (GumCpuContext, rdx) },
+  { GUM_REG_RBX, G_STRUCT_OFFSET (GumCpuContext, rbx) },
+  { GUM_REG_RSI, G_STRUCT_OFFSET (GumCpuContext, rsi) },
+  { GUM_REG_RDI, G_STRUCT_OFFSET (GumCpuContext, rdi) },
+  { GUM_REG_R8,  G_STRUCT_OFFSET (GumCpuContext, r8)  },
+  { GUM_REG_R9,  G_STRUCT_OFFSET (GumCpuContext, r9)  },
+  { GUM_REG_R10, G_STRUCT_OFFSET (GumCpuContext, r10) },
+  { GUM_REG_R11, G_STRUCT_OFFSET (GumCpuContext, r11) }
+};
+
+#endif
+
 static void gum_interceptor_backend_create_thunks (
     GumInterceptorBackend * self);
 static void gum_interceptor_backend_destroy_thunks (
@@ -43,10 +99,29 @@ static void gum_interceptor_backend_destroy_thunks (
 
 static gpointer gum_make_enter_thunk (GumX86Writer * cw);
 static gpointer gum_make_leave_thunk (GumX86Writer * cw);
+#if GLIB_SIZEOF_VOID_P == 8
+static gpointer gum_make_minimal_enter_thunk (GumX86Writer * cw);
+static gpointer gum_make_minimal_leave_thunk (GumX86Writer * cw);
+static gpointer gum_make_probe_exit_thunk (GumX86Writer * cw);
+#endif
 
 static void gum_interceptor_backend_write_prolog (GumX86Writer * cw,
     gsize stack_displacement);
 static void gum_interceptor_backend_write_epilog (GumX86Writer * cw);
+#if GLIB_SIZEOF_VOID_P == 8
+static void gum_interceptor_backend_write_probe (GumX86Writer * cw,
+    GumFunctionContext * ctx);
+static void gum_interceptor_backend_write_probe_exit (GumX86Writer * cw,
+    GumAddress header_address);
+static void gum_interceptor_backend_write_minimal_prolog (GumX86Writer * cw,
+    gsize stack_displacement, guint xmm_count);
+static void gum_interceptor_backend_write_minimal_epilog (GumX86Writer * cw,
+    guint xmm_count);
+static void gum_interceptor_backend_put_save_xmm (GumX86Writer * cw,
+    gint8 offset, guint xmm_index);
+static void gum_interceptor_backend_put_restore_xmm (GumX86Writer * cw,
+    guint xmm_index, gint8 offset);
+#endif
 
 GumInterceptorBackend *
 _gum_interceptor_backend_create (GumCodeAllocator * allocator)
@@ -105,26 +180,53 @@ _gum_interceptor_backend_create_trampoline (GumInterceptorBackend * self,
 {
   GumX86Writer * cw = &self->writer;
   GumX86Relocator * rl = &self->relocator;
-  GumAddress function_ctx_ptr;
+  GumTrampolineHeader header;
+  GumAddress header_address;
   guint reloc_bytes;
 
+#if GLIB_SIZEOF_VOID_P == 4
+  if (ctx->probe_counter != NULL)
+    return FALSE;
+#endif
+
   if (!gum_interceptor_backend_prepare_trampoline (self, ctx))
     return FALSE;
 
   gum_x86_writer_reset (cw, ctx->trampoline_slice->data);
 
-  function_ctx_ptr = GUM_ADDRESS (gum_x86_writer_cur (cw));
-  gum_x86_writer_put_bytes (cw, (guint8 *) &ctx, sizeof (GumFunctionContext *));
+  header.function_ctx = ctx;
+  header.enter_thunk = self->enter_thunk;
+  header.leave_thunk = self->leave_thunk;
+  header.probe_exit_thunk = self->probe_exit_thunk;
+  header.probe_resume_address = NULL;
+
+  header_address = GUM_ADDRESS (gum_x86_writer_cur (cw));
+  gum_x86_writer_put_bytes (cw, (guint8 *) &header, sizeof (header));
 
   ctx->on_enter_trampoline = gum_x86_writer_cur (cw);
 
-  gum_x86_writer_put_push_near_ptr (cw, function_ctx_ptr);
-  gum_x86_writer_put_jmp (cw, self->enter_thunk);
+#if GLIB_SIZEOF_VOID_P == 8
+  if (ctx->probe_counter != NULL)
+  {
+    /* falls through into the relocated prologue written below */
+    gum_interceptor_backend_write_probe (cw, ctx);
+    ctx->on_leave_trampoline = NULL;
+  }
+  else
+#endif
+  {
+    gum_x86_writer_put_push_near_ptr (cw, header_address +
+        G_STRUCT_OFFSET (GumTrampolineHeader, function_ctx));
+    gum_x86_writer_put_jmp_near_ptr (cw, header_address +
+        G_STRUCT_OFFSET (GumTrampolineHeader, enter_thunk));
 
-  ctx->on_leave_trampoline = gum_x86_writer_cur (cw);
+    ctx->on_leave_trampoline = gum_x86_writer_cur (cw);
 
-  gum_x86_writer_put_push_near_ptr (cw, function_ctx_ptr);
-  gum_x86_writer_put_jmp (cw, self->leave_thunk);
+    gum_x86_writer_put_push_near_ptr (cw, header_address +
+        G_STRUCT_OFFSET (GumTrampolineHeader, function_ctx));
+    gum_x86_writer_put_jmp_near_ptr (cw, header_address +
+        G_STRUCT_OFFSET (GumTrampolineHeader, leave_thunk));
+  }
 
   gum_x86_writer_flush (cw);
   g_assert_cmpuint (gum_x86_writer_offset (cw),
@@ -139,8 +241,30 @@ _gum_interceptor_backend_create_trampoline (GumInterceptorBackend * self,
     g_assert_cmpuint (reloc_bytes, !=, 0);
   }
   while (reloc_bytes < GUM_INTERCEPTOR_REDIRECT_CODE_SIZE);
+
+  /*
+   * A probe must leave through its exit thunk so the detaching thread can
+   * tell when it is safe to free the trampoline, which rules out prologues
+   * that branch away on their own.
+   */
+  if (ctx->probe_counter != NULL && gum_x86_relocator_eoi (rl))
+    return FALSE;
+
   gum_x86_relocator_write_all (rl);
 
+#if GLIB_SIZEOF_VOID_P == 8
+  if (ctx->probe_counter != NULL)
+  {
+    GumTrampolineHeader * written_header;
+
+    written_header = (GumTrampolineHeader *) GSIZE_TO_POINTER (header_address);
+    written_header->probe_resume_address =
+        (guint8 *) ctx->function_address + reloc_bytes;
+
+    gum_interceptor_backend_write_probe_exit (cw, header_address);
+  }
+  else
+#endif
   if (!gum_x86_relocator_eoi (rl))
   {
     gum_x86_writer_put_jmp (cw, (guint8 *) ctx->function_address + reloc_bytes);
@@ -203,6 +327,46 @@ _gum_interceptor_backend_commit_trampoline (GumInterceptorBackend * self,
   gum_clear_cache (ctx->function_address, ctx->overwritten_prologue_len);
 }
 
+void
+_gum_interceptor_backend_update_requirements (GumInterceptorBackend * self,
+                                              GumFunctionContext * ctx)
+{
+  GumTrampolineHeader * header;
+  gboolean minimal;
+
+  /* the header is only writable while the slice is, which it isn't here */
+  if (!gum_query_is_rwx_supported ())
+    return;
+
+  header = (GumTrampolineHeader *) ctx->trampoline_slice->data;
+  minimal = (ctx->requirements & GUM_INVOCATION_REQUIRES_CPU_CONTEXT) == 0;
+
+  g_atomic_pointer_set (&header->enter_thunk,
+      minimal ? self->minimal_enter_thunk : self->enter_thunk);
+  g_atomic_pointer_set (&header->leave_thunk,
+      minimal ? self->minimal_leave_thunk : self->leave_thunk);
+}
+
+gboolean
+_gum_interceptor_backend_is_using_minimal_thunks (GumInterceptorBackend * self,
+                                                  GumFunctionContext * ctx)
+{
+#if GLIB_SIZEOF_VOID_P == 8
+  GumTrampolineHeader * header;
+
+  header = (GumTrampolineHeader *) ctx->trampoline_slice->data;
+
+  return g_atomic_pointer_get (&header->enter_thunk) ==
+      self->minimal_enter_thunk;
+#else
+  /* the minimal thunks are the full ones here */
+  (void) self;
+  (void) ctx;
+
+  return FALSE;
+#endif
+}
+
 gpointer
 _gum_interceptor_backend_resolve_redirect (GumInterceptorBackend * self,
                                            gpointer address)
@@ -333,6 +497,21 @@ gum_interceptor_backend_create_thunks (GumInterceptorBackend * self)
   self->enter_thunk = gum_make_enter_thunk (cw);
   self->leave_thunk = gum_make_leave_thunk (cw);
 
+#if GLIB_SIZEOF_VOID_P == 8
+  self->minimal_enter_thunk = gum_make_minimal_enter_thunk (cw);
+  self->minimal_leave_thunk = gum_make_minimal_leave_thunk (cw);
+  self->probe_exit_thunk = gum_make_probe_exit_thunk (cw);
+#else
+  /*
+   * The cdecl family passes arguments on the stack and returns floating
+   * point values in st(0), so there is little to gain by skipping the
+   * context and plenty to lose.
+   */
+  self->minimal_enter_thunk = self->enter_thunk;
+  self->minimal_leave_thunk = self->leave_thunk;
+  self->probe_exit_thunk = NULL;
+#endif
+
   gum_x86_writer_flush (cw);
   g_assert_cmpuint (gum_x86_writer_offset (cw), <=, size_in_bytes);
 
@@ -417,6 +596,69 @@ gum_make_leave_thunk (GumX86Writer * cw)
   return thunk;
 }
 
+#if GLIB_SIZEOF_VOID_P == 8
+
+static gpointer
+gum_make_minimal_enter_thunk (GumX86Writer * cw)
+{
+  gpointer thunk;
+  const gsize return_address_stack_displacement = sizeof (gpointer);
+
+  thunk = gum_x86_writer_cur (cw);
+
+  gum_interceptor_backend_write_minimal_prolog (cw,
+      return_address_stack_displacement, GUM_MINIMAL_ENTER_XMM_COUNT);
+
+  gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XSI,
+      GUM_REG_XBP, GUM_FRAME_OFFSET_CPU_CONTEXT);
+  gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XDX,
+      GUM_REG_XBP, GUM_FRAME_OFFSET_TOP);
+  gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XCX,
+      GUM_REG_XBP, GUM_FRAME_OFFSET_NEXT_HOP);
+
+  gum_x86_writer_put_call_with_arguments (cw,
+      GUM_FUNCPTR_TO_POINTER (_gum_function_context_begin_invocation), 4,
+      GUM_ARG_REGISTER, GUM_REG_XBX,
+      GUM_ARG_REGISTER, GUM_REG_XSI,
+      GUM_ARG_REGISTER, GUM_REG_XDX,
+      GUM_ARG_REGISTER, GUM_REG_XCX);
+
+  gum_interceptor_backend_write_minimal_epilog (cw,
+      GUM_MINIMAL_ENTER_XMM_COUNT);
+
+  return thunk;
+}
+
+static gpointer
+gum_make_minimal_leave_thunk (GumX86Writer * cw)
+{
+  gpointer thunk;
+  const gsize no_stack_displacement = 0;
+
+  thunk = gum_x86_writer_cur (cw);
+
+  gum_interceptor_backend_write_minimal_prolog (cw, no_stack_displacement,
+      GUM_MINIMAL_LEAVE_XMM_COUNT);
+
+  gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XSI,
+      GUM_REG_XBP, GUM_FRAME_OFFSET_CPU_CONTEXT);
+  gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XDX,
+      GUM_REG_XBP, GUM_FRAME_OFFSET_NEXT_HOP);
+
+  gum_x86_writer_put_call_with_arguments (cw,
+      GUM_FUNCPTR_TO_POINTER (_gum_function_context_end_invocation), 3,
+      GUM_ARG_REGISTER, GUM_REG_XBX,
+      GUM_ARG_REGISTER, GUM_REG_XSI,
+      GUM_ARG_REGISTER, GUM_REG_XDX);
+
+  gum_interceptor_backend_write_minimal_epilog (cw,
+      GUM_MINIMAL_LEAVE_XMM_COUNT);
+
+  return thunk;
+}
+
+#endif
+
 static void
 gum_interceptor_backend_write_prolog (GumX86Writer * cw,
                                       gsize stack_displacement)
@@ -472,3 +714,195 @@ gum_interceptor_backend_write_epilog (GumX86Writer * cw)
   gum_x86_writer_put_popfx (cw);
   gum_x86_writer_put_ret (cw);
 }
+
+#if GLIB_SIZEOF_VOID_P == 8
+
+static gpointer
+gum_make_probe_exit_thunk (GumX86Writer * cw)
+{
+  gpointer thunk;
+
+  thunk = gum_x86_writer_cur (cw);
+
+  /*
+   * Entered with the function context on top of the stack, followed by the
+   * address to resume at and the red zone we stepped over. Unlike at entry
+   * the flags may be live here, so they are preserved.
+   */
+  gum_x86_writer_put_pushfx (cw);
+  gum_x86_writer_put_push_reg (cw, GUM_REG_RAX);
+  gum_x86_writer_put_push_reg (cw, GUM_REG_RCX);
+
+  gum_x86_writer_put_mov_reg_reg_offset_ptr (cw, GUM_REG_RAX,
+      GUM_REG_RSP, 3 * sizeof (gpointer));
+  gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_RAX, GUM_REG_RAX,
+      G_STRUCT_OFFSET (GumFunctionContext, probe_in_flight));
+  gum_x86_writer_put_mov_reg_u32 (cw, GUM_REG_ECX, G_MAXUINT32);
+  gum_x86_writer_put_lock_xadd_reg_ptr_reg (cw, GUM_REG_RAX, GUM_REG_ECX);
+
+  gum_x86_writer_put_pop_reg (cw, GUM_REG_RCX);
+  gum_x86_writer_put_pop_reg (cw, GUM_REG_RAX);
+  gum_x86_writer_put_popfx (cw);
+  gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_RSP,
+      GUM_REG_RSP, sizeof (gpointer));
+  gum_x86_writer_put_ret_imm (cw, GUM_RED_ZONE_SIZE);
+
+  return thunk;
+}
+
+static void
+gum_interceptor_backend_write_probe (GumX86Writer * cw,
+                                     GumFunctionContext * ctx)
+{
+  GumProbeCounter * counter = ctx->probe_counter;
+
+  /*
+   * Pick a slot by folding the stack pointer, which keeps threads running
+   * concurrently on separate cache lines without needing a TLS lookup. The
+   * status flags are clobbered, which the ABI allows at function entry.
+   */
+  gum_x86_writer_put_push_reg (cw, GUM_REG_RAX);
+  gum_x86_writer_put_push_reg (cw, GUM_REG_RCX);
+
+  gum_x86_writer_put_mov_reg_address (cw, GUM_REG_RAX,
+      GUM_ADDRESS (&ctx->probe_in_flight));
+  gum_x86_writer_put_mov_reg_u32 (cw, GUM_REG_ECX, 1);
+  gum_x86_writer_put_lock_xadd_reg_ptr_reg (cw, GUM_REG_RAX, GUM_REG_ECX);
+
+  gum_x86_writer_put_mov_reg_reg (cw, GUM_REG_RAX, GUM_REG_RSP);
+  gum_x86_writer_put_mov_reg_reg (cw, GUM_REG_RCX, GUM_REG_RSP);
+  gum_x86_writer_put_shr_reg_u8 (cw, GUM_REG_RAX, 12);
+  gum_x86_writer_put_shr_reg_u8 (cw, GUM_REG_RCX, 23);
+  gum_x86_writer_put_xor_reg_reg (cw, GUM_REG_RAX, GUM_REG_RCX);
+  gum_x86_writer_put_and_reg_u32 (cw, GUM_REG_RAX,
+      GUM_PROBE_COUNTER_SLOT_COUNT - 1);
+  gum_x86_writer_put_shl_reg_u8 (cw, GUM_REG_RAX,
+      GUM_PROBE_COUNTER_SLOT_SIZE_SHIFT);
+  gum_x86_writer_put_mov_reg_address (cw, GUM_REG_RCX,
+      GUM_ADDRESS (counter->slots));
+  gum_x86_writer_put_add_reg_reg (cw, GUM_REG_RAX, GUM_REG_RCX);
+
+  gum_x86_writer_put_mov_reg_u32 (cw, GUM_REG_ECX, 1);
+  gum_x86_writer_put_lock_xadd_reg_ptr_reg (cw, GUM_REG_RAX, GUM_REG_RCX);
+
+  gum_x86_writer_put_pop_reg (cw, GUM_REG_RCX);
+  gum_x86_writer_put_pop_reg (cw, GUM_REG_RAX);
+}
+
+static void
+gum_interceptor_backend_write_probe_exit (GumX86Writer * cw,
+                                          GumAddress header_address)
+{
+  gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_RSP,
+      GUM_REG_RSP, -GUM_RED_ZONE_SIZE);
+  gum_x86_writer_put_push_near_ptr (cw, header_address +
+      G_STRUCT_OFFSET (GumTrampolineHeader, probe_resume_address));
+  gum_x86_writer_put_push_near_ptr (cw, header_address +
+      G_STRUCT_OFFSET (GumTrampolineHeader, function_ctx));
+  gum_x86_writer_put_jmp_near_ptr (cw, header_address +
+      G_STRUCT_OFFSET (GumTrampolineHeader, probe_exit_thunk));
+}
+
+static void
+gum_interceptor_backend_write_minimal_prolog (GumX86Writer * cw,
+                                              gsize stack_displacement,
+                                              guint xmm_count)
+{
+  guint i;
+
+  /*
+   * Same frame layout as the full prolog, but we only fill in the registers
+   * that the ABI lets our C code clobber, and leave out the flags and the
+   * FPU/SSE state except for the XMM registers used to pass arguments and
+   * return values. Listeners that need more ask for
+   * GUM_INVOCATION_REQUIRES_CPU_CONTEXT and get the full thunks instead.
+   */
+  gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XSP,
+      GUM_REG_XSP, -((gssize) GUM_FRAME_OFFSET_NEXT_HOP));
+
+  for (i = 0; i != G_N_ELEMENTS (gum_minimal_context_registers); i++)
+  {
+    const GumMinimalContextRegister * r = &gum_minimal_context_registers[i];
+
+    gum_x86_writer_put_mov_reg_offset_ptr_reg (cw,
+        GUM_REG_XSP, GUM_FRAME_OFFSET_CPU_CONTEXT + r->offset,
+        r->reg);
+  }
+  gum_x86_writer_put_mov_reg_offset_ptr_reg (cw,
+      GUM_REG_XSP, GUM_FRAME_OFFSET_CPU_CONTEXT + GUM_CPU_CONTEXT_OFFSET_XBP,
+      GUM_REG_XBP);
+
+  gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XAX,
+      GUM_REG_XSP, GUM_FRAME_OFFSET_TOP + stack_displacement);
+  gum_x86_writer_put_mov_reg_offset_ptr_reg (cw,
+      GUM_REG_XSP, GUM_CPU_CONTEXT_OFFSET_XSP,
+      GUM_REG_XAX);
+
+  gum_x86_writer_put_mov_reg_reg_offset_ptr (cw, GUM_REG_XBX, GUM_REG_XSP,
+      GUM_FRAME_OFFSET_NEXT_HOP);
+  gum_x86_writer_put_mov_reg_reg (cw, GUM_REG_XBP, GUM_REG_XSP);
+  gum_x86_writer_put_and_reg_u32 (cw, GUM_REG_XSP, (guint32) ~(16 - 1));
+  gum_x86_writer_put_sub_reg_imm (cw, GUM_REG_XSP, xmm_count * 16);
+  for (i = 0; i != xmm_count; i++)
+    gum_interceptor_backend_put_save_xmm (cw, i * 16, i);
+}
+
+static void
+gum_interceptor_backend_write_minimal_epilog (GumX86Writer * cw,
+                                              guint xmm_count)
+{
+  guint i;
+
+  for (i = 0; i != xmm_count; i++)
+    gum_interceptor_backend_put_restore_xmm (cw, i, i * 16);
+  gum_x86_writer_put_mov_reg_reg (cw, GUM_REG_XSP, GUM_REG_XBP);
+
+  /* reload, as listeners may have replaced arguments or the return value */
+  for (i = 0; i != G_N_ELEMENTS (gum_minimal_context_registers); i++)
+  {
+    const GumMinimalContextRegister * r = &gum_minimal_context_registers[i];
+
+    gum_x86_writer_put_mov_reg_reg_offset_ptr (cw, r->reg,
+        GUM_REG_XSP, GUM_FRAME_OFFSET_CPU_CONTEXT + r->offset);
+  }
+  gum_x86_writer_put_mov_reg_reg_offset_ptr (cw, GUM_REG_XBP,
+      GUM_REG_XSP, GUM_FRAME_OFFSET_CPU_CONTEXT + GUM_CPU_CONTEXT_OFFSET_XBP);
+
+  gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XSP,
+      GUM_REG_XSP, GUM_FRAME_OFFSET_NEXT_HOP);
+  gum_x86_writer_put_ret (cw);
+}
+
+static void
+gum_interceptor_backend_put_save_xmm (GumX86Writer * cw,
+                                      gint8 offset,
+                                      guint xmm_index)
+{
+  guint8 movdqu[] = {
+    0xf3, 0x0f, 0x7f, 0x44, 0x24, 0x00 /* movdqu [rsp + offset], xmmN */
+  };
+
+  g_assert_cmpuint (xmm_index, <, 8);
+
+  movdqu[3] |= xmm_index << 3;
+  movdqu[5] = (guint8) offset;
+  gum_x86_writer_put_bytes (cw, movdqu, sizeof (movdqu));
+}
+
+static void
+gum_interceptor_backend_put_restore_xmm (GumX86Writer * cw,
+                                         guint xmm_index,
+                                         gint8 offset)
+{
+  guint8 movdqu[] = {
+    0xf3, 0x0f, 0x6f, 0x44, 0x24, 0x00 /* movdqu xmmN, [rsp + offset] */
+  };
+
+  g_assert_cmpuint (xmm_index, <, 8);
+
+  movdqu[3] |= xmm_index << 3;
+  movdqu[5] = (guint8) offset;
+  gum_x86_writer_put_bytes (cw, movdqu, sizeof (movdqu));
+}
+
+#endif
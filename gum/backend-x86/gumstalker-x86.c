@@ -33,6 +33,13 @@
 #define GUM_DATA_ALIGNMENT                     8
 #define GUM_CODE_SLAB_SIZE_IN_PAGES         1024
 #define GUM_EXEC_BLOCK_MIN_SIZE             1024
+#define GUM_EXEC_CTX_EVENT_CAPACITY         256
+
+#if defined (HAVE_LINUX) && !defined (HAVE_ANDROID) && \
+    GLIB_SIZEOF_VOID_P == 8 && defined (__GNUC__)
+# define GUM_STALKER_HAVE_SHARED_CACHE 1
+# define GUM_TLS_KEY_SEARCH_LIMIT 2048
+#endif
 
 typedef struct _GumInfectContext GumInfectContext;
 typedef struct _GumDisinfectContext GumDisinfectContext;
@@ -41,6 +48,7 @@ typedef struct _GumCallProbe GumCallProbe;
 typedef struct _GumSlab GumSlab;
 
 typedef struct _GumExecFrame GumExecFrame;
+typedef struct _GumExecSlots GumExecSlots;
 typedef struct _GumExecCtx GumExecCtx;
 typedef struct _GumExecBlock GumExecBlock;
 
@@ -68,6 +76,17 @@ struct _GumStalkerPrivate
   GHashTable * probe_target_by_id;
   GHashTable * probe_array_by_address;
 
+  gboolean shared_cache;
+  GRWLock shared_lock;
+  GumEventType shared_sink_mask;
+  GumSlab * shared_code_slab;
+  GumMetalHashTable * shared_mappings;
+#ifdef GUM_STALKER_HAVE_SHARED_CACHE
+  GumTlsKey shared_exec_ctx;
+  gint32 shared_exec_ctx_offset;
+  gboolean shared_exec_ctx_reachable;
+#endif
+
 #ifdef G_OS_WIN32
   GumExceptor * exceptor;
   gpointer user32_start, user32_end;
@@ -110,6 +129,28 @@ struct _GumExecFrame
   gpointer code_address;
 };
 
+/*
+ * Per-thread state that the generated code reads and writes. Private blocks
+ * address it absolutely through GumExecCtx.own_slots, whereas blocks living
+ * in the shared cache first load the thread's GumExecCtx from a TLS key that
+ * sits at a fixed offset from the thread pointer, so that one translation
+ * can be executed by every followed thread.
+ */
+struct _GumExecSlots
+{
+  GumExecCtx * ctx;
+
+  gpointer resume_at;
+  gpointer return_at;
+  gpointer app_stack;
+
+  GumExecFrame * current_frame;
+  GumExecFrame * first_frame;
+
+  GumEvent * event_cursor;
+  GumEvent * event_end;
+};
+
 enum _GumExecCtxState
 {
   GUM_EXEC_CTX_ACTIVE,
@@ -124,24 +165,26 @@ struct _GumExecCtx
 
   GumStalker * stalker;
   GumThreadId thread_id;
+  gboolean shared;
 
   GumX86Writer code_writer;
   GumX86Relocator relocator;
 
   GumEventSink * sink;
   GumEventType sink_mask;
-  gpointer sink_process_impl; /* cached */
-  GumEvent tmp_event;
 
   gboolean unfollow_called_while_still_following;
   GumExecBlock * current_block;
-  GumExecFrame * current_frame;
-  GumExecFrame * first_frame;
   GumExecFrame * frames;
 
-  gpointer resume_at;
-  gpointer return_at;
-  gpointer app_stack;
+  GumExecSlots * slots;
+  GumExecSlots own_slots;
+
+  GumEvent events[GUM_EXEC_CTX_EVENT_CAPACITY];
+  GumEvent * flushed_cursor;
+  GMutex flush_mutex;
+  gboolean sink_stopped;
+  guint flush_pins;
 
   gpointer thunks;
   gpointer infect_thunk;
@@ -238,6 +281,9 @@ enum _GumVirtualizationRequirements
 #define GUM_STALKER_LOCK(o) g_mutex_lock (&(o)->priv->mutex)
 #define GUM_STALKER_UNLOCK(o) g_mutex_unlock (&(o)->priv->mutex)
 
+#define GUM_EXEC_SLOT(f) G_STRUCT_OFFSET (GumExecSlots, f)
+#define GUM_EXEC_CTX_FIELD(f) G_STRUCT_OFFSET (GumExecCtx, f)
+
 #if GLIB_SIZEOF_VOID_P == 4
 #define STATE_PRESERVE_TOPMOST_REGISTER_INDEX (3)
 #else
@@ -261,9 +307,20 @@ static GumExecCtx * gum_stalker_create_exec_ctx (GumStalker * self,
     GumThreadId thread_id, GumEventSink * sink);
 static GumExecCtx * gum_stalker_get_exec_ctx (GumStalker * self);
 static void gum_stalker_invalidate_caches (GumStalker * self);
+static gboolean gum_stalker_can_share_blocks_with (GumStalker * self,
+    GumEventSink * sink);
+#ifdef GUM_STALKER_HAVE_SHARED_CACHE
+static gboolean gum_stalker_find_tls_key_offset (GumTlsKey key,
+    gint32 * offset);
+#endif
+static void gum_stalker_free_slabs (GumSlab * slab, GumSlab * last);
 
 static void gum_exec_ctx_free (GumExecCtx * ctx);
 static void gum_exec_ctx_unfollow (GumExecCtx * ctx, gpointer resume_at);
+static void gum_exec_ctx_flush_events (GumExecCtx * ctx);
+static void gum_exec_ctx_flush_pending_events (GumExecCtx * ctx);
+static void gum_exec_ctx_stop_events (GumExecCtx * ctx);
+static void gum_exec_ctx_deliver_events (GumExecCtx * ctx);
 static gboolean gum_exec_ctx_has_executed (GumExecCtx * ctx);
 static gpointer GUM_THUNK gum_exec_ctx_replace_current_block_with (
     GumExecCtx * ctx, gpointer start_address);
@@ -272,6 +329,14 @@ static void gum_exec_ctx_destroy_thunks (GumExecCtx * ctx);
 
 static GumExecBlock * gum_exec_ctx_obtain_block_for (GumExecCtx * ctx,
     gpointer real_address, gpointer * code_address);
+static GumExecBlock * gum_exec_ctx_obtain_shared_block_for (GumExecCtx * ctx,
+    gpointer real_address, gpointer * code_address);
+static GumExecBlock * gum_exec_ctx_lookup_block (GumExecCtx * ctx,
+    GumMetalHashTable * mappings, gpointer real_address,
+    gpointer * code_address);
+static GumExecBlock * gum_exec_ctx_compile_block (GumExecCtx * ctx,
+    GumMetalHashTable * mappings, gpointer real_address,
+    gpointer * code_address);
 static void gum_exec_ctx_write_prolog (GumExecCtx * ctx, GumPrologType type,
     gpointer ip, GumX86Writer * cw);
 static void gum_exec_ctx_write_epilog (GumExecCtx * ctx, GumPrologType type,
@@ -281,10 +346,20 @@ static void gum_exec_ctx_write_push_branch_target_address (GumExecCtx * ctx,
 static void gum_exec_ctx_load_real_register_into (GumExecCtx * ctx,
     GumCpuReg target_register, GumCpuReg source_register,
     gpointer ip, GumGeneratorContext * gc);
+static void gum_exec_ctx_write_load_slot (GumExecCtx * ctx,
+    GumCpuReg dst_reg, guint slot_offset, GumX86Writer * cw);
+static void gum_exec_ctx_write_store_slot (GumExecCtx * ctx,
+    guint slot_offset, GumCpuReg src_reg, GumX86Writer * cw);
+static void gum_exec_ctx_write_jmp_slot (GumExecCtx * ctx,
+    guint slot_offset, GumX86Writer * cw);
+static void gum_exec_ctx_write_load_ctx (GumExecCtx * ctx,
+    GumCpuReg dst_reg, GumX86Writer * cw);
+static void gum_exec_ctx_write_load_ctx_field (GumExecCtx * ctx,
+    GumCpuReg dst_reg, guint field_offset, GumX86Writer * cw);
+static void gum_exec_ctx_write_load_depth (GumExecCtx * ctx,
+    GumCpuReg dst_reg, GumCpuReg scratch_reg, GumX86Writer * cw);
 
 static GumExecBlock * gum_exec_block_new (GumExecCtx * ctx);
-static GumExecBlock * gum_exec_block_obtain (GumExecCtx * ctx,
-    gpointer real_address, gpointer * code_address);
 static gboolean gum_exec_block_is_full (GumExecBlock * block);
 static void gum_exec_block_commit (GumExecBlock * block);
 
@@ -426,6 +501,18 @@ gum_stalker_init (GumStalker * self)
   g_mutex_init (&priv->mutex);
   priv->contexts = NULL;
   priv->exec_ctx = gum_tls_key_new ();
+
+  g_rw_lock_init (&priv->shared_lock);
+
+#ifdef GUM_STALKER_HAVE_SHARED_CACHE
+  /*
+   * Unlike exec_ctx this one is never cleared, as a thread that has just
+   * been unfollowed still leaves through its slots.
+   */
+  priv->shared_exec_ctx = gum_tls_key_new ();
+  priv->shared_exec_ctx_reachable = gum_stalker_find_tls_key_offset (
+      priv->shared_exec_ctx, &priv->shared_exec_ctx_offset);
+#endif
 }
 
 static void
@@ -461,8 +548,16 @@ gum_stalker_finalize (GObject * object)
 
   g_assert (priv->contexts == NULL);
   gum_tls_key_free (priv->exec_ctx);
+#ifdef GUM_STALKER_HAVE_SHARED_CACHE
+  gum_tls_key_free (priv->shared_exec_ctx);
+#endif
   g_mutex_clear (&priv->mutex);
 
+  if (priv->shared_mappings != NULL)
+    gum_metal_hash_table_unref (priv->shared_mappings);
+  gum_stalker_free_slabs (priv->shared_code_slab, NULL);
+  g_rw_lock_clear (&priv->shared_lock);
+
   G_OBJECT_CLASS (gum_stalker_parent_class)->finalize (object);
 }
 
@@ -492,6 +587,19 @@ gum_stalker_set_trust_threshold (GumStalker * self,
   self->priv->trust_threshold = trust_threshold;
 }
 
+gboolean
+gum_stalker_get_shared_cache (GumStalker * self)
+{
+  return self->priv->shared_cache;
+}
+
+void
+gum_stalker_set_shared_cache (GumStalker * self,
+                              gboolean shared_cache)
+{
+  self->priv->shared_cache = shared_cache;
+}
+
 void
 gum_stalker_stop (GumStalker * self)
 {
@@ -545,7 +653,7 @@ gum_stalker_garbage_collect (GumStalker * self)
   for (cur = self->priv->contexts; cur != NULL; cur = cur->next)
   {
     GumExecCtx * ctx = (GumExecCtx *) cur->data;
-    if (ctx->state == GUM_EXEC_CTX_DESTROY_PENDING)
+    if (ctx->state == GUM_EXEC_CTX_DESTROY_PENDING && ctx->flush_pins == 0)
       gum_exec_ctx_free (ctx);
     else
       keep = g_slist_prepend (keep, ctx);
@@ -561,6 +669,45 @@ gum_stalker_garbage_collect (GumStalker * self)
   return pending_garbage;
 }
 
+/*
+ * Delivers the events that followed threads have buffered so far, as threads
+ * that are blocked or rarely produce events would otherwise sit on a
+ * partially filled batch indefinitely. Runs on the calling thread; contexts
+ * are pinned while we work on them so they stay alive without holding the
+ * Stalker lock across the sink.
+ */
+void
+gum_stalker_flush (GumStalker * self)
+{
+  GSList * pinned = NULL, * cur;
+
+  GUM_STALKER_LOCK (self);
+
+  for (cur = self->priv->contexts; cur != NULL; cur = cur->next)
+  {
+    GumExecCtx * ctx = (GumExecCtx *) cur->data;
+
+    if (ctx->state != GUM_EXEC_CTX_DESTROY_PENDING)
+    {
+      ctx->flush_pins++;
+      pinned = g_slist_prepend (pinned, ctx);
+    }
+  }
+
+  GUM_STALKER_UNLOCK (self);
+
+  for (cur = pinned; cur != NULL; cur = cur->next)
+    gum_exec_ctx_flush_pending_events ((GumExecCtx *) cur->data);
+
+  GUM_STALKER_LOCK (self);
+
+  for (cur = pinned; cur != NULL; cur = cur->next)
+    ((GumExecCtx *) cur->data)->flush_pins--;
+  g_slist_free (pinned);
+
+  GUM_STALKER_UNLOCK (self);
+}
+
 #ifdef _MSC_VER
 
 #define RETURN_ADDRESS_POINTER_FROM_FIRST_ARGUMENT(arg)   \
@@ -590,6 +737,10 @@ _gum_stalker_do_follow_me (GumStalker * self,
   ctx = gum_stalker_create_exec_ctx (self,
       gum_process_get_current_thread_id (), sink);
   gum_tls_key_set_value (self->priv->exec_ctx, ctx);
+#ifdef GUM_STALKER_HAVE_SHARED_CACHE
+  if (ctx->shared)
+    gum_tls_key_set_value (self->priv->shared_exec_ctx, ctx);
+#endif
   ctx->current_block = gum_exec_ctx_obtain_block_for (ctx, *ret_addr_ptr,
       &code_address);
   *ret_addr_ptr = code_address;
@@ -605,8 +756,6 @@ gum_stalker_unfollow_me (GumStalker * self)
   ctx = gum_stalker_get_exec_ctx (self);
   g_assert (ctx != NULL);
 
-  gum_event_sink_stop (ctx->sink);
-
   if (ctx->current_block != NULL &&
       ctx->current_block->has_call_to_excluded_range)
   {
@@ -614,15 +763,24 @@ gum_stalker_unfollow_me (GumStalker * self)
   }
   else
   {
+    gboolean can_free;
+
     g_assert (ctx->unfollow_called_while_still_following);
 
+    gum_exec_ctx_stop_events (ctx);
+
     gum_tls_key_set_value (self->priv->exec_ctx, NULL);
 
     GUM_STALKER_LOCK (self);
-    self->priv->contexts = g_slist_remove (self->priv->contexts, ctx);
+    can_free = ctx->flush_pins == 0;
+    if (can_free)
+      self->priv->contexts = g_slist_remove (self->priv->contexts, ctx);
+    else
+      ctx->state = GUM_EXEC_CTX_DESTROY_PENDING;
     GUM_STALKER_UNLOCK (self);
 
-    gum_exec_ctx_free (ctx);
+    if (can_free)
+      gum_exec_ctx_free (ctx);
   }
 }
 
@@ -644,6 +802,7 @@ gum_stalker_follow (GumStalker * self,
   else
   {
     GumInfectContext ctx;
+
     ctx.stalker = self;
     ctx.sink = sink;
     gum_process_modify_thread (thread_id, gum_stalker_infect, &ctx);
@@ -661,29 +820,43 @@ gum_stalker_unfollow (GumStalker * self,
   else
   {
     GSList * cur;
+    GumEventSink * stopped_sink = NULL;
 
     GUM_STALKER_LOCK (self);
 
+    /*
+     * The sink is stopped by the thread itself once it has flushed its last
+     * batch, except when it never got to run any of our code.
+     */
     for (cur = self->priv->contexts; cur != NULL; cur = cur->next)
     {
       GumExecCtx * ctx = (GumExecCtx *) cur->data;
       if (ctx->thread_id == thread_id && ctx->state == GUM_EXEC_CTX_ACTIVE)
       {
-        gum_event_sink_stop (ctx->sink);
-
         if (gum_exec_ctx_has_executed (ctx))
         {
           ctx->state = GUM_EXEC_CTX_UNFOLLOW_PENDING;
         }
         else
         {
+          GumEventSink * sink;
           GumDisinfectContext dc;
+
+          sink = g_object_ref (ctx->sink);
+
           dc.stalker = self;
           dc.exec_ctx = ctx;
           dc.success = FALSE;
           gum_process_modify_thread (thread_id, gum_stalker_disinfect, &dc);
-          if (!dc.success)
+          if (dc.success)
+          {
+            stopped_sink = sink;
+          }
+          else
+          {
             ctx->state = GUM_EXEC_CTX_UNFOLLOW_PENDING;
+            g_object_unref (sink);
+          }
         }
 
         break;
@@ -691,6 +864,12 @@ gum_stalker_unfollow (GumStalker * self,
     }
 
     GUM_STALKER_UNLOCK (self);
+
+    if (stopped_sink != NULL)
+    {
+      gum_event_sink_stop (stopped_sink);
+      g_object_unref (stopped_sink);
+    }
   }
 }
 
@@ -704,6 +883,7 @@ gum_stalker_infect (GumThreadId thread_id,
   GumExecCtx * ctx;
   gpointer code_address;
   GumX86Writer cw;
+  gboolean shared;
 #if GLIB_SIZEOF_VOID_P == 4
   guint align_correction = 8;
 #else
@@ -716,6 +896,13 @@ gum_stalker_infect (GumThreadId thread_id,
       GSIZE_TO_POINTER (GUM_CPU_CONTEXT_XIP (cpu_context)), &code_address);
   GUM_CPU_CONTEXT_XIP (cpu_context) = GPOINTER_TO_SIZE (ctx->infect_thunk);
 
+  /*
+   * The thunk runs before the thread's TLS keys point at ctx, so it must
+   * address the slots directly even when the blocks are shared.
+   */
+  shared = ctx->shared;
+  ctx->shared = FALSE;
+
   gum_x86_writer_init (&cw, ctx->infect_thunk);
   gum_exec_ctx_write_prolog (ctx, GUM_PROLOG_MINIMAL,
       ctx->current_block->real_begin, &cw);
@@ -724,11 +911,22 @@ gum_stalker_infect (GumThreadId thread_id,
       GUM_FUNCPTR_TO_POINTER (gum_tls_key_set_value), 2,
       GUM_ARG_POINTER, self->priv->exec_ctx,
       GUM_ARG_POINTER, ctx);
+#ifdef GUM_STALKER_HAVE_SHARED_CACHE
+  if (shared)
+  {
+    gum_x86_writer_put_call_with_arguments (&cw,
+        GUM_FUNCPTR_TO_POINTER (gum_tls_key_set_value), 2,
+        GUM_ARG_POINTER, self->priv->shared_exec_ctx,
+        GUM_ARG_POINTER, ctx);
+  }
+#endif
   gum_x86_writer_put_add_reg_imm (&cw, GUM_REG_XSP, align_correction);
   gum_exec_ctx_write_epilog (ctx, GUM_PROLOG_MINIMAL, &cw);
   gum_x86_writer_put_jmp (&cw, code_address);
   gum_x86_writer_free (&cw);
 
+  ctx->shared = shared;
+
   gum_event_sink_start (infect_context->sink);
 }
 
@@ -751,8 +949,15 @@ gum_stalker_disinfect (GumThreadId thread_id,
     GUM_CPU_CONTEXT_XIP (cpu_context) =
         GPOINTER_TO_SIZE (ctx->current_block->real_begin);
 
-    self->priv->contexts = g_slist_remove (self->priv->contexts, ctx);
-    gum_exec_ctx_free (ctx);
+    if (ctx->flush_pins == 0)
+    {
+      self->priv->contexts = g_slist_remove (self->priv->contexts, ctx);
+      gum_exec_ctx_free (ctx);
+    }
+    else
+    {
+      ctx->state = GUM_EXEC_CTX_DESTROY_PENDING;
+    }
 
     disinfect_context->success = TRUE;
   }
@@ -890,28 +1095,37 @@ gum_stalker_create_exec_ctx (GumStalker * self,
   ctx->first_code_slab.size = GUM_CODE_SLAB_SIZE_IN_PAGES * priv->page_size;
   ctx->first_code_slab.next = NULL;
 
+  ctx->slots = &ctx->own_slots;
+  ctx->slots->ctx = ctx;
+
   ctx->frames = (GumExecFrame *)
       (ctx->code_slab->data + ctx->code_slab->size);
-  ctx->first_frame = (GumExecFrame *) (ctx->code_slab->data +
+  ctx->slots->first_frame = (GumExecFrame *) (ctx->code_slab->data +
       ctx->code_slab->size + priv->page_size - sizeof (GumExecFrame));
-  ctx->current_frame = ctx->first_frame;
+  ctx->slots->current_frame = ctx->slots->first_frame;
 
   ctx->mappings = gum_metal_hash_table_new (NULL, NULL);
 
-  ctx->resume_at = NULL;
-  ctx->return_at = NULL;
-  ctx->app_stack = NULL;
+  ctx->slots->resume_at = NULL;
+  ctx->slots->return_at = NULL;
+  ctx->slots->app_stack = NULL;
+
+  ctx->slots->event_cursor = ctx->events;
+  ctx->slots->event_end = ctx->events + GUM_EXEC_CTX_EVENT_CAPACITY;
+  ctx->flushed_cursor = ctx->events;
+  g_mutex_init (&ctx->flush_mutex);
+  ctx->sink_stopped = FALSE;
+  ctx->flush_pins = 0;
 
   ctx->stalker = g_object_ref (self);
   ctx->thread_id = thread_id;
+  ctx->shared = gum_stalker_can_share_blocks_with (self, sink);
 
   gum_x86_writer_init (&ctx->code_writer, NULL);
   gum_x86_relocator_init (&ctx->relocator, NULL, &ctx->code_writer);
 
   ctx->sink = (GumEventSink *) g_object_ref (sink);
   ctx->sink_mask = gum_event_sink_query_mask (sink);
-  ctx->sink_process_impl = GUM_FUNCPTR_TO_POINTER (
-      GUM_EVENT_SINK_GET_INTERFACE (sink)->process);
 
   gum_exec_ctx_create_thunks (ctx);
 
@@ -931,11 +1145,12 @@ gum_stalker_get_exec_ctx (GumStalker * self)
 static void
 gum_stalker_invalidate_caches (GumStalker * self)
 {
+  GumStalkerPrivate * priv = self->priv;
   GSList * cur;
 
   GUM_STALKER_LOCK (self);
 
-  for (cur = self->priv->contexts; cur != NULL; cur = cur->next)
+  for (cur = priv->contexts; cur != NULL; cur = cur->next)
   {
     GumExecCtx * ctx = (GumExecCtx *) cur->data;
 
@@ -943,26 +1158,119 @@ gum_stalker_invalidate_caches (GumStalker * self)
   }
 
   GUM_STALKER_UNLOCK (self);
+
+  /*
+   * Shared blocks are never backpatched, so dropping the mappings is enough
+   * for every thread to pick up fresh translations on its next transfer.
+   * The slabs stay around until the Stalker itself goes away.
+   */
+  g_rw_lock_writer_lock (&priv->shared_lock);
+  if (priv->shared_mappings != NULL)
+    gum_metal_hash_table_remove_all (priv->shared_mappings);
+  g_rw_lock_writer_unlock (&priv->shared_lock);
 }
 
-static void
-gum_exec_ctx_free (GumExecCtx * ctx)
+static gboolean
+gum_stalker_can_share_blocks_with (GumStalker * self,
+                                   GumEventSink * sink)
 {
-  GumSlab * slab;
+#ifdef GUM_STALKER_HAVE_SHARED_CACHE
+  GumStalkerPrivate * priv = self->priv;
+  GumEventType sink_mask;
+  gboolean can_share;
 
-  gum_metal_hash_table_unref (ctx->mappings);
+  if (!priv->shared_cache || !priv->shared_exec_ctx_reachable ||
+      priv->trust_threshold < 0)
+    return FALSE;
+
+  sink_mask = gum_event_sink_query_mask (sink);
+
+  g_rw_lock_writer_lock (&priv->shared_lock);
+
+  if (priv->shared_mappings == NULL)
+  {
+    priv->shared_mappings = gum_metal_hash_table_new (NULL, NULL);
+    priv->shared_sink_mask = sink_mask;
+  }
+
+  /* The event mask is baked into the generated code */
+  can_share = sink_mask == priv->shared_sink_mask;
+
+  g_rw_lock_writer_unlock (&priv->shared_lock);
+
+  return can_share;
+#else
+  (void) self;
+  (void) sink;
+
+  return FALSE;
+#endif
+}
+
+#ifdef GUM_STALKER_HAVE_SHARED_CACHE
 
-  slab = ctx->code_slab;
-  while (slab != &ctx->first_code_slab)
+/*
+ * glibc keeps the values of the first few keys inline in struct pthread, at
+ * the same offset from the thread pointer in every thread. Look for ours
+ * there so shared blocks can load it with a single fs-relative mov; later
+ * keys live out of line, and sharing is then simply not offered.
+ */
+static gboolean
+gum_stalker_find_tls_key_offset (GumTlsKey key,
+                                 gint32 * offset)
+{
+  const gsize * thread_pointer;
+  gpointer previous_value;
+  guint8 first_marker, second_marker;
+  guint i;
+  gboolean found = FALSE;
+
+  asm ("movq %%fs:0, %0" : "=r" (thread_pointer));
+
+  previous_value = gum_tls_key_get_value (key);
+
+  for (i = 0; i != GUM_TLS_KEY_SEARCH_LIMIT / sizeof (gsize) && !found; i++)
+  {
+    gum_tls_key_set_value (key, &first_marker);
+    if (thread_pointer[i] != GPOINTER_TO_SIZE (&first_marker))
+      continue;
+
+    gum_tls_key_set_value (key, &second_marker);
+    found = thread_pointer[i] == GPOINTER_TO_SIZE (&second_marker);
+    if (found)
+      *offset = (gint32) (i * sizeof (gsize));
+  }
+
+  gum_tls_key_set_value (key, previous_value);
+
+  return found;
+}
+
+#endif
+
+static void
+gum_stalker_free_slabs (GumSlab * slab,
+                        GumSlab * last)
+{
+  while (slab != last)
   {
     GumSlab * next = slab->next;
     gum_free_pages (slab);
     slab = next;
   }
+}
+
+static void
+gum_exec_ctx_free (GumExecCtx * ctx)
+{
+  gum_metal_hash_table_unref (ctx->mappings);
+
+  gum_stalker_free_slabs (ctx->code_slab, &ctx->first_code_slab);
 
   gum_exec_ctx_destroy_thunks (ctx);
 
   g_object_unref (ctx->sink);
+  g_mutex_clear (&ctx->flush_mutex);
 
   gum_x86_relocator_free (&ctx->relocator);
   gum_x86_writer_free (&ctx->code_writer);
@@ -976,17 +1284,81 @@ static void
 gum_exec_ctx_unfollow (GumExecCtx * ctx,
                        gpointer resume_at)
 {
-  ctx->resume_at = resume_at;
+  gum_exec_ctx_stop_events (ctx);
+
+  ctx->slots->resume_at = resume_at;
 
   gum_tls_key_set_value (ctx->stalker->priv->exec_ctx, NULL);
   ctx->current_block = NULL;
   ctx->state = GUM_EXEC_CTX_DESTROY_PENDING;
 }
 
+static void
+gum_exec_ctx_flush_events (GumExecCtx * ctx)
+{
+  g_mutex_lock (&ctx->flush_mutex);
+
+  gum_exec_ctx_deliver_events (ctx);
+
+  ctx->slots->event_cursor = ctx->events;
+  ctx->flushed_cursor = ctx->events;
+
+  g_mutex_unlock (&ctx->flush_mutex);
+}
+
+/*
+ * Called from gum_stalker_flush () while the owning thread may still be writing
+ * events. Only the owner ever rewinds the cursor, so everything below it is
+ * stable as long as we hold the flush mutex.
+ */
+static void
+gum_exec_ctx_flush_pending_events (GumExecCtx * ctx)
+{
+  g_mutex_lock (&ctx->flush_mutex);
+
+  if (!ctx->sink_stopped)
+    gum_exec_ctx_deliver_events (ctx);
+
+  g_mutex_unlock (&ctx->flush_mutex);
+}
+
+static void
+gum_exec_ctx_stop_events (GumExecCtx * ctx)
+{
+  g_mutex_lock (&ctx->flush_mutex);
+
+  gum_exec_ctx_deliver_events (ctx);
+
+  ctx->slots->event_cursor = ctx->events;
+  ctx->flushed_cursor = ctx->events;
+  ctx->sink_stopped = TRUE;
+
+  g_mutex_unlock (&ctx->flush_mutex);
+
+  gum_event_sink_stop (ctx->sink);
+}
+
+static void
+gum_exec_ctx_deliver_events (GumExecCtx * ctx)
+{
+  GumEvent * cursor;
+  guint n_events;
+
+  cursor = (GumEvent *) g_atomic_pointer_get (&ctx->slots->event_cursor);
+
+  n_events = cursor - ctx->flushed_cursor;
+  if (n_events == 0)
+    return;
+
+  gum_event_sink_process_batch (ctx->sink, ctx->flushed_cursor, n_events);
+
+  ctx->flushed_cursor = cursor;
+}
+
 static gboolean
 gum_exec_ctx_has_executed (GumExecCtx * ctx)
 {
-  return ctx->resume_at != NULL;
+  return ctx->slots->resume_at != NULL;
 }
 
 static gpointer GUM_THUNK
@@ -1004,7 +1376,7 @@ gum_exec_ctx_replace_current_block_with (GumExecCtx * ctx,
   {
     ctx->unfollow_called_while_still_following = TRUE;
     ctx->current_block = NULL;
-    ctx->resume_at = start_address;
+    ctx->slots->resume_at = start_address;
   }
   else if (ctx->state == GUM_EXEC_CTX_UNFOLLOW_PENDING)
   {
@@ -1013,10 +1385,10 @@ gum_exec_ctx_replace_current_block_with (GumExecCtx * ctx,
   else
   {
     ctx->current_block = gum_exec_ctx_obtain_block_for (ctx, start_address,
-        &ctx->resume_at);
+        &ctx->slots->resume_at);
   }
 
-  return ctx->resume_at;
+  return ctx->slots->resume_at;
 }
 
 static void
@@ -1101,33 +1473,101 @@ gum_exec_ctx_obtain_block_for (GumExecCtx * ctx,
                                gpointer * code_address)
 {
   GumExecBlock * block;
-  GumX86Writer * cw = &ctx->code_writer;
-  GumX86Relocator * rl = &ctx->relocator;
-  GumGeneratorContext gc;
+
+  if (ctx->shared)
+  {
+    return gum_exec_ctx_obtain_shared_block_for (ctx, real_address,
+        code_address);
+  }
 
   if (ctx->stalker->priv->trust_threshold >= 0)
   {
-    block = gum_exec_block_obtain (ctx, real_address, code_address);
+    block = gum_exec_ctx_lookup_block (ctx, ctx->mappings, real_address,
+        code_address);
     if (block != NULL)
-    {
-      if (block->recycle_count >= ctx->stalker->priv->trust_threshold ||
-          memcmp (real_address, block->real_snapshot,
-            block->real_end - block->real_begin) == 0)
-      {
-        block->recycle_count++;
-        return block;
-      }
-      else
-      {
-        gum_metal_hash_table_remove (ctx->mappings, real_address);
-      }
-    }
+      return block;
+  }
+
+  return gum_exec_ctx_compile_block (ctx, ctx->mappings, real_address,
+      code_address);
+}
+
+static GumExecBlock *
+gum_exec_ctx_obtain_shared_block_for (GumExecCtx * ctx,
+                                      gpointer real_address,
+                                      gpointer * code_address)
+{
+  GumStalkerPrivate * priv = ctx->stalker->priv;
+  GumExecBlock * block;
+
+  g_rw_lock_reader_lock (&priv->shared_lock);
+  block = gum_exec_ctx_lookup_block (ctx, priv->shared_mappings, real_address,
+      code_address);
+  g_rw_lock_reader_unlock (&priv->shared_lock);
+
+  if (block != NULL)
+    return block;
+
+  g_rw_lock_writer_lock (&priv->shared_lock);
+
+  /* Another thread may have beaten us to it */
+  block = gum_exec_ctx_lookup_block (ctx, priv->shared_mappings, real_address,
+      code_address);
+  if (block == NULL)
+  {
+    block = gum_exec_ctx_compile_block (ctx, priv->shared_mappings,
+        real_address, code_address);
   }
 
+  g_rw_lock_writer_unlock (&priv->shared_lock);
+
+  return block;
+}
+
+static GumExecBlock *
+gum_exec_ctx_lookup_block (GumExecCtx * ctx,
+                           GumMetalHashTable * mappings,
+                           gpointer real_address,
+                           gpointer * code_address)
+{
+  GumExecBlock * block;
+
+  block = gum_metal_hash_table_lookup (mappings, real_address);
+  if (block == NULL)
+    return NULL;
+
+  if (block->recycle_count >= ctx->stalker->priv->trust_threshold ||
+      memcmp (real_address, block->real_snapshot,
+        block->real_end - block->real_begin) == 0)
+  {
+    if (ctx->shared)
+      g_atomic_int_inc (&block->recycle_count);
+    else
+      block->recycle_count++;
+
+    *code_address = block->code_begin;
+
+    return block;
+  }
+
+  return NULL;
+}
+
+static GumExecBlock *
+gum_exec_ctx_compile_block (GumExecCtx * ctx,
+                            GumMetalHashTable * mappings,
+                            gpointer real_address,
+                            gpointer * code_address)
+{
+  GumExecBlock * block;
+  GumX86Writer * cw = &ctx->code_writer;
+  GumX86Relocator * rl = &ctx->relocator;
+  GumGeneratorContext gc;
+
   block = gum_exec_block_new (ctx);
   *code_address = block->code_begin;
   if (ctx->stalker->priv->trust_threshold >= 0)
-    gum_metal_hash_table_insert (ctx->mappings, real_address, block);
+    gum_metal_hash_table_insert (mappings, real_address, block);
   gum_x86_writer_reset (cw, block->code_begin);
   gum_x86_relocator_reset (rl, real_address, cw);
 
@@ -1273,8 +1713,8 @@ gum_exec_ctx_write_prolog (GumExecCtx * ctx,
     0x0f, 0xae, 0x04, 0x24 /* fxsave [esp] */
   };
 
-  gum_x86_writer_put_mov_near_ptr_reg (cw, GUM_ADDRESS (&ctx->app_stack),
-      GUM_REG_XSP);
+  gum_exec_ctx_write_store_slot (ctx, GUM_EXEC_SLOT (app_stack), GUM_REG_XSP,
+      cw);
   gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XSP,
       GUM_REG_XSP, -GUM_RED_ZONE_SIZE);
 
@@ -1303,8 +1743,8 @@ gum_exec_ctx_write_prolog (GumExecCtx * ctx,
     gum_x86_writer_put_mov_reg_address (cw, GUM_REG_XAX, GUM_ADDRESS (ip));
     gum_x86_writer_put_push_reg (cw, GUM_REG_XAX); /* GumCpuContext.xip */
 
-    gum_x86_writer_put_mov_reg_near_ptr (cw, GUM_REG_XAX,
-        GUM_ADDRESS (&ctx->app_stack));
+    gum_exec_ctx_write_load_slot (ctx, GUM_REG_XAX, GUM_EXEC_SLOT (app_stack),
+        cw);
     gum_x86_writer_put_mov_reg_offset_ptr_reg (cw,
         GUM_REG_XSP, GUM_CPU_CONTEXT_OFFSET_XSP,
         GUM_REG_XAX);
@@ -1353,8 +1793,8 @@ gum_exec_ctx_write_epilog (GumExecCtx * ctx,
 
   gum_x86_writer_put_popfx (cw);
 
-  gum_x86_writer_put_mov_reg_near_ptr (cw, GUM_REG_XSP,
-      GUM_ADDRESS (&ctx->app_stack));
+  gum_exec_ctx_write_load_slot (ctx, GUM_REG_XSP, GUM_EXEC_SLOT (app_stack),
+      cw);
 }
 
 static void
@@ -1461,8 +1901,8 @@ gum_exec_ctx_load_real_register_into (GumExecCtx * ctx,
 #endif
   else if (source_meta == GUM_REG_XSP)
   {
-    gum_x86_writer_put_mov_reg_near_ptr (cw, target_register,
-        GUM_ADDRESS (&ctx->app_stack));
+    gum_exec_ctx_write_load_slot (ctx, target_register,
+        GUM_EXEC_SLOT (app_stack), cw);
     gum_x86_writer_put_lea_reg_reg_offset (cw, target_register,
         target_register, gc->accumulated_stack_delta);
   }
@@ -1481,12 +1921,194 @@ gum_exec_ctx_load_real_register_into (GumExecCtx * ctx,
   }
 }
 
+static void
+gum_exec_ctx_write_load_slot (GumExecCtx * ctx,
+                              GumCpuReg dst_reg,
+                              guint slot_offset,
+                              GumX86Writer * cw)
+{
+#ifdef GUM_STALKER_HAVE_SHARED_CACHE
+  if (ctx->shared)
+  {
+    if (dst_reg != GUM_REG_XSP)
+    {
+      gum_exec_ctx_write_load_ctx (ctx, dst_reg, cw);
+      gum_x86_writer_put_mov_reg_reg_offset_ptr (cw, dst_reg, dst_reg,
+          GUM_EXEC_CTX_FIELD (own_slots) + slot_offset);
+    }
+    else
+    {
+      /* Nothing to spare, so stage the value on the stack and pop it. */
+      gum_x86_writer_put_push_reg (cw, GUM_REG_XAX);
+      gum_x86_writer_put_push_reg (cw, GUM_REG_XAX);
+      gum_exec_ctx_write_load_slot (ctx, GUM_REG_XAX, slot_offset, cw);
+      gum_x86_writer_put_mov_reg_offset_ptr_reg (cw, GUM_REG_XSP, 0,
+          GUM_REG_XAX);
+      gum_x86_writer_put_mov_reg_reg_offset_ptr (cw, GUM_REG_XAX,
+          GUM_REG_XSP, sizeof (gpointer));
+      gum_x86_writer_put_pop_reg (cw, GUM_REG_XSP);
+    }
+    return;
+  }
+#endif
+
+  gum_x86_writer_put_mov_reg_near_ptr (cw, dst_reg,
+      GUM_ADDRESS (ctx->slots) + slot_offset);
+}
+
+static void
+gum_exec_ctx_write_store_slot (GumExecCtx * ctx,
+                               guint slot_offset,
+                               GumCpuReg src_reg,
+                               GumX86Writer * cw)
+{
+#ifdef GUM_STALKER_HAVE_SHARED_CACHE
+  if (ctx->shared)
+  {
+    GumCpuReg base_reg;
+
+    /* May be running on the application's stack, so skip its red zone. */
+    gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XSP,
+        GUM_REG_XSP, -GUM_RED_ZONE_SIZE);
+
+    if (src_reg == GUM_REG_XSP)
+    {
+      gum_x86_writer_put_push_reg (cw, GUM_REG_XAX);
+      gum_x86_writer_put_push_reg (cw, GUM_REG_XCX);
+      gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XCX, GUM_REG_XSP,
+          GUM_RED_ZONE_SIZE + (2 * sizeof (gpointer)));
+      gum_exec_ctx_write_load_ctx (ctx, GUM_REG_XAX, cw);
+      gum_x86_writer_put_mov_reg_offset_ptr_reg (cw, GUM_REG_XAX,
+          GUM_EXEC_CTX_FIELD (own_slots) + slot_offset, GUM_REG_XCX);
+      gum_x86_writer_put_pop_reg (cw, GUM_REG_XCX);
+      gum_x86_writer_put_pop_reg (cw, GUM_REG_XAX);
+    }
+    else
+    {
+      base_reg = (src_reg == GUM_REG_XAX) ? GUM_REG_XCX : GUM_REG_XAX;
+
+      gum_x86_writer_put_push_reg (cw, base_reg);
+      gum_exec_ctx_write_load_ctx (ctx, base_reg, cw);
+      gum_x86_writer_put_mov_reg_offset_ptr_reg (cw, base_reg,
+          GUM_EXEC_CTX_FIELD (own_slots) + slot_offset, src_reg);
+      gum_x86_writer_put_pop_reg (cw, base_reg);
+    }
+
+    gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XSP,
+        GUM_REG_XSP, GUM_RED_ZONE_SIZE);
+    return;
+  }
+#endif
+
+  gum_x86_writer_put_mov_near_ptr_reg (cw,
+      GUM_ADDRESS (ctx->slots) + slot_offset, src_reg);
+}
+
+static void
+gum_exec_ctx_write_jmp_slot (GumExecCtx * ctx,
+                             guint slot_offset,
+                             GumX86Writer * cw)
+{
+#ifdef GUM_STALKER_HAVE_SHARED_CACHE
+  if (ctx->shared)
+  {
+    /*
+     * Every register already holds its application value, so push the
+     * target below the red zone and return to it, dropping the rest.
+     */
+    gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XSP,
+        GUM_REG_XSP, -GUM_RED_ZONE_SIZE);
+    gum_x86_writer_put_push_reg (cw, GUM_REG_XAX);
+    gum_x86_writer_put_push_reg (cw, GUM_REG_XAX);
+    gum_exec_ctx_write_load_slot (ctx, GUM_REG_XAX, slot_offset, cw);
+    gum_x86_writer_put_mov_reg_offset_ptr_reg (cw, GUM_REG_XSP, 0,
+        GUM_REG_XAX);
+    gum_x86_writer_put_mov_reg_reg_offset_ptr (cw, GUM_REG_XAX,
+        GUM_REG_XSP, sizeof (gpointer));
+    gum_x86_writer_put_ret_imm (cw, sizeof (gpointer) + GUM_RED_ZONE_SIZE);
+    return;
+  }
+#endif
+
+  gum_x86_writer_put_jmp_near_ptr (cw,
+      GUM_ADDRESS (ctx->slots) + slot_offset);
+}
+
+static void
+gum_exec_ctx_write_load_ctx (GumExecCtx * ctx,
+                             GumCpuReg dst_reg,
+                             GumX86Writer * cw)
+{
+#ifdef GUM_STALKER_HAVE_SHARED_CACHE
+  if (ctx->shared)
+  {
+    gum_x86_writer_put_mov_reg_fs_u32_ptr (cw, dst_reg,
+        (guint32) ctx->stalker->priv->shared_exec_ctx_offset);
+    return;
+  }
+#endif
+
+  gum_x86_writer_put_mov_reg_address (cw, dst_reg, GUM_ADDRESS (ctx));
+}
+
+static void
+gum_exec_ctx_write_load_ctx_field (GumExecCtx * ctx,
+                                   GumCpuReg dst_reg,
+                                   guint field_offset,
+                                   GumX86Writer * cw)
+{
+  if (ctx->shared)
+  {
+    GumCpuReg base_reg = (dst_reg >= GUM_REG_XAX)
+        ? dst_reg
+        : gum_cpu_meta_reg_from_real_reg (dst_reg);
+
+    gum_exec_ctx_write_load_ctx (ctx, base_reg, cw);
+    gum_x86_writer_put_mov_reg_reg_offset_ptr (cw, dst_reg, base_reg,
+        field_offset);
+  }
+  else
+  {
+    gum_x86_writer_put_mov_reg_near_ptr (cw, dst_reg,
+        GUM_ADDRESS (ctx) + field_offset);
+  }
+}
+
+static void
+gum_exec_ctx_write_load_depth (GumExecCtx * ctx,
+                               GumCpuReg dst_reg,
+                               GumCpuReg scratch_reg,
+                               GumX86Writer * cw)
+{
+  gum_exec_ctx_write_load_slot (ctx, dst_reg, GUM_EXEC_SLOT (first_frame),
+      cw);
+  if (ctx->shared)
+  {
+    gum_exec_ctx_write_load_slot (ctx, scratch_reg,
+        GUM_EXEC_SLOT (current_frame), cw);
+    gum_x86_writer_put_sub_reg_reg (cw, dst_reg, scratch_reg);
+  }
+  else
+  {
+    gum_x86_writer_put_sub_reg_near_ptr (cw, dst_reg,
+        GUM_ADDRESS (ctx->slots) + GUM_EXEC_SLOT (current_frame));
+  }
+#if GLIB_SIZEOF_VOID_P == 4
+  gum_x86_writer_put_shr_reg_u8 (cw, dst_reg, 3);
+#else
+  gum_x86_writer_put_shr_reg_u8 (cw, dst_reg, 4);
+#endif
+}
+
 static GumExecBlock *
 gum_exec_block_new (GumExecCtx * ctx)
 {
-  GumSlab * slab = ctx->code_slab;
+  GumSlab ** code_slab = ctx->shared
+      ? &ctx->stalker->priv->shared_code_slab
+      : &ctx->code_slab;
+  GumSlab * slab = *code_slab;
 
-  if (slab->size - slab->offset >= GUM_EXEC_BLOCK_MIN_SIZE)
+  if (slab != NULL && slab->size - slab->offset >= GUM_EXEC_BLOCK_MIN_SIZE)
   {
     GumExecBlock * block = (GumExecBlock *) (slab->data + slab->offset);
 
@@ -1507,7 +2129,7 @@ gum_exec_block_new (GumExecCtx * ctx)
     return block;
   }
 
-  if (ctx->stalker->priv->trust_threshold < 0)
+  if (!ctx->shared && ctx->stalker->priv->trust_threshold < 0)
   {
     ctx->code_slab->offset = 0;
 
@@ -1519,26 +2141,12 @@ gum_exec_block_new (GumExecCtx * ctx)
   slab->offset = 0;
   slab->size = (GUM_CODE_SLAB_SIZE_IN_PAGES * ctx->stalker->priv->page_size)
       - sizeof (GumSlab);
-  slab->next = ctx->code_slab;
-  ctx->code_slab = slab;
+  slab->next = *code_slab;
+  *code_slab = slab;
 
   return gum_exec_block_new (ctx);
 }
 
-static GumExecBlock *
-gum_exec_block_obtain (GumExecCtx * ctx,
-                       gpointer real_address,
-                       gpointer * code_address)
-{
-  GumExecBlock * block;
-
-  block = gum_metal_hash_table_lookup (ctx->mappings, real_address);
-  if (block != NULL)
-    *code_address = block->code_begin;
-
-  return block;
-}
-
 static gboolean
 gum_exec_block_is_full (GumExecBlock * block)
 {
@@ -1587,16 +2195,16 @@ gum_exec_block_backpatch_call (GumExecBlock * block,
       gum_x86_writer_put_push_reg (cw, GUM_REG_XCX);
     }
 
-    gum_x86_writer_put_mov_reg_near_ptr (cw, GUM_REG_XCX,
-        GUM_ADDRESS (&block->ctx->current_frame));
+    gum_exec_ctx_write_load_slot (ctx, GUM_REG_XCX,
+        GUM_EXEC_SLOT (current_frame), cw);
     gum_x86_writer_put_test_reg_u32 (cw, GUM_REG_XCX,
-        block->ctx->stalker->priv->page_size - 1);
+        ctx->stalker->priv->page_size - 1);
     gum_x86_writer_put_jcc_short_label (cw, GUM_X86_JZ, beach_label,
         GUM_UNLIKELY);
 
     gum_x86_writer_put_sub_reg_imm (cw, GUM_REG_XCX, sizeof (GumExecFrame));
-    gum_x86_writer_put_mov_near_ptr_reg (cw,
-        GUM_ADDRESS (&block->ctx->current_frame), GUM_REG_XCX);
+    gum_exec_ctx_write_store_slot (ctx, GUM_EXEC_SLOT (current_frame),
+        GUM_REG_XCX, cw);
 
     gum_x86_writer_put_mov_reg_address (cw, GUM_REG_XAX,
         GUM_ADDRESS (ret_real_address));
@@ -1926,16 +2534,16 @@ gum_exec_block_virtualize_sysenter_insn (GumExecBlock * block,
   /* but first, check if we've been asked to unfollow,
    * in which case we'll enter the Stalker so the unfollow can
    * be completed... */
-  gum_x86_writer_put_mov_reg_near_ptr (cw, GUM_REG_EAX,
-      GUM_ADDRESS (&block->ctx->state));
+  gum_exec_ctx_write_load_ctx_field (block->ctx, GUM_REG_EAX,
+      GUM_EXEC_CTX_FIELD (state), cw);
   gum_x86_writer_put_cmp_reg_i32 (cw, GUM_REG_EAX,
       GUM_EXEC_CTX_UNFOLLOW_PENDING);
   gum_x86_writer_put_jcc_short_label (cw, GUM_X86_JZ,
       resolve_dynamically_label, GUM_UNLIKELY);
 
   /* check frame at the top of the stack */
-  gum_x86_writer_put_mov_reg_near_ptr (cw, GUM_REG_EAX,
-      GUM_ADDRESS (&block->ctx->current_frame));
+  gum_exec_ctx_write_load_slot (block->ctx, GUM_REG_EAX,
+      GUM_EXEC_SLOT (current_frame), cw);
   gum_x86_writer_put_cmp_reg_offset_ptr_reg (cw,
       GUM_REG_EAX, G_STRUCT_OFFSET (GumExecFrame, real_address),
       GUM_REG_EDX);
@@ -1948,8 +2556,8 @@ gum_exec_block_virtualize_sysenter_insn (GumExecBlock * block,
 
   /* pop from our stack */
   gum_x86_writer_put_add_reg_imm (cw, GUM_REG_EAX, sizeof (GumExecFrame));
-  gum_x86_writer_put_mov_near_ptr_reg (cw,
-      GUM_ADDRESS (&block->ctx->current_frame), GUM_REG_EAX);
+  gum_exec_ctx_write_store_slot (block->ctx, GUM_EXEC_SLOT (current_frame),
+      GUM_REG_EAX, cw);
 
   /* proceeed to block */
   gum_x86_writer_put_pop_reg (cw, GUM_REG_EAX);
@@ -1967,8 +2575,7 @@ gum_exec_block_virtualize_sysenter_insn (GumExecBlock * block,
 
   gum_x86_writer_put_mov_reg_near_ptr (cw, GUM_THUNK_REG_ARG1,
       GUM_ADDRESS (saved_ret_addr));
-  gum_x86_writer_put_mov_reg_address (cw, GUM_THUNK_REG_ARG0,
-      GUM_ADDRESS (block->ctx));
+  gum_exec_ctx_write_load_ctx (block->ctx, GUM_THUNK_REG_ARG0, cw);
   gum_x86_writer_put_sub_reg_imm (cw, GUM_REG_ESP,
       GUM_THUNK_ARGLIST_STACK_RESERVE);
   gum_x86_writer_put_mov_reg_address (cw, GUM_REG_XAX,
@@ -1978,7 +2585,7 @@ gum_exec_block_virtualize_sysenter_insn (GumExecBlock * block,
       GUM_THUNK_ARGLIST_STACK_RESERVE);
 
   gum_exec_block_close_prolog (block, gc);
-  gum_x86_writer_put_jmp_near_ptr (cw, GUM_ADDRESS (&block->ctx->resume_at));
+  gum_exec_ctx_write_jmp_slot (block->ctx, GUM_EXEC_SLOT (resume_at), cw);
 
   gum_x86_relocator_skip_one_no_label (gc->relocator);
 
@@ -2008,29 +2615,32 @@ gum_exec_block_write_call_invoke_code (GumExecBlock * block,
   call_code_start = cw->code;
   opened_prolog = gc->opened_prolog;
 
-  /* We can backpatch if we have some trust and the call's target is static */
+  /*
+   * We can backpatch if we have some trust and the call's target is static,
+   * unless the block is shared and thus might be running on other threads
+   */
   can_backpatch = (block->ctx->stalker->priv->trust_threshold >= 0 &&
+      !block->ctx->shared &&
       !target->is_indirect &&
       target->base == X86_REG_INVALID);
 
   gum_exec_block_open_prolog (block, GUM_PROLOG_MINIMAL, gc);
 
   /* fill in placeholder with application's retaddr */
-  gum_x86_writer_put_mov_reg_near_ptr (cw, GUM_REG_XAX,
-      GUM_ADDRESS (&block->ctx->app_stack));
+  gum_exec_ctx_write_load_slot (block->ctx, GUM_REG_XAX,
+      GUM_EXEC_SLOT (app_stack), cw);
   gum_x86_writer_put_sub_reg_imm (cw, GUM_REG_XAX, sizeof (gpointer));
   gum_x86_writer_put_mov_reg_address (cw, GUM_REG_XCX,
       GUM_ADDRESS (gc->instruction->end));
   gum_x86_writer_put_mov_reg_ptr_reg (cw, GUM_REG_XAX, GUM_REG_XCX);
-  gum_x86_writer_put_mov_near_ptr_reg (cw,
-      GUM_ADDRESS (&block->ctx->app_stack), GUM_REG_XAX);
+  gum_exec_ctx_write_store_slot (block->ctx, GUM_EXEC_SLOT (app_stack),
+      GUM_REG_XAX, cw);
   gc->accumulated_stack_delta += sizeof (gpointer);
 
   /* generate code for the target */
   gum_exec_ctx_write_push_branch_target_address (block->ctx, target, gc);
   gum_x86_writer_put_pop_reg (cw, GUM_THUNK_REG_ARG1);
-  gum_x86_writer_put_mov_reg_address (cw, GUM_THUNK_REG_ARG0,
-      GUM_ADDRESS (block->ctx));
+  gum_exec_ctx_write_load_ctx (block->ctx, GUM_THUNK_REG_ARG0, cw);
   gum_x86_writer_put_sub_reg_imm (cw, GUM_REG_XSP,
       GUM_THUNK_ARGLIST_STACK_RESERVE);
   gum_x86_writer_put_mov_reg_address (cw, GUM_REG_XAX,
@@ -2059,8 +2669,7 @@ gum_exec_block_write_call_invoke_code (GumExecBlock * block,
 
   gum_x86_writer_put_mov_reg_address (cw, GUM_THUNK_REG_ARG1,
       GUM_ADDRESS (ret_real_address));
-  gum_x86_writer_put_mov_reg_address (cw, GUM_THUNK_REG_ARG0,
-      GUM_ADDRESS (block->ctx));
+  gum_exec_ctx_write_load_ctx (block->ctx, GUM_THUNK_REG_ARG0, cw);
   gum_x86_writer_put_sub_reg_imm (cw, GUM_REG_XSP,
       GUM_THUNK_ARGLIST_STACK_RESERVE);
   gum_x86_writer_put_mov_reg_address (cw, GUM_REG_XAX,
@@ -2070,29 +2679,32 @@ gum_exec_block_write_call_invoke_code (GumExecBlock * block,
       GUM_THUNK_ARGLIST_STACK_RESERVE);
   gum_x86_writer_put_mov_reg_reg (cw, GUM_REG_XDX, GUM_REG_XAX);
 
-  gum_x86_writer_put_mov_reg_near_ptr (cw, GUM_REG_XAX,
-      GUM_ADDRESS (&block->ctx->current_block));
-  gum_x86_writer_put_call_with_arguments (cw,
-      GUM_FUNCPTR_TO_POINTER (gum_exec_block_backpatch_ret), 3,
-      GUM_ARG_REGISTER, GUM_REG_XAX,
-      GUM_ARG_POINTER, ret_code_address,
-      GUM_ARG_REGISTER, GUM_REG_XDX);
+  if (!block->ctx->shared)
+  {
+    gum_x86_writer_put_mov_reg_near_ptr (cw, GUM_REG_XAX,
+        GUM_ADDRESS (&block->ctx->current_block));
+    gum_x86_writer_put_call_with_arguments (cw,
+        GUM_FUNCPTR_TO_POINTER (gum_exec_block_backpatch_ret), 3,
+        GUM_ARG_REGISTER, GUM_REG_XAX,
+        GUM_ARG_POINTER, ret_code_address,
+        GUM_ARG_REGISTER, GUM_REG_XDX);
+  }
 
   gum_exec_ctx_write_epilog (block->ctx, GUM_PROLOG_MINIMAL, cw);
-  gum_x86_writer_put_jmp_near_ptr (cw, GUM_ADDRESS (&block->ctx->resume_at));
+  gum_exec_ctx_write_jmp_slot (block->ctx, GUM_EXEC_SLOT (resume_at), cw);
 
   /* push frame on stack */
   gum_x86_writer_put_label (cw, perform_stack_push);
-  gum_x86_writer_put_mov_reg_near_ptr (cw, GUM_REG_XCX,
-      GUM_ADDRESS (&block->ctx->current_frame));
+  gum_exec_ctx_write_load_slot (block->ctx, GUM_REG_XCX,
+      GUM_EXEC_SLOT (current_frame), cw);
   gum_x86_writer_put_test_reg_u32 (cw, GUM_REG_XCX,
       block->ctx->stalker->priv->page_size - 1);
   gum_x86_writer_put_jcc_short_label (cw, GUM_X86_JZ, skip_stack_push,
       GUM_UNLIKELY);
 
   gum_x86_writer_put_sub_reg_imm (cw, GUM_REG_XCX, sizeof (GumExecFrame));
-  gum_x86_writer_put_mov_near_ptr_reg (cw,
-      GUM_ADDRESS (&block->ctx->current_frame), GUM_REG_XCX);
+  gum_exec_ctx_write_store_slot (block->ctx, GUM_EXEC_SLOT (current_frame),
+      GUM_REG_XCX, cw);
 
   gum_x86_writer_put_mov_reg_address (cw, GUM_REG_XAX,
       GUM_ADDRESS (ret_real_address));
@@ -2118,7 +2730,7 @@ gum_exec_block_write_call_invoke_code (GumExecBlock * block,
 
   /* execute the generated code */
   gum_exec_block_close_prolog (block, gc);
-  gum_x86_writer_put_jmp_near_ptr (cw, GUM_ADDRESS (&block->ctx->resume_at));
+  gum_exec_ctx_write_jmp_slot (block->ctx, GUM_EXEC_SLOT (resume_at), cw);
 }
 
 static void
@@ -2137,8 +2749,7 @@ gum_exec_block_write_jmp_transfer_code (GumExecBlock * block,
 
   gum_exec_ctx_write_push_branch_target_address (block->ctx, target, gc);
   gum_x86_writer_put_pop_reg (cw, GUM_THUNK_REG_ARG1);
-  gum_x86_writer_put_mov_reg_address (cw, GUM_THUNK_REG_ARG0,
-      GUM_ADDRESS (block->ctx));
+  gum_exec_ctx_write_load_ctx (block->ctx, GUM_THUNK_REG_ARG0, cw);
   gum_x86_writer_put_sub_reg_imm (cw, GUM_REG_XSP,
       GUM_THUNK_ARGLIST_STACK_RESERVE);
   gum_x86_writer_put_mov_reg_address (cw, GUM_REG_XAX,
@@ -2148,6 +2759,7 @@ gum_exec_block_write_jmp_transfer_code (GumExecBlock * block,
       GUM_THUNK_ARGLIST_STACK_RESERVE);
 
   if (block->ctx->stalker->priv->trust_threshold >= 0 &&
+      !block->ctx->shared &&
       !target->is_indirect &&
       target->base == X86_REG_INVALID)
   {
@@ -2160,7 +2772,7 @@ gum_exec_block_write_jmp_transfer_code (GumExecBlock * block,
   }
 
   gum_exec_block_close_prolog (block, gc);
-  gum_x86_writer_put_jmp_near_ptr (cw, GUM_ADDRESS (&block->ctx->resume_at));
+  gum_exec_ctx_write_jmp_slot (block->ctx, GUM_EXEC_SLOT (resume_at), cw);
 }
 
 static void
@@ -2183,12 +2795,12 @@ gum_exec_block_write_ret_transfer_code (GumExecBlock * block,
    * return address on the stack */
   gum_x86_writer_put_mov_reg_address (cw, GUM_REG_XAX,
       GUM_ADDRESS (gc->instruction->begin));
-  gum_x86_writer_put_mov_near_ptr_reg (cw,
-      GUM_ADDRESS (&block->ctx->return_at), GUM_REG_XAX);
+  gum_exec_ctx_write_store_slot (block->ctx, GUM_EXEC_SLOT (return_at),
+      GUM_REG_XAX, cw);
 
   /* check frame at the top of the stack */
-  gum_x86_writer_put_mov_reg_near_ptr (cw, GUM_REG_XDX,
-      GUM_ADDRESS (&block->ctx->current_frame));
+  gum_exec_ctx_write_load_slot (block->ctx, GUM_REG_XDX,
+      GUM_EXEC_SLOT (current_frame), cw);
   gum_x86_writer_put_mov_reg_reg_ptr (cw, GUM_REG_XAX, GUM_REG_XDX);
   gum_x86_writer_put_cmp_reg_offset_ptr_reg (cw,
       GUM_REG_XSP, 3 * sizeof (gpointer),
@@ -2205,21 +2817,21 @@ gum_exec_block_write_ret_transfer_code (GumExecBlock * block,
 
   /* pop from our stack */
   gum_x86_writer_put_add_reg_imm (cw, GUM_REG_XDX, sizeof (GumExecFrame));
-  gum_x86_writer_put_mov_near_ptr_reg (cw,
-      GUM_ADDRESS (&block->ctx->current_frame), GUM_REG_XDX);
+  gum_exec_ctx_write_store_slot (block->ctx, GUM_EXEC_SLOT (current_frame),
+      GUM_REG_XDX, cw);
 
   /* proceeed to block */
   gum_x86_writer_put_pop_reg (cw, GUM_REG_XDX);
   gum_x86_writer_put_pop_reg (cw, GUM_REG_XAX);
   gum_x86_writer_put_popfx (cw);
-  gum_x86_writer_put_jmp_near_ptr (cw, GUM_ADDRESS (&block->ctx->return_at));
+  gum_exec_ctx_write_jmp_slot (block->ctx, GUM_EXEC_SLOT (return_at), cw);
 
   gum_x86_writer_put_label (cw, resolve_dynamically_label);
   /* clear our stack so we might resync later */
-  gum_x86_writer_put_mov_reg_near_ptr (cw, GUM_REG_XDX,
-      GUM_ADDRESS (&block->ctx->first_frame));
-  gum_x86_writer_put_mov_near_ptr_reg (cw,
-      GUM_ADDRESS (&block->ctx->current_frame), GUM_REG_XDX);
+  gum_exec_ctx_write_load_slot (block->ctx, GUM_REG_XDX,
+      GUM_EXEC_SLOT (first_frame), cw);
+  gum_exec_ctx_write_store_slot (block->ctx, GUM_EXEC_SLOT (current_frame),
+      GUM_REG_XDX, cw);
   gum_x86_writer_put_pop_reg (cw, GUM_REG_XDX);
   gum_x86_writer_put_pop_reg (cw, GUM_REG_XAX);
   gum_x86_writer_put_popfx (cw);
@@ -2229,11 +2841,10 @@ gum_exec_block_write_ret_transfer_code (GumExecBlock * block,
    */
   gum_exec_block_open_prolog (block, GUM_PROLOG_MINIMAL, gc);
 
-  gum_x86_writer_put_mov_reg_near_ptr (cw, GUM_REG_XAX,
-      GUM_ADDRESS (&block->ctx->app_stack));
+  gum_exec_ctx_write_load_slot (block->ctx, GUM_REG_XAX,
+      GUM_EXEC_SLOT (app_stack), cw);
   gum_x86_writer_put_mov_reg_reg_ptr (cw, GUM_THUNK_REG_ARG1, GUM_REG_XAX);
-  gum_x86_writer_put_mov_reg_address (cw, GUM_THUNK_REG_ARG0,
-      GUM_ADDRESS (block->ctx));
+  gum_exec_ctx_write_load_ctx (block->ctx, GUM_THUNK_REG_ARG0, cw);
   gum_x86_writer_put_sub_reg_imm (cw, GUM_REG_XSP,
       GUM_THUNK_ARGLIST_STACK_RESERVE);
 
@@ -2243,13 +2854,13 @@ gum_exec_block_write_ret_transfer_code (GumExecBlock * block,
 
   gum_x86_writer_put_add_reg_imm (cw, GUM_REG_XSP,
       GUM_THUNK_ARGLIST_STACK_RESERVE);
-  gum_x86_writer_put_mov_reg_near_ptr (cw, GUM_REG_XAX,
-      GUM_ADDRESS (&block->ctx->app_stack));
-  gum_x86_writer_put_mov_reg_near_ptr (cw, GUM_REG_XCX,
-      GUM_ADDRESS (&block->ctx->resume_at));
+  gum_exec_ctx_write_load_slot (block->ctx, GUM_REG_XAX,
+      GUM_EXEC_SLOT (app_stack), cw);
+  gum_exec_ctx_write_load_slot (block->ctx, GUM_REG_XCX,
+      GUM_EXEC_SLOT (resume_at), cw);
   gum_x86_writer_put_mov_reg_ptr_reg (cw, GUM_REG_XAX, GUM_REG_XCX);
   gum_exec_block_close_prolog (block, gc);
-  gum_x86_writer_put_jmp_near_ptr (cw, GUM_ADDRESS (&block->ctx->return_at));
+  gum_exec_ctx_write_jmp_slot (block->ctx, GUM_EXEC_SLOT (return_at), cw);
 }
 
 static void
@@ -2292,15 +2903,7 @@ gum_exec_block_write_call_event_code (GumExecBlock * block,
       GUM_REG_XAX, G_STRUCT_OFFSET (GumCallEvent, target),
       GUM_REG_XCX);
 
-  gum_x86_writer_put_mov_reg_near_ptr (cw, GUM_REG_XCX,
-      GUM_ADDRESS (&block->ctx->first_frame));
-  gum_x86_writer_put_sub_reg_near_ptr (cw, GUM_REG_XCX,
-      GUM_ADDRESS (&block->ctx->current_frame));
-#if GLIB_SIZEOF_VOID_P == 4
-  gum_x86_writer_put_shr_reg_u8 (cw, GUM_REG_XCX, 3);
-#else
-  gum_x86_writer_put_shr_reg_u8 (cw, GUM_REG_XCX, 4);
-#endif
+  gum_exec_ctx_write_load_depth (block->ctx, GUM_REG_XCX, GUM_REG_XDX, cw);
   gum_x86_writer_put_mov_reg_offset_ptr_reg (cw,
       GUM_REG_XAX, G_STRUCT_OFFSET (GumCallEvent, depth),
       GUM_REG_XCX);
@@ -2324,22 +2927,14 @@ gum_exec_block_write_ret_event_code (GumExecBlock * block,
       GUM_REG_XAX, G_STRUCT_OFFSET (GumRetEvent, location),
       GUM_REG_XCX);
 
-  gum_x86_writer_put_mov_reg_near_ptr (cw, GUM_REG_XDX,
-      GUM_ADDRESS (&block->ctx->app_stack));
+  gum_exec_ctx_write_load_slot (block->ctx, GUM_REG_XDX,
+      GUM_EXEC_SLOT (app_stack), cw);
   gum_x86_writer_put_mov_reg_reg_ptr (cw, GUM_REG_XDX, GUM_REG_XDX);
   gum_x86_writer_put_mov_reg_offset_ptr_reg (cw,
       GUM_REG_XAX, G_STRUCT_OFFSET (GumRetEvent, target),
       GUM_REG_XDX);
 
-  gum_x86_writer_put_mov_reg_near_ptr (cw, GUM_REG_XCX,
-      GUM_ADDRESS (&block->ctx->first_frame));
-  gum_x86_writer_put_sub_reg_near_ptr (cw, GUM_REG_XCX,
-      GUM_ADDRESS (&block->ctx->current_frame));
-#if GLIB_SIZEOF_VOID_P == 4
-  gum_x86_writer_put_shr_reg_u8 (cw, GUM_REG_XCX, 3);
-#else
-  gum_x86_writer_put_shr_reg_u8 (cw, GUM_REG_XCX, 4);
-#endif
+  gum_exec_ctx_write_load_depth (block->ctx, GUM_REG_XCX, GUM_REG_XDX, cw);
   gum_x86_writer_put_mov_reg_offset_ptr_reg (cw,
       GUM_REG_XAX, G_STRUCT_OFFSET (GumCallEvent, depth),
       GUM_REG_ECX);
@@ -2372,8 +2967,8 @@ gum_exec_block_write_event_init_code (GumExecBlock * block,
                                       GumGeneratorContext * gc)
 {
   GumX86Writer * cw = gc->code_writer;
-  gum_x86_writer_put_mov_reg_address (cw, GUM_REG_XAX,
-      GUM_ADDRESS (&block->ctx->tmp_event));
+  gum_exec_ctx_write_load_slot (block->ctx, GUM_REG_XAX,
+      GUM_EXEC_SLOT (event_cursor), cw);
   gum_x86_writer_put_mov_reg_offset_ptr_u32 (cw,
       GUM_REG_XAX, G_STRUCT_OFFSET (GumAnyEvent, type),
       type);
@@ -2387,47 +2982,62 @@ gum_exec_block_write_event_submit_code (GumExecBlock * block,
   GumExecCtx * ctx = block->ctx;
   GumX86Writer * cw = gc->code_writer;
   gconstpointer beach_label = cw->code + 1;
+  gconstpointer flush_done_label = cw->code + 2;
   GumPrologType opened_prolog;
+#if GLIB_SIZEOF_VOID_P == 4
+  guint align_correction = 12;
+#endif
 
+  /* commit the event and hand over the batch once the buffer is full */
+  gum_x86_writer_put_add_reg_imm (cw, GUM_REG_XAX, sizeof (GumEvent));
+  gum_exec_ctx_write_store_slot (ctx, GUM_EXEC_SLOT (event_cursor),
+      GUM_REG_XAX, cw);
+  gum_exec_ctx_write_load_slot (ctx, GUM_REG_XCX, GUM_EXEC_SLOT (event_end),
+      cw);
+  gum_x86_writer_put_cmp_reg_reg (cw, GUM_REG_XAX, GUM_REG_XCX);
+  gum_x86_writer_put_jcc_short_label (cw, GUM_X86_JB, flush_done_label,
+      GUM_LIKELY);
+  gum_exec_ctx_write_load_ctx (ctx, GUM_REG_XCX, cw);
 #if GLIB_SIZEOF_VOID_P == 4
-  guint align_correction = 8;
   gum_x86_writer_put_sub_reg_imm (cw, GUM_REG_XSP, align_correction);
 #endif
   gum_x86_writer_put_call_with_arguments (cw,
-      block->ctx->sink_process_impl, 2,
-      GUM_ARG_POINTER, block->ctx->sink,
-      GUM_ARG_REGISTER, GUM_REG_XAX);
+      GUM_FUNCPTR_TO_POINTER (gum_exec_ctx_flush_events), 1,
+      GUM_ARG_REGISTER, GUM_REG_XCX);
 #if GLIB_SIZEOF_VOID_P == 4
   gum_x86_writer_put_add_reg_imm (cw, GUM_REG_XSP, align_correction);
 #endif
+  gum_x86_writer_put_label (cw, flush_done_label);
 
   if (cc == GUM_CODE_INTERRUPTIBLE)
   {
     /* check if we've been asked to unfollow */
-    gum_x86_writer_put_mov_reg_near_ptr (cw, GUM_REG_EAX,
-        GUM_ADDRESS (&ctx->state));
+    gum_exec_ctx_write_load_ctx_field (ctx, GUM_REG_EAX,
+        GUM_EXEC_CTX_FIELD (state), cw);
     gum_x86_writer_put_cmp_reg_i32 (cw, GUM_REG_EAX,
         GUM_EXEC_CTX_UNFOLLOW_PENDING);
     gum_x86_writer_put_jcc_short_label (cw, GUM_X86_JNZ, beach_label, GUM_LIKELY);
+    gum_exec_ctx_write_load_ctx (ctx, GUM_REG_XCX, cw);
     gum_x86_writer_put_call_with_arguments (cw,
         GUM_FUNCPTR_TO_POINTER (gum_exec_ctx_unfollow), 2,
-        GUM_ARG_POINTER, ctx,
+        GUM_ARG_REGISTER, GUM_REG_XCX,
         GUM_ARG_POINTER, gc->instruction->begin);
     opened_prolog = gc->opened_prolog;
     gum_exec_block_close_prolog (block, gc);
     gc->opened_prolog = opened_prolog;
-    gum_x86_writer_put_jmp_near_ptr (cw, GUM_ADDRESS (&ctx->resume_at));
+    gum_exec_ctx_write_jmp_slot (ctx, GUM_EXEC_SLOT (resume_at), cw);
 
     gum_x86_writer_put_label (cw, beach_label);
   }
 }
 
 static void
-gum_exec_block_invoke_call_probes_for_target (GumExecBlock * block,
+gum_exec_block_invoke_call_probes_for_target (GumStalker * stalker,
+                                              GumExecBlock * block,
                                               gpointer target_address,
                                               GumCpuContext * cpu_context)
 {
-  GumStalkerPrivate * priv = block->ctx->stalker->priv;
+  GumStalkerPrivate * priv = stalker->priv;
   GArray * probes;
 
   gum_spinlock_acquire (&priv->probe_lock);
@@ -2440,7 +3050,8 @@ gum_exec_block_invoke_call_probes_for_target (GumExecBlock * block,
     guint i;
 
     call_site.block_address = block->real_begin;
-    call_site.stack_data = block->ctx->app_stack;
+    call_site.stack_data =
+        GSIZE_TO_POINTER (GUM_CPU_CONTEXT_XSP (cpu_context));
     call_site.cpu_context = cpu_context;
 
     for (i = 0; i != probes->len; i++)
@@ -2474,10 +3085,6 @@ gum_exec_block_write_call_probe_code (GumExecBlock * block,
 
   if (!skip_probing)
   {
-#if GLIB_SIZEOF_VOID_P == 4
-    guint align_correction = 4;
-#endif
-
     if (gc->opened_prolog != GUM_PROLOG_NONE)
       gum_exec_block_close_prolog (block, gc);
     gum_exec_block_open_prolog (block, GUM_PROLOG_FULL, gc);
@@ -2485,17 +3092,12 @@ gum_exec_block_write_call_probe_code (GumExecBlock * block,
     gum_exec_ctx_write_push_branch_target_address (block->ctx, target, gc);
     gum_x86_writer_put_pop_reg (cw, GUM_REG_XAX);
 
-#if GLIB_SIZEOF_VOID_P == 4
-    gum_x86_writer_put_sub_reg_imm (cw, GUM_REG_XSP, align_correction);
-#endif
     gum_x86_writer_put_call_with_arguments (cw,
-        GUM_FUNCPTR_TO_POINTER (gum_exec_block_invoke_call_probes_for_target), 3,
+        GUM_FUNCPTR_TO_POINTER (gum_exec_block_invoke_call_probes_for_target), 4,
+        GUM_ARG_POINTER, block->ctx->stalker,
         GUM_ARG_POINTER, block,
         GUM_ARG_REGISTER, GUM_REG_XAX,
         GUM_ARG_REGISTER, GUM_REG_XBX);
-#if GLIB_SIZEOF_VOID_P == 4
-    gum_x86_writer_put_add_reg_imm (cw, GUM_REG_XSP, align_correction);
-#endif
   }
 }
 
@@ -2756,7 +3358,7 @@ gum_stalker_on_exception (GumExceptionDetails * details,
 
       gum_exec_ctx_replace_current_block_with (ctx,
           GSIZE_TO_POINTER (cpu_context->eip));
-      cpu_context->eip = (DWORD) ctx->resume_at;
+      cpu_context->eip = (DWORD) ctx->slots->resume_at;
 
       block->state = GUM_EXEC_NORMAL;
 
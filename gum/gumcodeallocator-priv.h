@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#ifndef __GUM_CODE_ALLOCATOR_PRIV_H__
+#define __GUM_CODE_ALLOCATOR_PRIV_H__
+
+#include "gumcodeallocator.h"
+
+#define GUM_CODE_DEFLECTOR_TABLE_MIN_CAPACITY 16
+#define GUM_CODE_DEFLECTOR_TOMBSTONE GSIZE_TO_POINTER (1)
+
+typedef struct _GumCodeDeflectorTable GumCodeDeflectorTable;
+typedef struct _GumCodeDeflectorTableEntry GumCodeDeflectorTableEntry;
+
+struct _GumCodeDeflectorTableEntry
+{
+  gpointer volatile return_address;
+  gpointer volatile target;
+};
+
+/*
+ * Open-addressed and only ever appended to while live, so the dispatcher can
+ * look up callers without taking a lock. Removed entries become tombstones,
+ * and the table is replaced by a fresh one once it fills up.
+ */
+struct _GumCodeDeflectorTable
+{
+  guint capacity;
+  guint used;
+  GumCodeDeflectorTableEntry entries[1];
+};
+
+G_GNUC_INTERNAL GumCodeDeflectorTable * _gum_code_deflector_table_new (
+    guint capacity);
+G_GNUC_INTERNAL GumCodeDeflectorTable * _gum_code_deflector_table_new_for (
+    GumList * callers, guint caller_count);
+G_GNUC_INTERNAL void _gum_code_deflector_table_free (
+    GumCodeDeflectorTable * table);
+G_GNUC_INTERNAL gboolean _gum_code_deflector_table_is_full (
+    GumCodeDeflectorTable * self);
+G_GNUC_INTERNAL GumCodeDeflectorTableEntry * _gum_code_deflector_table_find (
+    GumCodeDeflectorTable * self, gpointer return_address);
+G_GNUC_INTERNAL void _gum_code_deflector_table_insert (
+    GumCodeDeflectorTable * self, gpointer return_address, gpointer target);
+G_GNUC_INTERNAL void _gum_code_deflector_table_remove (
+    GumCodeDeflectorTableEntry * entry);
+
+#endif
@@ -4,7 +4,7 @@
  * Licence: wxWindows Library Licence, Version 3.1
  */
 
-#include "gumcodeallocator.h"
+#include "gumcodeallocator-priv.h"
 
 #include "gummemory.h"
 #include "gumprocess.h"
@@ -24,19 +24,62 @@
     allocator->page_size - allocator->header_size))
 #define GUM_CODE_PAGE_DATA(ptr, allocator) \
     (GSIZE_TO_POINTER (GPOINTER_TO_SIZE (ptr) & ~(allocator->page_size - 1)))
+#define GUM_CODE_PAGE_HEADER_SIZE(n) \
+    (G_STRUCT_OFFSET (GumCodePage, slice) + ((n) * sizeof (GumCodeSlice)))
+
+#define GUM_CODE_MASK_BITS (GLIB_SIZEOF_LONG * 8)
+
+#define GUM_CODE_REGION_SHIFT 20
+#define GUM_CODE_REGION_SIZE (G_GUINT64_CONSTANT (1) << GUM_CODE_REGION_SHIFT)
+#define GUM_CODE_REGION_BASE(address) \
+    ((address) & ~(GUM_CODE_REGION_SIZE - 1))
 
 typedef struct _GumCodePage GumCodePage;
+typedef struct _GumCodeRegion GumCodeRegion;
 typedef struct _GumCodeDeflectorDispatcher GumCodeDeflectorDispatcher;
 typedef struct _GumProbeRangeForCodeCaveContext GumProbeRangeForCodeCaveContext;
 
 struct _GumCodePage
 {
+  GumCodePageInfo * info;
   GumCodeSlice slice[1];
 };
 
+/*
+ * Kept outside of the page so that the bookkeeping can be updated without
+ * touching the page's protection on systems without RWX support.
+ */
+struct _GumCodePageInfo
+{
+  GumCodePage * page;
+  gpointer data;
+
+  GumCodePageInfo * prev;
+  GumCodePageInfo * next;
+
+  GumCodeRegion * region;
+  GumCodePageInfo * prev_free;
+  GumCodePageInfo * next_free;
+
+  guint free_count;
+  gulong free_mask[1];
+};
+
+/* Pages with free slices, bucketed by address for near allocations. */
+struct _GumCodeRegion
+{
+  GumAddress base;
+  GumCodePageInfo * free_pages;
+};
+
 struct _GumCodeDeflectorDispatcher
 {
   GumList * callers;
+  guint caller_count;
+
+  GumCodeDeflectorTable * volatile table;
+  GumList * retired_tables;
+  volatile gint active_lookups;
 
   gpointer address;
   gpointer trampoline;
@@ -53,23 +96,38 @@ struct _GumProbeRangeForCodeCaveContext
   GumMemoryRange cave;
 };
 
-static GumCodePage * gum_code_allocator_try_alloc_page_near (
+static GumCodeSlice * gum_code_allocator_try_alloc_free_slice (
+    GumCodeAllocator * self, const GumAddressSpec * spec, gsize alignment);
+static GumCodePageInfo * gum_code_allocator_try_alloc_page_near (
     GumCodeAllocator * self, const GumAddressSpec * spec);
-static void gum_code_page_free (GumCodePage * self,
-    const GumCodeAllocator * allocator);
+static void gum_code_allocator_free_page (GumCodeAllocator * self,
+    GumCodePageInfo * info);
 static gboolean gum_code_allocator_page_is_near (const GumCodeAllocator * self,
-    const GumCodePage * page, const GumAddressSpec * spec);
-
+    const GumCodePageInfo * info, const GumAddressSpec * spec);
+static void gum_code_allocator_add_free_page (GumCodeAllocator * self,
+    GumCodePageInfo * info);
+static void gum_code_allocator_remove_free_page (GumCodeAllocator * self,
+    GumCodePageInfo * info);
+static guint gum_code_allocator_find_region (GumCodeAllocator * self,
+    GumAddress base);
+
+static gint gum_code_page_info_find_free_slice (GumCodePageInfo * self,
+    guint slices_per_page, gsize alignment);
 static gboolean gum_code_slice_is_aligned (const GumCodeSlice * slice,
     gsize alignment);
-static gboolean gum_code_slice_is_free (const GumCodeSlice * slice);
-static void gum_code_slice_mark_free (GumCodeSlice * slice);
-static void gum_code_slice_mark_taken (GumCodeSlice * slice);
 
 static GumCodeDeflectorDispatcher * gum_code_deflector_dispatcher_new (
     const GumAddressSpec * caller);
 static void gum_code_deflector_dispatcher_free (
     GumCodeDeflectorDispatcher * dispatcher);
+static void gum_code_deflector_dispatcher_add_caller (
+    GumCodeDeflectorDispatcher * self, GumCodeDeflector * caller);
+static void gum_code_deflector_dispatcher_remove_caller (
+    GumCodeDeflectorDispatcher * self, GumList * link);
+static void gum_code_deflector_dispatcher_rebuild_table (
+    GumCodeDeflectorDispatcher * self);
+static void gum_code_deflector_dispatcher_collect_tables (
+    GumCodeDeflectorDispatcher * self);
 static gpointer gum_code_deflector_dispatcher_lookup (
     GumCodeDeflectorDispatcher * self, gpointer return_address);
 static void gum_code_deflector_dispatcher_ensure_rw (
@@ -81,11 +139,15 @@ static gboolean gum_probe_range_for_code_cave (const GumRangeDetails * details,
 
 static void gum_code_deflector_free (GumCodeDeflector * deflector);
 
+static guint gum_code_deflector_hash (gpointer return_address);
+
 void
 gum_code_allocator_init (GumCodeAllocator * allocator,
                          guint slice_size)
 {
   allocator->pages = NULL;
+  allocator->free_regions = gum_array_new (FALSE, FALSE,
+      sizeof (GumCodeRegion *));
   allocator->dispatchers = NULL;
   allocator->page_size = gum_query_page_size ();
 
@@ -102,7 +164,7 @@ gum_code_allocator_init (GumCodeAllocator * allocator,
           / allocator->slice_size;
     }
     while (allocator->header_size <
-        allocator->slices_per_page * sizeof (GumCodeSlice));
+        GUM_CODE_PAGE_HEADER_SIZE (allocator->slices_per_page));
   }
   else
   {
@@ -110,7 +172,7 @@ gum_code_allocator_init (GumCodeAllocator * allocator,
      * We choose to waste some memory instead of risking stepping on existing
      * slices whenever a new one is to be initialized.
      */
-    allocator->header_size = 16;
+    allocator->header_size = (GUM_CODE_PAGE_HEADER_SIZE (1) + 15) & ~15;
     allocator->slices_per_page = 1;
   }
 }
@@ -123,9 +185,11 @@ gum_code_allocator_free (GumCodeAllocator * allocator)
   gum_list_free (allocator->dispatchers);
   allocator->dispatchers = NULL;
 
-  gum_list_foreach (allocator->pages, (GFunc) gum_code_page_free, allocator);
-  gum_list_free (allocator->pages);
-  allocator->pages = NULL;
+  while (allocator->pages != NULL)
+    gum_code_allocator_free_page (allocator, allocator->pages);
+
+  gum_array_free (allocator->free_regions, TRUE);
+  allocator->free_regions = NULL;
 }
 
 GumCodeSlice *
@@ -139,42 +203,25 @@ gum_code_allocator_try_alloc_slice_near (GumCodeAllocator * self,
                                          const GumAddressSpec * spec,
                                          gsize alignment)
 {
-  GumList * walk;
-  GumCodePage * cp;
   GumCodeSlice * slice;
+  GumCodePageInfo * info;
 
-  for (walk = self->pages; walk != NULL; walk = walk->next)
-  {
-    GumCodePage * page = (GumCodePage *) walk->data;
-
-    if (spec == NULL || gum_code_allocator_page_is_near (self, page, spec))
-    {
-      guint slice_idx;
-
-      for (slice_idx = 0; slice_idx != self->slices_per_page; slice_idx++)
-      {
-        slice = &page->slice[slice_idx];
-
-        if (gum_code_slice_is_free (slice) &&
-            gum_code_slice_is_aligned (slice, alignment))
-        {
-          if (!gum_query_is_rwx_supported ())
-            gum_mprotect (page, self->page_size, GUM_PAGE_RW);
-          gum_code_slice_mark_taken (slice);
-          return slice;
-        }
-      }
-    }
-  }
+  slice = gum_code_allocator_try_alloc_free_slice (self, spec, alignment);
+  if (slice != NULL)
+    return slice;
 
-  cp = gum_code_allocator_try_alloc_page_near (self, spec);
-  if (cp == NULL)
+  info = gum_code_allocator_try_alloc_page_near (self, spec);
+  if (info == NULL)
     return NULL;
-  self->pages = gum_list_prepend (self->pages, cp);
 
-  slice = &cp->slice[0];
+  slice = &info->page->slice[0];
   g_assert (gum_code_slice_is_aligned (slice, alignment));
-  gum_code_slice_mark_taken (slice);
+
+  info->free_mask[0] &= ~1UL;
+  info->free_count--;
+  if (info->free_count != 0)
+    gum_code_allocator_add_free_page (self, info);
+
   return slice;
 }
 
@@ -182,48 +229,102 @@ void
 gum_code_allocator_free_slice (GumCodeAllocator * self,
                                GumCodeSlice * slice)
 {
-  GumCodePage * cp;
-  gpointer data;
+  GumCodePageInfo * info;
   guint slice_idx;
-  gboolean is_empty;
-
-  cp = GUM_CODE_PAGE (slice, self);
-  data = GUM_CODE_PAGE_DATA (slice, self);
 
-  if (!gum_query_is_rwx_supported ())
-    gum_mprotect (data, self->page_size, GUM_PAGE_RW);
+  info = GUM_CODE_PAGE (slice, self)->info;
+  slice_idx = slice - info->page->slice;
 
-  gum_code_slice_mark_free (slice);
+  info->free_mask[slice_idx / GUM_CODE_MASK_BITS] |=
+      1UL << (slice_idx % GUM_CODE_MASK_BITS);
+  info->free_count++;
 
-  is_empty = TRUE;
-  for (slice_idx = 0; slice_idx != self->slices_per_page; slice_idx++)
+  if (info->free_count == self->slices_per_page)
   {
-    if (!gum_code_slice_is_free (&cp->slice[slice_idx]))
-    {
-      is_empty = FALSE;
-      break;
-    }
+    gum_code_allocator_free_page (self, info);
   }
+  else if (info->free_count == 1)
+  {
+    gum_code_allocator_add_free_page (self, info);
+  }
+}
 
-  if (is_empty)
+static GumCodeSlice *
+gum_code_allocator_try_alloc_free_slice (GumCodeAllocator * self,
+                                         const GumAddressSpec * spec,
+                                         gsize alignment)
+{
+  GumArray * regions = self->free_regions;
+  guint region_idx;
+  GumAddress upper;
+
+  if (spec != NULL)
   {
-    self->pages = gum_list_remove (self->pages, cp);
-    gum_code_page_free (cp, self);
+    GumAddress near_address, lower;
+
+    near_address = GUM_ADDRESS (spec->near_address);
+    lower = (near_address > spec->max_distance)
+        ? near_address - spec->max_distance
+        : 0;
+    upper = (near_address < G_MAXUINT64 - spec->max_distance)
+        ? near_address + spec->max_distance
+        : G_MAXUINT64;
+
+    region_idx = gum_code_allocator_find_region (self,
+        GUM_CODE_REGION_BASE (lower));
   }
-  else if (!gum_query_is_rwx_supported ())
+  else
   {
-    gum_mprotect (data, self->page_size, GUM_PAGE_RX);
+    region_idx = 0;
+    upper = G_MAXUINT64;
   }
+
+  for (; region_idx != regions->len; region_idx++)
+  {
+    GumCodeRegion * region;
+    GumCodePageInfo * info;
+
+    region = gum_array_index (regions, GumCodeRegion *, region_idx);
+    if (region->base > upper)
+      break;
+
+    for (info = region->free_pages; info != NULL; info = info->next_free)
+    {
+      gint slice_idx;
+
+      if (spec != NULL && !gum_code_allocator_page_is_near (self, info, spec))
+        continue;
+
+      slice_idx = gum_code_page_info_find_free_slice (info,
+          self->slices_per_page, alignment);
+      if (slice_idx == -1)
+        continue;
+
+      if (!gum_query_is_rwx_supported ())
+        gum_mprotect (info->data, self->page_size, GUM_PAGE_RW);
+
+      info->free_mask[slice_idx / GUM_CODE_MASK_BITS] &=
+          ~(1UL << (slice_idx % GUM_CODE_MASK_BITS));
+      info->free_count--;
+      if (info->free_count == 0)
+        gum_code_allocator_remove_free_page (self, info);
+
+      return &info->page->slice[slice_idx];
+    }
+  }
+
+  return NULL;
 }
 
-static GumCodePage *
+static GumCodePageInfo *
 gum_code_allocator_try_alloc_page_near (GumCodeAllocator * self,
                                         const GumAddressSpec * spec)
 {
   GumPageProtection prot;
   gpointer data;
   GumCodePage * cp;
-  guint slice_idx;
+  GumCodePageInfo * info;
+  guint mask_length, slice_idx;
 
   prot = gum_query_is_rwx_supported () ? GUM_PAGE_RWX : GUM_PAGE_RW;
 
@@ -240,34 +341,62 @@ gum_code_allocator_try_alloc_page_near (GumCodeAllocator * self,
 
   cp = GUM_CODE_PAGE (data, self);
 
+  mask_length = (self->slices_per_page + GUM_CODE_MASK_BITS - 1) /
+      GUM_CODE_MASK_BITS;
+  info = gum_malloc0 (G_STRUCT_OFFSET (GumCodePageInfo, free_mask) +
+      (mask_length * sizeof (gulong)));
+  info->page = cp;
+  info->data = data;
+
+  info->next = self->pages;
+  if (self->pages != NULL)
+    self->pages->prev = info;
+  self->pages = info;
+
+  cp->info = info;
+
   for (slice_idx = 0; slice_idx != self->slices_per_page; slice_idx++)
   {
     GumCodeSlice * slice = &cp->slice[slice_idx];
 
     slice->data = (guint8 *) data + (slice_idx * self->slice_size);
     slice->size = self->slice_size;
-    gum_code_slice_mark_free (slice);
+
+    info->free_mask[slice_idx / GUM_CODE_MASK_BITS] |=
+        1UL << (slice_idx % GUM_CODE_MASK_BITS);
   }
+  info->free_count = self->slices_per_page;
 
-  return cp;
+  return info;
 }
 
 static void
-gum_code_page_free (GumCodePage * self,
-                    const GumCodeAllocator * allocator)
+gum_code_allocator_free_page (GumCodeAllocator * self,
+                              GumCodePageInfo * info)
 {
-  gum_free_pages (GUM_CODE_PAGE_DATA (self, allocator));
+  if (info->region != NULL)
+    gum_code_allocator_remove_free_page (self, info);
+
+  if (info->prev != NULL)
+    info->prev->next = info->next;
+  else
+    self->pages = info->next;
+  if (info->next != NULL)
+    info->next->prev = info->prev;
+
+  gum_free_pages (info->data);
+  gum_free (info);
 }
 
 static gboolean
 gum_code_allocator_page_is_near (const GumCodeAllocator * self,
-                                 const GumCodePage * page,
+                                 const GumCodePageInfo * info,
                                  const GumAddressSpec * spec)
 {
   gssize page_data;
   gsize distance_start, distance_end;
 
-  page_data = GPOINTER_TO_SIZE (GUM_CODE_PAGE_DATA (page, self));
+  page_data = GPOINTER_TO_SIZE (info->data);
   distance_start = ABS ((gssize) spec->near_address - page_data);
   distance_end = ABS ((gssize) spec->near_address -
       (page_data + (gssize) self->page_size));
@@ -276,32 +405,120 @@ gum_code_allocator_page_is_near (const GumCodeAllocator * self,
       distance_end <= spec->max_distance;
 }
 
-static gboolean
-gum_code_slice_is_aligned (const GumCodeSlice * slice,
-                           gsize alignment)
+static void
+gum_code_allocator_add_free_page (GumCodeAllocator * self,
+                                  GumCodePageInfo * info)
 {
-  if (alignment == 0)
-    return TRUE;
+  GumArray * regions = self->free_regions;
+  GumAddress base;
+  guint region_idx;
+  GumCodeRegion * region;
+
+  base = GUM_CODE_REGION_BASE (GUM_ADDRESS (info->data));
+  region_idx = gum_code_allocator_find_region (self, base);
+  if (region_idx != regions->len &&
+      gum_array_index (regions, GumCodeRegion *, region_idx)->base == base)
+  {
+    region = gum_array_index (regions, GumCodeRegion *, region_idx);
+  }
+  else
+  {
+    region = gum_new (GumCodeRegion, 1);
+    region->base = base;
+    region->free_pages = NULL;
+    gum_array_insert_val (regions, region_idx, region);
+  }
 
-  return GPOINTER_TO_SIZE (slice->data) % alignment == 0;
+  info->region = region;
+  info->prev_free = NULL;
+  info->next_free = region->free_pages;
+  if (region->free_pages != NULL)
+    region->free_pages->prev_free = info;
+  region->free_pages = info;
 }
 
-static gboolean
-gum_code_slice_is_free (const GumCodeSlice * slice)
+static void
+gum_code_allocator_remove_free_page (GumCodeAllocator * self,
+                                     GumCodePageInfo * info)
 {
-  return (slice->size & 1) == 1;
+  GumCodeRegion * region = info->region;
+
+  if (info->prev_free != NULL)
+    info->prev_free->next_free = info->next_free;
+  else
+    region->free_pages = info->next_free;
+  if (info->next_free != NULL)
+    info->next_free->prev_free = info->prev_free;
+
+  info->region = NULL;
+  info->prev_free = NULL;
+  info->next_free = NULL;
+
+  if (region->free_pages == NULL)
+  {
+    gum_array_remove_index (self->free_regions,
+        gum_code_allocator_find_region (self, region->base));
+    gum_free (region);
+  }
 }
 
-static void
-gum_code_slice_mark_free (GumCodeSlice * slice)
+static guint
+gum_code_allocator_find_region (GumCodeAllocator * self,
+                                GumAddress base)
 {
-  slice->size |= 1;
+  GumArray * regions = self->free_regions;
+  guint lower, upper;
+
+  lower = 0;
+  upper = regions->len;
+  while (lower != upper)
+  {
+    guint mid = lower + ((upper - lower) / 2);
+
+    if (gum_array_index (regions, GumCodeRegion *, mid)->base < base)
+      lower = mid + 1;
+    else
+      upper = mid;
+  }
+
+  return lower;
 }
 
-static void
-gum_code_slice_mark_taken (GumCodeSlice * slice)
+static gint
+gum_code_page_info_find_free_slice (GumCodePageInfo * self,
+                                    guint slices_per_page,
+                                    gsize alignment)
+{
+  guint mask_length, mask_idx;
+
+  mask_length = (slices_per_page + GUM_CODE_MASK_BITS - 1) /
+      GUM_CODE_MASK_BITS;
+
+  for (mask_idx = 0; mask_idx != mask_length; mask_idx++)
+  {
+    gulong mask = self->free_mask[mask_idx];
+    gint bit = -1;
+
+    while ((bit = g_bit_nth_lsf (mask, bit)) != -1)
+    {
+      guint slice_idx = (mask_idx * GUM_CODE_MASK_BITS) + bit;
+
+      if (gum_code_slice_is_aligned (&self->page->slice[slice_idx], alignment))
+        return slice_idx;
+    }
+  }
+
+  return -1;
+}
+
+static gboolean
+gum_code_slice_is_aligned (const GumCodeSlice * slice,
+                           gsize alignment)
 {
-  slice->size &= ~1;
+  if (alignment == 0)
+    return TRUE;
+
+  return GPOINTER_TO_SIZE (slice->data) % alignment == 0;
 }
 
 GumCodeDeflector *
@@ -340,7 +557,7 @@ gum_code_allocator_alloc_deflector (GumCodeAllocator * self,
   deflector->target = target;
   deflector->trampoline = dispatcher->trampoline;
 
-  dispatcher->callers = gum_list_prepend (dispatcher->callers, deflector);
+  gum_code_deflector_dispatcher_add_caller (dispatcher, deflector);
 
   return deflector;
 }
@@ -362,7 +579,7 @@ gum_code_allocator_free_deflector (GumCodeAllocator * self,
     entry = gum_list_find (dispatcher->callers, deflector);
     if (entry != NULL)
     {
-      dispatcher->callers = gum_list_delete_link (dispatcher->callers, entry);
+      gum_code_deflector_dispatcher_remove_caller (dispatcher, entry);
       if (dispatcher->callers == NULL)
       {
         gum_code_deflector_dispatcher_free (dispatcher);
@@ -401,6 +618,12 @@ gum_code_deflector_dispatcher_new (const GumAddressSpec * caller)
   dispatcher = g_slice_new (GumCodeDeflectorDispatcher);
 
   dispatcher->callers = NULL;
+  dispatcher->caller_count = 0;
+
+  dispatcher->table = _gum_code_deflector_table_new (
+      GUM_CODE_DEFLECTOR_TABLE_MIN_CAPACITY);
+  dispatcher->retired_tables = NULL;
+  dispatcher->active_lookups = 0;
 
   dispatcher->address = GSIZE_TO_POINTER (ctx.cave.base_address);
   dispatcher->trampoline = dispatcher->address;
@@ -461,25 +684,124 @@ gum_code_deflector_dispatcher_free (GumCodeDeflectorDispatcher * dispatcher)
   gum_list_foreach (dispatcher->callers, (GFunc) gum_code_deflector_free, NULL);
   gum_list_free (dispatcher->callers);
 
+  _gum_code_deflector_table_free (dispatcher->table);
+  gum_list_foreach (dispatcher->retired_tables,
+      (GFunc) _gum_code_deflector_table_free, NULL);
+  gum_list_free (dispatcher->retired_tables);
+
   g_slice_free (GumCodeDeflectorDispatcher, dispatcher);
 }
 
-static gpointer
-gum_code_deflector_dispatcher_lookup (GumCodeDeflectorDispatcher * self,
-                                      gpointer return_address)
+static void
+gum_code_deflector_dispatcher_add_caller (GumCodeDeflectorDispatcher * self,
+                                          GumCodeDeflector * caller)
+{
+  GumCodeDeflectorTable * table = self->table;
+  GumCodeDeflectorTableEntry * entry;
+
+  gum_code_deflector_dispatcher_collect_tables (self);
+
+  self->callers = gum_list_prepend (self->callers, caller);
+  self->caller_count++;
+
+  entry = _gum_code_deflector_table_find (table, caller->return_address);
+  if (entry != NULL)
+  {
+    g_atomic_pointer_set (&entry->target, caller->target);
+  }
+  else if (_gum_code_deflector_table_is_full (table))
+  {
+    gum_code_deflector_dispatcher_rebuild_table (self);
+  }
+  else
+  {
+    _gum_code_deflector_table_insert (table, caller->return_address,
+        caller->target);
+  }
+}
+
+static void
+gum_code_deflector_dispatcher_remove_caller (GumCodeDeflectorDispatcher * self,
+                                             GumList * link)
 {
+  GumCodeDeflector * caller = link->data;
+  GumCodeDeflectorTableEntry * entry;
   GumList * cur;
 
+  gum_code_deflector_dispatcher_collect_tables (self);
+
+  self->callers = gum_list_delete_link (self->callers, link);
+  self->caller_count--;
+
+  entry = _gum_code_deflector_table_find (self->table, caller->return_address);
+  g_assert (entry != NULL);
+
   for (cur = self->callers; cur != NULL; cur = cur->next)
   {
-    GumCodeDeflector * caller = cur->data;
+    GumCodeDeflector * other = cur->data;
 
-    if (caller->return_address == return_address)
-      return caller->target;
+    if (other->return_address == caller->return_address)
+    {
+      g_atomic_pointer_set (&entry->target, other->target);
+      return;
+    }
   }
 
-  g_assert_not_reached ();
-  return NULL;
+  _gum_code_deflector_table_remove (entry);
+}
+
+static void
+gum_code_deflector_dispatcher_rebuild_table (GumCodeDeflectorDispatcher * self)
+{
+  GumCodeDeflectorTable * table;
+
+  table = _gum_code_deflector_table_new_for (self->callers, self->caller_count);
+
+  /*
+   * Deflected calls may still be walking the old table, so we only free it
+   * once no lookup is in progress.
+   */
+  self->retired_tables = gum_list_prepend (self->retired_tables, self->table);
+  g_atomic_pointer_set (&self->table, table);
+
+  gum_code_deflector_dispatcher_collect_tables (self);
+}
+
+/*
+ * Lookups announce themselves before loading the table pointer. Once we have
+ * seen none in flight after a table was swapped out, any later lookup is
+ * bound to load its replacement, so nobody can be left holding the old one.
+ */
+static void
+gum_code_deflector_dispatcher_collect_tables (GumCodeDeflectorDispatcher * self)
+{
+  if (self->retired_tables == NULL ||
+      g_atomic_int_get (&self->active_lookups) != 0)
+    return;
+
+  gum_list_foreach (self->retired_tables,
+      (GFunc) _gum_code_deflector_table_free, NULL);
+  gum_list_free (self->retired_tables);
+  self->retired_tables = NULL;
+}
+
+static gpointer
+gum_code_deflector_dispatcher_lookup (GumCodeDeflectorDispatcher * self,
+                                      gpointer return_address)
+{
+  GumCodeDeflectorTableEntry * entry;
+  gpointer target;
+
+  g_atomic_int_inc (&self->active_lookups);
+
+  entry = _gum_code_deflector_table_find (g_atomic_pointer_get (&self->table),
+      return_address);
+  g_assert (entry != NULL);
+  target = g_atomic_pointer_get (&entry->target);
+
+  g_atomic_int_dec_and_test (&self->active_lookups);
+
+  return target;
 }
 
 static void
@@ -546,3 +868,113 @@ gum_code_deflector_free (GumCodeDeflector * deflector)
 {
   g_slice_free (GumCodeDeflector, deflector);
 }
+
+GumCodeDeflectorTable *
+_gum_code_deflector_table_new (guint capacity)
+{
+  GumCodeDeflectorTable * table;
+
+  table = gum_malloc0 (G_STRUCT_OFFSET (GumCodeDeflectorTable, entries) +
+      (capacity * sizeof (GumCodeDeflectorTableEntry)));
+  table->capacity = capacity;
+  table->used = 0;
+
+  return table;
+}
+
+/* callers are prepended, so the first one seen for an address wins */
+GumCodeDeflectorTable *
+_gum_code_deflector_table_new_for (GumList * callers,
+                                   guint caller_count)
+{
+  GumCodeDeflectorTable * table;
+  guint capacity;
+  GumList * cur;
+
+  capacity = GUM_CODE_DEFLECTOR_TABLE_MIN_CAPACITY;
+  while (capacity < caller_count * 2)
+    capacity *= 2;
+
+  table = _gum_code_deflector_table_new (capacity);
+
+  for (cur = callers; cur != NULL; cur = cur->next)
+  {
+    GumCodeDeflector * caller = cur->data;
+
+    if (_gum_code_deflector_table_find (table, caller->return_address) == NULL)
+    {
+      _gum_code_deflector_table_insert (table, caller->return_address,
+          caller->target);
+    }
+  }
+
+  return table;
+}
+
+void
+_gum_code_deflector_table_free (GumCodeDeflectorTable * table)
+{
+  gum_free (table);
+}
+
+gboolean
+_gum_code_deflector_table_is_full (GumCodeDeflectorTable * self)
+{
+  return (self->used + 1) * 4 > self->capacity * 3;
+}
+
+GumCodeDeflectorTableEntry *
+_gum_code_deflector_table_find (GumCodeDeflectorTable * self,
+                                gpointer return_address)
+{
+  guint mask, i;
+
+  mask = self->capacity - 1;
+
+  i = gum_code_deflector_hash (return_address) & mask;
+
+  while (TRUE)
+  {
+    GumCodeDeflectorTableEntry * entry = &self->entries[i];
+    gpointer key;
+
+    key = g_atomic_pointer_get (&entry->return_address);
+    if (key == return_address)
+      return entry;
+    else if (key == NULL)
+      return NULL;
+
+    i = (i + 1) & mask;
+  }
+}
+
+void
+_gum_code_deflector_table_insert (GumCodeDeflectorTable * self,
+                                  gpointer return_address,
+                                  gpointer target)
+{
+  guint mask, i;
+
+  mask = self->capacity - 1;
+
+  /* tombstones are never reused, so a concurrent lookup can't mismatch */
+  i = gum_code_deflector_hash (return_address) & mask;
+  while (self->entries[i].return_address != NULL)
+    i = (i + 1) & mask;
+
+  self->entries[i].target = target;
+  g_atomic_pointer_set (&self->entries[i].return_address, return_address);
+  self->used++;
+}
+
+void
+_gum_code_deflector_table_remove (GumCodeDeflectorTableEntry * entry)
+{
+  g_atomic_pointer_set (&entry->return_address, GUM_CODE_DEFLECTOR_TOMBSTONE);
+}
+
+static guint
+gum_code_deflector_hash (gpointer return_address)
+{
+  return (guint) (GPOINTER_TO_SIZE (return_address) >> 1) * 2654435761U;
+}
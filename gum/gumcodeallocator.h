@@ -7,16 +7,19 @@
 #ifndef __GUM_CODE_ALLOCATOR_H__
 #define __GUM_CODE_ALLOCATOR_H__
 
+#include "gumarray.h"
 #include "gumlist.h"
 #include "gummemory.h"
 
 typedef struct _GumCodeAllocator GumCodeAllocator;
 typedef struct _GumCodeSlice GumCodeSlice;
 typedef struct _GumCodeDeflector GumCodeDeflector;
+typedef struct _GumCodePageInfo GumCodePageInfo;
 
 struct _GumCodeAllocator
 {
-  GumList * pages;
+  GumCodePageInfo * pages;
+  GumArray * free_regions;
   GumList * dispatchers;
   gsize page_size;
   guint header_size;
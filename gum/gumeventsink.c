@@ -50,6 +50,27 @@ gum_event_sink_process (GumEventSink * self,
   iface->process (self, ev);
 }
 
+void
+gum_event_sink_process_batch (GumEventSink * self,
+                              const GumEvent * events,
+                              guint n_events)
+{
+  GumEventSinkIface * iface = GUM_EVENT_SINK_GET_INTERFACE (self);
+
+  if (iface->process_batch != NULL)
+  {
+    iface->process_batch (self, events, n_events);
+  }
+  else
+  {
+    guint i;
+
+    g_assert (iface->process != NULL);
+    for (i = 0; i != n_events; i++)
+      iface->process (self, &events[i]);
+  }
+}
+
 void
 gum_event_sink_stop (GumEventSink * self)
 {
@@ -29,6 +29,8 @@ struct _GumEventSinkIface
   GumEventType (* query_mask) (GumEventSink * self);
   void (* start) (GumEventSink * self);
   void (* process) (GumEventSink * self, const GumEvent * ev);
+  void (* process_batch) (GumEventSink * self, const GumEvent * events,
+      guint n_events);
   void (* stop) (GumEventSink * self);
 };
 
@@ -39,6 +41,8 @@ GType gum_event_sink_get_type (void);
 GUM_API GumEventType gum_event_sink_query_mask (GumEventSink * self);
 GUM_API void gum_event_sink_start (GumEventSink * self);
 GUM_API void gum_event_sink_process (GumEventSink * self, const GumEvent * ev);
+GUM_API void gum_event_sink_process_batch (GumEventSink * self,
+    const GumEvent * events, guint n_events);
 GUM_API void gum_event_sink_stop (GumEventSink * self);
 
 G_END_DECLS
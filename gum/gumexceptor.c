@@ -862,6 +862,10 @@ gum_exceptor_on_signal (int sig,
       break;
     case SIGTRAP:
       ed.type = GUM_EXCEPTION_BREAKPOINT;
+#ifdef TRAP_TRACE
+      if (siginfo->si_code == TRAP_TRACE)
+        ed.type = GUM_EXCEPTION_SINGLE_STEP;
+#endif
       break;
     default:
       ed.type = GUM_EXCEPTION_SYSTEM;
@@ -885,6 +889,12 @@ gum_exceptor_on_signal (int sig,
     case SIGBUS:
       if (siginfo->si_addr == ed.address)
         md->operation = GUM_MEMOP_EXECUTE;
+#if defined (HAVE_LINUX) && defined (HAVE_I386)
+      /* bit 1 of the page fault error code is set for writes */
+      else if (sig == SIGSEGV &&
+          (((ucontext_t *) context)->uc_mcontext.gregs[REG_ERR] & 2) != 0)
+        md->operation = GUM_MEMOP_WRITE;
+#endif
       else
         md->operation = GUM_MEMOP_READ; /* FIXME */
       md->address = siginfo->si_addr;
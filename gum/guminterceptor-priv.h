@@ -18,6 +18,15 @@
 typedef struct _GumInterceptorBackend GumInterceptorBackend;
 typedef struct _GumFunctionContext GumFunctionContext;
 typedef struct _GumFunctionContextBackendData GumFunctionContextBackendData;
+typedef struct _GumListenerSnapshot GumListenerSnapshot;
+
+#define GUM_PROBE_COUNTER_SLOT_COUNT      64
+#define GUM_PROBE_COUNTER_SLOT_SIZE_SHIFT 6
+
+struct _GumProbeCounter
+{
+  guint8 * slots;
+};
 
 struct _GumFunctionContextBackendData
 {
@@ -33,7 +42,6 @@ struct _GumFunctionContext
   GumCodeAllocator * allocator;
   GumCodeSlice * trampoline_slice;
   GumCodeDeflector * trampoline_deflector;
-  volatile gint trampoline_usage_counter;
 
   gpointer on_enter_trampoline;
   guint8 overwritten_prologue[32];
@@ -43,11 +51,16 @@ struct _GumFunctionContext
 
   gpointer on_leave_trampoline;
 
-  GumArray * listener_entries;
+  GumListenerSnapshot * volatile listeners;
+  GumInvocationRequirements requirements;
+  volatile gint trampoline_usage_counter;
 
   gpointer replacement_function;
   gpointer replacement_function_data;
 
+  GumProbeCounter * probe_counter;
+  volatile gint probe_in_flight;
+
   GumFunctionContextBackendData backend_data;
 };
 
@@ -56,6 +69,9 @@ extern GumTlsKey _gum_interceptor_guard_key;
 G_GNUC_INTERNAL void _gum_interceptor_init (void);
 G_GNUC_INTERNAL void _gum_interceptor_deinit (void);
 
+G_GNUC_INTERNAL gboolean _gum_interceptor_is_using_minimal_thunks (
+    GumInterceptor * self, gpointer function_address);
+
 void _gum_function_context_begin_invocation (
     GumFunctionContext * function_ctx, GumCpuContext * cpu_context,
     gpointer * caller_ret_addr, gpointer * next_hop);
@@ -81,6 +97,10 @@ void _gum_interceptor_backend_deactivate_trampoline (
     GumInterceptorBackend * self, GumFunctionContext * ctx);
 void _gum_interceptor_backend_commit_trampoline (GumInterceptorBackend * self,
     GumFunctionContext * ctx);
+void _gum_interceptor_backend_update_requirements (
+    GumInterceptorBackend * self, GumFunctionContext * ctx);
+gboolean _gum_interceptor_backend_is_using_minimal_thunks (
+    GumInterceptorBackend * self, GumFunctionContext * ctx);
 
 gpointer _gum_interceptor_backend_resolve_redirect (
     GumInterceptorBackend * self, gpointer address);
@@ -17,11 +17,12 @@
 
 #include <string.h>
 
-#ifdef HAVE_ARM64
+#if defined (HAVE_ARM64) || GLIB_SIZEOF_VOID_P == 8
 # define GUM_INTERCEPTOR_CODE_SLICE_SIZE 256
 #else
 # define GUM_INTERCEPTOR_CODE_SLICE_SIZE 128
 #endif
+#define GUM_FUNCTION_PROLOGUE_SIZE 16
 
 G_DEFINE_TYPE (GumInterceptor, gum_interceptor, G_TYPE_OBJECT);
 
@@ -37,6 +38,8 @@ typedef struct _InterceptorThreadContext InterceptorThreadContext;
 typedef struct _GumInvocationStackEntry  GumInvocationStackEntry;
 typedef struct _ListenerDataSlot         ListenerDataSlot;
 typedef struct _ListenerInvocationState  ListenerInvocationState;
+typedef struct _GumPrologueUpdate        GumPrologueUpdate;
+typedef struct _GumRetiredObject         GumRetiredObject;
 
 struct _GumInterceptorPrivate
 {
@@ -44,6 +47,11 @@ struct _GumInterceptorPrivate
 
   GumHashTable * function_by_address;
 
+  guint transaction_level;
+  GumArray * pending_updates;
+
+  GumArray * retired_objects;
+
   GumInterceptorBackend * backend;
   GumCodeAllocator allocator;
 
@@ -55,6 +63,13 @@ struct _ListenerEntry
   GumInvocationListenerIface * listener_interface;
   GumInvocationListener * listener_instance;
   gpointer function_data;
+  GumInvocationRequirements requirements;
+};
+
+struct _GumListenerSnapshot
+{
+  guint length;
+  ListenerEntry entries[1];
 };
 
 struct _InterceptorThreadContext
@@ -75,8 +90,10 @@ struct _InterceptorThreadContext
 
 struct _GumInvocationStackEntry
 {
+  GumFunctionContext * function_ctx;
   gpointer trampoline_ret_addr;
   gpointer caller_ret_addr;
+  GumListenerSnapshot * listeners;
   GumInvocationContext invocation_context;
   GumCpuContext cpu_context;
   guint8 listener_invocation_data[GUM_MAX_LISTENERS_PER_FUNCTION][GUM_MAX_LISTENER_DATA];
@@ -100,6 +117,19 @@ struct _ListenerInvocationState
   guint8 * invocation_data;
 };
 
+struct _GumPrologueUpdate
+{
+  GumFunctionContext * function_ctx;
+  gboolean activate;
+};
+
+struct _GumRetiredObject
+{
+  GumFunctionContext * owner;
+  gpointer object;
+  GDestroyNotify destroy;
+};
+
 static void gum_interceptor_dispose (GObject * object);
 static void gum_interceptor_finalize (GObject * object);
 
@@ -107,11 +137,30 @@ static void the_interceptor_weak_notify (gpointer data,
     GObject * where_the_object_was);
 
 static GumFunctionContext * gum_interceptor_instrument (GumInterceptor * self,
-    gpointer function_address);
+    gpointer function_address, GumProbeCounter * probe_counter,
+    gboolean * conflict);
+static GumFunctionContext * gum_interceptor_reclaim_pending (
+    GumInterceptor * self, gpointer function_address,
+    GumProbeCounter * probe_counter, gboolean * conflict);
+static void gum_interceptor_commit_pending_updates (GumInterceptor * self);
+static void gum_interceptor_protect_prologue_pages (GumArray * pages,
+    GumPageProtection prot);
+static gint gum_compare_page_addresses (gconstpointer a, gconstpointer b);
+static void gum_interceptor_retire (GumInterceptor * self,
+    GumFunctionContext * owner, gpointer object, GDestroyNotify destroy);
+static void gum_interceptor_collect_retired (GumInterceptor * self);
+static gboolean gum_interceptor_has_retired_in_use (GumInterceptor * self,
+    InterceptorThreadContext * ignored_ctx);
+static gboolean gum_interceptor_has_retired_from (GumInterceptor * self,
+    GumFunctionContext * owner);
 static GumFunctionContext * gum_function_context_new (
     GumInterceptor * interceptor, gpointer function_address,
     GumCodeAllocator * allocator);
 static void gum_function_context_destroy (GumFunctionContext * function_ctx);
+static void gum_function_context_wait_for_probe (
+    GumFunctionContext * function_ctx);
+static void gum_function_context_release (GumFunctionContext * function_ctx);
+static void gum_function_context_free (GumFunctionContext * function_ctx);
 static gboolean gum_function_context_try_destroy (
     GumFunctionContext * function_ctx);
 static void gum_function_context_add_listener (
@@ -119,6 +168,11 @@ static void gum_function_context_add_listener (
     gpointer function_data);
 static void gum_function_context_remove_listener (
     GumFunctionContext * function_ctx, GumInvocationListener * listener);
+static void gum_function_context_publish_listeners (
+    GumFunctionContext * function_ctx, GumListenerSnapshot * listeners);
+static void gum_function_context_update_requirements (
+    GumFunctionContext * function_ctx);
+static GumListenerSnapshot * gum_listener_snapshot_new (guint length);
 static gboolean gum_function_context_has_listener (
     GumFunctionContext * function_ctx, GumInvocationListener * listener);
 static ListenerEntry * gum_function_context_find_listener_entry (
@@ -128,6 +182,8 @@ static InterceptorThreadContext * get_interceptor_thread_context (void);
 static InterceptorThreadContext * interceptor_thread_context_new (void);
 static void interceptor_thread_context_destroy (
     InterceptorThreadContext * context);
+static guint interceptor_thread_context_count_usage (
+    InterceptorThreadContext * self, GumFunctionContext * function_ctx);
 static gpointer interceptor_thread_context_get_listener_data (
     InterceptorThreadContext * self, GumInvocationListener * listener,
     gsize required_size);
@@ -144,9 +200,8 @@ static gpointer gum_interceptor_resolve (GumInterceptor * self,
     gpointer address);
 static gboolean gum_interceptor_has (GumInterceptor * self,
     gpointer function_address);
-static void gum_function_context_wait_for_idle_trampoline (
-    GumFunctionContext * ctx);
 
+static GumPageProtection gum_function_prologue_writable_protection (void);
 static void make_function_prologue_at_least_read_write (
     gpointer prologue_address);
 static void make_function_prologue_read_execute (gpointer prologue_address);
@@ -166,6 +221,19 @@ GumTlsKey _gum_interceptor_guard_key;
 static GumSpinlock _gum_interceptor_thread_context_lock;
 static GumArray * _gum_interceptor_thread_contexts;
 
+/*
+ * Listener lists and detached function contexts are retired along with the
+ * function context they belong to, and reclaimed once no thread is inside an
+ * intercepted call of that function, i.e. once its trampoline usage counter
+ * has dropped to zero. A thread parked in one hooked call thus only holds on
+ * to what was retired from that function. Probes are too lightweight to be
+ * counted this way, so their trampolines count the threads passing through
+ * them instead, and a detach waits for that count to drop to zero. Collection
+ * also happens whenever the interceptor lock is taken by one of the public
+ * entry points, as a thread that just left may still be on its way out of a
+ * trampoline.
+ */
+
 static GumInvocationStack _gum_interceptor_empty_stack = { NULL, 0 };
 
 static void
@@ -224,6 +292,13 @@ gum_interceptor_init (GumInterceptor * self)
   priv->function_by_address = gum_hash_table_new_full (g_direct_hash,
       g_direct_equal, NULL, NULL);
 
+  priv->transaction_level = 0;
+  priv->pending_updates = gum_array_new (FALSE, FALSE,
+      sizeof (GumPrologueUpdate));
+
+  priv->retired_objects = gum_array_new (FALSE, FALSE,
+      sizeof (GumRetiredObject));
+
   gum_code_allocator_init (&priv->allocator, GUM_INTERCEPTOR_CODE_SLICE_SIZE);
   priv->backend = _gum_interceptor_backend_create (&priv->allocator);
 }
@@ -235,6 +310,13 @@ gum_interceptor_dispose (GObject * object)
   GumInterceptorPrivate * priv = self->priv;
   GumHashTableIter iter;
   GumFunctionContext * function_ctx;
+  InterceptorThreadContext * self_ctx;
+  gulong delay;
+
+  GUM_INTERCEPTOR_LOCK ();
+
+  priv->transaction_level = 0;
+  gum_interceptor_commit_pending_updates (self);
 
   gum_hash_table_iter_init (&iter, priv->function_by_address);
   while (gum_hash_table_iter_next (&iter, NULL, (gpointer *) &function_ctx))
@@ -243,6 +325,30 @@ gum_interceptor_dispose (GObject * object)
     gum_hash_table_iter_remove (&iter);
   }
 
+  /*
+   * Everything has been retired at this point, so we wait for other threads
+   * to leave the functions we detached from. The calling thread may itself be
+   * inside some of them, in which case it would end up waiting for itself;
+   * what it is using is kept alive instead, see finalize().
+   */
+  self_ctx = (InterceptorThreadContext *)
+      gum_tls_key_get_value (_gum_interceptor_context_key);
+
+  delay = 1;
+  while (TRUE)
+  {
+    gum_interceptor_collect_retired (self);
+    if (!gum_interceptor_has_retired_in_use (self, self_ctx))
+      break;
+
+    GUM_INTERCEPTOR_UNLOCK ();
+    g_usleep (delay);
+    delay = MIN (delay * 2, G_USEC_PER_SEC / 100);
+    GUM_INTERCEPTOR_LOCK ();
+  }
+
+  GUM_INTERCEPTOR_UNLOCK ();
+
   G_OBJECT_CLASS (gum_interceptor_parent_class)->dispose (object);
 }
 
@@ -251,14 +357,26 @@ gum_interceptor_finalize (GObject * object)
 {
   GumInterceptor * self = GUM_INTERCEPTOR (object);
   GumInterceptorPrivate * priv = self->priv;
+  gboolean in_use;
 
-  _gum_interceptor_backend_destroy (priv->backend);
+  /*
+   * Anything still retired is in use by the thread that disposed us, which
+   * will return through its trampolines and thunks, so leave those be.
+   */
+  in_use = priv->retired_objects->len != 0;
+
+  if (!in_use)
+    _gum_interceptor_backend_destroy (priv->backend);
 
   g_mutex_clear (&priv->mutex);
 
   gum_hash_table_unref (priv->function_by_address);
 
-  gum_code_allocator_free (&priv->allocator);
+  gum_array_free (priv->pending_updates, TRUE);
+  gum_array_free (priv->retired_objects, TRUE);
+
+  if (!in_use)
+    gum_code_allocator_free (&priv->allocator);
 
   G_OBJECT_CLASS (gum_interceptor_parent_class)->finalize (object);
 }
@@ -312,17 +430,24 @@ gum_interceptor_attach_listener (GumInterceptor * self,
   GumInterceptorPrivate * priv = self->priv;
   GumAttachReturn result = GUM_ATTACH_OK;
   GumFunctionContext * function_ctx;
+  gboolean conflict;
 
   gum_interceptor_ignore_current_thread (self);
   GUM_INTERCEPTOR_LOCK ();
 
+  gum_interceptor_collect_retired (self);
+
   function_address = gum_interceptor_resolve (self, function_address);
 
-  function_ctx = gum_interceptor_instrument (self, function_address);
+  function_ctx = gum_interceptor_instrument (self, function_address, NULL,
+      &conflict);
+  if (conflict)
+    goto already_attached;
   if (function_ctx == NULL)
     goto wrong_signature;
 
-  if (gum_function_context_has_listener (function_ctx, listener))
+  if (function_ctx->probe_counter != NULL ||
+      gum_function_context_has_listener (function_ctx, listener))
     goto already_attached;
 
   gum_function_context_add_listener (function_ctx, listener,
@@ -402,21 +527,28 @@ gum_interceptor_replace_function (GumInterceptor * self,
   GumInterceptorPrivate * priv = self->priv;
   GumReplaceReturn result = GUM_REPLACE_OK;
   GumFunctionContext * function_ctx;
+  gboolean conflict;
 
   GUM_INTERCEPTOR_LOCK ();
 
   function_address = gum_interceptor_resolve (self, function_address);
 
-  function_ctx = gum_interceptor_instrument (self, function_address);
+  function_ctx = gum_interceptor_instrument (self, function_address, NULL,
+      &conflict);
+  if (conflict)
+    goto already_replaced;
   if (function_ctx == NULL)
     goto wrong_signature;
 
-  if (function_ctx->replacement_function != NULL)
+  if (function_ctx->probe_counter != NULL ||
+      function_ctx->replacement_function != NULL)
     goto already_replaced;
 
   function_ctx->replacement_function_data = replacement_function_data;
   function_ctx->replacement_function = replacement_function;
 
+  gum_function_context_update_requirements (function_ctx);
+
   goto beach;
 
 wrong_signature:
@@ -450,7 +582,7 @@ gum_interceptor_revert_function (GumInterceptor * self,
 
   function_ctx = (GumFunctionContext *) gum_hash_table_lookup (
       priv->function_by_address, function_address);
-  if (function_ctx == NULL)
+  if (function_ctx == NULL || function_ctx->probe_counter != NULL)
     goto beach;
 
   function_ctx->replacement_function = NULL;
@@ -460,9 +592,142 @@ gum_interceptor_revert_function (GumInterceptor * self,
   {
     gum_hash_table_remove (priv->function_by_address, function_address);
   }
+  else
+  {
+    gum_function_context_update_requirements (function_ctx);
+  }
+
+beach:
+  GUM_INTERCEPTOR_UNLOCK ();
+}
+
+/*
+ * The counter is updated directly by the generated code, so it must outlive
+ * the attachment: free it only once gum_interceptor_detach_probe() has
+ * returned, or once the transaction it was detached in has ended. Both wait
+ * for threads still passing through the probe.
+ */
+GumAttachReturn
+gum_interceptor_attach_probe (GumInterceptor * self,
+                              gpointer function_address,
+                              GumProbeCounter * counter)
+{
+  GumInterceptorPrivate * priv = self->priv;
+  GumAttachReturn result = GUM_ATTACH_OK;
+  gboolean conflict;
+
+  gum_interceptor_ignore_current_thread (self);
+  GUM_INTERCEPTOR_LOCK ();
+
+  function_address = gum_interceptor_resolve (self, function_address);
+
+  if (gum_interceptor_has (self, function_address))
+    goto already_attached;
+
+  if (gum_interceptor_instrument (self, function_address, counter,
+      &conflict) == NULL)
+  {
+    if (conflict)
+      goto already_attached;
+    goto wrong_signature;
+  }
+
+  goto beach;
 
+wrong_signature:
+  {
+    result = GUM_ATTACH_WRONG_SIGNATURE;
+    goto beach;
+  }
+already_attached:
+  {
+    result = GUM_ATTACH_ALREADY_ATTACHED;
+    goto beach;
+  }
 beach:
+  {
+    GUM_INTERCEPTOR_UNLOCK ();
+    gum_interceptor_unignore_current_thread (self);
+
+    return result;
+  }
+}
+
+void
+gum_interceptor_detach_probe (GumInterceptor * self,
+                              gpointer function_address)
+{
+  GumInterceptorPrivate * priv = self->priv;
+  GumFunctionContext * function_ctx;
+
+  gum_interceptor_ignore_current_thread (self);
+  GUM_INTERCEPTOR_LOCK ();
+
+  function_address = gum_interceptor_resolve (self, function_address);
+
+  function_ctx = (GumFunctionContext *) gum_hash_table_lookup (
+      priv->function_by_address, function_address);
+  if (function_ctx != NULL && function_ctx->probe_counter != NULL)
+  {
+    gum_hash_table_remove (priv->function_by_address, function_address);
+    gum_function_context_destroy (function_ctx);
+  }
+
+  GUM_INTERCEPTOR_UNLOCK ();
+  gum_interceptor_unignore_current_thread (self);
+}
+
+void
+gum_interceptor_begin_transaction (GumInterceptor * self)
+{
+  GumInterceptorPrivate * priv = self->priv;
+
+  GUM_INTERCEPTOR_LOCK ();
+  priv->transaction_level++;
+  gum_interceptor_collect_retired (self);
+  GUM_INTERCEPTOR_UNLOCK ();
+}
+
+void
+gum_interceptor_end_transaction (GumInterceptor * self)
+{
+  GumInterceptorPrivate * priv = self->priv;
+
+  gum_interceptor_ignore_current_thread (self);
+  GUM_INTERCEPTOR_LOCK ();
+
+  g_assert_cmpuint (priv->transaction_level, >, 0);
+  if (--priv->transaction_level == 0)
+    gum_interceptor_commit_pending_updates (self);
+  gum_interceptor_collect_retired (self);
+
   GUM_INTERCEPTOR_UNLOCK ();
+  gum_interceptor_unignore_current_thread (self);
+}
+
+gboolean
+_gum_interceptor_is_using_minimal_thunks (GumInterceptor * self,
+                                          gpointer function_address)
+{
+  GumInterceptorPrivate * priv = self->priv;
+  GumFunctionContext * function_ctx;
+  gboolean result = FALSE;
+
+  GUM_INTERCEPTOR_LOCK ();
+
+  function_address = gum_interceptor_resolve (self, function_address);
+
+  function_ctx = (GumFunctionContext *) gum_hash_table_lookup (
+      priv->function_by_address, function_address);
+  if (function_ctx != NULL)
+  {
+    result = _gum_interceptor_backend_is_using_minimal_thunks (priv->backend,
+        function_ctx);
+  }
+
+  GUM_INTERCEPTOR_UNLOCK ();
+
+  return result;
 }
 
 GumInvocationContext *
@@ -530,6 +795,42 @@ gum_interceptor_unignore_other_threads (GumInterceptor * self)
   priv->selected_thread_id = 0;
 }
 
+GumProbeCounter *
+gum_probe_counter_new (void)
+{
+  GumProbeCounter * counter;
+
+  g_assert_cmpuint (gum_query_page_size (), >=,
+      GUM_PROBE_COUNTER_SLOT_COUNT << GUM_PROBE_COUNTER_SLOT_SIZE_SHIFT);
+
+  counter = gum_new (GumProbeCounter, 1);
+  counter->slots = gum_alloc_n_pages (1, GUM_PAGE_RW);
+
+  return counter;
+}
+
+void
+gum_probe_counter_free (GumProbeCounter * counter)
+{
+  gum_free_pages (counter->slots);
+  gum_free (counter);
+}
+
+guint64
+gum_probe_counter_get_total (GumProbeCounter * counter)
+{
+  guint64 total = 0;
+  guint i;
+
+  for (i = 0; i != GUM_PROBE_COUNTER_SLOT_COUNT; i++)
+  {
+    total += *((volatile guint64 *)
+        (counter->slots + (i << GUM_PROBE_COUNTER_SLOT_SIZE_SHIFT)));
+  }
+
+  return total;
+}
+
 gpointer
 gum_invocation_stack_translate (GumInvocationStack * self,
                                 gpointer return_address)
@@ -551,16 +852,35 @@ gum_invocation_stack_translate (GumInvocationStack * self,
 
 static GumFunctionContext *
 gum_interceptor_instrument (GumInterceptor * self,
-                            gpointer function_address)
+                            gpointer function_address,
+                            GumProbeCounter * probe_counter,
+                            gboolean * conflict)
 {
   GumInterceptorPrivate * priv = self->priv;
   GumFunctionContext * ctx;
 
+  *conflict = FALSE;
+
   ctx = (GumFunctionContext *) gum_hash_table_lookup (priv->function_by_address,
       function_address);
   if (ctx != NULL)
     return ctx;
 
+  if (priv->transaction_level > 0)
+  {
+    ctx = gum_interceptor_reclaim_pending (self, function_address,
+        probe_counter, conflict);
+    if (ctx != NULL)
+    {
+      gum_hash_table_insert (priv->function_by_address, function_address, ctx);
+      return ctx;
+    }
+    else if (*conflict)
+    {
+      return NULL;
+    }
+  }
+
   if (!_gum_interceptor_backend_can_intercept (priv->backend,
       function_address))
     return NULL;
@@ -568,6 +888,7 @@ gum_interceptor_instrument (GumInterceptor * self,
   ctx = gum_function_context_new (self, function_address, &priv->allocator);
   if (ctx == NULL)
     return NULL;
+  ctx->probe_counter = probe_counter;
 
   if (!_gum_interceptor_backend_create_trampoline (priv->backend, ctx))
   {
@@ -581,16 +902,308 @@ gum_interceptor_instrument (GumInterceptor * self,
         GUM_PAGE_RX);
   }
 
-  make_function_prologue_at_least_read_write (function_address);
-  _gum_interceptor_backend_activate_trampoline (priv->backend, ctx);
-  make_function_prologue_read_execute (function_address);
-  _gum_interceptor_backend_commit_trampoline (priv->backend, ctx);
+  if (priv->transaction_level > 0)
+  {
+    GumPrologueUpdate update = { ctx, TRUE };
+
+    gum_array_append_val (priv->pending_updates, update);
+  }
+  else
+  {
+    make_function_prologue_at_least_read_write (function_address);
+    _gum_interceptor_backend_activate_trampoline (priv->backend, ctx);
+    make_function_prologue_read_execute (function_address);
+    _gum_interceptor_backend_commit_trampoline (priv->backend, ctx);
+  }
 
   gum_hash_table_insert (priv->function_by_address, function_address, ctx);
 
   return ctx;
 }
 
+/*
+ * A function detached and then attached to again within the same transaction
+ * still has its original trampoline activated, so we hand that context back
+ * instead of building a second trampoline on top of the first one. If the
+ * old context is of the other kind, i.e. a probe versus listeners, it cannot
+ * be reused and we report a conflict until the transaction has ended.
+ */
+static GumFunctionContext *
+gum_interceptor_reclaim_pending (GumInterceptor * self,
+                                 gpointer function_address,
+                                 GumProbeCounter * probe_counter,
+                                 gboolean * conflict)
+{
+  GumArray * updates = self->priv->pending_updates;
+  guint i;
+
+  for (i = 0; i != updates->len; i++)
+  {
+    GumPrologueUpdate * update;
+
+    update = &gum_array_index (updates, GumPrologueUpdate, i);
+    if (!update->activate &&
+        update->function_ctx->function_address == function_address)
+    {
+      GumFunctionContext * ctx = update->function_ctx;
+
+      if (ctx->probe_counter != probe_counter)
+      {
+        *conflict = TRUE;
+        return NULL;
+      }
+
+      gum_array_remove_index (updates, i);
+
+      return ctx;
+    }
+  }
+
+  return NULL;
+}
+
+static void
+gum_interceptor_commit_pending_updates (GumInterceptor * self)
+{
+  GumInterceptorPrivate * priv = self->priv;
+  GumArray * updates = priv->pending_updates;
+  GumArray * pages;
+  gsize page_mask;
+  guint i;
+
+  if (updates->len == 0)
+    return;
+
+  /*
+   * Flip each page touched by the batch once, instead of once per prologue,
+   * then apply every update in the order it was requested.
+   */
+  page_mask = ~((gsize) gum_query_page_size () - 1);
+  pages = gum_array_sized_new (FALSE, FALSE, sizeof (gsize),
+      2 * updates->len);
+  for (i = 0; i != updates->len; i++)
+  {
+    GumPrologueUpdate * update;
+    gsize start, end;
+
+    update = &gum_array_index (updates, GumPrologueUpdate, i);
+    start = GPOINTER_TO_SIZE (update->function_ctx->function_address);
+    end = start + GUM_FUNCTION_PROLOGUE_SIZE - 1;
+
+    start &= page_mask;
+    end &= page_mask;
+    gum_array_append_val (pages, start);
+    if (end != start)
+      gum_array_append_val (pages, end);
+  }
+  gum_array_sort (pages, gum_compare_page_addresses);
+
+  gum_interceptor_protect_prologue_pages (pages,
+      gum_function_prologue_writable_protection ());
+
+  for (i = 0; i != updates->len; i++)
+  {
+    GumPrologueUpdate * update;
+
+    update = &gum_array_index (updates, GumPrologueUpdate, i);
+    if (update->activate)
+    {
+      _gum_interceptor_backend_activate_trampoline (priv->backend,
+          update->function_ctx);
+    }
+    else
+    {
+      _gum_interceptor_backend_deactivate_trampoline (priv->backend,
+          update->function_ctx);
+    }
+  }
+
+  gum_interceptor_protect_prologue_pages (pages,
+      GUM_PAGE_READ | GUM_PAGE_EXECUTE);
+
+  gum_array_free (pages, TRUE);
+
+  for (i = 0; i != updates->len; i++)
+  {
+    GumPrologueUpdate * update;
+
+    update = &gum_array_index (updates, GumPrologueUpdate, i);
+    _gum_interceptor_backend_commit_trampoline (priv->backend,
+        update->function_ctx);
+  }
+
+  g_thread_yield ();
+
+  for (i = 0; i != updates->len; i++)
+  {
+    GumPrologueUpdate * update;
+
+    update = &gum_array_index (updates, GumPrologueUpdate, i);
+    if (!update->activate)
+    {
+      gum_function_context_wait_for_probe (update->function_ctx);
+
+      gum_interceptor_retire (self, update->function_ctx,
+          update->function_ctx,
+          (GDestroyNotify) gum_function_context_release);
+    }
+  }
+
+  gum_array_set_size (updates, 0);
+}
+
+static void
+gum_interceptor_protect_prologue_pages (GumArray * pages,
+                                        GumPageProtection prot)
+{
+  gsize page_size;
+  guint i;
+
+  page_size = gum_query_page_size ();
+
+  i = 0;
+  while (i != pages->len)
+  {
+    gsize start, end;
+
+    start = gum_array_index (pages, gsize, i);
+    end = start + page_size;
+    for (i++; i != pages->len; i++)
+    {
+      gsize page = gum_array_index (pages, gsize, i);
+
+      if (page > end)
+        break;
+      end = page + page_size;
+    }
+
+    gum_mprotect (GSIZE_TO_POINTER (start), end - start, prot);
+  }
+}
+
+static gint
+gum_compare_page_addresses (gconstpointer a,
+                            gconstpointer b)
+{
+  gsize page_a = *((const gsize *) a);
+  gsize page_b = *((const gsize *) b);
+
+  if (page_a < page_b)
+    return -1;
+  else if (page_a > page_b)
+    return 1;
+  else
+    return 0;
+}
+
+static void
+gum_interceptor_retire (GumInterceptor * self,
+                        GumFunctionContext * owner,
+                        gpointer object,
+                        GDestroyNotify destroy)
+{
+  GumRetiredObject retired;
+
+  retired.owner = owner;
+  retired.object = object;
+  retired.destroy = destroy;
+  gum_array_append_val (self->priv->retired_objects, retired);
+
+  gum_interceptor_collect_retired (self);
+}
+
+static void
+gum_interceptor_collect_retired (GumInterceptor * self)
+{
+  GumArray * retired_objects = self->priv->retired_objects;
+  guint i;
+
+  /*
+   * Listener lists go first, and a function context only once none of its
+   * lists are left, as those are reclaimed based on its usage counter.
+   */
+  i = 0;
+  while (i != retired_objects->len)
+  {
+    GumRetiredObject * retired;
+
+    retired = &gum_array_index (retired_objects, GumRetiredObject, i);
+    if (retired->object != retired->owner &&
+        g_atomic_int_get (&retired->owner->trampoline_usage_counter) == 0)
+    {
+      retired->destroy (retired->object);
+      gum_array_remove_index (retired_objects, i);
+    }
+    else
+    {
+      i++;
+    }
+  }
+
+  i = 0;
+  while (i != retired_objects->len)
+  {
+    GumRetiredObject * retired;
+
+    retired = &gum_array_index (retired_objects, GumRetiredObject, i);
+    if (retired->object == retired->owner &&
+        g_atomic_int_get (&retired->owner->trampoline_usage_counter) == 0 &&
+        !gum_interceptor_has_retired_from (self, retired->owner))
+    {
+      retired->destroy (retired->object);
+      gum_array_remove_index (retired_objects, i);
+    }
+    else
+    {
+      i++;
+    }
+  }
+}
+
+static gboolean
+gum_interceptor_has_retired_in_use (GumInterceptor * self,
+                                    InterceptorThreadContext * ignored_ctx)
+{
+  GumArray * retired_objects = self->priv->retired_objects;
+  guint i;
+
+  for (i = 0; i != retired_objects->len; i++)
+  {
+    GumFunctionContext * owner;
+    guint usage;
+
+    owner = gum_array_index (retired_objects, GumRetiredObject, i).owner;
+
+    usage = g_atomic_int_get (&owner->trampoline_usage_counter);
+    if (ignored_ctx != NULL)
+      usage -= interceptor_thread_context_count_usage (ignored_ctx, owner);
+
+    if (usage != 0)
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+static gboolean
+gum_interceptor_has_retired_from (GumInterceptor * self,
+                                  GumFunctionContext * owner)
+{
+  GumArray * retired_objects = self->priv->retired_objects;
+  guint i;
+
+  for (i = 0; i != retired_objects->len; i++)
+  {
+    GumRetiredObject * retired;
+
+    retired = &gum_array_index (retired_objects, GumRetiredObject, i);
+    if (retired->owner == owner && retired->object != owner)
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
 static GumFunctionContext *
 gum_function_context_new (GumInterceptor * interceptor,
                           gpointer function_address,
@@ -602,8 +1215,9 @@ gum_function_context_new (GumInterceptor * interceptor,
   ctx->interceptor = interceptor;
   ctx->function_address = function_address;
 
-  ctx->listener_entries =
-      gum_array_sized_new (FALSE, FALSE, sizeof (gpointer), 2);
+  ctx->listeners = NULL;
+  ctx->requirements = GUM_INVOCATION_REQUIRES_ALL;
+  ctx->probe_in_flight = 0;
 
   ctx->allocator = allocator;
 
@@ -613,28 +1227,74 @@ gum_function_context_new (GumInterceptor * interceptor,
 static void
 gum_function_context_destroy (GumFunctionContext * function_ctx)
 {
-  guint i;
+  GumInterceptorPrivate * priv = function_ctx->interceptor->priv;
+
+  if (function_ctx->trampoline_slice != NULL && priv->transaction_level > 0)
+  {
+    GumArray * updates = priv->pending_updates;
+    GumPrologueUpdate update = { function_ctx, FALSE };
+    guint i;
+
+    for (i = 0; i != updates->len; i++)
+    {
+      if (gum_array_index (updates, GumPrologueUpdate, i).function_ctx ==
+          function_ctx)
+      {
+        gum_array_remove_index (updates, i);
+        _gum_interceptor_backend_destroy_trampoline (priv->backend,
+            function_ctx);
+        gum_function_context_free (function_ctx);
+        return;
+      }
+    }
+
+    gum_array_append_val (updates, update);
+    return;
+  }
 
   if (function_ctx->trampoline_slice != NULL)
   {
-    GumInterceptorBackend * backend = function_ctx->interceptor->priv->backend;
+    GumInterceptorBackend * backend = priv->backend;
 
     make_function_prologue_at_least_read_write (function_ctx->function_address);
     _gum_interceptor_backend_deactivate_trampoline (backend, function_ctx);
     make_function_prologue_read_execute (function_ctx->function_address);
     _gum_interceptor_backend_commit_trampoline (backend, function_ctx);
 
-    gum_function_context_wait_for_idle_trampoline (function_ctx);
-    _gum_interceptor_backend_destroy_trampoline (backend, function_ctx);
-  }
+    g_thread_yield ();
 
-  for (i = 0; i != function_ctx->listener_entries->len; i++)
-  {
-    ListenerEntry * cur =
-        gum_array_index (function_ctx->listener_entries, ListenerEntry *, i);
-    gum_free (cur);
+    gum_function_context_wait_for_probe (function_ctx);
+
+    gum_interceptor_retire (function_ctx->interceptor, function_ctx,
+        function_ctx, (GDestroyNotify) gum_function_context_release);
+    return;
   }
-  gum_array_free (function_ctx->listener_entries, TRUE);
+
+  gum_function_context_free (function_ctx);
+}
+
+static void
+gum_function_context_wait_for_probe (GumFunctionContext * function_ctx)
+{
+  if (function_ctx->probe_counter == NULL)
+    return;
+
+  while (g_atomic_int_get (&function_ctx->probe_in_flight) != 0)
+    g_thread_yield ();
+}
+
+static void
+gum_function_context_release (GumFunctionContext * function_ctx)
+{
+  _gum_interceptor_backend_destroy_trampoline (
+      function_ctx->interceptor->priv->backend, function_ctx);
+  gum_function_context_free (function_ctx);
+}
+
+static void
+gum_function_context_free (GumFunctionContext * function_ctx)
+{
+  gum_free (function_ctx->listeners);
 
   gum_free (function_ctx);
 }
@@ -643,7 +1303,7 @@ static gboolean
 gum_function_context_try_destroy (GumFunctionContext * function_ctx)
 {
   if (function_ctx->replacement_function != NULL ||
-      function_ctx->listener_entries->len > 0)
+      function_ctx->listeners != NULL)
     return FALSE;
 
   gum_function_context_destroy (function_ctx);
@@ -655,38 +1315,102 @@ gum_function_context_add_listener (GumFunctionContext * function_ctx,
                                    GumInvocationListener * listener,
                                    gpointer function_data)
 {
+  GumListenerSnapshot * old_listeners = function_ctx->listeners;
+  GumListenerSnapshot * new_listeners;
+  guint old_length;
   ListenerEntry * entry;
 
-  entry = gum_new (ListenerEntry, 1);
+  old_length = (old_listeners != NULL) ? old_listeners->length : 0;
+
+  new_listeners = gum_listener_snapshot_new (old_length + 1);
+  if (old_length != 0)
+  {
+    memcpy (new_listeners->entries, old_listeners->entries,
+        old_length * sizeof (ListenerEntry));
+  }
+
+  entry = &new_listeners->entries[old_length];
   entry->listener_interface = GUM_INVOCATION_LISTENER_GET_INTERFACE (listener);
   entry->listener_instance = listener;
   entry->function_data = function_data;
+  entry->requirements = gum_invocation_listener_get_requirements (listener);
 
-  gum_array_append_val (function_ctx->listener_entries, entry);
+  gum_function_context_publish_listeners (function_ctx, new_listeners);
 }
 
 static void
 gum_function_context_remove_listener (GumFunctionContext * function_ctx,
                                       GumInvocationListener * listener)
 {
-  ListenerEntry * entry;
-  guint i;
+  GumListenerSnapshot * old_listeners = function_ctx->listeners;
+  GumListenerSnapshot * new_listeners = NULL;
+  guint i, j;
 
-  entry = gum_function_context_find_listener_entry (function_ctx, listener);
-  g_assert (entry != NULL);
+  g_assert (gum_function_context_find_listener_entry (function_ctx,
+      listener) != NULL);
 
-  for (i = 0; i != function_ctx->listener_entries->len; i++)
+  if (old_listeners->length > 1)
   {
-    ListenerEntry * cur =
-        gum_array_index (function_ctx->listener_entries, ListenerEntry *, i);
-    if (cur == entry)
+    new_listeners = gum_listener_snapshot_new (old_listeners->length - 1);
+    for (i = 0, j = 0; i != old_listeners->length; i++)
     {
-      gum_array_remove_index (function_ctx->listener_entries, i);
-      break;
+      if (old_listeners->entries[i].listener_instance != listener)
+        new_listeners->entries[j++] = old_listeners->entries[i];
     }
   }
 
-  gum_free (entry);
+  gum_function_context_publish_listeners (function_ctx, new_listeners);
+}
+
+static void
+gum_function_context_publish_listeners (GumFunctionContext * function_ctx,
+                                        GumListenerSnapshot * listeners)
+{
+  GumListenerSnapshot * old_listeners = function_ctx->listeners;
+
+  g_atomic_pointer_set (&function_ctx->listeners, listeners);
+
+  if (old_listeners != NULL)
+  {
+    gum_interceptor_retire (function_ctx->interceptor, function_ctx,
+        old_listeners, gum_free);
+  }
+
+  gum_function_context_update_requirements (function_ctx);
+}
+
+static void
+gum_function_context_update_requirements (GumFunctionContext * function_ctx)
+{
+  GumListenerSnapshot * listeners = function_ctx->listeners;
+  GumInvocationRequirements requirements = GUM_INVOCATION_REQUIRES_NOTHING;
+  guint i;
+
+  for (i = 0; listeners != NULL && i != listeners->length; i++)
+    requirements |= listeners->entries[i].requirements;
+
+  /* the replacement may inspect and modify anything through the context */
+  if (function_ctx->replacement_function != NULL)
+    requirements = GUM_INVOCATION_REQUIRES_ALL;
+
+  if (requirements == function_ctx->requirements)
+    return;
+  function_ctx->requirements = requirements;
+
+  _gum_interceptor_backend_update_requirements (
+      function_ctx->interceptor->priv->backend, function_ctx);
+}
+
+static GumListenerSnapshot *
+gum_listener_snapshot_new (guint length)
+{
+  GumListenerSnapshot * snapshot;
+
+  snapshot = gum_malloc (sizeof (GumListenerSnapshot) +
+      (length - 1) * sizeof (ListenerEntry));
+  snapshot->length = length;
+
+  return snapshot;
 }
 
 static gboolean
@@ -701,12 +1425,15 @@ static ListenerEntry *
 gum_function_context_find_listener_entry (GumFunctionContext * function_ctx,
                                           GumInvocationListener * listener)
 {
+  GumListenerSnapshot * listeners = function_ctx->listeners;
   guint i;
 
-  for (i = 0; i < function_ctx->listener_entries->len; i++)
+  if (listeners == NULL)
+    return NULL;
+
+  for (i = 0; i != listeners->length; i++)
   {
-    ListenerEntry * entry =
-        gum_array_index (function_ctx->listener_entries, ListenerEntry *, i);
+    ListenerEntry * entry = &listeners->entries[i];
 
     if (entry->listener_instance == listener)
       return entry;
@@ -846,8 +1573,11 @@ _gum_function_context_begin_invocation (GumFunctionContext * function_ctx,
       function_ctx->replacement_function != NULL || invoke_listeners;
   if (will_trap_on_leave)
   {
+    g_atomic_int_inc (&function_ctx->trampoline_usage_counter);
+
     stack_entry = gum_invocation_stack_push (stack, function_ctx,
         *caller_ret_addr);
+    stack_entry->listeners = g_atomic_pointer_get (&function_ctx->listeners);
     invocation_ctx = &stack_entry->invocation_context;
 
 #if defined (HAVE_I386)
@@ -865,22 +1595,20 @@ _gum_function_context_begin_invocation (GumFunctionContext * function_ctx,
 #endif
   }
 
-  if (invoke_listeners)
+  if (invoke_listeners && stack_entry->listeners != NULL)
   {
+    GumListenerSnapshot * listeners = stack_entry->listeners;
     guint i;
 
     invocation_ctx->cpu_context = cpu_context;
     invocation_ctx->system_error = system_error;
     invocation_ctx->backend = &interceptor_ctx->listener_backend;
 
-    for (i = 0; i < function_ctx->listener_entries->len; i++)
+    for (i = 0; i != listeners->length; i++)
     {
-      ListenerEntry * listener_entry;
+      ListenerEntry * listener_entry = &listeners->entries[i];
       ListenerInvocationState state;
 
-      listener_entry =
-          gum_array_index (function_ctx->listener_entries, ListenerEntry *, i);
-
       state.point_cut = GUM_POINT_ENTER;
       state.entry = listener_entry;
       state.interceptor_ctx = interceptor_ctx;
@@ -921,7 +1649,6 @@ _gum_function_context_begin_invocation (GumFunctionContext * function_ctx,
   if (will_trap_on_leave)
   {
     *caller_ret_addr = function_ctx->on_leave_trampoline;
-    g_atomic_int_inc (&function_ctx->trampoline_usage_counter);
   }
 
   if (function_ctx->replacement_function != NULL)
@@ -950,6 +1677,7 @@ _gum_function_context_end_invocation (GumFunctionContext * function_ctx,
   GumInvocationStackEntry * stack_entry;
   gpointer caller_ret_addr;
   GumInvocationContext * invocation_ctx;
+  GumListenerSnapshot * listeners;
   guint i;
 
 #ifdef G_OS_WIN32
@@ -967,7 +1695,6 @@ _gum_function_context_end_invocation (GumFunctionContext * function_ctx,
   stack_entry = gum_invocation_stack_peek_top (interceptor_ctx->stack);
   caller_ret_addr = stack_entry->caller_ret_addr;
   *next_hop = caller_ret_addr;
-  g_atomic_int_dec_and_test (&function_ctx->trampoline_usage_counter);
 
   invocation_ctx = &stack_entry->invocation_context;
   invocation_ctx->cpu_context = cpu_context;
@@ -988,14 +1715,12 @@ _gum_function_context_end_invocation (GumFunctionContext * function_ctx,
 # error Unsupported architecture
 #endif
 
-  for (i = 0; i < function_ctx->listener_entries->len; i++)
+  listeners = stack_entry->listeners;
+  for (i = 0; listeners != NULL && i != listeners->length; i++)
   {
-    ListenerEntry * entry;
+    ListenerEntry * entry = &listeners->entries[i];
     ListenerInvocationState state;
 
-    entry =
-        gum_array_index (function_ctx->listener_entries, ListenerEntry *, i);
-
     state.point_cut = GUM_POINT_LEAVE;
     state.entry = entry;
     state.interceptor_ctx = interceptor_ctx;
@@ -1028,6 +1753,8 @@ _gum_function_context_end_invocation (GumFunctionContext * function_ctx,
 
   gum_invocation_stack_pop (interceptor_ctx->stack);
 
+  g_atomic_int_add (&function_ctx->trampoline_usage_counter, -1);
+
   gum_tls_key_set_value (_gum_interceptor_guard_key, NULL);
 }
 
@@ -1202,6 +1929,27 @@ interceptor_thread_context_destroy (InterceptorThreadContext * context)
   gum_free (context);
 }
 
+static guint
+interceptor_thread_context_count_usage (InterceptorThreadContext * self,
+                                        GumFunctionContext * function_ctx)
+{
+  GumInvocationStack * stack = self->stack;
+  guint usage, i;
+
+  usage = 0;
+  for (i = 0; i != stack->len; i++)
+  {
+    GumInvocationStackEntry * entry;
+
+    entry = (GumInvocationStackEntry *)
+        &gum_array_index (stack, GumInvocationStackEntry, i);
+    if (entry->function_ctx == function_ctx)
+      usage++;
+  }
+
+  return usage;
+}
+
 static gpointer
 interceptor_thread_context_get_listener_data (InterceptorThreadContext * self,
                                               GumInvocationListener * listener,
@@ -1272,6 +2020,7 @@ gum_invocation_stack_push (GumInvocationStack * stack,
   gum_array_set_size (stack, stack->len + 1);
   entry = (GumInvocationStackEntry *)
       &gum_array_index (stack, GumInvocationStackEntry, stack->len - 1);
+  entry->function_ctx = function_ctx;
   entry->trampoline_ret_addr = function_ctx->on_leave_trampoline;
   entry->caller_ret_addr = caller_ret_addr;
 
@@ -1332,26 +2081,22 @@ gum_interceptor_has (GumInterceptor * self,
       function_address) != NULL;
 }
 
-static void
-gum_function_context_wait_for_idle_trampoline (GumFunctionContext * ctx)
+static GumPageProtection
+gum_function_prologue_writable_protection (void)
 {
-  while (ctx->trampoline_usage_counter != 0)
-    g_thread_yield ();
-  g_thread_yield ();
+  return gum_query_is_rwx_supported () ? GUM_PAGE_RWX : GUM_PAGE_RW;
 }
 
 static void
 make_function_prologue_at_least_read_write (gpointer prologue_address)
 {
-  GumPageProtection prot;
-
-  prot = gum_query_is_rwx_supported () ? GUM_PAGE_RWX : GUM_PAGE_RW;
-
-  gum_mprotect (prologue_address, 16, prot);
+  gum_mprotect (prologue_address, GUM_FUNCTION_PROLOGUE_SIZE,
+      gum_function_prologue_writable_protection ());
 }
 
 static void
 make_function_prologue_read_execute (gpointer prologue_address)
 {
-  gum_mprotect (prologue_address, 16, GUM_PAGE_READ | GUM_PAGE_EXECUTE);
+  gum_mprotect (prologue_address, GUM_FUNCTION_PROLOGUE_SIZE,
+      GUM_PAGE_READ | GUM_PAGE_EXECUTE);
 }
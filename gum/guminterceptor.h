@@ -31,6 +31,7 @@ typedef struct _GumInterceptorClass GumInterceptorClass;
 typedef GumArray GumInvocationStack;
 
 typedef struct _GumInterceptorPrivate GumInterceptorPrivate;
+typedef struct _GumProbeCounter GumProbeCounter;
 
 typedef enum
 {
@@ -76,6 +77,14 @@ GUM_API GumReplaceReturn gum_interceptor_replace_function (
 GUM_API void gum_interceptor_revert_function (GumInterceptor * self,
     gpointer function_address);
 
+GUM_API GumAttachReturn gum_interceptor_attach_probe (GumInterceptor * self,
+    gpointer function_address, GumProbeCounter * counter);
+GUM_API void gum_interceptor_detach_probe (GumInterceptor * self,
+    gpointer function_address);
+
+GUM_API void gum_interceptor_begin_transaction (GumInterceptor * self);
+GUM_API void gum_interceptor_end_transaction (GumInterceptor * self);
+
 GUM_API GumInvocationContext * gum_interceptor_get_current_invocation (void);
 GUM_API GumInvocationStack * gum_interceptor_get_current_stack (void);
 
@@ -88,6 +97,10 @@ GUM_API void gum_interceptor_unignore_other_threads (GumInterceptor * self);
 GUM_API gpointer gum_invocation_stack_translate (GumInvocationStack * self,
     gpointer return_address);
 
+GUM_API GumProbeCounter * gum_probe_counter_new (void);
+GUM_API void gum_probe_counter_free (GumProbeCounter * counter);
+GUM_API guint64 gum_probe_counter_get_total (GumProbeCounter * counter);
+
 G_END_DECLS
 
 #endif
@@ -39,3 +39,15 @@ gum_invocation_listener_on_leave (GumInvocationListener * self,
 {
   GUM_INVOCATION_LISTENER_GET_INTERFACE (self)->on_leave (self, context);
 }
+
+GumInvocationRequirements
+gum_invocation_listener_get_requirements (GumInvocationListener * self)
+{
+  GumInvocationListenerIface * iface =
+      GUM_INVOCATION_LISTENER_GET_INTERFACE (self);
+
+  if (iface->get_requirements == NULL)
+    return GUM_INVOCATION_REQUIRES_ALL;
+
+  return iface->get_requirements (self);
+}
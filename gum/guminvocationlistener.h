@@ -23,6 +23,17 @@
 typedef struct _GumInvocationListener GumInvocationListener;
 typedef struct _GumInvocationListenerIface GumInvocationListenerIface;
 
+typedef enum _GumInvocationRequirements GumInvocationRequirements;
+
+enum _GumInvocationRequirements
+{
+  GUM_INVOCATION_REQUIRES_NOTHING      = 0,
+  GUM_INVOCATION_REQUIRES_ARGUMENTS    = (1 << 0),
+  GUM_INVOCATION_REQUIRES_RETURN_VALUE = (1 << 1),
+  GUM_INVOCATION_REQUIRES_CPU_CONTEXT  = (1 << 2),
+  GUM_INVOCATION_REQUIRES_ALL          = (1 << 3) - 1
+};
+
 struct _GumInvocationListenerIface
 {
   GTypeInterface parent;
@@ -31,6 +42,10 @@ struct _GumInvocationListenerIface
       GumInvocationContext * context);
   void (* on_leave) (GumInvocationListener * self,
       GumInvocationContext * context);
+
+  /* optional, listeners that leave it out get GUM_INVOCATION_REQUIRES_ALL */
+  GumInvocationRequirements (* get_requirements) (
+      GumInvocationListener * self);
 };
 
 G_BEGIN_DECLS
@@ -41,6 +56,8 @@ GUM_API void gum_invocation_listener_on_enter (GumInvocationListener * self,
     GumInvocationContext * context);
 GUM_API void gum_invocation_listener_on_leave (GumInvocationListener * self,
     GumInvocationContext * context);
+GUM_API GumInvocationRequirements gum_invocation_listener_get_requirements (
+    GumInvocationListener * self);
 
 G_END_DECLS
 
@@ -7,9 +7,32 @@
 #include "gummemory.h"
 
 #include "gummemory-priv.h"
+#include "gumtls-priv.h"
 
 #include <string.h>
 
+#if defined (HAVE_I386) && (GLIB_SIZEOF_VOID_P == 8 || defined (__SSE2__))
+# define GUM_HAVE_SSE2_SCAN 1
+# include <emmintrin.h>
+#endif
+#if defined (HAVE_I386) && defined (__GNUC__)
+# define GUM_HAVE_AVX2_SCAN 1
+# include <immintrin.h>
+#endif
+
+#define GUM_SCAN_CHUNK_SIZE (16 * 1024 * 1024)
+
+#define GUM_SCAN_STATE_NONE    G_MAXUINT32
+#define GUM_SCAN_STATE_REPORTS (1U << 31)
+#define GUM_SCAN_STATE_MASK    (GUM_SCAN_STATE_REPORTS - 1)
+
+#define GUM_MAGAZINE_QUANTUM     16
+#define GUM_MAGAZINE_CLASS_COUNT 16
+#define GUM_MAGAZINE_MAX_SIZE \
+    (GUM_MAGAZINE_QUANTUM * GUM_MAGAZINE_CLASS_COUNT)
+#define GUM_MAGAZINE_CAPACITY    32
+#define GUM_MAGAZINE_BATCH_SIZE  (GUM_MAGAZINE_CAPACITY / 2)
+
 #ifdef G_OS_UNIX
 # include <unistd.h>
 # define __USE_GNU     1
@@ -38,6 +61,134 @@
 # pragma warning (pop)
 #endif
 
+typedef struct _GumScanNeedle GumScanNeedle;
+typedef struct _GumScanJob GumScanJob;
+typedef struct _GumParallelScan GumParallelScan;
+typedef struct _GumScanAutomaton GumScanAutomaton;
+typedef struct _GumScanState GumScanState;
+typedef struct _GumScanOutput GumScanOutput;
+typedef struct _GumMagazine GumMagazine;
+typedef struct _GumMagazineCache GumMagazineCache;
+
+typedef const guint8 * (* GumScanFindFunc) (const guint8 * cur,
+    const guint8 * end, const GumScanNeedle * needle);
+
+struct _GumScanNeedle
+{
+  const guint8 * data;
+  guint len;
+  guint offset;
+
+  guint anchor_a;
+  guint anchor_b;
+};
+
+struct _GumScanJob
+{
+  guint8 * start;
+  guint8 * stop;
+  guint range_index;
+
+  GArray * matches;
+  gboolean completed;
+};
+
+struct _GumParallelScan
+{
+  const GumMatchPattern * pattern;
+  GumScanNeedle needle;
+
+  volatile gint cancelled;
+
+  GMutex mutex;
+  GCond cond;
+};
+
+struct _GumMatchPatternSet
+{
+  GPtrArray * patterns;
+  GumScanAutomaton * automaton;
+};
+
+/*
+ * Aho-Corasick automaton over the longest exact token of each pattern in a
+ * set. Input bytes are first mapped to equivalence classes, so the fully
+ * resolved transition table is only as wide as the number of distinct bytes
+ * appearing in the tokens, plus one class for everything else.
+ */
+struct _GumScanAutomaton
+{
+  guint16 classes[256];
+  guint n_classes;
+
+  guint32 * delta;
+  GArray * states;
+  GArray * outputs;
+};
+
+struct _GumScanState
+{
+  guint32 fail;
+  guint32 output_link;
+  guint32 first_output;
+};
+
+struct _GumScanOutput
+{
+  guint pattern_id;
+  guint end_offset;
+  guint32 next;
+};
+
+struct _GumMagazine
+{
+  guint count;
+  gpointer blocks[GUM_MAGAZINE_CAPACITY];
+};
+
+/*
+ * Per-thread stacks of free small blocks, one per size class, sitting in
+ * front of the shared mspace. Blocks parked here are still in use as far as
+ * dlmalloc is concerned, so cached_size is what we subtract when reporting
+ * usage. Caches live in the mspace themselves and are recycled when their
+ * thread exits. Deinit destroys them along with the mspace, and starts over
+ * with a fresh TLS key so no thread can get at a stale one.
+ */
+struct _GumMagazineCache
+{
+  GumMagazineCache * next;
+  gboolean in_use;
+
+  volatile gsize cached_size;
+  GumMagazine magazines[GUM_MAGAZINE_CLASS_COUNT];
+};
+
+static void gum_scan_needle_init (GumScanNeedle * needle,
+    const GumMatchPattern * pattern);
+static guint gum_scan_byte_commonness (guint8 byte);
+static gboolean gum_scan_span (const GumMatchPattern * pattern,
+    const GumScanNeedle * needle, guint8 * start, guint8 * stop,
+    gboolean overlapping, GumMemoryScanMatchFunc func, gpointer user_data);
+static GumScanFindFunc gum_scan_get_find_func (void);
+static const guint8 * gum_scan_find_scalar (const guint8 * cur,
+    const guint8 * end, const GumScanNeedle * needle);
+#ifdef GUM_HAVE_SSE2_SCAN
+static const guint8 * gum_scan_find_sse2 (const guint8 * cur,
+    const guint8 * end, const GumScanNeedle * needle);
+#endif
+#ifdef GUM_HAVE_AVX2_SCAN
+static const guint8 * gum_scan_find_avx2 (const guint8 * cur,
+    const guint8 * end, const GumScanNeedle * needle)
+    __attribute__ ((target ("avx2")));
+#endif
+static void gum_scan_job_process (gpointer data, gpointer user_data);
+static GumScanAutomaton * gum_scan_automaton_new (GPtrArray * patterns);
+static void gum_scan_automaton_free (GumScanAutomaton * automaton);
+static guint32 gum_scan_automaton_add_state (GumScanAutomaton * self,
+    GArray * delta);
+static gboolean gum_scan_job_collect_match (GumAddress address, gsize size,
+    gpointer user_data);
+
 static GumMatchPattern * gum_match_pattern_new (void);
 static void gum_match_pattern_update_computed_size (GumMatchPattern * self);
 static GumMatchToken * gum_match_pattern_get_longest_token (
@@ -52,8 +203,21 @@ static GumMatchToken * gum_match_token_new (GumMatchType type);
 static void gum_match_token_free (GumMatchToken * token);
 static void gum_match_token_append (GumMatchToken * self, guint8 byte);
 
+static GumMagazineCache * gum_magazine_cache_get (void);
+static void gum_magazine_cache_release (gpointer data);
+static void gum_magazine_cache_flush (GumMagazineCache * self);
+static gpointer gum_magazine_cache_alloc (GumMagazineCache * self,
+    gsize size);
+static gboolean gum_magazine_cache_try_free (GumMagazineCache * self,
+    gpointer mem);
+
 static mspace gum_mspace = NULL;
 
+G_LOCK_DEFINE_STATIC (gum_magazine_caches);
+static GumMagazineCache * gum_magazine_caches = NULL;
+static gboolean gum_magazine_caches_enabled = FALSE;
+static GumTlsKey gum_magazine_cache_key;
+
 static mspace
 gum_mspace_get (void)
 {
@@ -66,11 +230,28 @@ void
 gum_memory_init (void)
 {
   gum_mspace_get ();
+
+  gum_magazine_cache_key =
+      _gum_tls_key_new_full (gum_magazine_cache_release);
+  gum_magazine_caches_enabled = TRUE;
 }
 
 void
 gum_memory_deinit (void)
 {
+  /*
+   * Live threads may still be using their caches, so rather than flushing
+   * them we let destroy_mspace() reclaim both the caches and their blocks.
+   */
+  G_LOCK (gum_magazine_caches);
+  if (gum_magazine_caches_enabled)
+  {
+    gum_magazine_caches_enabled = FALSE;
+    gum_tls_key_free (gum_magazine_cache_key);
+  }
+  gum_magazine_caches = NULL;
+  G_UNLOCK (gum_magazine_caches);
+
   if (gum_mspace != NULL)
   {
     destroy_mspace (gum_mspace);
@@ -142,37 +323,686 @@ gum_memory_scan (const GumMemoryRange * range,
                  GumMemoryScanMatchFunc func,
                  gpointer user_data)
 {
-  GumMatchToken * needle;
-  guint8 * needle_data;
-  guint needle_len;
-  guint8 * cur, * end_address;
+  GumScanNeedle needle;
+  guint8 * start;
+
+  if (range->size < pattern->size)
+    return;
+
+  gum_scan_needle_init (&needle, pattern);
+
+  start = GSIZE_TO_POINTER (range->base_address);
+
+  gum_scan_span (pattern, &needle, start,
+      start + range->size - pattern->size + 1, FALSE, func, user_data);
+}
+
+void
+gum_memory_scan_ranges (const GumMemoryRange * ranges,
+                        guint n_ranges,
+                        const GumMatchPattern * pattern,
+                        GumMemoryScanMatchFunc func,
+                        gpointer user_data)
+{
+  GumParallelScan scan;
+  GArray * jobs;
+  GThreadPool * pool;
+  guint n_workers, i, j;
+  gboolean carry_on;
+  guint prev_range_index;
+  GumAddress next_allowed;
+
+  jobs = g_array_new (FALSE, FALSE, sizeof (GumScanJob));
+
+  for (i = 0; i != n_ranges; i++)
+  {
+    const GumMemoryRange * range = &ranges[i];
+    guint8 * start, * stop;
+
+    if (range->size < pattern->size)
+      continue;
+
+    start = GSIZE_TO_POINTER (range->base_address);
+    stop = start + range->size - pattern->size + 1;
+
+    /* each job owns the match start positions [start, stop) */
+    while (start != stop)
+    {
+      GumScanJob job;
+
+      job.start = start;
+      job.stop = ((gsize) (stop - start) > GUM_SCAN_CHUNK_SIZE)
+          ? start + GUM_SCAN_CHUNK_SIZE
+          : stop;
+      job.range_index = i;
+      job.matches = NULL;
+      job.completed = FALSE;
+      g_array_append_val (jobs, job);
+
+      start = job.stop;
+    }
+  }
+
+  n_workers = MIN (g_get_num_processors (), jobs->len);
+  if (n_workers <= 1)
+  {
+    g_array_free (jobs, TRUE);
+
+    for (i = 0; i != n_ranges; i++)
+      gum_memory_scan (&ranges[i], pattern, func, user_data);
+
+    return;
+  }
+
+  scan.pattern = pattern;
+  gum_scan_needle_init (&scan.needle, pattern);
+  scan.cancelled = FALSE;
+  g_mutex_init (&scan.mutex);
+  g_cond_init (&scan.cond);
+
+  pool = g_thread_pool_new (gum_scan_job_process, &scan, n_workers, TRUE,
+      NULL);
+  for (i = 0; i != jobs->len; i++)
+  {
+    GumScanJob * job = &g_array_index (jobs, GumScanJob, i);
 
-  needle = gum_match_pattern_get_longest_token (pattern, GUM_MATCH_EXACT);
-  needle_data = (guint8 *) needle->bytes->data;
-  needle_len = needle->bytes->len;
+    job->matches = g_array_new (FALSE, FALSE, sizeof (GumAddress));
+    g_thread_pool_push (pool, job, NULL);
+  }
+
+  /*
+   * Jobs report overlapping matches so that we can apply the
+   * non-overlapping rule across job boundaries, in address order.
+   */
+  carry_on = TRUE;
+  prev_range_index = G_MAXUINT;
+  next_allowed = 0;
+  for (i = 0; i != jobs->len && carry_on; i++)
+  {
+    GumScanJob * job = &g_array_index (jobs, GumScanJob, i);
+
+    g_mutex_lock (&scan.mutex);
+    while (!job->completed)
+      g_cond_wait (&scan.cond, &scan.mutex);
+    g_mutex_unlock (&scan.mutex);
+
+    if (job->range_index != prev_range_index)
+    {
+      prev_range_index = job->range_index;
+      next_allowed = 0;
+    }
+
+    for (j = 0; j != job->matches->len && carry_on; j++)
+    {
+      GumAddress address = g_array_index (job->matches, GumAddress, j);
 
-  cur = GSIZE_TO_POINTER (range->base_address);
-  end_address = cur + range->size - (pattern->size - needle->offset) + 1;
+      if (address < next_allowed)
+        continue;
 
-  for (; cur < end_address; cur++)
+      carry_on = func (address, pattern->size, user_data);
+      next_allowed = address + pattern->size;
+    }
+  }
+
+  g_atomic_int_set (&scan.cancelled, TRUE);
+  g_thread_pool_free (pool, FALSE, TRUE);
+
+  for (i = 0; i != jobs->len; i++)
+    g_array_free (g_array_index (jobs, GumScanJob, i).matches, TRUE);
+  g_array_free (jobs, TRUE);
+
+  g_cond_clear (&scan.cond);
+  g_mutex_clear (&scan.mutex);
+}
+
+void
+gum_memory_scan_many (const GumMemoryRange * range,
+                      GumMatchPatternSet * set,
+                      GumMemoryScanManyMatchFunc func,
+                      gpointer user_data)
+{
+  GumScanAutomaton * automaton;
+  const guint32 * delta;
+  const GumScanState * states;
+  const GumScanOutput * outputs;
+  const guint16 * classes;
+  guint n_classes;
+  guint8 * start, * end, * p;
+  guint8 ** next_allowed;
+  guint32 state;
+
+  if (set->patterns->len == 0 || range->size == 0)
+    return;
+
+  if (set->automaton == NULL)
+    set->automaton = gum_scan_automaton_new (set->patterns);
+  automaton = set->automaton;
+
+  delta = automaton->delta;
+  states = (const GumScanState *) automaton->states->data;
+  outputs = (const GumScanOutput *) automaton->outputs->data;
+  classes = automaton->classes;
+  n_classes = automaton->n_classes;
+
+  start = GSIZE_TO_POINTER (range->base_address);
+  end = start + range->size;
+
+  /* Like gum_memory_scan(), matches of the same pattern do not overlap. */
+  next_allowed = g_new0 (guint8 *, set->patterns->len);
+
+  state = 0;
+  for (p = start; p != end; p++)
   {
-    guint8 * start;
+    guint32 next, s;
 
-    if (cur[0] != needle_data[0] || memcmp (cur, needle_data, needle_len) != 0)
+    next = delta[state * n_classes + classes[*p]];
+    state = next & GUM_SCAN_STATE_MASK;
+    if ((next & GUM_SCAN_STATE_REPORTS) == 0)
       continue;
 
-    start = cur - needle->offset;
+    s = (states[state].first_output != GUM_SCAN_STATE_NONE)
+        ? state
+        : states[state].output_link;
+    for (; s != GUM_SCAN_STATE_NONE; s = states[s].output_link)
+    {
+      guint32 o;
+
+      for (o = states[s].first_output; o != GUM_SCAN_STATE_NONE;
+          o = outputs[o].next)
+      {
+        const GumScanOutput * output = &outputs[o];
+        const GumMatchPattern * pattern;
+        guint8 * match;
+
+        if ((gsize) (p + 1 - start) < output->end_offset)
+          continue;
+        match = p + 1 - output->end_offset;
+
+        if (match < next_allowed[output->pattern_id])
+          continue;
+
+        pattern = (const GumMatchPattern *)
+            g_ptr_array_index (set->patterns, output->pattern_id);
+        if ((gsize) (end - match) < pattern->size)
+          continue;
+
+        if (!gum_match_pattern_try_match_on (pattern, match))
+          continue;
+
+        if (!func (output->pattern_id, GUM_ADDRESS (match), pattern->size,
+            user_data))
+        {
+          goto beach;
+        }
+
+        next_allowed[output->pattern_id] = match + pattern->size;
+      }
+    }
+  }
+
+beach:
+  g_free (next_allowed);
+}
+
+static void
+gum_scan_job_process (gpointer data,
+                      gpointer user_data)
+{
+  GumScanJob * job = (GumScanJob *) data;
+  GumParallelScan * scan = (GumParallelScan *) user_data;
+
+  if (!g_atomic_int_get (&scan->cancelled))
+  {
+    gum_scan_span (scan->pattern, &scan->needle, job->start, job->stop, TRUE,
+        gum_scan_job_collect_match, job);
+  }
+
+  g_mutex_lock (&scan->mutex);
+  job->completed = TRUE;
+  g_cond_broadcast (&scan->cond);
+  g_mutex_unlock (&scan->mutex);
+}
+
+static gboolean
+gum_scan_job_collect_match (GumAddress address,
+                            gsize size,
+                            gpointer user_data)
+{
+  GumScanJob * job = (GumScanJob *) user_data;
+
+  (void) size;
+
+  g_array_append_val (job->matches, address);
+
+  return TRUE;
+}
+
+static GumScanAutomaton *
+gum_scan_automaton_new (GPtrArray * patterns)
+{
+  GumScanAutomaton * automaton;
+  gboolean used[256] = { FALSE, };
+  GArray * delta;
+  guint32 * table, * queue;
+  GumScanState * states;
+  guint n_classes, n_states, head, tail, i, j, c;
+
+  automaton = g_slice_new (GumScanAutomaton);
+  automaton->states = g_array_new (FALSE, FALSE, sizeof (GumScanState));
+  automaton->outputs = g_array_new (FALSE, FALSE, sizeof (GumScanOutput));
+
+  for (i = 0; i != patterns->len; i++)
+  {
+    GumMatchToken * token;
+
+    token = gum_match_pattern_get_longest_token (
+        g_ptr_array_index (patterns, i), GUM_MATCH_EXACT);
+    for (j = 0; j != token->bytes->len; j++)
+      used[g_array_index (token->bytes, guint8, j)] = TRUE;
+  }
+
+  n_classes = 1;
+  for (i = 0; i != G_N_ELEMENTS (used); i++)
+    automaton->classes[i] = used[i] ? n_classes++ : 0;
+  automaton->n_classes = n_classes;
+
+  delta = g_array_new (FALSE, FALSE, sizeof (guint32));
+  gum_scan_automaton_add_state (automaton, delta);
+
+  /*
+   * Insert in reverse so that each state's output list, which is built by
+   * prepending, ends up in the order the patterns were added.
+   */
+  for (i = patterns->len; i-- != 0;)
+  {
+    GumMatchToken * token;
+    guint32 state = 0;
+    GumScanOutput output;
+    GumScanState * s;
+
+    token = gum_match_pattern_get_longest_token (
+        g_ptr_array_index (patterns, i), GUM_MATCH_EXACT);
+
+    for (j = 0; j != token->bytes->len; j++)
+    {
+      guint index;
+
+      index = state * n_classes +
+          automaton->classes[g_array_index (token->bytes, guint8, j)];
+      if (g_array_index (delta, guint32, index) == GUM_SCAN_STATE_NONE)
+      {
+        guint32 new_state;
+
+        new_state = gum_scan_automaton_add_state (automaton, delta);
+        g_array_index (delta, guint32, index) = new_state;
+      }
+      state = g_array_index (delta, guint32, index);
+    }
+
+    output.pattern_id = i;
+    output.end_offset = token->offset + token->bytes->len;
+    s = &g_array_index (automaton->states, GumScanState, state);
+    output.next = s->first_output;
+    s->first_output = automaton->outputs->len;
+    g_array_append_val (automaton->outputs, output);
+  }
+
+  n_states = automaton->states->len;
+  table = (guint32 *) delta->data;
+  states = (GumScanState *) automaton->states->data;
+
+  /*
+   * Resolve failure links breadth-first, filling in every missing transition
+   * so that scanning never has to follow a failure link at runtime.
+   */
+  queue = g_new (guint32, n_states);
+  head = tail = 0;
+
+  for (c = 0; c != n_classes; c++)
+  {
+    guint32 s = table[c];
+
+    if (s == GUM_SCAN_STATE_NONE)
+    {
+      table[c] = 0;
+    }
+    else
+    {
+      states[s].fail = 0;
+      states[s].output_link = GUM_SCAN_STATE_NONE;
+      queue[tail++] = s;
+    }
+  }
+
+  while (head != tail)
+  {
+    guint32 r = queue[head++];
+    guint32 * row = table + r * n_classes;
+    const guint32 * fail_row = table + states[r].fail * n_classes;
+
+    for (c = 0; c != n_classes; c++)
+    {
+      guint32 s = row[c];
+
+      if (s == GUM_SCAN_STATE_NONE)
+      {
+        row[c] = fail_row[c];
+      }
+      else
+      {
+        guint32 f = fail_row[c];
+
+        states[s].fail = f;
+        states[s].output_link = (states[f].first_output != GUM_SCAN_STATE_NONE)
+            ? f
+            : states[f].output_link;
+        queue[tail++] = s;
+      }
+    }
+  }
+
+  g_free (queue);
+
+  for (i = 0; i != n_states * n_classes; i++)
+  {
+    guint32 target = table[i];
+
+    if (states[target].first_output != GUM_SCAN_STATE_NONE ||
+        states[target].output_link != GUM_SCAN_STATE_NONE)
+    {
+      table[i] = target | GUM_SCAN_STATE_REPORTS;
+    }
+  }
+
+  automaton->delta = (guint32 *) g_array_free (delta, FALSE);
+
+  return automaton;
+}
+
+static void
+gum_scan_automaton_free (GumScanAutomaton * automaton)
+{
+  g_free (automaton->delta);
+  g_array_free (automaton->outputs, TRUE);
+  g_array_free (automaton->states, TRUE);
+
+  g_slice_free (GumScanAutomaton, automaton);
+}
+
+static guint32
+gum_scan_automaton_add_state (GumScanAutomaton * self,
+                              GArray * delta)
+{
+  guint32 id;
+  GumScanState state;
+  guint c;
+
+  id = self->states->len;
+
+  state.fail = 0;
+  state.output_link = GUM_SCAN_STATE_NONE;
+  state.first_output = GUM_SCAN_STATE_NONE;
+  g_array_append_val (self->states, state);
+
+  for (c = 0; c != self->n_classes; c++)
+  {
+    guint32 none = GUM_SCAN_STATE_NONE;
+
+    g_array_append_val (delta, none);
+  }
+
+  return id;
+}
+
+static void
+gum_scan_needle_init (GumScanNeedle * needle,
+                      const GumMatchPattern * pattern)
+{
+  GumMatchToken * token;
+  guint i, best_a, best_b;
+
+  token = gum_match_pattern_get_longest_token (pattern, GUM_MATCH_EXACT);
+
+  needle->data = (const guint8 *) token->bytes->data;
+  needle->len = token->bytes->len;
+  needle->offset = token->offset;
+
+  /*
+   * Anchor the search on the two least common bytes of the needle, so the
+   * vectorized filter lets through as few false candidates as possible.
+   */
+  needle->anchor_a = 0;
+  needle->anchor_b = 0;
+  best_a = best_b = G_MAXUINT;
+  for (i = 0; i != needle->len; i++)
+  {
+    guint commonness = gum_scan_byte_commonness (needle->data[i]);
+
+    if (commonness < best_a)
+    {
+      needle->anchor_b = needle->anchor_a;
+      best_b = best_a;
+      needle->anchor_a = i;
+      best_a = commonness;
+    }
+    else if (commonness < best_b)
+    {
+      needle->anchor_b = i;
+      best_b = commonness;
+    }
+  }
+  if (best_b == G_MAXUINT)
+    needle->anchor_b = needle->anchor_a;
+}
+
+static guint
+gum_scan_byte_commonness (guint8 byte)
+{
+  switch (byte)
+  {
+    case 0x00:
+    case 0xff:
+      return 3;
+    case 0x01:
+    case 0x0f:
+    case 0x20:
+    case 0x24:
+    case 0x48:
+    case 0x89:
+    case 0x8b:
+    case 0x90:
+    case 0xcc:
+    case 0xe8:
+      return 2;
+    default:
+      return g_ascii_isalnum (byte) ? 1 : 0;
+  }
+}
+
+static gboolean
+gum_scan_span (const GumMatchPattern * pattern,
+               const GumScanNeedle * needle,
+               guint8 * start,
+               guint8 * stop,
+               gboolean overlapping,
+               GumMemoryScanMatchFunc func,
+               gpointer user_data)
+{
+  GumScanFindFunc find;
+  const guint8 * cur, * end;
+
+  find = gum_scan_get_find_func ();
+
+  cur = start + needle->offset;
+  end = stop + needle->offset;
+
+  while (cur < end)
+  {
+    const guint8 * hit;
+    guint8 * match;
+
+    hit = find (cur, end, needle);
+    if (hit == NULL)
+      break;
+
+    match = (guint8 *) hit - needle->offset;
+
+    if (gum_match_pattern_try_match_on (pattern, match))
+    {
+      if (!func (GUM_ADDRESS (match), pattern->size, user_data))
+        return FALSE;
+
+      cur = overlapping ? hit + 1 : hit + pattern->size;
+    }
+    else
+    {
+      cur = hit + 1;
+    }
+  }
+
+  return TRUE;
+}
+
+static GumScanFindFunc
+gum_scan_get_find_func (void)
+{
+  static gsize cached_func = 0;
+
+  if (g_once_init_enter (&cached_func))
+  {
+    GumScanFindFunc func = gum_scan_find_scalar;
+
+#ifdef GUM_HAVE_SSE2_SCAN
+    func = gum_scan_find_sse2;
+#endif
+#ifdef GUM_HAVE_AVX2_SCAN
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("avx2"))
+      func = gum_scan_find_avx2;
+#endif
+
+    g_once_init_leave (&cached_func, (gsize) func);
+  }
+
+  return (GumScanFindFunc) cached_func;
+}
+
+/*
+ * The finders below return the first position in [cur, end) where the
+ * needle starts, or NULL. Callers guarantee that the whole needle is
+ * readable for every position in that interval.
+ */
+
+static const guint8 *
+gum_scan_find_scalar (const guint8 * cur,
+                      const guint8 * end,
+                      const GumScanNeedle * needle)
+{
+  const guint a = needle->anchor_a;
+  const guint b = needle->anchor_b;
+  const guint8 byte_a = needle->data[a];
+  const guint8 byte_b = needle->data[b];
+
+  while (cur < end)
+  {
+    const guint8 * hit;
+
+    hit = memchr (cur + a, byte_a, end - cur);
+    if (hit == NULL)
+      return NULL;
+    cur = hit - a;
+
+    if (cur[b] == byte_b && memcmp (cur, needle->data, needle->len) == 0)
+      return cur;
+
+    cur++;
+  }
+
+  return NULL;
+}
+
+#ifdef GUM_HAVE_SSE2_SCAN
+
+static const guint8 *
+gum_scan_find_sse2 (const guint8 * cur,
+                    const guint8 * end,
+                    const GumScanNeedle * needle)
+{
+  const guint a = needle->anchor_a;
+  const guint b = needle->anchor_b;
+  const __m128i byte_a = _mm_set1_epi8 ((gchar) needle->data[a]);
+  const __m128i byte_b = _mm_set1_epi8 ((gchar) needle->data[b]);
+
+  while (end - cur >= 16)
+  {
+    __m128i eq_a, eq_b;
+    guint mask;
+
+    eq_a = _mm_cmpeq_epi8 (byte_a,
+        _mm_loadu_si128 ((const __m128i *) (cur + a)));
+    eq_b = _mm_cmpeq_epi8 (byte_b,
+        _mm_loadu_si128 ((const __m128i *) (cur + b)));
+    mask = _mm_movemask_epi8 (_mm_and_si128 (eq_a, eq_b));
 
-    if (gum_match_pattern_try_match_on (pattern, start))
+    while (mask != 0)
     {
-      if (!func (GUM_ADDRESS (start), pattern->size, user_data))
-        return;
+      const guint8 * candidate = cur + g_bit_nth_lsf (mask, -1);
+
+      if (memcmp (candidate, needle->data, needle->len) == 0)
+        return candidate;
 
-      cur = start + pattern->size - 1;
+      mask &= mask - 1;
     }
+
+    cur += 16;
   }
+
+  return gum_scan_find_scalar (cur, end, needle);
 }
 
+#endif
+
+#ifdef GUM_HAVE_AVX2_SCAN
+
+static const guint8 *
+gum_scan_find_avx2 (const guint8 * cur,
+                    const guint8 * end,
+                    const GumScanNeedle * needle)
+{
+  const guint a = needle->anchor_a;
+  const guint b = needle->anchor_b;
+  const __m256i byte_a = _mm256_set1_epi8 ((gchar) needle->data[a]);
+  const __m256i byte_b = _mm256_set1_epi8 ((gchar) needle->data[b]);
+
+  while (end - cur >= 32)
+  {
+    __m256i eq_a, eq_b;
+    guint32 mask;
+
+    eq_a = _mm256_cmpeq_epi8 (byte_a,
+        _mm256_loadu_si256 ((const __m256i *) (cur + a)));
+    eq_b = _mm256_cmpeq_epi8 (byte_b,
+        _mm256_loadu_si256 ((const __m256i *) (cur + b)));
+    mask = (guint32) _mm256_movemask_epi8 (_mm256_and_si256 (eq_a, eq_b));
+
+    while (mask != 0)
+    {
+      const guint8 * candidate = cur + __builtin_ctz (mask);
+
+      if (memcmp (candidate, needle->data, needle->len) == 0)
+        return candidate;
+
+      mask &= mask - 1;
+    }
+
+    cur += 32;
+  }
+
+  return gum_scan_find_scalar (cur, end, needle);
+}
+
+#endif
+
 GumMatchPattern *
 gum_match_pattern_new_from_string (const gchar * match_str)
 {
@@ -247,6 +1077,53 @@ gum_match_pattern_free (GumMatchPattern * pattern)
   g_slice_free (GumMatchPattern, pattern);
 }
 
+GumMatchPatternSet *
+gum_match_pattern_set_new (void)
+{
+  GumMatchPatternSet * set;
+
+  set = g_slice_new (GumMatchPatternSet);
+  set->patterns =
+      g_ptr_array_new_with_free_func ((GDestroyNotify) gum_match_pattern_free);
+  set->automaton = NULL;
+
+  return set;
+}
+
+void
+gum_match_pattern_set_free (GumMatchPatternSet * set)
+{
+  if (set->automaton != NULL)
+    gum_scan_automaton_free (set->automaton);
+  g_ptr_array_free (set->patterns, TRUE);
+
+  g_slice_free (GumMatchPatternSet, set);
+}
+
+guint
+gum_match_pattern_set_add (GumMatchPatternSet * self,
+                           GumMatchPattern * pattern)
+{
+  guint id;
+
+  id = self->patterns->len;
+  g_ptr_array_add (self->patterns, pattern);
+
+  if (self->automaton != NULL)
+  {
+    gum_scan_automaton_free (self->automaton);
+    self->automaton = NULL;
+  }
+
+  return id;
+}
+
+guint
+gum_match_pattern_set_size (const GumMatchPatternSet * self)
+{
+  return self->patterns->len;
+}
+
 static void
 gum_match_pattern_update_computed_size (GumMatchPattern * self)
 {
@@ -391,28 +1268,56 @@ guint
 gum_peek_private_memory_usage (void)
 {
   struct mallinfo info;
+  gsize cached_size;
+  GumMagazineCache * cache;
 
   info = mspace_mallinfo (gum_mspace_get ());
 
-  return (guint) info.uordblks;
+  cached_size = 0;
+  G_LOCK (gum_magazine_caches);
+  for (cache = gum_magazine_caches; cache != NULL; cache = cache->next)
+    cached_size += cache->cached_size;
+  G_UNLOCK (gum_magazine_caches);
+
+  return (guint) (info.uordblks - cached_size);
 }
 
 gpointer
 gum_malloc (gsize size)
 {
+  GumMagazineCache * cache;
+
+  if (size <= GUM_MAGAZINE_MAX_SIZE &&
+      (cache = gum_magazine_cache_get ()) != NULL)
+    return gum_magazine_cache_alloc (cache, size);
+
   return mspace_malloc (gum_mspace_get (), size);
 }
 
 gpointer
 gum_malloc0 (gsize size)
 {
-  return mspace_calloc (gum_mspace_get (), 1, size);
+  GumMagazineCache * cache;
+  gpointer result;
+
+  if (size > GUM_MAGAZINE_MAX_SIZE ||
+      (cache = gum_magazine_cache_get ()) == NULL)
+    return mspace_calloc (gum_mspace_get (), 1, size);
+
+  result = gum_magazine_cache_alloc (cache, size);
+  if (result != NULL)
+    memset (result, 0, size);
+
+  return result;
 }
 
 gpointer
 gum_calloc (gsize count, gsize size)
 {
-  return mspace_calloc (gum_mspace_get (), count, size);
+  if (size != 0 && count > G_MAXSIZE / size)
+    return NULL;
+
+  return gum_malloc0 (count * size);
 }
 
 gpointer
@@ -428,7 +1333,7 @@ gum_memdup (gconstpointer mem,
 {
   gpointer result;
 
-  result = mspace_malloc (gum_mspace_get (), byte_size);
+  result = gum_malloc (byte_size);
   memcpy (result, mem, byte_size);
 
   return result;
@@ -437,7 +1342,167 @@ gum_memdup (gconstpointer mem,
 void
 gum_free (gpointer mem)
 {
-  mspace_free (gum_mspace_get (), mem);
+  GumMagazineCache * cache;
+
+  if (mem == NULL)
+    return;
+
+  cache = gum_magazine_cache_get ();
+  if (cache == NULL || !gum_magazine_cache_try_free (cache, mem))
+    mspace_free (gum_mspace_get (), mem);
+}
+
+/*
+ * Returns NULL outside of init/deinit, in which case callers go straight to
+ * the mspace.
+ */
+static GumMagazineCache *
+gum_magazine_cache_get (void)
+{
+  GumMagazineCache * cache;
+
+  if (G_UNLIKELY (!gum_magazine_caches_enabled))
+    return NULL;
+
+  cache = gum_tls_key_get_value (gum_magazine_cache_key);
+  if (G_LIKELY (cache != NULL))
+    return cache;
+
+  G_LOCK (gum_magazine_caches);
+  for (cache = gum_magazine_caches; cache != NULL; cache = cache->next)
+  {
+    if (!cache->in_use)
+      break;
+  }
+  if (cache == NULL)
+  {
+    cache = mspace_calloc (gum_mspace_get (), 1, sizeof (GumMagazineCache));
+    if (cache == NULL)
+    {
+      G_UNLOCK (gum_magazine_caches);
+      return NULL;
+    }
+    cache->next = gum_magazine_caches;
+    gum_magazine_caches = cache;
+  }
+  cache->in_use = TRUE;
+  G_UNLOCK (gum_magazine_caches);
+
+  gum_tls_key_set_value (gum_magazine_cache_key, cache);
+
+  return cache;
+}
+
+static void
+gum_magazine_cache_release (gpointer data)
+{
+  GumMagazineCache * self = data;
+
+  G_LOCK (gum_magazine_caches);
+  gum_magazine_cache_flush (self);
+  self->in_use = FALSE;
+  G_UNLOCK (gum_magazine_caches);
+}
+
+static void
+gum_magazine_cache_flush (GumMagazineCache * self)
+{
+  guint class_index, i;
+
+  for (class_index = 0; class_index != GUM_MAGAZINE_CLASS_COUNT;
+      class_index++)
+  {
+    GumMagazine * magazine = &self->magazines[class_index];
+
+    for (i = 0; i != magazine->count; i++)
+      mspace_free (gum_mspace, magazine->blocks[i]);
+    magazine->count = 0;
+  }
+
+  self->cached_size = 0;
+}
+
+static gpointer
+gum_magazine_cache_alloc (GumMagazineCache * self,
+                          gsize size)
+{
+  guint class_index;
+  GumMagazine * magazine;
+  gpointer block;
+
+  class_index = (size != 0) ? (guint) ((size - 1) / GUM_MAGAZINE_QUANTUM) : 0;
+  magazine = &self->magazines[class_index];
+
+  if (magazine->count == 0)
+  {
+    gsize sizes[GUM_MAGAZINE_BATCH_SIZE];
+    guint i;
+
+    /*
+     * Carve the whole batch out of a single chunk so that a refill takes
+     * the mspace lock once instead of once per block. The pieces are
+     * independently freeable.
+     */
+    for (i = 0; i != GUM_MAGAZINE_BATCH_SIZE; i++)
+      sizes[i] = (class_index + 1) * GUM_MAGAZINE_QUANTUM;
+    if (mspace_independent_comalloc (gum_mspace_get (),
+        GUM_MAGAZINE_BATCH_SIZE, sizes, magazine->blocks) == NULL)
+      return NULL;
+
+    for (i = 0; i != GUM_MAGAZINE_BATCH_SIZE; i++)
+      self->cached_size += chunksize (mem2chunk (magazine->blocks[i]));
+    magazine->count = GUM_MAGAZINE_BATCH_SIZE;
+  }
+
+  block = magazine->blocks[--magazine->count];
+  self->cached_size -= chunksize (mem2chunk (block));
+
+  return block;
+}
+
+static gboolean
+gum_magazine_cache_try_free (GumMagazineCache * self,
+                             gpointer mem)
+{
+  mchunkptr chunk;
+  gsize usable_size;
+  guint class_index;
+  GumMagazine * magazine;
+
+  chunk = mem2chunk (mem);
+  usable_size = chunksize (chunk) - overhead_for (chunk);
+
+  /*
+   * Blocks may come from anywhere in the mspace, so file each one under the
+   * largest size class it can still satisfy.
+   */
+  class_index = (guint) MIN (usable_size / GUM_MAGAZINE_QUANTUM,
+      GUM_MAGAZINE_CLASS_COUNT + 1);
+  if (class_index == 0 || class_index > GUM_MAGAZINE_CLASS_COUNT)
+    return FALSE;
+  magazine = &self->magazines[class_index - 1];
+
+  if (magazine->count == GUM_MAGAZINE_CAPACITY)
+  {
+    guint i;
+
+    /* Hand back the coldest half, keeping the recently freed blocks. */
+    for (i = 0; i != GUM_MAGAZINE_BATCH_SIZE; i++)
+    {
+      gpointer block = magazine->blocks[i];
+
+      self->cached_size -= chunksize (mem2chunk (block));
+      mspace_free (gum_mspace_get (), block);
+    }
+    memmove (magazine->blocks, magazine->blocks + GUM_MAGAZINE_BATCH_SIZE,
+        (GUM_MAGAZINE_CAPACITY - GUM_MAGAZINE_BATCH_SIZE) * sizeof (gpointer));
+    magazine->count -= GUM_MAGAZINE_BATCH_SIZE;
+  }
+
+  magazine->blocks[magazine->count++] = mem;
+  self->cached_size += chunksize (chunk);
+
+  return TRUE;
 }
 
 gpointer
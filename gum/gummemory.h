@@ -15,6 +15,7 @@ typedef guint GumPageProtection;
 typedef struct _GumAddressSpec GumAddressSpec;
 typedef struct _GumMemoryRange GumMemoryRange;
 typedef struct _GumMatchPattern GumMatchPattern;
+typedef struct _GumMatchPatternSet GumMatchPatternSet;
 
 typedef gboolean (* GumMemoryIsNearFunc) (gpointer memory, gpointer address);
 
@@ -57,6 +58,8 @@ G_BEGIN_DECLS
 
 typedef gboolean (* GumMemoryScanMatchFunc) (GumAddress address, gsize size,
     gpointer user_data);
+typedef gboolean (* GumMemoryScanManyMatchFunc) (guint pattern_id,
+    GumAddress address, gsize size, gpointer user_data);
 
 void gum_memory_init (void);
 void gum_memory_deinit (void);
@@ -70,10 +73,22 @@ gboolean gum_memory_write (GumAddress address, const guint8 * bytes, gsize len);
 void gum_memory_scan (const GumMemoryRange * range,
     const GumMatchPattern * pattern,
     GumMemoryScanMatchFunc func, gpointer user_data);
+void gum_memory_scan_ranges (const GumMemoryRange * ranges, guint n_ranges,
+    const GumMatchPattern * pattern,
+    GumMemoryScanMatchFunc func, gpointer user_data);
+void gum_memory_scan_many (const GumMemoryRange * range,
+    GumMatchPatternSet * set,
+    GumMemoryScanManyMatchFunc func, gpointer user_data);
 
 GumMatchPattern * gum_match_pattern_new_from_string (const gchar * match_str);
 void gum_match_pattern_free (GumMatchPattern * pattern);
 
+GumMatchPatternSet * gum_match_pattern_set_new (void);
+void gum_match_pattern_set_free (GumMatchPatternSet * set);
+guint gum_match_pattern_set_add (GumMatchPatternSet * self,
+    GumMatchPattern * pattern);
+guint gum_match_pattern_set_size (const GumMatchPatternSet * self);
+
 void gum_mprotect (gpointer address, gsize size, GumPageProtection page_prot);
 gboolean gum_try_mprotect (gpointer address, gsize size, GumPageProtection page_prot);
 
@@ -8,26 +8,24 @@
 
 #include "gumprocess.h"
 
-typedef struct _GumUpdateMemoryRangesContext GumUpdateMemoryRangesContext;
-
 struct _GumMemoryMapPrivate
 {
   GumPageProtection prot;
   GArray * ranges;
   gsize ranges_min;
   gsize ranges_max;
-};
 
-struct _GumUpdateMemoryRangesContext
-{
-  GArray * ranges;
-  gint prev_range_index;
+  volatile gint last_hit;
 };
 
 static void gum_memory_map_finalize (GObject * object);
 
+static const GumMemoryRange * gum_memory_map_find_range (GumMemoryMap * self,
+    GumAddress address);
 static gboolean gum_memory_map_add_range (const GumRangeDetails * details,
     gpointer user_data);
+static gint gum_memory_range_compare_base (const GumMemoryRange * a,
+    const GumMemoryRange * b);
 
 G_DEFINE_TYPE (GumMemoryMap, gum_memory_map, G_TYPE_OBJECT);
 
@@ -80,43 +78,57 @@ gum_memory_map_contains (GumMemoryMap * self,
   GumMemoryMapPrivate * priv = self->priv;
   const GumAddress start = range->base_address;
   const GumAddress end = range->base_address + range->size;
-  guint i;
+  const GumMemoryRange * r;
 
   if (start < priv->ranges_min)
     return FALSE;
   else if (end > priv->ranges_max)
     return FALSE;
 
-  for (i = 0; i < priv->ranges->len; i++)
-  {
-    GumMemoryRange * r = &g_array_index (priv->ranges, GumMemoryRange, i);
-    if (start >= r->base_address && end <= r->base_address + r->size)
-      return TRUE;
-  }
+  r = gum_memory_map_find_range (self, start);
 
-  return FALSE;
+  return r != NULL && end <= r->base_address + r->size;
 }
 
 void
 gum_memory_map_update (GumMemoryMap * self)
 {
   GumMemoryMapPrivate * priv = self->priv;
-  GumUpdateMemoryRangesContext ctx;
+  GArray * ranges = priv->ranges;
+  guint i, n;
+
+  g_array_set_size (ranges, 0);
 
-  ctx.ranges = priv->ranges;
-  ctx.prev_range_index = -1;
+  gum_process_enumerate_ranges (priv->prot, gum_memory_map_add_range, ranges);
 
-  g_array_set_size (priv->ranges, 0);
+  g_array_sort (ranges, (GCompareFunc) gum_memory_range_compare_base);
 
-  gum_process_enumerate_ranges (priv->prot, gum_memory_map_add_range, &ctx);
+  /* Coalesce adjacent ranges so that each address maps to a single entry. */
+  for (i = 0, n = 0; i != ranges->len; i++)
+  {
+    GumMemoryRange * cur = &g_array_index (ranges, GumMemoryRange, i);
+    GumMemoryRange * prev;
+
+    prev = (n != 0) ? &g_array_index (ranges, GumMemoryRange, n - 1) : NULL;
+    if (prev != NULL && cur->base_address <= prev->base_address + prev->size)
+    {
+      GumAddress end = MAX (prev->base_address + prev->size,
+          cur->base_address + cur->size);
+      prev->size = end - prev->base_address;
+    }
+    else
+    {
+      g_array_index (ranges, GumMemoryRange, n++) = *cur;
+    }
+  }
+  g_array_set_size (ranges, n);
 
-  if (priv->ranges->len > 0)
+  if (ranges->len > 0)
   {
     GumMemoryRange * first_range, * last_range;
 
-    first_range = &g_array_index (priv->ranges, GumMemoryRange, 0);
-    last_range = &g_array_index (priv->ranges, GumMemoryRange,
-        priv->ranges->len - 1);
+    first_range = &g_array_index (ranges, GumMemoryRange, 0);
+    last_range = &g_array_index (ranges, GumMemoryRange, ranges->len - 1);
 
     priv->ranges_min = first_range->base_address;
     priv->ranges_max = last_range->base_address + last_range->size;
@@ -128,28 +140,68 @@ gum_memory_map_update (GumMemoryMap * self)
   }
 }
 
+/*
+ * Backtracers probe many neighbouring addresses in a row, so the map
+ * remembers the range it last hit and tries that before searching. The hint
+ * is shared by all threads and may be stale or another thread's, which is
+ * harmless as it is validated first.
+ */
+static const GumMemoryRange *
+gum_memory_map_find_range (GumMemoryMap * self,
+                           GumAddress address)
+{
+  GumMemoryMapPrivate * priv = self->priv;
+  const GumMemoryRange * ranges, * r;
+  guint n, hint;
+
+  ranges = (const GumMemoryRange *) priv->ranges->data;
+  n = priv->ranges->len;
+
+  hint = (guint) g_atomic_int_get (&priv->last_hit);
+  if (hint != 0 && hint <= n)
+  {
+    r = &ranges[hint - 1];
+    if (GUM_MEMORY_RANGE_INCLUDES (r, address))
+      return r;
+  }
+
+  if (n == 0)
+    return NULL;
+
+  r = ranges;
+  while (n > 1)
+  {
+    guint half = n / 2;
+
+    r = (r[half].base_address <= address) ? r + half : r;
+    n -= half;
+  }
+
+  if (!GUM_MEMORY_RANGE_INCLUDES (r, address))
+    return NULL;
+
+  g_atomic_int_set (&priv->last_hit, (gint) (r - ranges) + 1);
+
+  return r;
+}
+
 static gboolean
 gum_memory_map_add_range (const GumRangeDetails * details,
                           gpointer user_data)
 {
-  GumUpdateMemoryRangesContext * ctx =
-      (GumUpdateMemoryRangesContext *) user_data;
-  GArray * ranges = ctx->ranges;
-  const GumMemoryRange * cur = details->range;
-  GumMemoryRange * prev;
-
-  if (ctx->prev_range_index >= 0)
-    prev = &g_array_index (ranges, GumMemoryRange, ctx->prev_range_index);
-  else
-    prev = NULL;
-
-  if (prev != NULL && cur->base_address == prev->base_address + prev->size)
-    prev->size += cur->size;
-  else
-    g_array_append_val (ranges, *cur);
+  GArray * ranges = (GArray *) user_data;
 
-  ctx->prev_range_index = ranges->len - 1;
+  g_array_append_val (ranges, *details->range);
 
   return TRUE;
 }
 
+static gint
+gum_memory_range_compare_base (const GumMemoryRange * a,
+                               const GumMemoryRange * b)
+{
+  if (a->base_address == b->base_address)
+    return 0;
+
+  return (a->base_address < b->base_address) ? -1 : 1;
+}
@@ -9,6 +9,9 @@
 struct _GumModuleMapPrivate
 {
   GArray * modules;
+  GArray * ranges;
+
+  volatile gint last_hit;
 };
 
 static void gum_module_map_finalize (GObject * object);
@@ -16,6 +19,8 @@ static void gum_module_map_finalize (GObject * object);
 static void gum_module_map_clear (GumModuleMap * self);
 static gboolean gum_add_module (const GumModuleDetails * details,
     gpointer user_data);
+static gint gum_module_details_compare_base (const GumModuleDetails * a,
+    const GumModuleDetails * b);
 
 G_DEFINE_TYPE (GumModuleMap, gum_module_map, G_TYPE_OBJECT);
 
@@ -36,6 +41,7 @@ gum_module_map_init (GumModuleMap * self)
       GumModuleMapPrivate);
 
   self->priv->modules = g_array_new (FALSE, FALSE, sizeof (GumModuleDetails));
+  self->priv->ranges = g_array_new (FALSE, FALSE, sizeof (GumMemoryRange));
 }
 
 static void
@@ -44,6 +50,7 @@ gum_module_map_finalize (GObject * object)
   GumModuleMap * self = GUM_MODULE_MAP (object);
 
   gum_module_map_clear (self);
+  g_array_free (self->priv->ranges, TRUE);
   g_array_free (self->priv->modules, TRUE);
 
   G_OBJECT_CLASS (gum_module_map_parent_class)->finalize (object);
@@ -61,28 +68,68 @@ gum_module_map_new (void)
   return map;
 }
 
+/*
+ * Modules are kept sorted by base address, with their ranges copied into a
+ * separate array so that the binary search stays within a few cache lines.
+ * The module last hit, by any thread, is tried first.
+ */
 const GumModuleDetails *
 gum_module_map_find (GumModuleMap * self,
                      GumAddress address)
 {
   GumModuleMapPrivate * priv = self->priv;
-  guint i;
+  const GumMemoryRange * ranges, * r;
+  guint n, hint, index;
 
-  for (i = 0; i < priv->modules->len; i++)
+  ranges = (const GumMemoryRange *) priv->ranges->data;
+  n = priv->ranges->len;
+
+  hint = (guint) g_atomic_int_get (&priv->last_hit);
+  if (hint != 0 && hint <= n && GUM_MEMORY_RANGE_INCLUDES (&ranges[hint - 1],
+      address))
   {
-    GumModuleDetails * d = &g_array_index (priv->modules, GumModuleDetails, i);
-    if (GUM_MEMORY_RANGE_INCLUDES (d->range, address))
-      return d;
+    return &g_array_index (priv->modules, GumModuleDetails, hint - 1);
   }
 
-  return NULL;
+  if (n == 0)
+    return NULL;
+
+  r = ranges;
+  while (n > 1)
+  {
+    guint half = n / 2;
+
+    r = (r[half].base_address <= address) ? r + half : r;
+    n -= half;
+  }
+
+  if (!GUM_MEMORY_RANGE_INCLUDES (r, address))
+    return NULL;
+
+  index = r - ranges;
+  g_atomic_int_set (&priv->last_hit, (gint) index + 1);
+
+  return &g_array_index (priv->modules, GumModuleDetails, index);
 }
 
 void
 gum_module_map_update (GumModuleMap * self)
 {
+  GumModuleMapPrivate * priv = self->priv;
+  guint i;
+
   gum_module_map_clear (self);
-  gum_process_enumerate_modules (gum_add_module, self->priv);
+  gum_process_enumerate_modules (gum_add_module, priv);
+
+  g_array_sort (priv->modules,
+      (GCompareFunc) gum_module_details_compare_base);
+
+  g_array_set_size (priv->ranges, priv->modules->len);
+  for (i = 0; i != priv->modules->len; i++)
+  {
+    g_array_index (priv->ranges, GumMemoryRange, i) =
+        *g_array_index (priv->modules, GumModuleDetails, i).range;
+  }
 }
 
 static void
@@ -99,6 +146,7 @@ gum_module_map_clear (GumModuleMap * self)
     g_free ((gchar *) d->path);
   }
   g_array_set_size (priv->modules, 0);
+  g_array_set_size (priv->ranges, 0);
 }
 
 static gboolean
@@ -116,3 +164,13 @@ gum_add_module (const GumModuleDetails * details,
 
   return TRUE;
 }
+
+static gint
+gum_module_details_compare_base (const GumModuleDetails * a,
+                                 const GumModuleDetails * b)
+{
+  if (a->range->base_address == b->range->base_address)
+    return 0;
+
+  return (a->range->base_address < b->range->base_address) ? -1 : 1;
+}
@@ -25,3 +25,17 @@ gum_process_get_native_os (void)
 # error Unknown OS
 #endif
 }
+
+#ifndef HAVE_LINUX
+
+void
+gum_process_enumerate_threads_full (GumThreadFlags flags,
+                                    GumFoundThreadFunc func,
+                                    gpointer user_data)
+{
+  (void) flags;
+
+  gum_process_enumerate_threads (func, user_data);
+}
+
+#endif
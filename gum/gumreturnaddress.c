@@ -5,10 +5,23 @@
  */
 
 #include "gumreturnaddress.h"
+
 #include "gumsymbolutil.h"
 
+#include <stdlib.h>
 #include <string.h>
 
+typedef struct _GumSymbolicateItem GumSymbolicateItem;
+
+struct _GumSymbolicateItem
+{
+  GumReturnAddress address;
+  guint index;
+};
+
+static gint gum_symbolicate_item_compare (const GumSymbolicateItem * a,
+    const GumSymbolicateItem * b);
+
 gboolean
 gum_return_address_details_from_address (GumReturnAddress address,
                                          GumReturnAddressDetails * details)
@@ -30,6 +43,98 @@ gum_return_address_details_from_address (GumReturnAddress address,
   return FALSE;
 }
 
+/*
+ * Resolves addresses[0 .. n_addresses) into details[]. Duplicates are only
+ * resolved once, and the unique addresses are resolved in address order so
+ * that each module's lookups are contiguous and its symbol index and debug
+ * info stay warm. This is done serially, as the symbol backends serialize
+ * their lookups anyway. resolved may be NULL; if not, it receives the outcome
+ * for each address. Returns the number of addresses that were resolved.
+ */
+guint
+gum_symbolicate_batch (const GumReturnAddress * addresses,
+                       guint n_addresses,
+                       GumReturnAddressDetails * details,
+                       gboolean * resolved)
+{
+  GumSymbolicateItem * items;
+  GumReturnAddress * unique_addresses;
+  GumReturnAddressDetails * unique_details;
+  gboolean * unique_resolved;
+  guint * unique_index_of;
+  guint n_unique, n_resolved, i;
+
+  if (n_addresses == 0)
+    return 0;
+
+  items = g_new (GumSymbolicateItem, n_addresses);
+  for (i = 0; i != n_addresses; i++)
+  {
+    items[i].address = addresses[i];
+    items[i].index = i;
+  }
+  qsort (items, n_addresses, sizeof (GumSymbolicateItem),
+      (GCompareFunc) gum_symbolicate_item_compare);
+
+  unique_addresses = g_new (GumReturnAddress, n_addresses);
+  unique_index_of = g_new (guint, n_addresses);
+  n_unique = 0;
+  for (i = 0; i != n_addresses; i++)
+  {
+    if (n_unique == 0 || unique_addresses[n_unique - 1] != items[i].address)
+      unique_addresses[n_unique++] = items[i].address;
+    unique_index_of[items[i].index] = n_unique - 1;
+  }
+  g_free (items);
+
+  unique_details = g_new (GumReturnAddressDetails, n_unique);
+  unique_resolved = g_new (gboolean, n_unique);
+
+  for (i = 0; i != n_unique; i++)
+  {
+    GumReturnAddressDetails * d = &unique_details[i];
+
+    unique_resolved[i] =
+        gum_return_address_details_from_address (unique_addresses[i], d);
+    if (!unique_resolved[i])
+    {
+      memset (d, 0, sizeof (GumReturnAddressDetails));
+      d->address = unique_addresses[i];
+    }
+  }
+
+  n_resolved = 0;
+  for (i = 0; i != n_addresses; i++)
+  {
+    guint u = unique_index_of[i];
+
+    details[i] = unique_details[u];
+    if (resolved != NULL)
+      resolved[i] = unique_resolved[u];
+    if (unique_resolved[u])
+      n_resolved++;
+  }
+
+  g_free (unique_resolved);
+  g_free (unique_details);
+  g_free (unique_index_of);
+  g_free (unique_addresses);
+
+  return n_resolved;
+}
+
+static gint
+gum_symbolicate_item_compare (const GumSymbolicateItem * a,
+                              const GumSymbolicateItem * b)
+{
+  if (a->address == b->address)
+    return 0;
+
+  return (GPOINTER_TO_SIZE (a->address) < GPOINTER_TO_SIZE (b->address))
+      ? -1
+      : 1;
+}
+
 gboolean
 gum_return_address_array_is_equal (const GumReturnAddressArray * array1,
                                    const GumReturnAddressArray * array2)
@@ -32,6 +32,9 @@ G_BEGIN_DECLS
 
 GUM_API gboolean gum_return_address_details_from_address (
     GumReturnAddress address, GumReturnAddressDetails * details);
+GUM_API guint gum_symbolicate_batch (const GumReturnAddress * addresses,
+    guint n_addresses, GumReturnAddressDetails * details,
+    gboolean * resolved);
 
 GUM_API gboolean gum_return_address_array_is_equal (
     const GumReturnAddressArray * array1,
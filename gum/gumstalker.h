@@ -65,9 +65,13 @@ GUM_API void gum_stalker_exclude (GumStalker * self,
 GUM_API gint gum_stalker_get_trust_threshold (GumStalker * self);
 GUM_API void gum_stalker_set_trust_threshold (GumStalker * self,
     gint trust_threshold);
+GUM_API gboolean gum_stalker_get_shared_cache (GumStalker * self);
+GUM_API void gum_stalker_set_shared_cache (GumStalker * self,
+    gboolean shared_cache);
 
 GUM_API void gum_stalker_stop (GumStalker * self);
 GUM_API gboolean gum_stalker_garbage_collect (GumStalker * self);
+GUM_API void gum_stalker_flush (GumStalker * self);
 
 GUM_API void gum_stalker_follow_me (GumStalker * self, GumEventSink * sink);
 GUM_API void gum_stalker_unfollow_me (GumStalker * self);
@@ -31,6 +31,8 @@ GUM_API gpointer gum_find_function (const gchar * name);
 GUM_API GArray * gum_find_functions_named (const gchar * name);
 GUM_API GArray * gum_find_functions_matching (const gchar * str);
 
+GUM_API void gum_symbol_util_set_cache_directory (const gchar * path);
+
 G_END_DECLS
 
 #endif
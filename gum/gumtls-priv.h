@@ -7,12 +7,14 @@
 #ifndef __GUM_TLS_PRIV_H__
 #define __GUM_TLS_PRIV_H__
 
-#include <gum/gumdefs.h>
+#include <gum/gumtls.h>
 
 G_BEGIN_DECLS
 
 G_GNUC_INTERNAL void _gum_tls_init (void);
 
+G_GNUC_INTERNAL GumTlsKey _gum_tls_key_new_full (GDestroyNotify destroy);
+
 G_END_DECLS
 
 #endif
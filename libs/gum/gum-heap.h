@@ -10,6 +10,7 @@
 #include <gum/gum.h>
 
 #include <gum/heap/gumallocationblock.h>
+#include <gum/heap/gumallocationcallsite.h>
 #include <gum/heap/gumallocationgroup.h>
 #include <gum/heap/gumallocationtracker.h>
 #include <gum/heap/gumallocatorprobe.h>
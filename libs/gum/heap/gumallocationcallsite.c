@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "gumallocationcallsite.h"
+#include "gummemory.h"
+
+#include <string.h>
+
+GumAllocationCallSite *
+gum_allocation_call_site_new (const GumReturnAddress * return_addresses,
+                              guint len)
+{
+  GumAllocationCallSite * site;
+
+  g_assert (len <= GUM_MAX_BACKTRACE_DEPTH);
+
+  site = gum_malloc0 (sizeof (GumAllocationCallSite));
+  memcpy (site->return_addresses.items, return_addresses,
+      len * sizeof (GumReturnAddress));
+  site->return_addresses.len = len;
+
+  return site;
+}
+
+GumAllocationCallSite *
+gum_allocation_call_site_copy (const GumAllocationCallSite * site)
+{
+  return gum_memdup (site, sizeof (GumAllocationCallSite));
+}
+
+void
+gum_allocation_call_site_free (GumAllocationCallSite * site)
+{
+  gum_free (site);
+}
+
+void
+gum_allocation_call_site_list_free (GumList * sites)
+{
+  GumList * cur;
+
+  for (cur = sites; cur != NULL; cur = cur->next)
+    gum_allocation_call_site_free (cur->data);
+
+  gum_list_free (sites);
+}
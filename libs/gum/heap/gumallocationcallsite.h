@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#ifndef __GUM_ALLOCATION_CALL_SITE_H__
+#define __GUM_ALLOCATION_CALL_SITE_H__
+
+#include <gum/gumdefs.h>
+#include <gum/gumlist.h>
+#include <gum/gumreturnaddress.h>
+
+typedef struct _GumAllocationCallSite GumAllocationCallSite;
+
+struct _GumAllocationCallSite
+{
+  GumReturnAddressArray return_addresses;
+  guint alive_now;
+  guint alive_size;
+};
+
+G_BEGIN_DECLS
+
+GUM_API GumAllocationCallSite * gum_allocation_call_site_new (
+    const GumReturnAddress * return_addresses, guint len);
+GUM_API GumAllocationCallSite * gum_allocation_call_site_copy (
+    const GumAllocationCallSite * site);
+GUM_API void gum_allocation_call_site_free (GumAllocationCallSite * site);
+
+GUM_API void gum_allocation_call_site_list_free (GumList * sites);
+
+G_END_DECLS
+
+#endif
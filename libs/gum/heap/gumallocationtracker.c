@@ -6,18 +6,45 @@
 
 #include "gumallocationtracker.h"
 
+#include <math.h>
 #include <string.h>
 
 #include "gumallocationblock.h"
+#include "gumallocationcallsite.h"
 #include "gumallocationgroup.h"
 #include "gummemory.h"
 #include "gumreturnaddress.h"
+#include "gumarray.h"
 #include "gumbacktracer.h"
 #include "gumhash.h"
+#include "gumtls.h"
+
+#define GUM_ALLOCATION_TRACKER_SHARD_BITS  5
+#define GUM_ALLOCATION_TRACKER_SHARD_COUNT \
+    (1 << GUM_ALLOCATION_TRACKER_SHARD_BITS)
+
+#define GUM_ALLOCATION_TRACKER_NO_TRACE        0
+#define GUM_ALLOCATION_TRACKER_TRACE_ID(generation, shard_index, local_id) \
+    (((guint64) (generation) << 32) | \
+    ((guint64) (local_id) << GUM_ALLOCATION_TRACKER_SHARD_BITS) | \
+    (shard_index))
+#define GUM_ALLOCATION_TRACKER_TRACE_ID_GENERATION(trace_id) \
+    ((guint32) ((trace_id) >> 32))
+#define GUM_ALLOCATION_TRACKER_TRACE_ID_SHARD(trace_id) \
+    ((guint) ((trace_id) & (GUM_ALLOCATION_TRACKER_SHARD_COUNT - 1)))
+#define GUM_ALLOCATION_TRACKER_TRACE_ID_LOCAL(trace_id) \
+    ((guint32) (trace_id) >> GUM_ALLOCATION_TRACKER_SHARD_BITS)
+#define GUM_ALLOCATION_TRACKER_ARENA_MIN_SIZE  64
+#define GUM_ALLOCATION_TRACKER_ARENA_MAX_SIZE  16384
+#define GUM_ALLOCATION_TRACKER_INDEX_MIN_SIZE  16
 
 G_DEFINE_TYPE (GumAllocationTracker, gum_allocation_tracker, G_TYPE_OBJECT);
 
+typedef struct _GumAllocationTrackerShard GumAllocationTrackerShard;
 typedef struct _GumAllocationTrackerBlock GumAllocationTrackerBlock;
+typedef struct _GumAllocationTrackerGroup GumAllocationTrackerGroup;
+typedef struct _GumAllocationTrackerTrace GumAllocationTrackerTrace;
+typedef struct _GumAllocationTrackerArena GumAllocationTrackerArena;
 
 enum
 {
@@ -25,34 +52,106 @@ enum
   PROP_BACKTRACER,
 };
 
+/*
+ * Blocks live in the shard picked by their address, size groups in the
+ * shard picked by their size, and backtraces in the shard picked by their
+ * hash, so threads only contend when they happen to touch the same shard.
+ *
+ * The traces have a lock of their own, which is always taken last.
+ */
+struct _GumAllocationTrackerShard
+{
+  GMutex mutex;
+
+  GumHashTable * known_blocks_ht;
+  GumHashTable * block_groups_ht;
+  gdouble block_count;
+  gdouble block_total_size;
+
+  GMutex trace_mutex;
+  GumArray * traces;
+  guint32 * trace_index;
+  guint trace_index_size;
+  guint32 trace_generation;
+  GumAllocationTrackerArena * trace_arena;
+};
+
 struct _GumAllocationTrackerPrivate
 {
   gboolean disposed;
 
-  GMutex mutex;
-
   volatile gint enabled;
+  gboolean uses_block_records;
 
   GumAllocationTrackerFilterFunction filter_func;
   gpointer filter_func_user_data;
 
-  guint block_count;
-  guint block_total_size;
-  GumHashTable * known_blocks_ht;
-  GumHashTable * block_groups_ht;
+  guint sample_interval;
+  GumTlsKey sample_countdown;
+  volatile gint sample_sequence;
+
+  GumAllocationTrackerShard shards[GUM_ALLOCATION_TRACKER_SHARD_COUNT];
+  volatile guint generation;
 
   GumBacktracerIface * backtracer_interface;
   GumBacktracer * backtracer_instance;
 };
 
+/*
+ * Used instead of storing just the size whenever there is more to remember,
+ * i.e. a backtrace, or the weight a sampled block was recorded with. A block
+ * keeps its weight when reallocated, as it still stands in for the same
+ * unsampled blocks.
+ */
 struct _GumAllocationTrackerBlock
 {
   guint size;
-  GumReturnAddress return_addresses[1];
+  gdouble weight;
+  guint64 trace_id;
 };
 
-#define GUM_ALLOCATION_TRACKER_LOCK(t) g_mutex_lock (&t->priv->mutex)
-#define GUM_ALLOCATION_TRACKER_UNLOCK(t) g_mutex_unlock (&t->priv->mutex)
+/*
+ * Counts are kept as fractional weights and only rounded when reported, as
+ * rounding each sampled block's weight would bias the estimates.
+ */
+struct _GumAllocationTrackerGroup
+{
+  guint size;
+  gdouble alive_now;
+  gdouble alive_peak;
+  gdouble total_peak;
+};
+
+/*
+ * Each distinct backtrace is stored once, with its frames in its shard's
+ * arena, and blocks refer to it by id. The id packs the shard's generation,
+ * the trace's index in the shard's traces array plus one, and the shard's
+ * index, so that zero can mean "no backtrace" and an id from before a reset
+ * is never mistaken for a trace interned after it.
+ */
+struct _GumAllocationTrackerTrace
+{
+  guint32 hash;
+  guint depth;
+  const GumReturnAddress * frames;
+
+  gdouble alive_now;
+  gdouble alive_size;
+};
+
+struct _GumAllocationTrackerArena
+{
+  GumAllocationTrackerArena * next;
+  guint size;
+  guint used;
+  GumReturnAddress frames[1];
+};
+
+#define GUM_ALLOCATION_TRACKER_SHARD_LOCK(s) g_mutex_lock (&(s)->mutex)
+#define GUM_ALLOCATION_TRACKER_SHARD_UNLOCK(s) g_mutex_unlock (&(s)->mutex)
+#define GUM_ALLOCATION_TRACKER_TRACE_LOCK(s) g_mutex_lock (&(s)->trace_mutex)
+#define GUM_ALLOCATION_TRACKER_TRACE_UNLOCK(s) \
+    g_mutex_unlock (&(s)->trace_mutex)
 
 static void gum_allocation_tracker_constructed (GObject * object);
 static void gum_allocation_tracker_set_property (GObject * object,
@@ -61,11 +160,57 @@ static void gum_allocation_tracker_get_property (GObject * object,
     guint property_id, GValue * value, GParamSpec * pspec);
 static void gum_allocation_tracker_dispose (GObject * object);
 static void gum_allocation_tracker_finalize (GObject * object);
+static void gum_allocation_tracker_create_block_tables (
+    GumAllocationTracker * self);
+
+static void gum_allocation_tracker_lock_all (GumAllocationTracker * self);
+static void gum_allocation_tracker_unlock_all (GumAllocationTracker * self);
+static void gum_allocation_tracker_reset_stats (GumAllocationTracker * self);
+static GumAllocationTrackerShard * gum_allocation_tracker_shard_for_address (
+    GumAllocationTracker * self, gpointer address);
+static GumAllocationTrackerShard * gum_allocation_tracker_shard_for_size (
+    GumAllocationTracker * self, guint size);
+
+static gboolean gum_allocation_tracker_should_sample (
+    GumAllocationTracker * self, gpointer address, guint size);
+static gsize gum_allocation_tracker_next_sample_distance (
+    GumAllocationTracker * self, gpointer address);
+static gdouble gum_allocation_tracker_weigh (GumAllocationTracker * self,
+    guint size);
+static guint gum_round_weight (gdouble weight);
 
 static void gum_allocation_tracker_size_stats_add_block (
-    GumAllocationTracker * self, guint size);
+    GumAllocationTracker * self, guint size, gdouble weight, guint generation);
 static void gum_allocation_tracker_size_stats_remove_block (
-    GumAllocationTracker * self, guint size);
+    GumAllocationTracker * self, guint size, gdouble weight, guint generation);
+
+static guint64 gum_allocation_tracker_trace_add_block (
+    GumAllocationTracker * self, const GumReturnAddressArray * frames,
+    guint size, gdouble weight);
+static void gum_allocation_tracker_trace_remove_block (
+    GumAllocationTracker * self, guint64 trace_id, guint size,
+    gdouble weight);
+static void gum_allocation_tracker_trace_resize_block (
+    GumAllocationTracker * self, guint64 trace_id, guint old_size,
+    guint new_size, gdouble weight);
+static void gum_allocation_tracker_copy_trace (GumAllocationTracker * self,
+    guint64 trace_id, GumReturnAddressArray * frames);
+static void gum_allocation_tracker_reset_traces (GumAllocationTracker * self);
+
+static GumAllocationTrackerTrace * gum_allocation_tracker_shard_find_trace (
+    GumAllocationTrackerShard * shard, guint64 trace_id);
+static void gum_allocation_tracker_shard_reset_traces (
+    GumAllocationTrackerShard * shard);
+static guint32 gum_allocation_tracker_shard_intern_trace (
+    GumAllocationTrackerShard * shard, const GumReturnAddressArray * frames,
+    guint32 hash);
+static void gum_allocation_tracker_shard_insert_trace_id (
+    GumAllocationTrackerShard * shard, guint32 local_id);
+static void gum_allocation_tracker_shard_grow_trace_index (
+    GumAllocationTrackerShard * shard);
+static const GumReturnAddress * gum_allocation_tracker_shard_store_frames (
+    GumAllocationTrackerShard * shard, const GumReturnAddressArray * frames);
+static guint32 gum_hash_frames (const GumReturnAddressArray * frames);
 
 static void
 gum_allocation_tracker_class_init (GumAllocationTrackerClass * klass)
@@ -91,32 +236,67 @@ static void
 gum_allocation_tracker_init (GumAllocationTracker * self)
 {
   GumAllocationTrackerPrivate * priv;
+  guint i;
 
   self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self, GUM_TYPE_ALLOCATION_TRACKER,
       GumAllocationTrackerPrivate);
   priv = self->priv;
 
-  g_mutex_init (&priv->mutex);
+  for (i = 0; i != GUM_ALLOCATION_TRACKER_SHARD_COUNT; i++)
+  {
+    GumAllocationTrackerShard * shard = &priv->shards[i];
+
+    g_mutex_init (&shard->mutex);
+
+    g_mutex_init (&shard->trace_mutex);
+    shard->traces = gum_array_new (FALSE, FALSE,
+        sizeof (GumAllocationTrackerTrace));
+  }
+
+  priv->sample_countdown = gum_tls_key_new ();
 }
 
 static void
 gum_allocation_tracker_constructed (GObject * object)
 {
   GumAllocationTracker * self = GUM_ALLOCATION_TRACKER (object);
-  GumAllocationTrackerPrivate * priv = self->priv;
+  guint i;
 
-  if (priv->backtracer_instance != NULL)
+  gum_allocation_tracker_create_block_tables (self);
+
+  for (i = 0; i != GUM_ALLOCATION_TRACKER_SHARD_COUNT; i++)
   {
-    priv->known_blocks_ht = gum_hash_table_new_full (NULL, NULL, NULL,
-        gum_free);
+    self->priv->shards[i].block_groups_ht = gum_hash_table_new_full (NULL,
+        NULL, NULL, gum_free);
   }
-  else
+}
+
+static void
+gum_allocation_tracker_create_block_tables (GumAllocationTracker * self)
+{
+  GumAllocationTrackerPrivate * priv = self->priv;
+  guint i;
+
+  priv->uses_block_records =
+      priv->backtracer_instance != NULL || priv->sample_interval != 0;
+
+  for (i = 0; i != GUM_ALLOCATION_TRACKER_SHARD_COUNT; i++)
   {
-    priv->known_blocks_ht = gum_hash_table_new (NULL, NULL);
-  }
+    GumAllocationTrackerShard * shard = &priv->shards[i];
+
+    if (shard->known_blocks_ht != NULL)
+      gum_hash_table_unref (shard->known_blocks_ht);
 
-  priv->block_groups_ht = gum_hash_table_new_full (NULL, NULL, NULL,
-      (GDestroyNotify) gum_allocation_group_free);
+    if (priv->uses_block_records)
+    {
+      shard->known_blocks_ht = gum_hash_table_new_full (NULL, NULL, NULL,
+          gum_free);
+    }
+    else
+    {
+      shard->known_blocks_ht = gum_hash_table_new (NULL, NULL);
+    }
+  }
 }
 
 static void
@@ -178,6 +358,8 @@ gum_allocation_tracker_dispose (GObject * object)
 
   if (!priv->disposed)
   {
+    guint i;
+
     priv->disposed = TRUE;
 
     if (priv->backtracer_instance != NULL)
@@ -187,11 +369,20 @@ gum_allocation_tracker_dispose (GObject * object)
     }
     priv->backtracer_interface = NULL;
 
-    gum_hash_table_unref (priv->known_blocks_ht);
-    priv->known_blocks_ht = NULL;
+    for (i = 0; i != GUM_ALLOCATION_TRACKER_SHARD_COUNT; i++)
+    {
+      GumAllocationTrackerShard * shard = &priv->shards[i];
+
+      gum_hash_table_unref (shard->known_blocks_ht);
+      shard->known_blocks_ht = NULL;
 
-    gum_hash_table_unref (priv->block_groups_ht);
-    priv->block_groups_ht = NULL;
+      gum_hash_table_unref (shard->block_groups_ht);
+      shard->block_groups_ht = NULL;
+
+      gum_allocation_tracker_shard_reset_traces (shard);
+      gum_array_free (shard->traces, TRUE);
+      shard->traces = NULL;
+    }
   }
 
   G_OBJECT_CLASS (gum_allocation_tracker_parent_class)->dispose (object);
@@ -201,8 +392,15 @@ static void
 gum_allocation_tracker_finalize (GObject * object)
 {
   GumAllocationTracker * self = GUM_ALLOCATION_TRACKER (object);
+  guint i;
 
-  g_mutex_clear (&self->priv->mutex);
+  for (i = 0; i != GUM_ALLOCATION_TRACKER_SHARD_COUNT; i++)
+  {
+    g_mutex_clear (&self->priv->shards[i].mutex);
+    g_mutex_clear (&self->priv->shards[i].trace_mutex);
+  }
+
+  gum_tls_key_free (self->priv->sample_countdown);
 
   G_OBJECT_CLASS (gum_allocation_tracker_parent_class)->finalize (object);
 }
@@ -234,16 +432,37 @@ gum_allocation_tracker_set_filter_function (GumAllocationTracker * self,
   priv->filter_func_user_data = user_data;
 }
 
+/*
+ * Record roughly one allocation per interval bytes, with counts and sizes
+ * scaled back up in the reports. Zero records every allocation.
+ */
+void
+gum_allocation_tracker_set_sample_interval (GumAllocationTracker * self,
+                                            guint interval)
+{
+  GumAllocationTrackerPrivate * priv = self->priv;
+
+  g_assert (g_atomic_int_get (&priv->enabled) == FALSE);
+
+  priv->sample_interval = interval;
+
+  gum_allocation_tracker_lock_all (self);
+  gum_allocation_tracker_create_block_tables (self);
+  gum_allocation_tracker_unlock_all (self);
+}
+
 void
 gum_allocation_tracker_begin (GumAllocationTracker * self)
 {
   GumAllocationTrackerPrivate * priv = self->priv;
+  guint i;
 
-  GUM_ALLOCATION_TRACKER_LOCK (self);
-  priv->block_count = 0;
-  priv->block_total_size = 0;
-  gum_hash_table_remove_all (priv->known_blocks_ht);
-  GUM_ALLOCATION_TRACKER_UNLOCK (self);
+  gum_allocation_tracker_lock_all (self);
+  gum_allocation_tracker_reset_stats (self);
+  for (i = 0; i != GUM_ALLOCATION_TRACKER_SHARD_COUNT; i++)
+    gum_hash_table_remove_all (priv->shards[i].known_blocks_ht);
+  gum_allocation_tracker_reset_traces (self);
+  gum_allocation_tracker_unlock_all (self);
 
   g_atomic_int_set (&priv->enabled, TRUE);
 }
@@ -252,61 +471,94 @@ void
 gum_allocation_tracker_end (GumAllocationTracker * self)
 {
   GumAllocationTrackerPrivate * priv = self->priv;
+  guint i;
 
   g_atomic_int_set (&priv->enabled, FALSE);
 
-  GUM_ALLOCATION_TRACKER_LOCK (self);
-  priv->block_count = 0;
-  priv->block_total_size = 0;
-  gum_hash_table_remove_all (priv->known_blocks_ht);
-  gum_hash_table_remove_all (priv->block_groups_ht);
-  GUM_ALLOCATION_TRACKER_UNLOCK (self);
+  gum_allocation_tracker_lock_all (self);
+  gum_allocation_tracker_reset_stats (self);
+  for (i = 0; i != GUM_ALLOCATION_TRACKER_SHARD_COUNT; i++)
+  {
+    gum_hash_table_remove_all (priv->shards[i].known_blocks_ht);
+    gum_hash_table_remove_all (priv->shards[i].block_groups_ht);
+  }
+  gum_allocation_tracker_reset_traces (self);
+  gum_allocation_tracker_unlock_all (self);
 }
 
 guint
 gum_allocation_tracker_peek_block_count (GumAllocationTracker * self)
 {
-  return self->priv->block_count;
+  gdouble count = 0;
+  guint i;
+
+  for (i = 0; i != GUM_ALLOCATION_TRACKER_SHARD_COUNT; i++)
+  {
+    GumAllocationTrackerShard * shard = &self->priv->shards[i];
+
+    GUM_ALLOCATION_TRACKER_SHARD_LOCK (shard);
+    count += shard->block_count;
+    GUM_ALLOCATION_TRACKER_SHARD_UNLOCK (shard);
+  }
+
+  return gum_round_weight (count);
 }
 
 guint
 gum_allocation_tracker_peek_block_total_size (GumAllocationTracker * self)
 {
-  return self->priv->block_total_size;
+  gdouble total_size = 0;
+  guint i;
+
+  for (i = 0; i != GUM_ALLOCATION_TRACKER_SHARD_COUNT; i++)
+  {
+    GumAllocationTrackerShard * shard = &self->priv->shards[i];
+
+    GUM_ALLOCATION_TRACKER_SHARD_LOCK (shard);
+    total_size += shard->block_total_size;
+    GUM_ALLOCATION_TRACKER_SHARD_UNLOCK (shard);
+  }
+
+  return gum_round_weight (total_size);
 }
 
 GumList *
 gum_allocation_tracker_peek_block_list (GumAllocationTracker * self)
 {
+  GumAllocationTrackerPrivate * priv = self->priv;
   GumList * blocks = NULL;
-  GumHashTableIter iter;
-  gpointer key, value;
+  guint shard_index;
 
-  GUM_ALLOCATION_TRACKER_LOCK (self);
-  gum_hash_table_iter_init (&iter, self->priv->known_blocks_ht);
-  while (gum_hash_table_iter_next (&iter, &key, &value))
+  for (shard_index = 0; shard_index != GUM_ALLOCATION_TRACKER_SHARD_COUNT;
+      shard_index++)
   {
-    if (self->priv->backtracer_instance != NULL)
-    {
-      GumAllocationTrackerBlock * tb = (GumAllocationTrackerBlock *) value;
-      GumAllocationBlock * block;
-      guint i;
+    GumAllocationTrackerShard * shard = &priv->shards[shard_index];
+    GumHashTableIter iter;
+    gpointer key, value;
 
-      block = gum_allocation_block_new (key, tb->size);
+    GUM_ALLOCATION_TRACKER_SHARD_LOCK (shard);
+    gum_hash_table_iter_init (&iter, shard->known_blocks_ht);
+    while (gum_hash_table_iter_next (&iter, &key, &value))
+    {
+      if (priv->uses_block_records)
+      {
+        GumAllocationTrackerBlock * tb = (GumAllocationTrackerBlock *) value;
+        GumAllocationBlock * block;
 
-      for (i = 0; tb->return_addresses[i] != NULL; i++)
-        block->return_addresses.items[i] = tb->return_addresses[i];
-      block->return_addresses.len = i;
+        block = gum_allocation_block_new (key, tb->size);
+        gum_allocation_tracker_copy_trace (self, tb->trace_id,
+            &block->return_addresses);
 
-      blocks = gum_list_prepend (blocks, block);
-    }
-    else
-    {
-      blocks = gum_list_prepend (blocks,
-          gum_allocation_block_new (key, GPOINTER_TO_UINT (value)));
+        blocks = gum_list_prepend (blocks, block);
+      }
+      else
+      {
+        blocks = gum_list_prepend (blocks,
+            gum_allocation_block_new (key, GPOINTER_TO_UINT (value)));
+      }
     }
+    GUM_ALLOCATION_TRACKER_SHARD_UNLOCK (shard);
   }
-  GUM_ALLOCATION_TRACKER_UNLOCK (self);
 
   return blocks;
 }
@@ -314,17 +566,69 @@ gum_allocation_tracker_peek_block_list (GumAllocationTracker * self)
 GumList *
 gum_allocation_tracker_peek_block_groups (GumAllocationTracker * self)
 {
-  GumList * groups, * cur;
+  GumList * groups = NULL;
+  guint i;
 
-  GUM_ALLOCATION_TRACKER_LOCK (self);
-  groups = gum_hash_table_get_values (self->priv->block_groups_ht);
-  for (cur = groups; cur != NULL; cur = cur->next)
-    cur->data = gum_allocation_group_copy ((GumAllocationGroup *) cur->data);
-  GUM_ALLOCATION_TRACKER_UNLOCK (self);
+  for (i = 0; i != GUM_ALLOCATION_TRACKER_SHARD_COUNT; i++)
+  {
+    GumAllocationTrackerShard * shard = &self->priv->shards[i];
+    GumList * shard_groups, * cur;
+
+    GUM_ALLOCATION_TRACKER_SHARD_LOCK (shard);
+    shard_groups = gum_hash_table_get_values (shard->block_groups_ht);
+    for (cur = shard_groups; cur != NULL; cur = cur->next)
+    {
+      GumAllocationTrackerGroup * tg = (GumAllocationTrackerGroup *) cur->data;
+      GumAllocationGroup * group;
+
+      group = gum_allocation_group_new (tg->size);
+      group->alive_now = gum_round_weight (tg->alive_now);
+      group->alive_peak = gum_round_weight (tg->alive_peak);
+      group->total_peak = gum_round_weight (tg->total_peak);
+
+      cur->data = group;
+    }
+    GUM_ALLOCATION_TRACKER_SHARD_UNLOCK (shard);
+
+    groups = gum_list_concat (shard_groups, groups);
+  }
 
   return groups;
 }
 
+GumList *
+gum_allocation_tracker_peek_call_sites (GumAllocationTracker * self)
+{
+  GumList * sites = NULL;
+  guint shard_index, i;
+
+  for (shard_index = 0; shard_index != GUM_ALLOCATION_TRACKER_SHARD_COUNT;
+      shard_index++)
+  {
+    GumAllocationTrackerShard * shard = &self->priv->shards[shard_index];
+
+    GUM_ALLOCATION_TRACKER_TRACE_LOCK (shard);
+    for (i = 0; i != shard->traces->len; i++)
+    {
+      GumAllocationTrackerTrace * trace;
+      GumAllocationCallSite * site;
+
+      trace = &gum_array_index (shard->traces, GumAllocationTrackerTrace, i);
+      if (gum_round_weight (trace->alive_now) == 0)
+        continue;
+
+      site = gum_allocation_call_site_new (trace->frames, trace->depth);
+      site->alive_now = gum_round_weight (trace->alive_now);
+      site->alive_size = gum_round_weight (trace->alive_size);
+
+      sites = gum_list_prepend (sites, site);
+    }
+    GUM_ALLOCATION_TRACKER_TRACE_UNLOCK (shard);
+  }
+
+  return sites;
+}
+
 void
 gum_allocation_tracker_on_malloc (GumAllocationTracker * self,
                                   gpointer address,
@@ -357,43 +661,53 @@ gum_allocation_tracker_on_malloc_full (GumAllocationTracker * self,
                                        const GumCpuContext * cpu_context)
 {
   GumAllocationTrackerPrivate * priv = self->priv;
+  GumAllocationTrackerShard * shard;
   gpointer value;
+  gdouble weight;
+  guint generation;
 
   if (!g_atomic_int_get (&priv->enabled))
     return;
 
-  if (priv->backtracer_instance != NULL)
-  {
-    gboolean do_backtrace = TRUE;
-    GumReturnAddressArray return_addresses;
-    GumAllocationTrackerBlock * block;
+  if (priv->sample_interval != 0 &&
+      !gum_allocation_tracker_should_sample (self, address, size))
+    return;
 
-    if (priv->filter_func != NULL)
-    {
-      do_backtrace = priv->filter_func (self, address, size,
-          priv->filter_func_user_data);
-    }
+  weight = gum_allocation_tracker_weigh (self, size);
 
-    if (do_backtrace)
-    {
-      priv->backtracer_interface->generate (priv->backtracer_instance,
-          cpu_context, &return_addresses);
-    }
-    else
-    {
-      return_addresses.len = 0;
-    }
+  if (priv->uses_block_records)
+  {
+    GumAllocationTrackerBlock * block;
 
     block = (GumAllocationTrackerBlock *)
-        gum_malloc (sizeof (GumAllocationTrackerBlock) +
-            (return_addresses.len * sizeof (GumReturnAddress)));
+        gum_malloc (sizeof (GumAllocationTrackerBlock));
     block->size = size;
-    block->return_addresses[return_addresses.len] = NULL;
+    block->weight = weight;
+    block->trace_id = GUM_ALLOCATION_TRACKER_NO_TRACE;
 
-    if (return_addresses.len > 0)
+    if (priv->backtracer_instance != NULL)
     {
-      memcpy (block->return_addresses, &return_addresses.items,
-          return_addresses.len * sizeof (GumReturnAddress));
+      gboolean do_backtrace = TRUE;
+      GumReturnAddressArray return_addresses;
+
+      if (priv->filter_func != NULL)
+      {
+        do_backtrace = priv->filter_func (self, address, size,
+            priv->filter_func_user_data);
+      }
+
+      if (do_backtrace)
+      {
+        priv->backtracer_interface->generate (priv->backtracer_instance,
+            cpu_context, &return_addresses);
+      }
+      else
+      {
+        return_addresses.len = 0;
+      }
+
+      block->trace_id = gum_allocation_tracker_trace_add_block (self,
+          &return_addresses, size, weight);
     }
 
     value = block;
@@ -403,13 +717,15 @@ gum_allocation_tracker_on_malloc_full (GumAllocationTracker * self,
     value = GUINT_TO_POINTER (size);
   }
 
-  GUM_ALLOCATION_TRACKER_LOCK (self);
-
-  gum_hash_table_insert (priv->known_blocks_ht, address, value);
+  shard = gum_allocation_tracker_shard_for_address (self, address);
 
-  gum_allocation_tracker_size_stats_add_block (self, size);
+  GUM_ALLOCATION_TRACKER_SHARD_LOCK (shard);
+  gum_hash_table_insert (shard->known_blocks_ht, address, value);
+  generation = priv->generation;
+  GUM_ALLOCATION_TRACKER_SHARD_UNLOCK (shard);
 
-  GUM_ALLOCATION_TRACKER_UNLOCK (self);
+  gum_allocation_tracker_size_stats_add_block (self, size, weight,
+      generation);
 }
 
 void
@@ -418,31 +734,49 @@ gum_allocation_tracker_on_free_full (GumAllocationTracker * self,
                                      const GumCpuContext * cpu_context)
 {
   GumAllocationTrackerPrivate * priv = self->priv;
+  GumAllocationTrackerShard * shard;
   gpointer value;
+  guint size = 0;
+  gdouble weight = 1.0;
+  guint generation;
 
   (void) cpu_context;
 
   if (!g_atomic_int_get (&priv->enabled))
     return;
 
-  GUM_ALLOCATION_TRACKER_LOCK (self);
+  shard = gum_allocation_tracker_shard_for_address (self, address);
+
+  GUM_ALLOCATION_TRACKER_SHARD_LOCK (shard);
 
-  value = gum_hash_table_lookup (priv->known_blocks_ht, address);
+  value = gum_hash_table_lookup (shard->known_blocks_ht, address);
   if (value != NULL)
   {
-    guint size;
+    if (priv->uses_block_records)
+    {
+      GumAllocationTrackerBlock * block = (GumAllocationTrackerBlock *) value;
 
-    if (priv->backtracer_instance != NULL)
-      size = ((GumAllocationTrackerBlock *) value)->size;
+      size = block->size;
+      weight = block->weight;
+      gum_allocation_tracker_trace_remove_block (self, block->trace_id, size,
+          weight);
+    }
     else
+    {
       size = GPOINTER_TO_UINT (value);
+    }
 
-    gum_allocation_tracker_size_stats_remove_block (self, size);
-
-    gum_hash_table_remove (priv->known_blocks_ht, address);
+    gum_hash_table_remove (shard->known_blocks_ht, address);
   }
+  generation = priv->generation;
+
+  GUM_ALLOCATION_TRACKER_SHARD_UNLOCK (shard);
 
-  GUM_ALLOCATION_TRACKER_UNLOCK (self);
+  if (value != NULL)
+  {
+    gum_allocation_tracker_size_stats_remove_block (self, size, weight,
+        generation);
+  }
 }
 
 void
@@ -461,41 +795,66 @@ gum_allocation_tracker_on_realloc_full (GumAllocationTracker * self,
   {
     if (new_size != 0)
     {
+      GumAllocationTrackerShard * old_shard, * new_shard;
       gpointer value;
+      guint old_size, generation;
+      gdouble weight = 1.0;
+      gboolean still_tracked;
 
-      GUM_ALLOCATION_TRACKER_LOCK (self);
+      old_shard = gum_allocation_tracker_shard_for_address (self, old_address);
+      new_shard = gum_allocation_tracker_shard_for_address (self, new_address);
 
-      value = gum_hash_table_lookup (priv->known_blocks_ht, old_address);
+      GUM_ALLOCATION_TRACKER_SHARD_LOCK (old_shard);
+      value = gum_hash_table_lookup (old_shard->known_blocks_ht, old_address);
       if (value != NULL)
+        gum_hash_table_steal (old_shard->known_blocks_ht, old_address);
+      generation = priv->generation;
+      GUM_ALLOCATION_TRACKER_SHARD_UNLOCK (old_shard);
+
+      /*
+       * Most likely an unsampled block, which the weight of a sampled one
+       * already accounts for, so sampling it again would count it twice.
+       */
+      if (value == NULL)
+        return;
+
+      if (priv->uses_block_records)
       {
-        guint old_size;
-
-        gum_hash_table_steal (priv->known_blocks_ht, old_address);
-
-        if (priv->backtracer_instance != NULL)
-        {
-          GumAllocationTrackerBlock * block;
+        GumAllocationTrackerBlock * block;
 
-          block = (GumAllocationTrackerBlock *) value;
+        block = (GumAllocationTrackerBlock *) value;
 
-          gum_hash_table_insert (priv->known_blocks_ht, new_address, block);
+        old_size = block->size;
+        weight = block->weight;
+        block->size = new_size;
 
-          old_size = block->size;
-          block->size = new_size;
-        }
-        else
-        {
-          gum_hash_table_insert (priv->known_blocks_ht, new_address,
-              GUINT_TO_POINTER (new_size));
+        gum_allocation_tracker_trace_resize_block (self, block->trace_id,
+            old_size, new_size, weight);
+      }
+      else
+      {
+        old_size = GPOINTER_TO_UINT (value);
+        value = GUINT_TO_POINTER (new_size);
+      }
 
-          old_size = GPOINTER_TO_UINT (value);
-        }
+      /* a reset in between has already forgotten about the old block */
+      GUM_ALLOCATION_TRACKER_SHARD_LOCK (new_shard);
+      still_tracked = priv->generation == generation;
+      if (still_tracked)
+        gum_hash_table_insert (new_shard->known_blocks_ht, new_address, value);
+      GUM_ALLOCATION_TRACKER_SHARD_UNLOCK (new_shard);
 
-        gum_allocation_tracker_size_stats_remove_block (self, old_size);
-        gum_allocation_tracker_size_stats_add_block (self, new_size);
+      if (!still_tracked)
+      {
+        if (priv->uses_block_records)
+          gum_free (value);
+        return;
       }
 
-      GUM_ALLOCATION_TRACKER_UNLOCK (self);
+      gum_allocation_tracker_size_stats_remove_block (self, old_size, weight,
+          generation);
+      gum_allocation_tracker_size_stats_add_block (self, new_size, weight,
+          generation);
     }
     else
     {
@@ -510,42 +869,501 @@ gum_allocation_tracker_on_realloc_full (GumAllocationTracker * self,
 }
 
 static void
-gum_allocation_tracker_size_stats_add_block (GumAllocationTracker * self,
-                                             guint size)
+gum_allocation_tracker_lock_all (GumAllocationTracker * self)
+{
+  guint i;
+
+  for (i = 0; i != GUM_ALLOCATION_TRACKER_SHARD_COUNT; i++)
+    GUM_ALLOCATION_TRACKER_SHARD_LOCK (&self->priv->shards[i]);
+}
+
+static void
+gum_allocation_tracker_unlock_all (GumAllocationTracker * self)
+{
+  guint i;
+
+  for (i = 0; i != GUM_ALLOCATION_TRACKER_SHARD_COUNT; i++)
+    GUM_ALLOCATION_TRACKER_SHARD_UNLOCK (&self->priv->shards[i]);
+}
+
+/*
+ * Called with all shards locked. Blocks record the generation they were
+ * tracked in while holding their shard's lock, so stats updates that lose a
+ * race with a reset can tell and leave the fresh counters alone.
+ */
+static void
+gum_allocation_tracker_reset_stats (GumAllocationTracker * self)
 {
   GumAllocationTrackerPrivate * priv = self->priv;
-  GumAllocationGroup * group;
+  guint i;
+
+  priv->generation++;
+  for (i = 0; i != GUM_ALLOCATION_TRACKER_SHARD_COUNT; i++)
+  {
+    priv->shards[i].block_count = 0;
+    priv->shards[i].block_total_size = 0;
+  }
+}
+
+static GumAllocationTrackerShard *
+gum_allocation_tracker_shard_for_address (GumAllocationTracker * self,
+                                          gpointer address)
+{
+  guint32 h;
+
+  /* heap blocks are at least 16 byte aligned, so skip the low bits */
+  h = (guint32) (GPOINTER_TO_SIZE (address) >> 4) * 2654435761U;
+
+  return &self->priv->shards[h >> (32 - GUM_ALLOCATION_TRACKER_SHARD_BITS)];
+}
+
+static GumAllocationTrackerShard *
+gum_allocation_tracker_shard_for_size (GumAllocationTracker * self,
+                                       guint size)
+{
+  guint32 h;
+
+  h = (guint32) size * 2654435761U;
+
+  return &self->priv->shards[h >> (32 - GUM_ALLOCATION_TRACKER_SHARD_BITS)];
+}
+
+static gboolean
+gum_allocation_tracker_should_sample (GumAllocationTracker * self,
+                                      gpointer address,
+                                      guint size)
+{
+  GumAllocationTrackerPrivate * priv = self->priv;
+  gsize remaining;
+
+  remaining = GPOINTER_TO_SIZE (gum_tls_key_get_value (priv->sample_countdown));
+  if (remaining == 0)
+    remaining = gum_allocation_tracker_next_sample_distance (self, address);
+
+  if (size < remaining)
+  {
+    gum_tls_key_set_value (priv->sample_countdown,
+        GSIZE_TO_POINTER (remaining - size));
+    return FALSE;
+  }
+
+  gum_tls_key_set_value (priv->sample_countdown, GSIZE_TO_POINTER (
+      gum_allocation_tracker_next_sample_distance (self, address)));
+  return TRUE;
+}
+
+static gsize
+gum_allocation_tracker_next_sample_distance (GumAllocationTracker * self,
+                                             gpointer address)
+{
+  GumAllocationTrackerPrivate * priv = self->priv;
+  guint64 x;
+  gdouble u, distance;
+
+  /*
+   * splitmix64 over the address and a sequence number; this runs only once
+   * per sample, and unlike g_random_*() it never allocates or locks.
+   */
+  x = GPOINTER_TO_SIZE (address) ^
+      ((guint64) g_atomic_int_add (&priv->sample_sequence, 1) << 32);
+  x += G_GUINT64_CONSTANT (0x9e3779b97f4a7c15);
+  x = (x ^ (x >> 30)) * G_GUINT64_CONSTANT (0xbf58476d1ce4e5b9);
+  x = (x ^ (x >> 27)) * G_GUINT64_CONSTANT (0x94d049bb133111eb);
+  x ^= x >> 31;
+
+  u = ((x >> 11) + 1) / 9007199254740993.0;
+  distance = -log (u) * priv->sample_interval;
+
+  return (distance >= 1.0) ? (gsize) distance : 1;
+}
+
+static gdouble
+gum_allocation_tracker_weigh (GumAllocationTracker * self,
+                              guint size)
+{
+  guint interval = self->priv->sample_interval;
+
+  if (interval == 0)
+    return 1.0;
+
+  /* a block of this size is sampled with probability 1 - e^(-size/interval) */
+  return 1.0 / (1.0 - exp (-(gdouble) size / interval));
+}
+
+static guint
+gum_round_weight (gdouble weight)
+{
+  /* removals may leave a tiny negative residue behind */
+  if (weight <= 0)
+    return 0;
+
+  return (guint) (weight + 0.5);
+}
+
+static void
+gum_allocation_tracker_size_stats_add_block (GumAllocationTracker * self,
+                                             guint size,
+                                             gdouble weight,
+                                             guint generation)
+{
+  GumAllocationTrackerShard * shard;
+  GumAllocationTrackerGroup * group;
+
+  shard = gum_allocation_tracker_shard_for_size (self, size);
+
+  GUM_ALLOCATION_TRACKER_SHARD_LOCK (shard);
+
+  if (self->priv->generation != generation)
+  {
+    GUM_ALLOCATION_TRACKER_SHARD_UNLOCK (shard);
+    return;
+  }
 
-  priv->block_count++;
-  priv->block_total_size += size;
+  shard->block_count += weight;
+  shard->block_total_size += size * weight;
 
-  group = (GumAllocationGroup *)
-      gum_hash_table_lookup (priv->block_groups_ht, GUINT_TO_POINTER (size));
+  group = (GumAllocationTrackerGroup *)
+      gum_hash_table_lookup (shard->block_groups_ht, GUINT_TO_POINTER (size));
 
   if (group == NULL)
   {
-    group = gum_allocation_group_new (size);
-    gum_hash_table_insert (priv->block_groups_ht, GUINT_TO_POINTER (size),
+    group = gum_malloc0 (sizeof (GumAllocationTrackerGroup));
+    group->size = size;
+    gum_hash_table_insert (shard->block_groups_ht, GUINT_TO_POINTER (size),
         group);
   }
 
-  group->alive_now++;
+  group->alive_now += weight;
   if (group->alive_now > group->alive_peak)
     group->alive_peak = group->alive_now;
-  group->total_peak++;
+  group->total_peak += weight;
+
+  GUM_ALLOCATION_TRACKER_SHARD_UNLOCK (shard);
 }
 
 static void
 gum_allocation_tracker_size_stats_remove_block (GumAllocationTracker * self,
-                                                guint size)
+                                                guint size,
+                                                gdouble weight,
+                                                guint generation)
 {
-  GumAllocationTrackerPrivate * priv = self->priv;
-  GumAllocationGroup * group;
+  GumAllocationTrackerShard * shard;
+  GumAllocationTrackerGroup * group;
+
+  shard = gum_allocation_tracker_shard_for_size (self, size);
+
+  GUM_ALLOCATION_TRACKER_SHARD_LOCK (shard);
+
+  if (self->priv->generation == generation)
+  {
+    shard->block_count -= weight;
+    shard->block_total_size -= size * weight;
 
-  priv->block_count--;
-  priv->block_total_size -= size;
+    group = (GumAllocationTrackerGroup *) gum_hash_table_lookup (
+        shard->block_groups_ht, GUINT_TO_POINTER (size));
+    if (group != NULL)
+      group->alive_now -= weight;
+  }
+
+  GUM_ALLOCATION_TRACKER_SHARD_UNLOCK (shard);
+}
+
+static guint64
+gum_allocation_tracker_trace_add_block (GumAllocationTracker * self,
+                                        const GumReturnAddressArray * frames,
+                                        guint size,
+                                        gdouble weight)
+{
+  GumAllocationTrackerShard * shard;
+  guint32 hash, local_id;
+  guint64 trace_id;
+  GumAllocationTrackerTrace * trace;
+
+  if (frames->len == 0)
+    return GUM_ALLOCATION_TRACKER_NO_TRACE;
+
+  hash = gum_hash_frames (frames);
+  shard = &self->priv->shards[hash >> (32 - GUM_ALLOCATION_TRACKER_SHARD_BITS)];
+
+  GUM_ALLOCATION_TRACKER_TRACE_LOCK (shard);
+
+  local_id = gum_allocation_tracker_shard_intern_trace (shard, frames, hash);
+  trace_id = GUM_ALLOCATION_TRACKER_TRACE_ID (shard->trace_generation,
+      shard - self->priv->shards, local_id);
+
+  trace = &gum_array_index (shard->traces, GumAllocationTrackerTrace,
+      local_id - 1);
+  trace->alive_now += weight;
+  trace->alive_size += size * weight;
+
+  GUM_ALLOCATION_TRACKER_TRACE_UNLOCK (shard);
+
+  return trace_id;
+}
+
+static void
+gum_allocation_tracker_trace_remove_block (GumAllocationTracker * self,
+                                           guint64 trace_id,
+                                           guint size,
+                                           gdouble weight)
+{
+  GumAllocationTrackerShard * shard;
+  GumAllocationTrackerTrace * trace;
+
+  if (trace_id == GUM_ALLOCATION_TRACKER_NO_TRACE)
+    return;
+
+  shard = &self->priv->shards[GUM_ALLOCATION_TRACKER_TRACE_ID_SHARD (trace_id)];
+
+  GUM_ALLOCATION_TRACKER_TRACE_LOCK (shard);
+  trace = gum_allocation_tracker_shard_find_trace (shard, trace_id);
+  if (trace != NULL)
+  {
+    trace->alive_now -= weight;
+    trace->alive_size -= size * weight;
+  }
+  GUM_ALLOCATION_TRACKER_TRACE_UNLOCK (shard);
+}
+
+static void
+gum_allocation_tracker_trace_resize_block (GumAllocationTracker * self,
+                                           guint64 trace_id,
+                                           guint old_size,
+                                           guint new_size,
+                                           gdouble weight)
+{
+  GumAllocationTrackerShard * shard;
+  GumAllocationTrackerTrace * trace;
+
+  if (trace_id == GUM_ALLOCATION_TRACKER_NO_TRACE)
+    return;
+
+  shard = &self->priv->shards[GUM_ALLOCATION_TRACKER_TRACE_ID_SHARD (trace_id)];
+
+  GUM_ALLOCATION_TRACKER_TRACE_LOCK (shard);
+  trace = gum_allocation_tracker_shard_find_trace (shard, trace_id);
+  if (trace != NULL)
+    trace->alive_size += ((gdouble) new_size - (gdouble) old_size) * weight;
+  GUM_ALLOCATION_TRACKER_TRACE_UNLOCK (shard);
+}
+
+static void
+gum_allocation_tracker_copy_trace (GumAllocationTracker * self,
+                                   guint64 trace_id,
+                                   GumReturnAddressArray * frames)
+{
+  GumAllocationTrackerShard * shard;
+  const GumAllocationTrackerTrace * trace;
+
+  frames->len = 0;
+
+  if (trace_id == GUM_ALLOCATION_TRACKER_NO_TRACE)
+    return;
+
+  shard = &self->priv->shards[GUM_ALLOCATION_TRACKER_TRACE_ID_SHARD (trace_id)];
+
+  GUM_ALLOCATION_TRACKER_TRACE_LOCK (shard);
+  trace = gum_allocation_tracker_shard_find_trace (shard, trace_id);
+  if (trace != NULL)
+  {
+    memcpy (frames->items, trace->frames,
+        trace->depth * sizeof (GumReturnAddress));
+    frames->len = trace->depth;
+  }
+  GUM_ALLOCATION_TRACKER_TRACE_UNLOCK (shard);
+}
+
+static void
+gum_allocation_tracker_reset_traces (GumAllocationTracker * self)
+{
+  guint i;
+
+  for (i = 0; i != GUM_ALLOCATION_TRACKER_SHARD_COUNT; i++)
+  {
+    GumAllocationTrackerShard * shard = &self->priv->shards[i];
+
+    GUM_ALLOCATION_TRACKER_TRACE_LOCK (shard);
+    gum_allocation_tracker_shard_reset_traces (shard);
+    GUM_ALLOCATION_TRACKER_TRACE_UNLOCK (shard);
+  }
+}
+
+static GumAllocationTrackerTrace *
+gum_allocation_tracker_shard_find_trace (GumAllocationTrackerShard * shard,
+                                         guint64 trace_id)
+{
+  guint32 local_id;
+
+  /* the shard may have been reset since the block was added */
+  if (GUM_ALLOCATION_TRACKER_TRACE_ID_GENERATION (trace_id) !=
+      shard->trace_generation)
+    return NULL;
+
+  local_id = GUM_ALLOCATION_TRACKER_TRACE_ID_LOCAL (trace_id);
+  if (local_id > shard->traces->len)
+    return NULL;
+
+  return &gum_array_index (shard->traces, GumAllocationTrackerTrace,
+      local_id - 1);
+}
+
+static void
+gum_allocation_tracker_shard_reset_traces (GumAllocationTrackerShard * shard)
+{
+  GumAllocationTrackerArena * arena;
+
+  gum_array_set_size (shard->traces, 0);
+  shard->trace_generation++;
+
+  gum_free (shard->trace_index);
+  shard->trace_index = NULL;
+  shard->trace_index_size = 0;
+
+  arena = shard->trace_arena;
+  while (arena != NULL)
+  {
+    GumAllocationTrackerArena * next = arena->next;
+    gum_free (arena);
+    arena = next;
+  }
+  shard->trace_arena = NULL;
+}
+
+static guint32
+gum_allocation_tracker_shard_intern_trace (GumAllocationTrackerShard * shard,
+                                           const GumReturnAddressArray * frames,
+                                           guint32 hash)
+{
+  guint32 mask, i;
+  GumAllocationTrackerTrace trace;
+
+  if (shard->trace_index != NULL)
+  {
+    mask = shard->trace_index_size - 1;
+    for (i = hash & mask; shard->trace_index[i] != 0; i = (i + 1) & mask)
+    {
+      guint32 local_id = shard->trace_index[i];
+      const GumAllocationTrackerTrace * candidate;
+
+      candidate = &gum_array_index (shard->traces, GumAllocationTrackerTrace,
+          local_id - 1);
+      if (candidate->hash == hash && candidate->depth == frames->len &&
+          memcmp (candidate->frames, frames->items,
+              frames->len * sizeof (GumReturnAddress)) == 0)
+      {
+        return local_id;
+      }
+    }
+  }
+
+  trace.hash = hash;
+  trace.depth = frames->len;
+  trace.frames = gum_allocation_tracker_shard_store_frames (shard, frames);
+  trace.alive_now = 0;
+  trace.alive_size = 0;
+  gum_array_append_val (shard->traces, trace);
+
+  gum_allocation_tracker_shard_insert_trace_id (shard, shard->traces->len);
+
+  return shard->traces->len;
+}
+
+static void
+gum_allocation_tracker_shard_insert_trace_id (GumAllocationTrackerShard * shard,
+                                              guint32 local_id)
+{
+  const GumAllocationTrackerTrace * trace;
+  guint32 mask, i;
+
+  if ((shard->traces->len * 4) > (shard->trace_index_size * 3))
+    gum_allocation_tracker_shard_grow_trace_index (shard);
+
+  trace = &gum_array_index (shard->traces, GumAllocationTrackerTrace,
+      local_id - 1);
+
+  mask = shard->trace_index_size - 1;
+  for (i = trace->hash & mask; shard->trace_index[i] != 0; i = (i + 1) & mask)
+    ;
+  shard->trace_index[i] = local_id;
+}
+
+static void
+gum_allocation_tracker_shard_grow_trace_index (
+    GumAllocationTrackerShard * shard)
+{
+  guint32 * old_index, mask, local_id;
+  guint old_size, i;
+
+  old_index = shard->trace_index;
+  old_size = shard->trace_index_size;
+
+  shard->trace_index_size = MAX (old_size * 2,
+      GUM_ALLOCATION_TRACKER_INDEX_MIN_SIZE);
+  shard->trace_index = gum_malloc0 (shard->trace_index_size * sizeof (guint32));
+
+  mask = shard->trace_index_size - 1;
+  for (i = 0; i != old_size; i++)
+  {
+    const GumAllocationTrackerTrace * trace;
+    guint32 j;
+
+    local_id = old_index[i];
+    if (local_id == 0)
+      continue;
+
+    trace = &gum_array_index (shard->traces, GumAllocationTrackerTrace,
+        local_id - 1);
+    for (j = trace->hash & mask; shard->trace_index[j] != 0; j = (j + 1) & mask)
+      ;
+    shard->trace_index[j] = local_id;
+  }
+
+  gum_free (old_index);
+}
+
+static const GumReturnAddress *
+gum_allocation_tracker_shard_store_frames (GumAllocationTrackerShard * shard,
+                                           const GumReturnAddressArray * frames)
+{
+  GumAllocationTrackerArena * arena = shard->trace_arena;
+  GumReturnAddress * result;
+
+  if (arena == NULL || arena->used + frames->len > arena->size)
+  {
+    guint size;
+
+    /* start small and double, so a handful of traces stays cheap */
+    size = (arena != NULL) ? MIN (arena->size * 2,
+        GUM_ALLOCATION_TRACKER_ARENA_MAX_SIZE) :
+        GUM_ALLOCATION_TRACKER_ARENA_MIN_SIZE;
+
+    arena = gum_malloc (sizeof (GumAllocationTrackerArena) +
+        ((size - 1) * sizeof (GumReturnAddress)));
+    arena->next = shard->trace_arena;
+    arena->size = size;
+    arena->used = 0;
+    shard->trace_arena = arena;
+  }
+
+  result = &arena->frames[arena->used];
+  memcpy (result, frames->items, frames->len * sizeof (GumReturnAddress));
+  arena->used += frames->len;
+
+  return result;
+}
+
+static guint32
+gum_hash_frames (const GumReturnAddressArray * frames)
+{
+  guint32 hash = 2166136261U;
+  guint i;
+
+  for (i = 0; i != frames->len; i++)
+  {
+    guint64 frame = GPOINTER_TO_SIZE (frames->items[i]);
+
+    hash = (hash ^ (guint32) frame ^ (guint32) (frame >> 32)) * 16777619U;
+  }
 
-  group = (GumAllocationGroup *) gum_hash_table_lookup (priv->block_groups_ht,
-      GUINT_TO_POINTER (size));
-  group->alive_now--;
+  return hash;
 }
@@ -6,8 +6,13 @@
 
 #include "gumcyclesampler.h"
 
+#include "gummemory.h"
+#include "gumtls.h"
+
+#include <errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <sys/syscall.h>
 
 # define PERF_TYPE_HARDWARE       0
@@ -55,15 +60,66 @@ struct perf_event_attr
   guint64 __reserved_3;
 };
 
-struct _GumCycleSamplerPrivate
+/*
+ * Leading part of the page the kernel maps for a perf event. While the
+ * event is scheduled on the current CPU, index - 1 names the hardware
+ * counter to rdpmc, and offset is what has to be added to its value.
+ * Writers bump lock around every update, seqlock style.
+ */
+struct perf_event_mmap_page
+{
+  guint32 version;
+  guint32 compat_version;
+  volatile guint32 lock;
+  volatile guint32 index;
+  volatile gint64 offset;
+  guint64 time_enabled;
+  guint64 time_running;
+
+  union
+  {
+    guint64 capabilities;
+    struct
+    {
+      guint64 cap_bit0               :  1,
+              cap_bit0_is_deprecated :  1,
+              cap_user_rdpmc         :  1,
+              cap_user_time          :  1,
+              cap_user_time_zero     :  1,
+              __reserved_1           : 59;
+    };
+  };
+
+  guint16 pmc_width;
+};
+
+typedef struct _GumCycleSamplerThread GumCycleSamplerThread;
+
+struct _GumCycleSamplerThread
 {
+  GumCycleSamplerThread * next;
+
+  pid_t tid;
   gint device;
+  struct perf_event_mmap_page * page;
 };
 
 static void gum_cycle_sampler_iface_init (gpointer g_iface,
     gpointer iface_data);
-static void gum_cycle_sampler_dispose (GObject * object);
 static GumSample gum_cycle_sampler_sample (GumSampler * sampler);
+static GumCycleSamplerThread * gum_cycle_sampler_get_thread (void);
+static GumCycleSamplerThread * gum_cycle_sampler_add_thread (void);
+static void gum_cycle_sampler_reap_threads (void);
+
+static GumCycleSamplerThread * gum_cycle_sampler_thread_new (void);
+static void gum_cycle_sampler_thread_free (GumCycleSamplerThread * thread);
+#ifdef HAVE_I386
+static gboolean gum_cycle_sampler_thread_try_read (
+    GumCycleSamplerThread * self, GumSample * sample);
+
+static guint64 gum_read_pmc (guint32 counter);
+static guint64 gum_read_tsc (void);
+#endif
 
 G_DEFINE_TYPE_EXTENDED (GumCycleSampler,
                         gum_cycle_sampler,
@@ -72,14 +128,19 @@ G_DEFINE_TYPE_EXTENDED (GumCycleSampler,
                         G_IMPLEMENT_INTERFACE (GUM_TYPE_SAMPLER,
                                                gum_cycle_sampler_iface_init));
 
+/*
+ * The counters belong to threads rather than to samplers, so every sampler
+ * shares them. They live for as long as their thread does, which means no
+ * sampler ever frees one that another thread might still be reading.
+ */
+G_LOCK_DEFINE_STATIC (gum_cycle_sampler_threads);
+static GumTlsKey gum_cycle_sampler_thread_key;
+static GumCycleSamplerThread * gum_cycle_sampler_threads = NULL;
+
 static void
 gum_cycle_sampler_class_init (GumCycleSamplerClass * klass)
 {
-  GObjectClass * object_class = G_OBJECT_CLASS (klass);
-
-  object_class->dispose = gum_cycle_sampler_dispose;
-
-  g_type_class_add_private (klass, sizeof (GumCycleSamplerPrivate));
+  gum_cycle_sampler_thread_key = gum_tls_key_new ();
 }
 
 static void
@@ -94,54 +155,213 @@ gum_cycle_sampler_iface_init (gpointer g_iface,
 static void
 gum_cycle_sampler_init (GumCycleSampler * self)
 {
-  GumCycleSamplerPrivate * priv;
+}
+
+GumSampler *
+gum_cycle_sampler_new (void)
+{
+  return GUM_SAMPLER_CAST (g_object_new (GUM_TYPE_CYCLE_SAMPLER, NULL));
+}
+
+/*
+ * Only reports a real cycle counter. On x86 we still fall back to the TSC
+ * when sampling without one, but that ticks at a fixed rate and keeps going
+ * while the thread is scheduled out.
+ */
+gboolean
+gum_cycle_sampler_is_available (GumCycleSampler * self)
+{
+  return gum_cycle_sampler_get_thread ()->device != -1;
+}
+
+static GumSample
+gum_cycle_sampler_sample (GumSampler * sampler)
+{
+  GumCycleSamplerThread * thread;
+  long long result = 0;
+
+  thread = gum_cycle_sampler_get_thread ();
+
+#ifdef HAVE_I386
+  {
+    GumSample sample;
+
+    if (thread->page != NULL &&
+        gum_cycle_sampler_thread_try_read (thread, &sample))
+      return sample;
+
+    if (thread->device == -1)
+      return gum_read_tsc ();
+  }
+#endif
+
+  if (thread->device == -1)
+    return 0;
+
+  if (read (thread->device, &result, sizeof (result)) < sizeof (result))
+    return 0;
+
+  return result;
+}
+
+/*
+ * A perf event opened with pid 0 and cpu -1 only counts the thread that
+ * opened it, so each thread sampling us gets its own. Those left behind by
+ * threads that have since exited are reaped whenever a new one comes along.
+ */
+static GumCycleSamplerThread *
+gum_cycle_sampler_get_thread (void)
+{
+  GumCycleSamplerThread * thread;
+
+  thread = gum_tls_key_get_value (gum_cycle_sampler_thread_key);
+  if (G_UNLIKELY (thread == NULL))
+    thread = gum_cycle_sampler_add_thread ();
+
+  return thread;
+}
+
+static GumCycleSamplerThread *
+gum_cycle_sampler_add_thread (void)
+{
+  GumCycleSamplerThread * thread;
+
+  thread = gum_cycle_sampler_thread_new ();
+
+  G_LOCK (gum_cycle_sampler_threads);
+  gum_cycle_sampler_reap_threads ();
+  thread->next = gum_cycle_sampler_threads;
+  gum_cycle_sampler_threads = thread;
+  G_UNLOCK (gum_cycle_sampler_threads);
+
+  gum_tls_key_set_value (gum_cycle_sampler_thread_key, thread);
+
+  return thread;
+}
+
+static void
+gum_cycle_sampler_reap_threads (void)
+{
+  GumCycleSamplerThread ** link;
+  pid_t pid;
+
+  pid = getpid ();
+
+  link = &gum_cycle_sampler_threads;
+  while (*link != NULL)
+  {
+    GumCycleSamplerThread * thread = *link;
+
+    if (syscall (__NR_tgkill, pid, thread->tid, 0) == -1 && errno == ESRCH)
+    {
+      *link = thread->next;
+      gum_cycle_sampler_thread_free (thread);
+    }
+    else
+    {
+      link = &thread->next;
+    }
+  }
+}
+
+static GumCycleSamplerThread *
+gum_cycle_sampler_thread_new (void)
+{
+  GumCycleSamplerThread * thread;
   struct perf_event_attr attr;
 
-  self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self, GUM_TYPE_CYCLE_SAMPLER,
-      GumCycleSamplerPrivate);
-  priv = self->priv;
+  thread = g_slice_new0 (GumCycleSamplerThread);
+  thread->tid = syscall (__NR_gettid);
 
   memset (&attr, 0, sizeof (attr));
   attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof (attr);
   attr.config = PERF_COUNT_HW_CPU_CYCLES;
-  priv->device = syscall (__NR_perf_event_open, &attr, 0, -1, -1, 0);
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  thread->device = syscall (__NR_perf_event_open, &attr, 0, -1, -1, 0);
+
+#ifdef HAVE_I386
+  if (thread->device != -1)
+  {
+    gpointer page;
+
+    page = mmap (NULL, gum_query_page_size (), PROT_READ, MAP_SHARED,
+        thread->device, 0);
+    if (page != MAP_FAILED)
+      thread->page = page;
+  }
+#endif
+
+  return thread;
 }
 
 static void
-gum_cycle_sampler_dispose (GObject * object)
+gum_cycle_sampler_thread_free (GumCycleSamplerThread * thread)
 {
-  GumCycleSampler * self = GUM_CYCLE_SAMPLER (object);
-  GumCycleSamplerPrivate * priv = self->priv;
+  if (thread->page != NULL)
+    munmap (thread->page, gum_query_page_size ());
 
-  if (priv->device != -1)
-  {
-    close (priv->device);
-    priv->device = -1;
-  }
+  if (thread->device != -1)
+    close (thread->device);
 
-  G_OBJECT_CLASS (gum_cycle_sampler_parent_class)->dispose (object);
+  g_slice_free (GumCycleSamplerThread, thread);
 }
 
-GumSampler *
-gum_cycle_sampler_new (void)
+#ifdef HAVE_I386
+
+static gboolean
+gum_cycle_sampler_thread_try_read (GumCycleSamplerThread * self,
+                                   GumSample * sample)
 {
-  return GUM_SAMPLER_CAST (g_object_new (GUM_TYPE_CYCLE_SAMPLER, NULL));
+  struct perf_event_mmap_page * page = self->page;
+  guint32 seq, index;
+  guint shift;
+  gint64 count;
+
+  if (!page->cap_bit0_is_deprecated || !page->cap_user_rdpmc)
+    return FALSE;
+
+  do
+  {
+    seq = page->lock;
+    __asm__ __volatile__ ("" ::: "memory");
+
+    index = page->index;
+    if (index == 0)
+      return FALSE;
+
+    count = page->offset;
+    shift = 64 - page->pmc_width;
+    count += ((gint64) (gum_read_pmc (index - 1) << shift)) >> shift;
+
+    __asm__ __volatile__ ("" ::: "memory");
+  }
+  while (page->lock != seq);
+
+  *sample = count;
+
+  return TRUE;
 }
 
-gboolean
-gum_cycle_sampler_is_available (GumCycleSampler * self)
+static guint64
+gum_read_pmc (guint32 counter)
 {
-  return self->priv->device != -1;
+  guint32 low, high;
+
+  __asm__ __volatile__ ("rdpmc" : "=a" (low), "=d" (high) : "c" (counter));
+
+  return ((guint64) high << 32) | low;
 }
 
-static GumSample
-gum_cycle_sampler_sample (GumSampler * sampler)
+static guint64
+gum_read_tsc (void)
 {
-  GumCycleSampler * self = GUM_CYCLE_SAMPLER_CAST (sampler);
-  long long result = 0;
+  guint32 low, high;
 
-  if (read (self->priv->device, &result, sizeof (result)) < sizeof (result))
-    return 0;
+  __asm__ __volatile__ ("lfence\n\trdtsc" : "=a" (low), "=d" (high));
 
-  return result;
+  return ((guint64) high << 32) | low;
 }
+
+#endif
@@ -10,6 +10,8 @@
 #include "gumarray.h"
 #include "guminterceptor.h"
 #include "gumhash.h"
+#include "gummemory.h"
+#include "gummodulemap.h"
 #include "gumsymbolutil.h"
 
 #include <string.h>
@@ -17,12 +19,23 @@
 #define GUM_PROFILER_LOCK()   (g_mutex_lock (&priv->mutex))
 #define GUM_PROFILER_UNLOCK() (g_mutex_unlock (&priv->mutex))
 
+#define GUM_PROFILER_ARENA_SIZE 32
+#define GUM_PROFILER_INDEX_MIN_SIZE 16
+#define GUM_CALL_GRAPH_ARENA_SIZE 256
+
+#define GUM_CALL_GRAPH_MAGIC "GCG1"
+
 typedef struct _GumProfilerInvocation GumProfilerInvocation;
 typedef struct _GumProfilerContext GumProfilerContext;
+typedef struct _GumProfilerThread GumProfilerThread;
+typedef struct _GumProfilerArena GumProfilerArena;
 typedef struct _GumFunctionContext GumFunctionContext;
 typedef struct _GumWorstCaseInfo GumWorstCaseInfo;
 typedef struct _GumWorstCase GumWorstCase;
 typedef struct _GumFunctionThreadContext GumFunctionThreadContext;
+typedef struct _GumCallGraphNode GumCallGraphNode;
+typedef struct _GumCallGraphArena GumCallGraphArena;
+typedef struct _GumCallGraphFrame GumCallGraphFrame;
 
 struct _GumProfilerPrivate
 {
@@ -30,7 +43,12 @@ struct _GumProfilerPrivate
 
   GumInterceptor * interceptor;
   GHashTable * function_by_address;
-  GumList * stacks;
+  GumProfilerThread * volatile threads;
+
+  GumSamplerIface * call_graph_sampler_interface;
+  GumSampler * call_graph_sampler_instance;
+
+  GumModuleMap * modules;
 };
 
 struct _GumProfilerInvocation
@@ -38,13 +56,81 @@ struct _GumProfilerInvocation
   GumProfilerContext * profiler;
   GumFunctionContext * function;
   GumFunctionThreadContext * thread;
+  GumCallGraphNode * node;
 
   GumSample start_time;
+  GumSample node_start_time;
 };
 
 struct _GumProfilerContext
 {
+  GumProfilerThread * thread;
+};
+
+/*
+ * Each thread builds its own profile tree, so the hot path never shares any
+ * state with other threads. Trees are pushed onto the profiler's lock-free
+ * list of threads the first time a thread enters an instrumented function,
+ * and are merged when a report is generated.
+ */
+struct _GumProfilerThread
+{
+  GumProfilerThread * next;
+  guint thread_id;
+
   GumArray * stack;
+
+  GumFunctionThreadContext ** index;
+  guint index_size;
+  guint function_count;
+  GumFunctionThreadContext * volatile functions;
+
+  GumProfilerArena * arena;
+
+  GumCallGraphNode root_node;
+  GumCallGraphNode * current_node;
+  GumCallGraphNode ** node_index;
+  guint node_index_size;
+  guint node_count;
+  GumCallGraphArena * node_arena;
+};
+
+struct _GumProfilerArena
+{
+  GumProfilerArena * next;
+  guint used;
+  GumFunctionThreadContext contexts[GUM_PROFILER_ARENA_SIZE];
+};
+
+/*
+ * One node per distinct call path, keyed by (parent, function) so that the
+ * same function reached through different callers gets separate statistics.
+ * Children are published lock-free, newest first, so a report can be emitted
+ * while the thread keeps running.
+ */
+struct _GumCallGraphNode
+{
+  GumCallGraphNode * parent;
+  GumFunctionContext * function_ctx;
+  GumCallGraphNode * volatile first_child;
+  GumCallGraphNode * next_sibling;
+
+  guint64 total_calls;
+  GumSample total_duration;
+};
+
+struct _GumCallGraphArena
+{
+  GumCallGraphArena * next;
+  guint used;
+  GumCallGraphNode nodes[GUM_CALL_GRAPH_ARENA_SIZE];
+};
+
+struct _GumCallGraphFrame
+{
+  GumCallGraphNode * node;
+  guint depth;
+  gsize path_length;
 };
 
 struct _GumWorstCaseInfo
@@ -62,6 +148,8 @@ struct _GumFunctionThreadContext
 {
   GumFunctionContext * function_ctx;
   guint thread_id;
+  guint thread_index;
+  GumFunctionThreadContext * next;
 
   /* statistics */
   guint64 total_calls;
@@ -85,8 +173,9 @@ struct _GumFunctionContext
   GumWorstCaseInspectorFunc inspector_func;
   gpointer inspector_user_data;
 
-  GumFunctionThreadContext thread_contexts[GUM_MAX_THREADS];
   volatile gint thread_context_count;
+
+  gchar * name;
 };
 
 #define GUM_PROFILER_GET_PRIVATE(o) ((o)->priv)
@@ -103,8 +192,8 @@ static void gum_profiler_on_leave (GumInvocationListener * listener,
 static void unstrument_and_free_function (gpointer key, gpointer value,
     gpointer user_data);
 
-static void add_to_report_if_root_node (gpointer key, gpointer value,
-    gpointer user_data);
+static void add_to_report_if_root_node (GumFunctionThreadContext * thread_ctx,
+    GumProfileReport * report);
 static GumProfileReportNode * make_node_from_thread_context (
     GumFunctionThreadContext * thread_ctx, GHashTable ** processed_nodes);
 static GumProfileReportNode * make_node (gchar * name, guint64 total_calls,
@@ -114,11 +203,35 @@ static void thread_context_register_child_timing (
     GumFunctionThreadContext * parent_ctx,
     GumFunctionThreadContext * child_ctx);
 
-static void get_number_of_threads_foreach (gpointer key, gpointer value,
-    gpointer user_data);
-
-static GumFunctionThreadContext * gum_function_context_get_current_thread (
-    GumFunctionContext * function_ctx, GumInvocationContext * context);
+static GumFunctionThreadContext * gum_profiler_find_thread_context (
+    GumProfiler * self, guint thread_index, gpointer function_address);
+
+static GumProfilerThread * gum_profiler_thread_new (GumProfiler * profiler,
+    guint thread_id);
+static void gum_profiler_thread_free (GumProfilerThread * thread);
+static GumFunctionThreadContext * gum_profiler_thread_get_function_context (
+    GumProfilerThread * thread, GumFunctionContext * function_ctx);
+static void gum_profiler_thread_insert_into_index (GumProfilerThread * thread,
+    GumFunctionThreadContext * thread_ctx);
+static void gum_profiler_thread_grow_index (GumProfilerThread * thread);
+static guint gum_profiler_thread_hash_function (
+    GumFunctionContext * function_ctx);
+static GumCallGraphNode * gum_profiler_thread_get_call_graph_node (
+    GumProfilerThread * thread, GumCallGraphNode * parent,
+    GumFunctionContext * function_ctx);
+static void gum_profiler_thread_insert_into_node_index (
+    GumProfilerThread * thread, GumCallGraphNode * node);
+static void gum_profiler_thread_grow_node_index (GumProfilerThread * thread);
+static guint gum_profiler_thread_hash_node (GumCallGraphNode * parent,
+    GumFunctionContext * function_ctx);
+
+static void gum_call_graph_push_children (GArray * pending,
+    GumCallGraphNode * node, guint depth, gsize path_length);
+static GumSample gum_call_graph_node_get_self_duration (
+    GumCallGraphNode * node);
+static const gchar * gum_profiler_get_function_name (GumProfiler * self,
+    GumFunctionContext * function_ctx);
+static void gum_byte_array_append_uleb128 (GByteArray * array, guint64 value);
 
 G_DEFINE_TYPE_EXTENDED (GumProfiler,
                         gum_profiler,
@@ -181,11 +294,17 @@ gum_profiler_finalize (GObject * object)
   g_object_unref (priv->interceptor);
   g_hash_table_unref (priv->function_by_address);
 
-  while (priv->stacks != NULL)
+  if (priv->call_graph_sampler_instance != NULL)
+    g_object_unref (priv->call_graph_sampler_instance);
+
+  if (priv->modules != NULL)
+    g_object_unref (priv->modules);
+
+  while (priv->threads != NULL)
   {
-    GumArray * stack = (GumArray *) priv->stacks->data;
-    gum_array_free (stack, TRUE);
-    priv->stacks = gum_list_delete_link (priv->stacks, priv->stacks);
+    GumProfilerThread * thread = priv->threads;
+    priv->threads = thread->next;
+    gum_profiler_thread_free (thread);
   }
 
   G_OBJECT_CLASS (gum_profiler_parent_class)->finalize (object);
@@ -195,6 +314,7 @@ static void
 gum_profiler_on_enter (GumInvocationListener * listener,
                        GumInvocationContext * context)
 {
+  GumProfilerPrivate * priv = GUM_PROFILER_CAST (listener)->priv;
   GumProfilerInvocation * inv;
   GumFunctionContext * fctx;
   GumFunctionThreadContext * tctx;
@@ -202,26 +322,21 @@ gum_profiler_on_enter (GumInvocationListener * listener,
   inv = GUM_LINCTX_GET_FUNC_INVDATA (context, GumProfilerInvocation);
 
   inv->profiler = GUM_LINCTX_GET_THREAD_DATA (context, GumProfilerContext);
-  if (inv->profiler->stack == NULL)
+  if (inv->profiler->thread == NULL)
   {
-    GumProfilerPrivate * priv = GUM_PROFILER_CAST (listener)->priv;
-
-    inv->profiler->stack = gum_array_sized_new (FALSE, FALSE,
-        sizeof (GumFunctionThreadContext *), GUM_MAX_CALL_DEPTH);
-
-    GUM_PROFILER_LOCK ();
-    priv->stacks = gum_list_prepend (priv->stacks, inv->profiler->stack);
-    GUM_PROFILER_UNLOCK ();
+    inv->profiler->thread = gum_profiler_thread_new (
+        GUM_PROFILER_CAST (listener),
+        gum_invocation_context_get_thread_id (context));
   }
 
   inv->function = GUM_LINCTX_GET_FUNC_DATA (context, GumFunctionContext *);
-  inv->thread = gum_function_context_get_current_thread (inv->function,
-      context);
+  inv->thread = gum_profiler_thread_get_function_context (
+      inv->profiler->thread, inv->function);
 
   fctx = inv->function;
   tctx = inv->thread;
 
-  gum_array_append_val (inv->profiler->stack, tctx);
+  gum_array_append_val (inv->profiler->thread->stack, tctx);
 
   tctx->total_calls++;
 
@@ -239,24 +354,51 @@ gum_profiler_on_enter (GumInvocationListener * listener,
   }
 
   tctx->recurse_count++;
+
+  if (priv->call_graph_sampler_interface != NULL)
+  {
+    GumProfilerThread * thread = inv->profiler->thread;
+
+    inv->node = gum_profiler_thread_get_call_graph_node (thread,
+        thread->current_node, fctx);
+    inv->node->total_calls++;
+    thread->current_node = inv->node;
+
+    inv->node_start_time = priv->call_graph_sampler_interface->sample (
+        priv->call_graph_sampler_instance);
+  }
+  else
+  {
+    inv->node = NULL;
+  }
 }
 
 static void
 gum_profiler_on_leave (GumInvocationListener * listener,
                        GumInvocationContext * context)
 {
+  GumProfilerPrivate * priv = GUM_PROFILER_CAST (listener)->priv;
   GumProfilerInvocation * inv;
   GumFunctionContext * fctx;
   GumFunctionThreadContext * tctx;
   GumArray * stack;
 
-  (void) listener;
-
   inv = GUM_LINCTX_GET_FUNC_INVDATA (context, GumProfilerInvocation);
 
+  if (inv->node != NULL)
+  {
+    GumSample now;
+
+    now = priv->call_graph_sampler_interface->sample (
+        priv->call_graph_sampler_instance);
+    inv->node->total_duration += now - inv->node_start_time;
+
+    inv->profiler->thread->current_node = inv->node->parent;
+  }
+
   fctx = inv->function;
   tctx = inv->thread;
-  stack = inv->profiler->stack;
+  stack = inv->profiler->thread->stack;
 
   if (tctx->recurse_count == 1)
   {
@@ -402,6 +544,7 @@ unstrument_and_free_function (gpointer key,
   (void) user_data;
 
   g_object_unref (function_ctx->sampler_instance);
+  g_free (function_ctx->name);
   g_free (function_ctx);
 }
 
@@ -410,45 +553,37 @@ gum_profiler_generate_report (GumProfiler * self)
 {
   GumProfilerPrivate * priv = GUM_PROFILER_GET_PRIVATE (self);
   GumProfileReport * report;
+  GumProfilerThread * thread;
 
   report = gum_profile_report_new ();
-  g_hash_table_foreach (priv->function_by_address, add_to_report_if_root_node,
-      report);
+  for (thread = g_atomic_pointer_get (&priv->threads); thread != NULL;
+      thread = thread->next)
+  {
+    GumFunctionThreadContext * thread_ctx;
+
+    for (thread_ctx = g_atomic_pointer_get (&thread->functions);
+        thread_ctx != NULL; thread_ctx = thread_ctx->next)
+    {
+      add_to_report_if_root_node (thread_ctx, report);
+    }
+  }
   _gum_profile_report_sort (report);
 
   return report;
 }
 
 static void
-add_to_report_if_root_node (gpointer key,
-                            gpointer value,
-                            gpointer user_data)
+add_to_report_if_root_node (GumFunctionThreadContext * thread_ctx,
+                            GumProfileReport * report)
 {
-  GumProfileReport * report = GUM_PROFILE_REPORT (user_data);
-  GumFunctionContext * function_ctx = (GumFunctionContext *) value;
-
-  (void) key;
-
-  if (function_ctx->thread_context_count > 0)
+  if (thread_ctx->is_root_node)
   {
-    gint i;
-
-    for (i = 0; i != function_ctx->thread_context_count; i++)
-    {
-      GumFunctionThreadContext * thread_ctx =
-          &function_ctx->thread_contexts[i];
-
-      if (thread_ctx->is_root_node)
-      {
-        GHashTable * processed_nodes = NULL;
-        GumProfileReportNode * root_node;
+    GHashTable * processed_nodes = NULL;
+    GumProfileReportNode * root_node;
 
-        root_node = make_node_from_thread_context (thread_ctx,
-            &processed_nodes);
-        _gum_profile_report_append_thread_root_node (report,
-            thread_ctx->thread_id, root_node);
-      }
-    }
+    root_node = make_node_from_thread_context (thread_ctx, &processed_nodes);
+    _gum_profile_report_append_thread_root_node (report,
+        thread_ctx->thread_id, root_node);
   }
 }
 
@@ -514,18 +649,206 @@ make_node (gchar * name,
   return node;
 }
 
+/*
+ * Records the full path of every call from now on, timed with sampler. Must
+ * be called before any of the instrumented functions run.
+ */
+void
+gum_profiler_enable_call_graph (GumProfiler * self,
+                                GumSampler * sampler)
+{
+  GumProfilerPrivate * priv = GUM_PROFILER_GET_PRIVATE (self);
+
+  g_assert (priv->call_graph_sampler_instance == NULL);
+  g_assert (g_atomic_pointer_get (&priv->threads) == NULL);
+
+  priv->call_graph_sampler_instance = g_object_ref (sampler);
+  priv->call_graph_sampler_interface = GUM_SAMPLER_GET_INTERFACE (sampler);
+}
+
+/*
+ * One line per call path with a non-zero self time, in the
+ * "outer;inner self_duration" format consumed by flamegraph.pl and friends.
+ */
+gchar *
+gum_profiler_emit_folded_stacks (GumProfiler * self)
+{
+  GumProfilerPrivate * priv = GUM_PROFILER_GET_PRIVATE (self);
+  GString * output;
+  GArray * pending;
+  GumProfilerThread * thread;
+
+  output = g_string_sized_new (4096);
+  pending = g_array_new (FALSE, FALSE, sizeof (GumCallGraphFrame));
+
+  GUM_PROFILER_LOCK ();
+
+  for (thread = g_atomic_pointer_get (&priv->threads); thread != NULL;
+      thread = thread->next)
+  {
+    GString * path;
+
+    if (thread->root_node.first_child == NULL)
+      continue;
+
+    path = g_string_sized_new (256);
+
+    gum_call_graph_push_children (pending, &thread->root_node, 0, 0);
+    while (pending->len != 0)
+    {
+      GumCallGraphFrame frame;
+      GumSample self_duration;
+
+      frame = g_array_index (pending, GumCallGraphFrame, pending->len - 1);
+      g_array_set_size (pending, pending->len - 1);
+
+      g_string_truncate (path, frame.path_length);
+      if (path->len != 0)
+        g_string_append_c (path, ';');
+      g_string_append (path,
+          gum_profiler_get_function_name (self, frame.node->function_ctx));
+
+      self_duration = gum_call_graph_node_get_self_duration (frame.node);
+      if (self_duration != 0)
+      {
+        g_string_append_len (output, path->str, path->len);
+        g_string_append_printf (output, " %" G_GUINT64_FORMAT "\n",
+            (guint64) self_duration);
+      }
+
+      gum_call_graph_push_children (pending, frame.node, 0, path->len);
+    }
+
+    g_string_free (path, TRUE);
+  }
+
+  GUM_PROFILER_UNLOCK ();
+
+  g_array_free (pending, TRUE);
+
+  return g_string_free (output, FALSE);
+}
+
+/*
+ * Compact binary form of the call graph, with all integers ULEB128-encoded:
+ *
+ *   "GCG1"
+ *   function_count, then function_count times: length, UTF-8 name
+ *   thread_count, then thread_count times:
+ *     thread_id, node_count, then node_count nodes in pre-order:
+ *       depth, function_index, total_calls, total_duration, self_duration
+ *
+ * A node's parent is the closest preceding node with a smaller depth.
+ */
+GByteArray *
+gum_profiler_emit_call_graph (GumProfiler * self)
+{
+  GumProfilerPrivate * priv = GUM_PROFILER_GET_PRIVATE (self);
+  GByteArray * output, * names, * body, * nodes;
+  GArray * pending;
+  GHashTable * function_indices;
+  guint function_count, thread_count;
+  GumProfilerThread * thread;
+
+  function_indices = g_hash_table_new (NULL, NULL);
+  names = g_byte_array_new ();
+  body = g_byte_array_new ();
+  nodes = g_byte_array_new ();
+  pending = g_array_new (FALSE, FALSE, sizeof (GumCallGraphFrame));
+  function_count = 0;
+  thread_count = 0;
+
+  GUM_PROFILER_LOCK ();
+
+  for (thread = g_atomic_pointer_get (&priv->threads); thread != NULL;
+      thread = thread->next)
+  {
+    guint node_count = 0;
+
+    if (thread->root_node.first_child == NULL)
+      continue;
+
+    g_byte_array_set_size (nodes, 0);
+
+    gum_call_graph_push_children (pending, &thread->root_node, 0, 0);
+    while (pending->len != 0)
+    {
+      GumCallGraphFrame frame;
+      GumCallGraphNode * node;
+      GumFunctionContext * function_ctx;
+      guint function_index;
+
+      frame = g_array_index (pending, GumCallGraphFrame, pending->len - 1);
+      g_array_set_size (pending, pending->len - 1);
+      node = frame.node;
+      function_ctx = node->function_ctx;
+
+      function_index = GPOINTER_TO_UINT (
+          g_hash_table_lookup (function_indices, function_ctx));
+      if (function_index == 0)
+      {
+        const gchar * name =
+            gum_profiler_get_function_name (self, function_ctx);
+        guint length = strlen (name);
+
+        gum_byte_array_append_uleb128 (names, length);
+        g_byte_array_append (names, (const guint8 *) name, length);
+
+        function_index = ++function_count;
+        g_hash_table_insert (function_indices, function_ctx,
+            GUINT_TO_POINTER (function_index));
+      }
+
+      gum_byte_array_append_uleb128 (nodes, frame.depth);
+      gum_byte_array_append_uleb128 (nodes, function_index - 1);
+      gum_byte_array_append_uleb128 (nodes, node->total_calls);
+      gum_byte_array_append_uleb128 (nodes, node->total_duration);
+      gum_byte_array_append_uleb128 (nodes,
+          gum_call_graph_node_get_self_duration (node));
+      node_count++;
+
+      gum_call_graph_push_children (pending, node, frame.depth + 1, 0);
+    }
+
+    gum_byte_array_append_uleb128 (body, thread->thread_id);
+    gum_byte_array_append_uleb128 (body, node_count);
+    g_byte_array_append (body, nodes->data, nodes->len);
+    thread_count++;
+  }
+
+  GUM_PROFILER_UNLOCK ();
+
+  output = g_byte_array_sized_new (4 + names->len + body->len + 20);
+  g_byte_array_append (output, (const guint8 *) GUM_CALL_GRAPH_MAGIC, 4);
+  gum_byte_array_append_uleb128 (output, function_count);
+  g_byte_array_append (output, names->data, names->len);
+  gum_byte_array_append_uleb128 (output, thread_count);
+  g_byte_array_append (output, body->data, body->len);
+
+  g_array_free (pending, TRUE);
+  g_byte_array_unref (nodes);
+  g_byte_array_unref (body);
+  g_byte_array_unref (names);
+  g_hash_table_unref (function_indices);
+
+  return output;
+}
+
 guint
 gum_profiler_get_number_of_threads (GumProfiler * self)
 {
   GumProfilerPrivate * priv = GUM_PROFILER_GET_PRIVATE (self);
   guint result;
   GHashTable * unique_thread_id_set;
+  GumProfilerThread * thread;
 
   unique_thread_id_set = g_hash_table_new (g_direct_hash, g_direct_equal);
-  GUM_PROFILER_LOCK ();
-  g_hash_table_foreach (priv->function_by_address,
-      get_number_of_threads_foreach, unique_thread_id_set);
-  GUM_PROFILER_UNLOCK ();
+  for (thread = g_atomic_pointer_get (&priv->threads); thread != NULL;
+      thread = thread->next)
+  {
+    g_hash_table_insert (unique_thread_id_set,
+        GUINT_TO_POINTER (thread->thread_id), NULL);
+  }
   result = g_hash_table_size (unique_thread_id_set);
   g_hash_table_unref (unique_thread_id_set);
 
@@ -537,17 +860,13 @@ gum_profiler_get_total_duration_of (GumProfiler * self,
                                     guint thread_index,
                                     gpointer function_address)
 {
-  GumProfilerPrivate * priv = GUM_PROFILER_GET_PRIVATE (self);
-  GumFunctionContext * function_ctx;
+  GumFunctionThreadContext * thread_ctx;
 
-  GUM_PROFILER_LOCK ();
-  function_ctx = (GumFunctionContext *)
-      g_hash_table_lookup (priv->function_by_address, function_address);
-  GUM_PROFILER_UNLOCK ();
+  thread_ctx = gum_profiler_find_thread_context (self, thread_index,
+      function_address);
 
-  if (function_ctx != NULL
-      && (gint) thread_index < function_ctx->thread_context_count)
-    return function_ctx->thread_contexts[thread_index].total_duration;
+  if (thread_ctx != NULL)
+    return thread_ctx->total_duration;
   else
     return 0;
 }
@@ -557,17 +876,13 @@ gum_profiler_get_worst_case_duration_of (GumProfiler * self,
                                          guint thread_index,
                                          gpointer function_address)
 {
-  GumProfilerPrivate * priv = GUM_PROFILER_GET_PRIVATE (self);
-  GumFunctionContext * function_ctx;
+  GumFunctionThreadContext * thread_ctx;
 
-  GUM_PROFILER_LOCK ();
-  function_ctx = (GumFunctionContext *)
-      g_hash_table_lookup (priv->function_by_address, function_address);
-  GUM_PROFILER_UNLOCK ();
+  thread_ctx = gum_profiler_find_thread_context (self, thread_index,
+      function_address);
 
-  if (function_ctx != NULL
-      && (gint) thread_index < function_ctx->thread_context_count)
-    return function_ctx->thread_contexts[thread_index].worst_case.duration;
+  if (thread_ctx != NULL)
+    return thread_ctx->worst_case.duration;
   else
     return 0;
 }
@@ -577,17 +892,13 @@ gum_profiler_get_worst_case_info_of (GumProfiler * self,
                                      guint thread_index,
                                      gpointer function_address)
 {
-  GumProfilerPrivate * priv = GUM_PROFILER_GET_PRIVATE (self);
-  GumFunctionContext * function_ctx;
+  GumFunctionThreadContext * thread_ctx;
 
-  GUM_PROFILER_LOCK ();
-  function_ctx = (GumFunctionContext *)
-      g_hash_table_lookup (priv->function_by_address, function_address);
-  GUM_PROFILER_UNLOCK ();
+  thread_ctx = gum_profiler_find_thread_context (self, thread_index,
+      function_address);
 
-  if (function_ctx != NULL
-      && (gint) thread_index < function_ctx->thread_context_count)
-    return function_ctx->thread_contexts[thread_index].worst_case.info.buf;
+  if (thread_ctx != NULL)
+    return thread_ctx->worst_case.info.buf;
   else
     return "";
 }
@@ -609,50 +920,387 @@ thread_context_register_child_timing (GumFunctionThreadContext * parent_ctx,
   }
 }
 
-static void
-get_number_of_threads_foreach (gpointer key,
-                               gpointer value,
-                               gpointer user_data)
+static GumFunctionThreadContext *
+gum_profiler_find_thread_context (GumProfiler * self,
+                                  guint thread_index,
+                                  gpointer function_address)
 {
-  GumFunctionContext * function_ctx = value;
-  GHashTable * unique_thread_id_set = user_data;
-  guint thread_count = function_ctx->thread_context_count;
-  guint i;
+  GumProfilerPrivate * priv = GUM_PROFILER_GET_PRIVATE (self);
+  GumFunctionContext * function_ctx;
+  GumProfilerThread * thread;
 
-  (void) key;
+  GUM_PROFILER_LOCK ();
+  function_ctx = (GumFunctionContext *)
+      g_hash_table_lookup (priv->function_by_address, function_address);
+  GUM_PROFILER_UNLOCK ();
+
+  if (function_ctx == NULL)
+    return NULL;
 
-  for (i = 0; i < thread_count; i++)
+  for (thread = g_atomic_pointer_get (&priv->threads); thread != NULL;
+      thread = thread->next)
   {
-    g_hash_table_insert (unique_thread_id_set,
-        GUINT_TO_POINTER (function_ctx->thread_contexts[i].thread_id), NULL);
+    GumFunctionThreadContext * thread_ctx;
+
+    for (thread_ctx = g_atomic_pointer_get (&thread->functions);
+        thread_ctx != NULL; thread_ctx = thread_ctx->next)
+    {
+      if (thread_ctx->function_ctx == function_ctx &&
+          thread_ctx->thread_index == thread_index)
+        return thread_ctx;
+    }
   }
+
+  return NULL;
 }
 
-GumFunctionThreadContext *
-gum_function_context_get_current_thread (GumFunctionContext * function_ctx,
-                                         GumInvocationContext * context)
+static GumProfilerThread *
+gum_profiler_thread_new (GumProfiler * profiler,
+                         guint thread_id)
 {
-  guint32 current_thread_id;
-  guint thread_count;
-  guint i;
-  GumFunctionThreadContext * thread_ctx;
+  GumProfilerPrivate * priv = GUM_PROFILER_GET_PRIVATE (profiler);
+  GumProfilerThread * thread;
+  GumProfilerThread * head;
+
+  thread = gum_malloc0 (sizeof (GumProfilerThread));
+  thread->thread_id = thread_id;
+  thread->stack = gum_array_sized_new (FALSE, FALSE,
+      sizeof (GumFunctionThreadContext *), GUM_MAX_CALL_DEPTH);
+  thread->current_node = &thread->root_node;
+
+  do
+  {
+    head = g_atomic_pointer_get (&priv->threads);
+    thread->next = head;
+  }
+  while (!g_atomic_pointer_compare_and_exchange (&priv->threads, head,
+      thread));
+
+  return thread;
+}
+
+static void
+gum_profiler_thread_free (GumProfilerThread * thread)
+{
+  while (thread->arena != NULL)
+  {
+    GumProfilerArena * arena = thread->arena;
+    thread->arena = arena->next;
+    gum_free (arena);
+  }
+
+  while (thread->node_arena != NULL)
+  {
+    GumCallGraphArena * arena = thread->node_arena;
+    thread->node_arena = arena->next;
+    gum_free (arena);
+  }
+
+  gum_free (thread->node_index);
+  gum_free (thread->index);
+  gum_array_free (thread->stack, TRUE);
 
-  current_thread_id = gum_invocation_context_get_thread_id (context);
+  gum_free (thread);
+}
 
-  thread_count = g_atomic_int_get (&function_ctx->thread_context_count);
-  for (i = 0; i != thread_count; i++)
+static GumFunctionThreadContext *
+gum_profiler_thread_get_function_context (GumProfilerThread * thread,
+                                          GumFunctionContext * function_ctx)
+{
+  GumFunctionThreadContext * thread_ctx;
+  GumProfilerArena * arena;
+
+  if (thread->index != NULL)
   {
-    thread_ctx = &function_ctx->thread_contexts[i];
+    guint mask, i;
+
+    mask = thread->index_size - 1;
+    for (i = gum_profiler_thread_hash_function (function_ctx) & mask;
+        (thread_ctx = thread->index[i]) != NULL; i = (i + 1) & mask)
+    {
+      if (thread_ctx->function_ctx == function_ctx)
+        return thread_ctx;
+    }
+  }
 
-    if (thread_ctx->thread_id == current_thread_id)
-      return thread_ctx;
+  arena = thread->arena;
+  if (arena == NULL || arena->used == GUM_PROFILER_ARENA_SIZE)
+  {
+    arena = gum_malloc0 (sizeof (GumProfilerArena));
+    arena->next = thread->arena;
+    thread->arena = arena;
   }
+  thread_ctx = &arena->contexts[arena->used++];
 
-  i = g_atomic_int_add (&function_ctx->thread_context_count, 1);
-  g_assert (i < G_N_ELEMENTS (function_ctx->thread_contexts));
-  thread_ctx = &function_ctx->thread_contexts[i];
   thread_ctx->function_ctx = function_ctx;
-  thread_ctx->thread_id = current_thread_id;
+  thread_ctx->thread_id = thread->thread_id;
+  thread_ctx->thread_index =
+      g_atomic_int_add (&function_ctx->thread_context_count, 1);
+
+  gum_profiler_thread_insert_into_index (thread, thread_ctx);
+
+  thread_ctx->next = thread->functions;
+  g_atomic_pointer_set (&thread->functions, thread_ctx);
 
   return thread_ctx;
 }
+
+static void
+gum_profiler_thread_insert_into_index (GumProfilerThread * thread,
+                                       GumFunctionThreadContext * thread_ctx)
+{
+  guint mask, i;
+
+  if ((thread->function_count + 1) * 4 > thread->index_size * 3)
+    gum_profiler_thread_grow_index (thread);
+
+  mask = thread->index_size - 1;
+  for (i = gum_profiler_thread_hash_function (thread_ctx->function_ctx) & mask;
+      thread->index[i] != NULL; i = (i + 1) & mask)
+    ;
+  thread->index[i] = thread_ctx;
+  thread->function_count++;
+}
+
+static void
+gum_profiler_thread_grow_index (GumProfilerThread * thread)
+{
+  GumFunctionThreadContext ** old_index;
+  guint old_size, mask, i;
+
+  old_index = thread->index;
+  old_size = thread->index_size;
+
+  thread->index_size = MAX (old_size * 2, GUM_PROFILER_INDEX_MIN_SIZE);
+  thread->index = gum_malloc0 (
+      thread->index_size * sizeof (GumFunctionThreadContext *));
+
+  mask = thread->index_size - 1;
+  for (i = 0; i != old_size; i++)
+  {
+    GumFunctionThreadContext * thread_ctx = old_index[i];
+    guint j;
+
+    if (thread_ctx == NULL)
+      continue;
+
+    for (j = gum_profiler_thread_hash_function (thread_ctx->function_ctx) &
+        mask; thread->index[j] != NULL; j = (j + 1) & mask)
+      ;
+    thread->index[j] = thread_ctx;
+  }
+
+  gum_free (old_index);
+}
+
+static guint
+gum_profiler_thread_hash_function (GumFunctionContext * function_ctx)
+{
+  return (guint) (GPOINTER_TO_SIZE (function_ctx) >> 4) * 2654435761U;
+}
+
+static GumCallGraphNode *
+gum_profiler_thread_get_call_graph_node (GumProfilerThread * thread,
+                                         GumCallGraphNode * parent,
+                                         GumFunctionContext * function_ctx)
+{
+  GumCallGraphNode * node;
+  GumCallGraphArena * arena;
+
+  if (thread->node_index != NULL)
+  {
+    guint mask, i;
+
+    mask = thread->node_index_size - 1;
+    for (i = gum_profiler_thread_hash_node (parent, function_ctx) & mask;
+        (node = thread->node_index[i]) != NULL; i = (i + 1) & mask)
+    {
+      if (node->parent == parent && node->function_ctx == function_ctx)
+        return node;
+    }
+  }
+
+  arena = thread->node_arena;
+  if (arena == NULL || arena->used == GUM_CALL_GRAPH_ARENA_SIZE)
+  {
+    arena = gum_malloc0 (sizeof (GumCallGraphArena));
+    arena->next = thread->node_arena;
+    thread->node_arena = arena;
+  }
+  node = &arena->nodes[arena->used++];
+
+  node->parent = parent;
+  node->function_ctx = function_ctx;
+
+  gum_profiler_thread_insert_into_node_index (thread, node);
+
+  node->next_sibling = parent->first_child;
+  g_atomic_pointer_set (&parent->first_child, node);
+
+  return node;
+}
+
+static void
+gum_profiler_thread_insert_into_node_index (GumProfilerThread * thread,
+                                            GumCallGraphNode * node)
+{
+  guint mask, i;
+
+  if ((thread->node_count + 1) * 4 > thread->node_index_size * 3)
+    gum_profiler_thread_grow_node_index (thread);
+
+  mask = thread->node_index_size - 1;
+  for (i = gum_profiler_thread_hash_node (node->parent, node->function_ctx) &
+      mask; thread->node_index[i] != NULL; i = (i + 1) & mask)
+    ;
+  thread->node_index[i] = node;
+  thread->node_count++;
+}
+
+static void
+gum_profiler_thread_grow_node_index (GumProfilerThread * thread)
+{
+  GumCallGraphNode ** old_index;
+  guint old_size, mask, i;
+
+  old_index = thread->node_index;
+  old_size = thread->node_index_size;
+
+  thread->node_index_size = MAX (old_size * 2, GUM_PROFILER_INDEX_MIN_SIZE);
+  thread->node_index = gum_malloc0 (
+      thread->node_index_size * sizeof (GumCallGraphNode *));
+
+  mask = thread->node_index_size - 1;
+  for (i = 0; i != old_size; i++)
+  {
+    GumCallGraphNode * node = old_index[i];
+    guint j;
+
+    if (node == NULL)
+      continue;
+
+    for (j = gum_profiler_thread_hash_node (node->parent, node->function_ctx) &
+        mask; thread->node_index[j] != NULL; j = (j + 1) & mask)
+      ;
+    thread->node_index[j] = node;
+  }
+
+  gum_free (old_index);
+}
+
+static guint
+gum_profiler_thread_hash_node (GumCallGraphNode * parent,
+                               GumFunctionContext * function_ctx)
+{
+  return ((guint) (GPOINTER_TO_SIZE (parent) >> 4) * 31U +
+      (guint) (GPOINTER_TO_SIZE (function_ctx) >> 4)) * 2654435761U;
+}
+
+static void
+gum_call_graph_push_children (GArray * pending,
+                              GumCallGraphNode * node,
+                              guint depth,
+                              gsize path_length)
+{
+  GumCallGraphNode * child;
+
+  /*
+   * Children are linked newest first, and frames are popped off the end, so
+   * this visits them in the order they were first called.
+   */
+  for (child = g_atomic_pointer_get (&node->first_child); child != NULL;
+      child = child->next_sibling)
+  {
+    GumCallGraphFrame frame;
+
+    frame.node = child;
+    frame.depth = depth;
+    frame.path_length = path_length;
+    g_array_append_val (pending, frame);
+  }
+}
+
+static GumSample
+gum_call_graph_node_get_self_duration (GumCallGraphNode * node)
+{
+  GumSample children_duration = 0;
+  GumCallGraphNode * child;
+
+  for (child = g_atomic_pointer_get (&node->first_child); child != NULL;
+      child = child->next_sibling)
+  {
+    children_duration += child->total_duration;
+  }
+
+  /* Children may still be running while their parent has not returned. */
+  if (children_duration > node->total_duration)
+    return 0;
+
+  return node->total_duration - children_duration;
+}
+
+/*
+ * Called with the profiler lock held. Functions without a symbol are named
+ * after their module and offset, or failing that just their address.
+ */
+static const gchar *
+gum_profiler_get_function_name (GumProfiler * self,
+                                GumFunctionContext * function_ctx)
+{
+  GumProfilerPrivate * priv = GUM_PROFILER_GET_PRIVATE (self);
+  gchar * name;
+
+  if (function_ctx->name != NULL)
+    return function_ctx->name;
+
+  name = gum_symbol_name_from_address (function_ctx->function_address);
+  if (name == NULL || name[0] == '\0')
+  {
+    GumAddress address = GUM_ADDRESS (function_ctx->function_address);
+    const GumModuleDetails * module;
+
+    g_free (name);
+
+    if (priv->modules == NULL)
+      priv->modules = gum_module_map_new ();
+
+    module = gum_module_map_find (priv->modules, address);
+    if (module == NULL)
+    {
+      gum_module_map_update (priv->modules);
+      module = gum_module_map_find (priv->modules, address);
+    }
+
+    if (module != NULL)
+    {
+      name = g_strdup_printf ("%s+0x%" G_GINT64_MODIFIER "x", module->name,
+          address - module->range->base_address);
+    }
+    else
+    {
+      name = g_strdup_printf ("0x%" G_GINT64_MODIFIER "x", address);
+    }
+  }
+  g_strdelimit (name, ";", ':');
+
+  function_ctx->name = name;
+
+  return name;
+}
+
+static void
+gum_byte_array_append_uleb128 (GByteArray * array,
+                               guint64 value)
+{
+  do
+  {
+    guint8 byte = value & 0x7f;
+
+    value >>= 7;
+    if (value != 0)
+      byte |= 0x80;
+
+    g_byte_array_append (array, &byte, 1);
+  }
+  while (value != 0);
+}
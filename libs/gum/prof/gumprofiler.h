@@ -72,6 +72,11 @@ GUM_API GumInstrumentReturn gum_profiler_instrument_function_with_inspector (
 
 GUM_API GumProfileReport * gum_profiler_generate_report (GumProfiler * self);
 
+GUM_API void gum_profiler_enable_call_graph (GumProfiler * self,
+    GumSampler * sampler);
+GUM_API gchar * gum_profiler_emit_folded_stacks (GumProfiler * self);
+GUM_API GByteArray * gum_profiler_emit_call_graph (GumProfiler * self);
+
 GUM_API guint gum_profiler_get_number_of_threads (GumProfiler * self);
 GUM_API GumSample gum_profiler_get_total_duration_of (GumProfiler * self,
     guint thread_index, gpointer function_address);
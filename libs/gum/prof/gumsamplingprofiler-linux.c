@@ -0,0 +1,902 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "gumsamplingprofiler.h"
+
+#include "backend-linux/gumlinux.h"
+#include "gummodulemap.h"
+#include "gumprocess.h"
+#include "gumreturnaddress.h"
+#include "gumsymbolutil.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#define GUM_SAMPLING_PROFILER_DEFAULT_INTERVAL 1000
+#define GUM_SAMPLING_PROFILER_DRAIN_INTERVAL   (20 * G_TIME_SPAN_MILLISECOND)
+#define GUM_SAMPLING_PROFILER_RANGES_REFRESH   50
+
+#define GUM_SAMPLE_BUFFER_CAPACITY 256
+#define GUM_SAMPLE_BUFFER_MASK     (GUM_SAMPLE_BUFFER_CAPACITY - 1)
+
+#ifndef SIGEV_THREAD_ID
+# define SIGEV_THREAD_ID 4
+#endif
+#ifndef sigev_notify_thread_id
+# define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+#define GUM_CPUCLOCK_PERTHREAD_MASK 4
+#define GUM_CPUCLOCK_SCHED          2
+#define GUM_THREAD_CPU_CLOCK(tid) \
+    ((clockid_t) ((~(guint) (tid)) << 3) | GUM_CPUCLOCK_PERTHREAD_MASK | \
+        GUM_CPUCLOCK_SCHED)
+
+typedef struct _GumSampleBuffer GumSampleBuffer;
+typedef struct _GumSampleSlots GumSampleSlots;
+typedef struct _GumStackRanges GumStackRanges;
+typedef struct _GumStackEntry GumStackEntry;
+
+struct _GumSamplingProfilerPrivate
+{
+  guint interval;
+
+  GMutex mutex;
+  GCond cond;
+  GThread * aggregator;
+  gboolean stopping;
+
+  GumSampleBuffer * buffers;
+  GumStackRanges * ranges;
+  guint drains_since_refresh;
+
+  GHashTable * stacks;
+  guint64 sample_count;
+  guint64 dropped_count;
+
+  GumModuleMap * modules;
+  GHashTable * frame_names;
+};
+
+/*
+ * Single-producer single-consumer ring: the SIGPROF handler running on the
+ * sampled thread only ever advances head, and the aggregator thread only
+ * ever advances tail.
+ */
+struct _GumSampleBuffer
+{
+  GumSampleBuffer * next;
+
+  guint thread_id;
+  guint slot;
+  gint timer_id;
+  gboolean seen;
+
+  volatile gint head;
+  volatile gint tail;
+  volatile gint dropped;
+
+  GumReturnAddressArray samples[GUM_SAMPLE_BUFFER_CAPACITY];
+};
+
+/*
+ * Maps the slot carried by each timer's signal to the ring it fills. Grown
+ * by the aggregator when every slot is taken, so that no thread goes
+ * unsampled; the handler sees either the old or the new table.
+ */
+struct _GumSampleSlots
+{
+  guint capacity;
+  GumSampleBuffer * volatile items[1];
+};
+
+/*
+ * Snapshot of the writable mappings, sorted by address. The signal handler
+ * uses it to know how far above the stack pointer it may safely read while
+ * following frame pointers. Adjacent mappings are deliberately kept apart,
+ * as the one holding the stack pointer is then the thread's own stack and
+ * a walk cannot wander into a neighbouring one.
+ */
+struct _GumStackRanges
+{
+  guint count;
+  GumMemoryRange items[1];
+};
+
+struct _GumStackEntry
+{
+  GumReturnAddressArray stack;
+  guint64 count;
+};
+
+static void gum_sampling_profiler_dispose (GObject * object);
+static void gum_sampling_profiler_finalize (GObject * object);
+
+static gpointer gum_sampling_profiler_aggregate (gpointer data);
+static void gum_sampling_profiler_rescan_threads (GumSamplingProfiler * self);
+static void gum_sampling_profiler_refresh_ranges (GumSamplingProfiler * self);
+static gboolean gum_sampling_profiler_add_range (
+    const GumRangeDetails * details, gpointer user_data);
+static void gum_sampling_profiler_drain (GumSamplingProfiler * self);
+static void gum_sampling_profiler_drain_buffer (GumSamplingProfiler * self,
+    GumSampleBuffer * buffer);
+static void gum_sampling_profiler_wait_for_handlers (void);
+static guint gum_sampling_profiler_claim_slot (void);
+static const gchar * gum_sampling_profiler_get_frame_name (
+    GumSamplingProfiler * self, GumReturnAddress address);
+
+static GumSampleBuffer * gum_sample_buffer_arm (guint thread_id,
+    guint interval);
+static void gum_sample_buffer_disarm (GumSampleBuffer * buffer);
+
+static void gum_sampling_profiler_install_handler (void);
+static void gum_sampling_profiler_on_signal (int sig, siginfo_t * info,
+    void * context);
+static void gum_sampling_profiler_unwind (const GumCpuContext * cpu_context,
+    GumReturnAddressArray * stack);
+
+static const GumMemoryRange * gum_stack_ranges_find (
+    const GumStackRanges * self, gsize address);
+
+static guint gum_stack_hash (gconstpointer key);
+static gboolean gum_stack_equal (gconstpointer a, gconstpointer b);
+
+G_DEFINE_TYPE (GumSamplingProfiler, gum_sampling_profiler, G_TYPE_OBJECT);
+
+G_LOCK_DEFINE_STATIC (gum_sampling);
+static GumSamplingProfiler * gum_sampling_owner = NULL;
+static gboolean gum_sampling_handler_installed = FALSE;
+static struct sigaction gum_sampling_previous_action;
+
+static GumSampleSlots * volatile gum_sample_slots = NULL;
+static GumStackRanges * volatile gum_stack_ranges = NULL;
+static volatile gint gum_sampling_handlers_in_flight = 0;
+
+static void
+gum_sampling_profiler_class_init (GumSamplingProfilerClass * klass)
+{
+  GObjectClass * object_class = G_OBJECT_CLASS (klass);
+
+  g_type_class_add_private (klass, sizeof (GumSamplingProfilerPrivate));
+
+  object_class->dispose = gum_sampling_profiler_dispose;
+  object_class->finalize = gum_sampling_profiler_finalize;
+}
+
+static void
+gum_sampling_profiler_init (GumSamplingProfiler * self)
+{
+  GumSamplingProfilerPrivate * priv;
+
+  self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
+      GUM_TYPE_SAMPLING_PROFILER, GumSamplingProfilerPrivate);
+  priv = self->priv;
+
+  priv->interval = GUM_SAMPLING_PROFILER_DEFAULT_INTERVAL;
+
+  g_mutex_init (&priv->mutex);
+  g_cond_init (&priv->cond);
+
+  priv->stacks = g_hash_table_new_full (gum_stack_hash, gum_stack_equal,
+      NULL, g_free);
+  priv->frame_names = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+}
+
+static void
+gum_sampling_profiler_dispose (GObject * object)
+{
+  GumSamplingProfiler * self = GUM_SAMPLING_PROFILER (object);
+  GumSamplingProfilerPrivate * priv = self->priv;
+
+  gum_sampling_profiler_stop (self);
+
+  if (priv->modules != NULL)
+  {
+    g_object_unref (priv->modules);
+    priv->modules = NULL;
+  }
+
+  G_OBJECT_CLASS (gum_sampling_profiler_parent_class)->dispose (object);
+}
+
+static void
+gum_sampling_profiler_finalize (GObject * object)
+{
+  GumSamplingProfiler * self = GUM_SAMPLING_PROFILER (object);
+  GumSamplingProfilerPrivate * priv = self->priv;
+
+  g_hash_table_unref (priv->frame_names);
+  g_hash_table_unref (priv->stacks);
+
+  g_cond_clear (&priv->cond);
+  g_mutex_clear (&priv->mutex);
+
+  G_OBJECT_CLASS (gum_sampling_profiler_parent_class)->finalize (object);
+}
+
+GumSamplingProfiler *
+gum_sampling_profiler_new (void)
+{
+  return g_object_new (GUM_TYPE_SAMPLING_PROFILER, NULL);
+}
+
+void
+gum_sampling_profiler_set_interval (GumSamplingProfiler * self,
+                                    guint interval_usec)
+{
+  g_assert (self->priv->aggregator == NULL);
+  g_assert_cmpuint (interval_usec, !=, 0);
+
+  self->priv->interval = interval_usec;
+}
+
+/*
+ * Arms a timer on the CPU clock of every thread in the process, so only
+ * threads that are actually running get sampled. Threads started later are
+ * picked up by the aggregator thread. Only one sampling profiler can be
+ * running at a time, as SIGPROF is process-wide.
+ */
+gboolean
+gum_sampling_profiler_start (GumSamplingProfiler * self)
+{
+  GumSamplingProfilerPrivate * priv = self->priv;
+
+  G_LOCK (gum_sampling);
+  if (gum_sampling_owner != NULL)
+  {
+    G_UNLOCK (gum_sampling);
+    return FALSE;
+  }
+  gum_sampling_owner = self;
+  gum_sampling_profiler_install_handler ();
+  G_UNLOCK (gum_sampling);
+
+  priv->stopping = FALSE;
+  priv->drains_since_refresh = 0;
+
+  g_mutex_lock (&priv->mutex);
+  gum_sampling_profiler_refresh_ranges (self);
+  g_mutex_unlock (&priv->mutex);
+
+  priv->aggregator = g_thread_new ("gum-sampling-profiler",
+      gum_sampling_profiler_aggregate, self);
+
+  return TRUE;
+}
+
+void
+gum_sampling_profiler_stop (GumSamplingProfiler * self)
+{
+  GumSamplingProfilerPrivate * priv = self->priv;
+  GumSampleBuffer * buffer;
+  GumSampleSlots * slots;
+
+  if (priv->aggregator == NULL)
+    return;
+
+  g_mutex_lock (&priv->mutex);
+  priv->stopping = TRUE;
+  g_cond_signal (&priv->cond);
+  g_mutex_unlock (&priv->mutex);
+
+  g_thread_join (priv->aggregator);
+  priv->aggregator = NULL;
+
+  g_mutex_lock (&priv->mutex);
+
+  for (buffer = priv->buffers; buffer != NULL; buffer = buffer->next)
+    gum_sample_buffer_disarm (buffer);
+  gum_sampling_profiler_wait_for_handlers ();
+
+  gum_sampling_profiler_drain (self);
+
+  while ((buffer = priv->buffers) != NULL)
+  {
+    priv->buffers = buffer->next;
+    g_free (buffer);
+  }
+
+  /* Every slot is empty by now, so late handlers won't touch the ranges. */
+  g_atomic_pointer_set (&gum_stack_ranges, NULL);
+  g_free (priv->ranges);
+  priv->ranges = NULL;
+
+  slots = gum_sample_slots;
+  g_atomic_pointer_set (&gum_sample_slots, NULL);
+  gum_sampling_profiler_wait_for_handlers ();
+  g_free (slots);
+
+  g_mutex_unlock (&priv->mutex);
+
+  G_LOCK (gum_sampling);
+  gum_sampling_owner = NULL;
+  G_UNLOCK (gum_sampling);
+}
+
+guint64
+gum_sampling_profiler_get_sample_count (GumSamplingProfiler * self)
+{
+  GumSamplingProfilerPrivate * priv = self->priv;
+  guint64 result;
+
+  g_mutex_lock (&priv->mutex);
+  gum_sampling_profiler_drain (self);
+  result = priv->sample_count;
+  g_mutex_unlock (&priv->mutex);
+
+  return result;
+}
+
+guint64
+gum_sampling_profiler_get_dropped_count (GumSamplingProfiler * self)
+{
+  GumSamplingProfilerPrivate * priv = self->priv;
+  guint64 result;
+
+  g_mutex_lock (&priv->mutex);
+  gum_sampling_profiler_drain (self);
+  result = priv->dropped_count;
+  g_mutex_unlock (&priv->mutex);
+
+  return result;
+}
+
+/*
+ * One line per distinct stack, outermost frame first, in the format used by
+ * flamegraph.pl. Frames are named after their symbol when one is known, and
+ * as module+offset otherwise.
+ */
+gchar *
+gum_sampling_profiler_emit_folded_stacks (GumSamplingProfiler * self)
+{
+  GumSamplingProfilerPrivate * priv = self->priv;
+  GString * output;
+  GHashTableIter iter;
+  GumStackEntry * entry;
+
+  output = g_string_sized_new (4096);
+
+  g_mutex_lock (&priv->mutex);
+
+  gum_sampling_profiler_drain (self);
+
+  if (priv->modules == NULL)
+    priv->modules = gum_module_map_new ();
+  else
+    gum_module_map_update (priv->modules);
+
+  g_hash_table_iter_init (&iter, priv->stacks);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &entry))
+  {
+    guint i;
+
+    for (i = entry->stack.len; i != 0; i--)
+    {
+      g_string_append (output, gum_sampling_profiler_get_frame_name (self,
+          entry->stack.items[i - 1]));
+      if (i != 1)
+        g_string_append_c (output, ';');
+    }
+
+    g_string_append_printf (output, " %" G_GUINT64_FORMAT "\n", entry->count);
+  }
+
+  g_mutex_unlock (&priv->mutex);
+
+  return g_string_free (output, FALSE);
+}
+
+static gpointer
+gum_sampling_profiler_aggregate (gpointer data)
+{
+  GumSamplingProfiler * self = GUM_SAMPLING_PROFILER_CAST (data);
+  GumSamplingProfilerPrivate * priv = self->priv;
+
+  g_mutex_lock (&priv->mutex);
+
+  while (!priv->stopping)
+  {
+    gum_sampling_profiler_rescan_threads (self);
+    gum_sampling_profiler_drain (self);
+
+    g_cond_wait_until (&priv->cond, &priv->mutex,
+        g_get_monotonic_time () + GUM_SAMPLING_PROFILER_DRAIN_INTERVAL);
+  }
+
+  g_mutex_unlock (&priv->mutex);
+
+  return NULL;
+}
+
+static void
+gum_sampling_profiler_rescan_threads (GumSamplingProfiler * self)
+{
+  GumSamplingProfilerPrivate * priv = self->priv;
+  guint own_thread_id;
+  GDir * dir;
+  const gchar * name;
+  GumSampleBuffer * buffer, ** link;
+  gboolean added = FALSE;
+
+  dir = g_dir_open ("/proc/self/task", 0, NULL);
+  if (dir == NULL)
+    return;
+
+  own_thread_id = syscall (__NR_gettid);
+
+  for (buffer = priv->buffers; buffer != NULL; buffer = buffer->next)
+    buffer->seen = FALSE;
+
+  while ((name = g_dir_read_name (dir)) != NULL)
+  {
+    guint thread_id;
+
+    thread_id = (guint) strtoul (name, NULL, 10);
+    if (thread_id == 0 || thread_id == own_thread_id)
+      continue;
+
+    for (buffer = priv->buffers; buffer != NULL; buffer = buffer->next)
+    {
+      if (buffer->thread_id == thread_id)
+        break;
+    }
+
+    if (buffer == NULL)
+    {
+      buffer = gum_sample_buffer_arm (thread_id, priv->interval);
+      if (buffer == NULL)
+        continue;
+      buffer->next = priv->buffers;
+      priv->buffers = buffer;
+      added = TRUE;
+    }
+
+    buffer->seen = TRUE;
+  }
+
+  g_dir_close (dir);
+
+  /* The new threads' stacks must be in the snapshot for them to unwind. */
+  if (added ||
+      ++priv->drains_since_refresh == GUM_SAMPLING_PROFILER_RANGES_REFRESH)
+  {
+    gum_sampling_profiler_refresh_ranges (self);
+  }
+
+  link = &priv->buffers;
+  while ((buffer = *link) != NULL)
+  {
+    if (!buffer->seen)
+    {
+      *link = buffer->next;
+
+      gum_sample_buffer_disarm (buffer);
+      gum_sampling_profiler_wait_for_handlers ();
+      gum_sampling_profiler_drain_buffer (self, buffer);
+      g_free (buffer);
+    }
+    else
+    {
+      link = &buffer->next;
+    }
+  }
+}
+
+static void
+gum_sampling_profiler_refresh_ranges (GumSamplingProfiler * self)
+{
+  GumSamplingProfilerPrivate * priv = self->priv;
+  GArray * ranges;
+  GumStackRanges * snapshot;
+
+  ranges = g_array_new (FALSE, FALSE, sizeof (GumMemoryRange));
+  gum_process_enumerate_ranges (GUM_PAGE_RW, gum_sampling_profiler_add_range,
+      ranges);
+
+  snapshot = g_malloc (G_STRUCT_OFFSET (GumStackRanges, items) +
+      MAX (ranges->len, 1) * sizeof (GumMemoryRange));
+  snapshot->count = ranges->len;
+  memcpy (snapshot->items, ranges->data,
+      ranges->len * sizeof (GumMemoryRange));
+
+  g_array_free (ranges, TRUE);
+
+  g_atomic_pointer_set (&gum_stack_ranges, snapshot);
+
+  /* Handlers that started before the swap may still be reading the old one. */
+  if (priv->ranges != NULL)
+  {
+    gum_sampling_profiler_wait_for_handlers ();
+    g_free (priv->ranges);
+  }
+  priv->ranges = snapshot;
+  priv->drains_since_refresh = 0;
+}
+
+static gboolean
+gum_sampling_profiler_add_range (const GumRangeDetails * details,
+                                 gpointer user_data)
+{
+  GArray * ranges = (GArray *) user_data;
+
+  g_array_append_val (ranges, *details->range);
+
+  return TRUE;
+}
+
+static void
+gum_sampling_profiler_drain (GumSamplingProfiler * self)
+{
+  GumSampleBuffer * buffer;
+
+  for (buffer = self->priv->buffers; buffer != NULL; buffer = buffer->next)
+    gum_sampling_profiler_drain_buffer (self, buffer);
+}
+
+static void
+gum_sampling_profiler_drain_buffer (GumSamplingProfiler * self,
+                                    GumSampleBuffer * buffer)
+{
+  GumSamplingProfilerPrivate * priv = self->priv;
+  gint head, tail, dropped;
+
+  head = g_atomic_int_get (&buffer->head);
+  tail = buffer->tail;
+
+  for (; tail != head; tail++)
+  {
+    GumReturnAddressArray * stack;
+    GumStackEntry * entry;
+
+    stack = &buffer->samples[tail & GUM_SAMPLE_BUFFER_MASK];
+
+    entry = g_hash_table_lookup (priv->stacks, stack);
+    if (entry == NULL)
+    {
+      entry = g_new (GumStackEntry, 1);
+      entry->stack = *stack;
+      entry->count = 0;
+      g_hash_table_insert (priv->stacks, &entry->stack, entry);
+    }
+    entry->count++;
+
+    priv->sample_count++;
+  }
+
+  g_atomic_int_set (&buffer->tail, tail);
+
+  dropped = g_atomic_int_get (&buffer->dropped);
+  if (dropped != 0)
+  {
+    g_atomic_int_add (&buffer->dropped, -dropped);
+    priv->dropped_count += dropped;
+  }
+}
+
+static void
+gum_sampling_profiler_wait_for_handlers (void)
+{
+  while (g_atomic_int_get (&gum_sampling_handlers_in_flight) != 0)
+    g_thread_yield ();
+}
+
+static guint
+gum_sampling_profiler_claim_slot (void)
+{
+  GumSampleSlots * slots, * grown;
+  guint slot, capacity;
+
+  slots = gum_sample_slots;
+  capacity = (slots != NULL) ? slots->capacity : 0;
+
+  for (slot = 0; slot != capacity; slot++)
+  {
+    if (g_atomic_pointer_get (&slots->items[slot]) == NULL)
+      return slot;
+  }
+
+  grown = g_malloc0 (G_STRUCT_OFFSET (GumSampleSlots, items) +
+      MAX (2 * capacity, GUM_MAX_THREADS) * sizeof (GumSampleBuffer *));
+  grown->capacity = MAX (2 * capacity, GUM_MAX_THREADS);
+  if (slots != NULL)
+  {
+    memcpy ((gpointer) grown->items, (gpointer) slots->items,
+        capacity * sizeof (GumSampleBuffer *));
+  }
+
+  g_atomic_pointer_set (&gum_sample_slots, grown);
+
+  if (slots != NULL)
+  {
+    gum_sampling_profiler_wait_for_handlers ();
+    g_free (slots);
+  }
+
+  return capacity;
+}
+
+static const gchar *
+gum_sampling_profiler_get_frame_name (GumSamplingProfiler * self,
+                                      GumReturnAddress address)
+{
+  GumSamplingProfilerPrivate * priv = self->priv;
+  gchar * name;
+  GumSymbolDetails details;
+  const GumModuleDetails * module;
+
+  name = g_hash_table_lookup (priv->frame_names, address);
+  if (name != NULL)
+    return name;
+
+  if (gum_symbol_details_from_address (address, &details) &&
+      details.symbol_name[0] != '\0')
+  {
+    name = g_strdup (details.symbol_name);
+  }
+  else if ((module = gum_module_map_find (priv->modules,
+      GUM_ADDRESS (address))) != NULL)
+  {
+    name = g_strdup_printf ("%s+0x%" G_GINT64_MODIFIER "x", module->name,
+        GUM_ADDRESS (address) - module->range->base_address);
+  }
+  else
+  {
+    name = g_strdup_printf ("0x%" G_GINT64_MODIFIER "x",
+        GUM_ADDRESS (address));
+  }
+  g_strdelimit (name, ";", ':');
+
+  g_hash_table_insert (priv->frame_names, address, name);
+
+  return name;
+}
+
+static GumSampleBuffer *
+gum_sample_buffer_arm (guint thread_id,
+                       guint interval)
+{
+  GumSampleBuffer * buffer;
+  guint slot;
+  struct sigevent event;
+  struct itimerspec spec;
+
+  slot = gum_sampling_profiler_claim_slot ();
+
+  buffer = g_malloc0 (sizeof (GumSampleBuffer));
+  buffer->thread_id = thread_id;
+  buffer->slot = slot;
+  g_atomic_pointer_set (&gum_sample_slots->items[slot], buffer);
+
+  memset (&event, 0, sizeof (event));
+  event.sigev_notify = SIGEV_THREAD_ID;
+  event.sigev_signo = SIGPROF;
+  event.sigev_value.sival_int = slot;
+  event.sigev_notify_thread_id = thread_id;
+
+  /* Raw syscalls, so that we need neither librt nor glibc's timer_t. */
+  if (syscall (__NR_timer_create, GUM_THREAD_CPU_CLOCK (thread_id), &event,
+      &buffer->timer_id) != 0)
+  {
+    g_atomic_pointer_set (&gum_sample_slots->items[slot], NULL);
+    g_free (buffer);
+    return NULL;
+  }
+
+  spec.it_interval.tv_sec = interval / G_USEC_PER_SEC;
+  spec.it_interval.tv_nsec = (interval % G_USEC_PER_SEC) * 1000;
+  spec.it_value = spec.it_interval;
+  syscall (__NR_timer_settime, buffer->timer_id, 0, &spec, NULL);
+
+  return buffer;
+}
+
+static void
+gum_sample_buffer_disarm (GumSampleBuffer * buffer)
+{
+  syscall (__NR_timer_delete, buffer->timer_id);
+
+  g_atomic_pointer_set (&gum_sample_slots->items[buffer->slot], NULL);
+}
+
+/*
+ * The handler stays installed once we have started, as a SIGPROF may still
+ * be pending for a timer that was just deleted, and the default action would
+ * kill the process.
+ */
+static void
+gum_sampling_profiler_install_handler (void)
+{
+  struct sigaction action;
+
+  if (gum_sampling_handler_installed)
+    return;
+
+  action.sa_sigaction = gum_sampling_profiler_on_signal;
+  sigemptyset (&action.sa_mask);
+  action.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigaction (SIGPROF, &action, &gum_sampling_previous_action);
+
+  gum_sampling_handler_installed = TRUE;
+}
+
+/*
+ * Runs on the sampled thread, so only async-signal-safe operations here: no
+ * locks, no allocations, and no reads that have not been bounds-checked.
+ */
+static void
+gum_sampling_profiler_on_signal (int sig,
+                                 siginfo_t * info,
+                                 void * context)
+{
+  gint saved_errno = errno;
+  GumSampleSlots * slots;
+  GumSampleBuffer * buffer = NULL;
+
+  g_atomic_int_inc (&gum_sampling_handlers_in_flight);
+
+  slots = g_atomic_pointer_get (&gum_sample_slots);
+  if (info->si_code == SI_TIMER && slots != NULL &&
+      (guint) info->si_value.sival_int < slots->capacity)
+  {
+    buffer = g_atomic_pointer_get (&slots->items[info->si_value.sival_int]);
+  }
+
+  /*
+   * A signal still pending for a deleted timer may find its slot reused by
+   * another thread, whose ring only that thread may write to.
+   */
+  if (buffer != NULL && buffer->thread_id == (guint) syscall (__NR_gettid))
+  {
+    gint head, tail;
+
+    head = buffer->head;
+    tail = g_atomic_int_get (&buffer->tail);
+
+    if (head - tail == GUM_SAMPLE_BUFFER_CAPACITY)
+    {
+      g_atomic_int_inc (&buffer->dropped);
+    }
+    else
+    {
+      GumCpuContext cpu_context;
+
+      gum_linux_parse_ucontext (context, &cpu_context);
+      gum_sampling_profiler_unwind (&cpu_context,
+          &buffer->samples[head & GUM_SAMPLE_BUFFER_MASK]);
+
+      g_atomic_int_set (&buffer->head, head + 1);
+    }
+  }
+
+  g_atomic_int_add (&gum_sampling_handlers_in_flight, -1);
+
+  if (buffer == NULL)
+  {
+    if ((gum_sampling_previous_action.sa_flags & SA_SIGINFO) != 0)
+    {
+      gum_sampling_previous_action.sa_sigaction (sig, info, context);
+    }
+    else if (gum_sampling_previous_action.sa_handler != SIG_DFL &&
+        gum_sampling_previous_action.sa_handler != SIG_IGN)
+    {
+      gum_sampling_previous_action.sa_handler (sig);
+    }
+  }
+
+  errno = saved_errno;
+}
+
+static void
+gum_sampling_profiler_unwind (const GumCpuContext * cpu_context,
+                              GumReturnAddressArray * stack)
+{
+  const GumStackRanges * ranges;
+  const GumMemoryRange * range;
+  gsize pc, sp, fp, lower, upper;
+  guint n;
+
+#if defined (HAVE_I386)
+  pc = GUM_CPU_CONTEXT_XIP (cpu_context);
+  sp = GUM_CPU_CONTEXT_XSP (cpu_context);
+  fp = GUM_CPU_CONTEXT_XBP (cpu_context);
+#elif defined (HAVE_ARM64)
+  pc = cpu_context->pc;
+  sp = cpu_context->sp;
+  fp = cpu_context->fp;
+#else
+  /* No reliable frame pointer register here, settle for pc and lr. */
+  stack->items[0] = GSIZE_TO_POINTER (cpu_context->pc);
+  stack->items[1] = GSIZE_TO_POINTER (cpu_context->lr);
+  stack->len = 2;
+  return;
+#endif
+
+  stack->items[0] = GSIZE_TO_POINTER (pc);
+  stack->len = 1;
+
+  ranges = g_atomic_pointer_get (&gum_stack_ranges);
+  if (ranges == NULL)
+    return;
+
+  range = gum_stack_ranges_find (ranges, sp);
+  if (range == NULL)
+    return;
+  lower = sp;
+  upper = range->base_address + range->size;
+
+  /* Each frame record is [saved fp, return address], growing upwards. */
+  for (n = 1; n != G_N_ELEMENTS (stack->items); n++)
+  {
+    gsize * frame = GSIZE_TO_POINTER (fp);
+    gsize return_address;
+
+    if (fp < lower || fp > upper - (2 * sizeof (gsize)) ||
+        (fp & (sizeof (gsize) - 1)) != 0)
+      break;
+
+    return_address = frame[1];
+    if (return_address == 0)
+      break;
+    stack->items[n] = GSIZE_TO_POINTER (return_address);
+
+    lower = fp + (2 * sizeof (gsize));
+    fp = frame[0];
+  }
+
+  stack->len = n;
+}
+
+static const GumMemoryRange *
+gum_stack_ranges_find (const GumStackRanges * self,
+                       gsize address)
+{
+  guint lower, upper;
+
+  lower = 0;
+  upper = self->count;
+  while (lower != upper)
+  {
+    guint mid = lower + ((upper - lower) / 2);
+    const GumMemoryRange * range = &self->items[mid];
+
+    if (address < range->base_address)
+      upper = mid;
+    else if (address >= range->base_address + range->size)
+      lower = mid + 1;
+    else
+      return range;
+  }
+
+  return NULL;
+}
+
+static guint
+gum_stack_hash (gconstpointer key)
+{
+  const GumReturnAddressArray * stack = key;
+  guint hash = 2166136261U;
+  guint i;
+
+  for (i = 0; i != stack->len; i++)
+  {
+    hash ^= (guint) GPOINTER_TO_SIZE (stack->items[i]);
+    hash *= 16777619U;
+  }
+
+  return hash;
+}
+
+static gboolean
+gum_stack_equal (gconstpointer a,
+                 gconstpointer b)
+{
+  return gum_return_address_array_is_equal (a, b);
+}
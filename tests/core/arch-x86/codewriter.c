@@ -30,6 +30,8 @@ TEST_LIST_BEGIN (codewriter)
   CODEWRITER_TESTENTRY (add_eax_ecx)
   CODEWRITER_TESTENTRY (add_rax_rcx)
   CODEWRITER_TESTENTRY (add_r8_rcx)
+  CODEWRITER_TESTENTRY (sub_eax_ecx)
+  CODEWRITER_TESTENTRY (sub_rax_rcx)
   CODEWRITER_TESTENTRY (inc_ecx)
   CODEWRITER_TESTENTRY (inc_rcx)
   CODEWRITER_TESTENTRY (dec_ecx)
@@ -68,6 +70,8 @@ TEST_LIST_BEGIN (codewriter)
   CODEWRITER_TESTENTRY (test_rax_r9)
   CODEWRITER_TESTENTRY (cmp_eax_i32)
   CODEWRITER_TESTENTRY (cmp_r9_i32)
+  CODEWRITER_TESTENTRY (cmp_eax_ecx)
+  CODEWRITER_TESTENTRY (cmp_rax_r9)
 TEST_LIST_END ()
 
 CODEWRITER_TESTCASE (jump_label)
@@ -346,6 +350,20 @@ CODEWRITER_TESTCASE (add_r8_rcx)
   assert_output_equals (expected_code);
 }
 
+CODEWRITER_TESTCASE (sub_eax_ecx)
+{
+  const guint8 expected_code[] = { 0x29, 0xc8 };
+  gum_x86_writer_put_sub_reg_reg (&fixture->cw, GUM_REG_EAX, GUM_REG_ECX);
+  assert_output_equals (expected_code);
+}
+
+CODEWRITER_TESTCASE (sub_rax_rcx)
+{
+  const guint8 expected_code[] = { 0x48, 0x29, 0xc8 };
+  gum_x86_writer_put_sub_reg_reg (&fixture->cw, GUM_REG_RAX, GUM_REG_RCX);
+  assert_output_equals (expected_code);
+}
+
 CODEWRITER_TESTCASE (inc_ecx)
 {
   const guint8 expected_code[] = { 0xff, 0xc1 };
@@ -702,6 +720,20 @@ CODEWRITER_TESTCASE (cmp_r9_i32)
   assert_output_equals (expected_code);
 }
 
+CODEWRITER_TESTCASE (cmp_eax_ecx)
+{
+  const guint8 expected_code[] = { 0x39, 0xc8 };
+  gum_x86_writer_put_cmp_reg_reg (&fixture->cw, GUM_REG_EAX, GUM_REG_ECX);
+  assert_output_equals (expected_code);
+}
+
+CODEWRITER_TESTCASE (cmp_rax_r9)
+{
+  const guint8 expected_code[] = { 0x4c, 0x39, 0xc8 };
+  gum_x86_writer_put_cmp_reg_reg (&fixture->cw, GUM_REG_RAX, GUM_REG_R9);
+  assert_output_equals (expected_code);
+}
+
 #ifdef HAVE_I386
 
 static void
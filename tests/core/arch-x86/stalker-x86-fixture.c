@@ -214,3 +214,14 @@ enum _StalkerVictimState
   STALKER_VICTIM_READY_FOR_SHUTDOWN,
   STALKER_VICTIM_IS_SHUTDOWN
 };
+
+typedef struct _StalkerIdleContext StalkerIdleContext;
+
+struct _StalkerIdleContext
+{
+  TestStalkerFixture * fixture;
+  gboolean waiting;
+  gboolean done;
+  GMutex mutex;
+  GCond cond;
+};
@@ -50,6 +50,9 @@ TEST_LIST_BEGIN (stalker)
   STALKER_TESTENTRY (big_block)
 
   STALKER_TESTENTRY (heap_api)
+  STALKER_TESTENTRY (events_are_batched)
+  STALKER_TESTENTRY (events_of_idle_thread_are_flushed)
+  STALKER_TESTENTRY (shared_cache)
   STALKER_TESTENTRY (follow_syscall)
   STALKER_TESTENTRY (follow_thread)
   STALKER_TESTENTRY (performance)
@@ -66,6 +69,8 @@ TEST_LIST_END ()
 
 static void pretend_workload (void);
 static gpointer stalker_victim (gpointer data);
+static gpointer stalk_pretend_workload_until_done (gpointer data);
+static gpointer stalk_until_done (gpointer data);
 static void invoke_follow_return_code (TestStalkerFixture * fixture);
 static void invoke_unfollow_deep_code (TestStalkerFixture * fixture);
 
@@ -87,6 +92,138 @@ STALKER_TESTCASE (heap_api)
   /*gum_fake_event_sink_dump (fixture->sink);*/
 }
 
+STALKER_TESTCASE (events_are_batched)
+{
+  fixture->sink->mask = (GumEventType) (GUM_EXEC | GUM_CALL | GUM_RET);
+
+  gum_stalker_follow_me (fixture->stalker, GUM_EVENT_SINK (fixture->sink));
+  pretend_workload ();
+  gum_stalker_unfollow_me (fixture->stalker);
+
+  g_assert_cmpuint (fixture->sink->batch_count, >, 1);
+  g_assert_cmpuint (fixture->sink->events->len, >,
+      fixture->sink->batch_count);
+}
+
+STALKER_TESTCASE (events_of_idle_thread_are_flushed)
+{
+  StalkerIdleContext ctx;
+  GThread * thread;
+  guint n_events;
+
+  fixture->sink->mask = GUM_CALL;
+
+  ctx.fixture = fixture;
+  ctx.waiting = FALSE;
+  ctx.done = FALSE;
+  g_mutex_init (&ctx.mutex);
+  g_cond_init (&ctx.cond);
+
+  thread = g_thread_new ("stalker-test-idle", stalk_until_done, &ctx);
+
+  /* the thread blocks long before filling up a batch */
+  g_mutex_lock (&ctx.mutex);
+  while (!ctx.waiting)
+    g_cond_wait (&ctx.cond, &ctx.mutex);
+
+  g_assert_cmpuint (fixture->sink->events->len, ==, 0);
+  gum_stalker_flush (fixture->stalker);
+  n_events = fixture->sink->events->len;
+
+  ctx.done = TRUE;
+  g_cond_broadcast (&ctx.cond);
+  g_mutex_unlock (&ctx.mutex);
+
+  g_thread_join (thread);
+
+  g_assert_cmpuint (n_events, >, 0);
+
+  g_mutex_clear (&ctx.mutex);
+  g_cond_clear (&ctx.cond);
+}
+
+static gpointer
+stalk_until_done (gpointer data)
+{
+  StalkerIdleContext * ctx = (StalkerIdleContext *) data;
+  TestStalkerFixture * fixture = ctx->fixture;
+
+  gum_stalker_follow_me (fixture->stalker, GUM_EVENT_SINK (fixture->sink));
+  g_mutex_lock (&ctx->mutex);
+  ctx->waiting = TRUE;
+  g_cond_broadcast (&ctx->cond);
+  while (!ctx->done)
+    g_cond_wait (&ctx->cond, &ctx->mutex);
+  g_mutex_unlock (&ctx->mutex);
+  gum_stalker_unfollow_me (fixture->stalker);
+
+  return NULL;
+}
+
+STALKER_TESTCASE (shared_cache)
+{
+  GumFakeEventSink * sink;
+  StalkerIdleContext ctx;
+  GThread * thread;
+
+  gum_stalker_set_shared_cache (fixture->stalker, TRUE);
+  g_assert (gum_stalker_get_shared_cache (fixture->stalker));
+
+  fixture->sink->mask = (GumEventType) (GUM_CALL | GUM_RET);
+  sink = GUM_FAKE_EVENT_SINK (gum_fake_event_sink_new ());
+  sink->mask = fixture->sink->mask;
+
+  ctx.fixture = fixture;
+  ctx.waiting = FALSE;
+  ctx.done = FALSE;
+  g_mutex_init (&ctx.mutex);
+  g_cond_init (&ctx.cond);
+
+  /* both threads are followed at once, running the same translations */
+  thread = g_thread_new ("stalker-test-shared",
+      stalk_pretend_workload_until_done, &ctx);
+
+  gum_stalker_follow_me (fixture->stalker, GUM_EVENT_SINK (sink));
+  pretend_workload ();
+  gum_stalker_unfollow_me (fixture->stalker);
+
+  g_mutex_lock (&ctx.mutex);
+  ctx.done = TRUE;
+  g_cond_signal (&ctx.cond);
+  g_mutex_unlock (&ctx.mutex);
+
+  g_thread_join (thread);
+
+  /*
+   * Each of the 250 iterations calls malloc () and free (), and the call
+   * and return events of every thread must end up in its own sink.
+   */
+  g_assert_cmpuint (fixture->sink->events->len, >=, 2 * 2 * 250);
+  g_assert_cmpuint (sink->events->len, >=, 2 * 2 * 250);
+
+  g_mutex_clear (&ctx.mutex);
+  g_cond_clear (&ctx.cond);
+
+  g_object_unref (sink);
+}
+
+static gpointer
+stalk_pretend_workload_until_done (gpointer data)
+{
+  StalkerIdleContext * ctx = (StalkerIdleContext *) data;
+  TestStalkerFixture * fixture = ctx->fixture;
+
+  gum_stalker_follow_me (fixture->stalker, GUM_EVENT_SINK (fixture->sink));
+  pretend_workload ();
+  g_mutex_lock (&ctx->mutex);
+  while (!ctx->done)
+    g_cond_wait (&ctx->cond, &ctx->mutex);
+  g_mutex_unlock (&ctx->mutex);
+  gum_stalker_unfollow_me (fixture->stalker);
+
+  return NULL;
+}
+
 STALKER_TESTCASE (follow_syscall)
 {
 #ifdef G_OS_WIN32
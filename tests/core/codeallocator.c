@@ -0,0 +1,301 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "testutil.h"
+
+#include "gumcodeallocator-priv.h"
+
+#define CODEALLOCATOR_TESTCASE(NAME) \
+    void test_code_allocator_ ## NAME (void)
+#define CODEALLOCATOR_TESTENTRY(NAME) \
+    TEST_ENTRY_SIMPLE ("Core/CodeAllocator", test_code_allocator, NAME)
+
+TEST_LIST_BEGIN (code_allocator)
+  CODEALLOCATOR_TESTENTRY (slices_should_not_overlap)
+  CODEALLOCATOR_TESTENTRY (freed_slice_should_be_reused)
+  CODEALLOCATOR_TESTENTRY (near_slice_should_be_near)
+  CODEALLOCATOR_TESTENTRY (alloc_and_free_performance)
+  CODEALLOCATOR_TESTENTRY (deflector_table_add)
+  CODEALLOCATOR_TESTENTRY (deflector_table_remove_leaves_tombstone)
+  CODEALLOCATOR_TESTENTRY (deflector_table_duplicate_return_address)
+  CODEALLOCATOR_TESTENTRY (deflector_table_rebuild)
+TEST_LIST_END ()
+
+/* addresses 32 bytes apart hash to the same slot in a 16-entry table */
+#define DEFLECTOR_COLLIDING_ADDRESS(i) \
+    GSIZE_TO_POINTER (0x10000 + ((i) * 32))
+#define DEFLECTOR_TARGET(i) \
+    GSIZE_TO_POINTER (0x20000 + ((i) * 16))
+
+CODEALLOCATOR_TESTCASE (slices_should_not_overlap)
+{
+  GumCodeAllocator allocator;
+  GumCodeSlice * slices[3];
+  guint i, j;
+
+  gum_code_allocator_init (&allocator, 128);
+
+  for (i = 0; i != G_N_ELEMENTS (slices); i++)
+  {
+    slices[i] = gum_code_allocator_alloc_slice (&allocator);
+    g_assert (slices[i] != NULL);
+    g_assert_cmpuint (slices[i]->size, ==, 128);
+  }
+
+  for (i = 0; i != G_N_ELEMENTS (slices); i++)
+  {
+    for (j = 0; j != G_N_ELEMENTS (slices); j++)
+    {
+      gsize a = GPOINTER_TO_SIZE (slices[i]->data);
+      gsize b = GPOINTER_TO_SIZE (slices[j]->data);
+
+      if (i != j)
+        g_assert (a + slices[i]->size <= b || b + slices[j]->size <= a);
+    }
+  }
+
+  for (i = 0; i != G_N_ELEMENTS (slices); i++)
+    gum_code_allocator_free_slice (&allocator, slices[i]);
+
+  gum_code_allocator_free (&allocator);
+}
+
+CODEALLOCATOR_TESTCASE (freed_slice_should_be_reused)
+{
+  GumCodeAllocator allocator;
+  GumCodeSlice * first, * second, * third;
+  gpointer second_data;
+
+  gum_code_allocator_init (&allocator, 128);
+
+  first = gum_code_allocator_alloc_slice (&allocator);
+  second = gum_code_allocator_alloc_slice (&allocator);
+  second_data = second->data;
+  gum_code_allocator_free_slice (&allocator, second);
+
+  third = gum_code_allocator_alloc_slice (&allocator);
+  if (allocator.slices_per_page > 1)
+    g_assert (third->data == second_data);
+
+  gum_code_allocator_free_slice (&allocator, third);
+  gum_code_allocator_free_slice (&allocator, first);
+
+  gum_code_allocator_free (&allocator);
+}
+
+CODEALLOCATOR_TESTCASE (near_slice_should_be_near)
+{
+  GumCodeAllocator allocator;
+  GumAddressSpec spec;
+  GumCodeSlice * far_slice, * near_slice;
+  gsize distance;
+
+  gum_code_allocator_init (&allocator, 128);
+
+  far_slice = gum_code_allocator_alloc_slice (&allocator);
+
+  spec.near_address =
+      GUM_FUNCPTR_TO_POINTER (test_code_allocator_near_slice_should_be_near);
+  spec.max_distance = G_MAXINT32 - 16384;
+
+  near_slice = gum_code_allocator_try_alloc_slice_near (&allocator, &spec, 0);
+  g_assert (near_slice != NULL);
+  distance = ABS ((gssize) GPOINTER_TO_SIZE (near_slice->data) -
+      (gssize) GPOINTER_TO_SIZE (spec.near_address));
+  g_assert_cmpuint (distance, <=, spec.max_distance);
+
+  gum_code_allocator_free_slice (&allocator, near_slice);
+  gum_code_allocator_free_slice (&allocator, far_slice);
+
+  gum_code_allocator_free (&allocator);
+}
+
+CODEALLOCATOR_TESTCASE (alloc_and_free_performance)
+{
+  const guint count = 100000;
+  GumCodeAllocator allocator;
+  GumCodeSlice ** slices;
+  GTimer * timer;
+  gdouble duration_alloc, duration_free;
+  guint i;
+
+  if (!g_test_slow ())
+  {
+    g_print ("<skipping, run in slow mode> ");
+    return;
+  }
+
+  gum_code_allocator_init (&allocator, 128);
+  slices = g_new (GumCodeSlice *, count);
+
+  timer = g_timer_new ();
+
+  for (i = 0; i != count; i++)
+    slices[i] = gum_code_allocator_alloc_slice (&allocator);
+  duration_alloc = g_timer_elapsed (timer, NULL);
+
+  g_timer_reset (timer);
+  for (i = 0; i != count; i += 2)
+    gum_code_allocator_free_slice (&allocator, slices[i]);
+  for (i = 0; i != count; i += 2)
+    slices[i] = gum_code_allocator_alloc_slice (&allocator);
+  for (i = 0; i != count; i++)
+    gum_code_allocator_free_slice (&allocator, slices[i]);
+  duration_free = g_timer_elapsed (timer, NULL);
+
+  g_timer_destroy (timer);
+
+  g_assert (allocator.pages == NULL);
+
+  g_print ("<alloc=%f churn=%f> ", duration_alloc, duration_free);
+
+  g_free (slices);
+  gum_code_allocator_free (&allocator);
+}
+
+CODEALLOCATOR_TESTCASE (deflector_table_add)
+{
+  GumCodeDeflectorTable * table;
+  GumCodeDeflectorTableEntry * entry;
+  guint i;
+
+  table = _gum_code_deflector_table_new (
+      GUM_CODE_DEFLECTOR_TABLE_MIN_CAPACITY);
+
+  for (i = 0; i != 4; i++)
+  {
+    _gum_code_deflector_table_insert (table, DEFLECTOR_COLLIDING_ADDRESS (i),
+        DEFLECTOR_TARGET (i));
+  }
+  g_assert_cmpuint (table->used, ==, 4);
+
+  for (i = 0; i != 4; i++)
+  {
+    entry = _gum_code_deflector_table_find (table,
+        DEFLECTOR_COLLIDING_ADDRESS (i));
+    g_assert (entry != NULL);
+    g_assert (entry->target == DEFLECTOR_TARGET (i));
+  }
+  g_assert (_gum_code_deflector_table_find (table,
+      DEFLECTOR_COLLIDING_ADDRESS (4)) == NULL);
+
+  _gum_code_deflector_table_free (table);
+}
+
+CODEALLOCATOR_TESTCASE (deflector_table_remove_leaves_tombstone)
+{
+  GumCodeDeflectorTable * table;
+  GumCodeDeflectorTableEntry * entry, * removed;
+  guint i;
+
+  table = _gum_code_deflector_table_new (
+      GUM_CODE_DEFLECTOR_TABLE_MIN_CAPACITY);
+
+  for (i = 0; i != 3; i++)
+  {
+    _gum_code_deflector_table_insert (table, DEFLECTOR_COLLIDING_ADDRESS (i),
+        DEFLECTOR_TARGET (i));
+  }
+
+  removed = _gum_code_deflector_table_find (table,
+      DEFLECTOR_COLLIDING_ADDRESS (1));
+  _gum_code_deflector_table_remove (removed);
+  g_assert (removed->return_address == GUM_CODE_DEFLECTOR_TOMBSTONE);
+  g_assert_cmpuint (table->used, ==, 3);
+
+  g_assert (_gum_code_deflector_table_find (table,
+      DEFLECTOR_COLLIDING_ADDRESS (1)) == NULL);
+  entry = _gum_code_deflector_table_find (table,
+      DEFLECTOR_COLLIDING_ADDRESS (2));
+  g_assert (entry != NULL);
+  g_assert (entry->target == DEFLECTOR_TARGET (2));
+
+  _gum_code_deflector_table_insert (table, DEFLECTOR_COLLIDING_ADDRESS (1),
+      DEFLECTOR_TARGET (1));
+  entry = _gum_code_deflector_table_find (table,
+      DEFLECTOR_COLLIDING_ADDRESS (1));
+  g_assert (entry != NULL);
+  g_assert (entry != removed);
+  g_assert_cmpuint (table->used, ==, 4);
+
+  _gum_code_deflector_table_free (table);
+}
+
+CODEALLOCATOR_TESTCASE (deflector_table_duplicate_return_address)
+{
+  GumCodeDeflector first, second;
+  GumList * callers = NULL;
+  GumCodeDeflectorTable * table;
+  GumCodeDeflectorTableEntry * entry;
+
+  first.return_address = DEFLECTOR_COLLIDING_ADDRESS (0);
+  first.target = DEFLECTOR_TARGET (0);
+  second.return_address = DEFLECTOR_COLLIDING_ADDRESS (0);
+  second.target = DEFLECTOR_TARGET (1);
+
+  callers = gum_list_prepend (callers, &first);
+  callers = gum_list_prepend (callers, &second);
+
+  table = _gum_code_deflector_table_new_for (callers, 2);
+  g_assert_cmpuint (table->used, ==, 1);
+  entry = _gum_code_deflector_table_find (table,
+      DEFLECTOR_COLLIDING_ADDRESS (0));
+  g_assert (entry != NULL);
+  g_assert (entry->target == second.target);
+
+  _gum_code_deflector_table_free (table);
+  gum_list_free (callers);
+}
+
+CODEALLOCATOR_TESTCASE (deflector_table_rebuild)
+{
+  const guint count = 40;
+  GumCodeDeflector * deflectors;
+  GumList * callers = NULL;
+  GumCodeDeflectorTable * table;
+  GumCodeDeflectorTableEntry * entry;
+  guint i;
+
+  deflectors = g_new (GumCodeDeflector, count);
+  for (i = 0; i != count; i++)
+  {
+    deflectors[i].return_address = DEFLECTOR_COLLIDING_ADDRESS (i);
+    deflectors[i].target = DEFLECTOR_TARGET (i);
+    callers = gum_list_prepend (callers, &deflectors[i]);
+  }
+
+  table = _gum_code_deflector_table_new_for (callers, count);
+  g_assert_cmpuint (table->capacity, >=, count * 2);
+  g_assert_cmpuint (table->used, ==, count);
+  g_assert (!_gum_code_deflector_table_is_full (table));
+
+  for (i = 0; i != count; i++)
+  {
+    entry = _gum_code_deflector_table_find (table,
+        DEFLECTOR_COLLIDING_ADDRESS (i));
+    g_assert (entry != NULL);
+    g_assert (entry->target == DEFLECTOR_TARGET (i));
+  }
+
+  _gum_code_deflector_table_remove (_gum_code_deflector_table_find (table,
+      DEFLECTOR_COLLIDING_ADDRESS (0)));
+  callers = gum_list_remove (callers, &deflectors[0]);
+  _gum_code_deflector_table_free (table);
+
+  table = _gum_code_deflector_table_new_for (callers, count - 1);
+  g_assert_cmpuint (table->used, ==, count - 1);
+  for (i = 0; i != table->capacity; i++)
+  {
+    g_assert (table->entries[i].return_address !=
+        GUM_CODE_DEFLECTOR_TOMBSTONE);
+  }
+  g_assert (_gum_code_deflector_table_find (table,
+      DEFLECTOR_COLLIDING_ADDRESS (0)) == NULL);
+
+  _gum_code_deflector_table_free (table);
+  gum_list_free (callers);
+  g_free (deflectors);
+}
@@ -13,6 +13,7 @@ typedef struct {
   TestCallbackListenerFunc on_enter;
   TestCallbackListenerFunc on_leave;
   gpointer user_data;
+  GumInvocationRequirements requirements;
 } TestCallbackListener;
 
 typedef struct {
@@ -54,6 +55,12 @@ test_callback_listener_on_leave (GumInvocationListener * listener,
     self->on_leave (self->user_data, context);
 }
 
+static GumInvocationRequirements
+test_callback_listener_get_requirements (GumInvocationListener * listener)
+{
+  return TEST_CALLBACK_LISTENER (listener)->requirements;
+}
+
 static void
 test_callback_listener_iface_init (gpointer g_iface,
                                    gpointer iface_data)
@@ -64,6 +71,7 @@ test_callback_listener_iface_init (gpointer g_iface,
 
   iface->on_enter = test_callback_listener_on_enter;
   iface->on_leave = test_callback_listener_on_leave;
+  iface->get_requirements = test_callback_listener_get_requirements;
 }
 
 static void
@@ -75,7 +83,7 @@ test_callback_listener_class_init (TestCallbackListenerClass * klass)
 static void
 test_callback_listener_init (TestCallbackListener * self)
 {
-  (void) self;
+  self->requirements = GUM_INVOCATION_REQUIRES_ALL;
 }
 
 static TestCallbackListener *
@@ -305,6 +305,7 @@ listener_context_init (ListenerContext * self)
   (void) self;
 }
 
+static gpointer hit_nop_function_repeatedly (gpointer data);
 #ifdef G_OS_WIN32
 static gpointer hit_target_function_repeatedly (gpointer data);
 #endif
@@ -313,3 +314,5 @@ static gpointer replacement_malloc_calling_malloc_and_replaced_free (
     gsize size);
 static void replacement_free_doing_nothing (gpointer mem);
 static gpointer replacement_target_function (GString * str);
+static gsize replacement_function_with_many_arguments (gsize a, gsize b,
+    gsize c, gsize d, gsize e, gsize f, gdouble g);
@@ -7,6 +7,8 @@
 
 #include "interceptor-fixture.c"
 
+#include "guminterceptor-priv.h"
+
 TEST_LIST_BEGIN (interceptor)
 #ifdef HAVE_I386
   INTERCEPTOR_TESTENTRY (cpu_register_clobber)
@@ -45,6 +47,7 @@ TEST_LIST_BEGIN (interceptor)
 #endif
   INTERCEPTOR_TESTENTRY (function_arguments)
   INTERCEPTOR_TESTENTRY (function_return_value)
+  INTERCEPTOR_TESTENTRY (function_with_minimal_requirements)
 #ifdef HAVE_I386
   INTERCEPTOR_TESTENTRY (function_cpu_context_on_enter)
 #endif
@@ -54,6 +57,14 @@ TEST_LIST_BEGIN (interceptor)
   INTERCEPTOR_TESTENTRY (detach)
   INTERCEPTOR_TESTENTRY (listener_ref_count)
   INTERCEPTOR_TESTENTRY (function_data)
+  INTERCEPTOR_TESTENTRY (attach_in_transaction)
+  INTERCEPTOR_TESTENTRY (detach_and_reattach_in_transaction)
+  INTERCEPTOR_TESTENTRY (listeners_can_be_swapped_under_load)
+#if defined (HAVE_I386) && GLIB_SIZEOF_VOID_P == 8
+  INTERCEPTOR_TESTENTRY (probe_counts_calls)
+  INTERCEPTOR_TESTENTRY (probe_can_be_detached_under_load)
+  INTERCEPTOR_TESTENTRY (probe_conflicts_in_transaction)
+#endif
 
 #if !(defined (HAVE_ANDROID) && defined (HAVE_ARM64))
   INTERCEPTOR_TESTENTRY (i_can_has_replaceability)
@@ -61,6 +72,7 @@ TEST_LIST_BEGIN (interceptor)
   INTERCEPTOR_TESTENTRY (replace_function)
   INTERCEPTOR_TESTENTRY (two_replaced_functions)
   INTERCEPTOR_TESTENTRY (replace_function_then_attach_to_it)
+  INTERCEPTOR_TESTENTRY (replace_function_with_minimal_listener)
 #endif
 TEST_LIST_END ()
 
@@ -686,6 +698,246 @@ INTERCEPTOR_TESTCASE (function_data)
   g_object_unref (fd_listener);
 }
 
+static void
+store_first_argument (gpointer user_data,
+                      GumInvocationContext * context)
+{
+  gpointer * values = (gpointer *) user_data;
+
+  values[0] = gum_invocation_context_get_nth_argument (context, 0);
+}
+
+static void
+store_and_replace_return_value (gpointer user_data,
+                                GumInvocationContext * context)
+{
+  gpointer * values = (gpointer *) user_data;
+
+  values[1] = gum_invocation_context_get_return_value (context);
+  gum_invocation_context_replace_return_value (context,
+      GSIZE_TO_POINTER (0xc0ffee));
+}
+
+INTERCEPTOR_TESTCASE (function_with_minimal_requirements)
+{
+  TestCallbackListener * listener;
+  gpointer values[2] = { NULL, NULL };
+  gpointer ret;
+
+  listener = test_callback_listener_new ();
+  listener->on_enter = store_first_argument;
+  listener->on_leave = store_and_replace_return_value;
+  listener->user_data = values;
+  listener->requirements =
+      GUM_INVOCATION_REQUIRES_ARGUMENTS | GUM_INVOCATION_REQUIRES_RETURN_VALUE;
+
+  g_assert_cmpint (gum_interceptor_attach_listener (fixture->interceptor,
+      target_nop_function_a, GUM_INVOCATION_LISTENER (listener), NULL),
+      ==, GUM_ATTACH_OK);
+
+  ret = target_nop_function_a (GSIZE_TO_POINTER (0x12349876));
+  g_assert_cmphex (GPOINTER_TO_SIZE (values[0]), ==, 0x12349876);
+  g_assert_cmphex (GPOINTER_TO_SIZE (values[1]), ==, 0x1337);
+  g_assert_cmphex (GPOINTER_TO_SIZE (ret), ==, 0xc0ffee);
+#if defined (HAVE_I386) && GLIB_SIZEOF_VOID_P == 8
+  if (gum_query_is_rwx_supported ())
+  {
+    g_assert (_gum_interceptor_is_using_minimal_thunks (fixture->interceptor,
+        target_nop_function_a));
+  }
+#endif
+
+  interceptor_fixture_attach_listener (fixture, 0, target_nop_function_a,
+      'a', 'b');
+  g_assert (!_gum_interceptor_is_using_minimal_thunks (fixture->interceptor,
+      target_nop_function_a));
+
+  ret = target_nop_function_a (GSIZE_TO_POINTER (0x4321));
+  g_assert_cmphex (GPOINTER_TO_SIZE (values[0]), ==, 0x4321);
+  g_assert_cmphex (fixture->listener_context[0]->last_seen_argument,
+      ==, 0x4321);
+  g_assert_cmphex (GPOINTER_TO_SIZE (ret), ==, 0xc0ffee);
+  g_assert_cmpstr (fixture->result->str, ==, "ab");
+
+  interceptor_fixture_detach_listener (fixture, 0);
+#if defined (HAVE_I386) && GLIB_SIZEOF_VOID_P == 8
+  if (gum_query_is_rwx_supported ())
+  {
+    g_assert (_gum_interceptor_is_using_minimal_thunks (fixture->interceptor,
+        target_nop_function_a));
+  }
+#endif
+
+  gum_interceptor_detach_listener (fixture->interceptor,
+      GUM_INVOCATION_LISTENER (listener));
+  g_object_unref (listener);
+}
+
+INTERCEPTOR_TESTCASE (attach_in_transaction)
+{
+  gum_interceptor_begin_transaction (fixture->interceptor);
+  interceptor_fixture_attach_listener (fixture, 0, target_function, 'a', 'b');
+  interceptor_fixture_attach_listener (fixture, 1, target_nop_function_a,
+      'c', 'd');
+
+  target_function (fixture->result);
+  target_nop_function_a (NULL);
+  g_assert_cmpstr (fixture->result->str, ==, "|");
+
+  gum_interceptor_end_transaction (fixture->interceptor);
+  g_string_truncate (fixture->result, 0);
+
+  target_function (fixture->result);
+  target_nop_function_a (NULL);
+  g_assert_cmpstr (fixture->result->str, ==, "a|bcd");
+}
+
+INTERCEPTOR_TESTCASE (detach_and_reattach_in_transaction)
+{
+  interceptor_fixture_attach_listener (fixture, 0, target_function, 'a', 'b');
+
+  gum_interceptor_begin_transaction (fixture->interceptor);
+  interceptor_fixture_detach_listener (fixture, 0);
+  interceptor_fixture_attach_listener (fixture, 1, target_function, 'c', 'd');
+  gum_interceptor_end_transaction (fixture->interceptor);
+
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, "c|d");
+
+  gum_interceptor_begin_transaction (fixture->interceptor);
+  interceptor_fixture_detach_listener (fixture, 1);
+  gum_interceptor_end_transaction (fixture->interceptor);
+  g_string_truncate (fixture->result, 0);
+
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, "|");
+}
+
+INTERCEPTOR_TESTCASE (listeners_can_be_swapped_under_load)
+{
+  TestCallbackListener * base_listener;
+  GThread * th;
+  volatile gboolean done = FALSE;
+  guint i;
+
+  base_listener = test_callback_listener_new ();
+  g_assert_cmpint (gum_interceptor_attach_listener (fixture->interceptor,
+      target_nop_function_a, GUM_INVOCATION_LISTENER (base_listener), NULL),
+      ==, GUM_ATTACH_OK);
+
+  th = g_thread_new ("interceptor-test-swap", hit_nop_function_repeatedly,
+      (gpointer) &done);
+
+  for (i = 0; i != 1000; i++)
+  {
+    TestCallbackListener * listener;
+
+    listener = test_callback_listener_new ();
+    g_assert_cmpint (gum_interceptor_attach_listener (fixture->interceptor,
+        target_nop_function_a, GUM_INVOCATION_LISTENER (listener), NULL),
+        ==, GUM_ATTACH_OK);
+    gum_interceptor_detach_listener (fixture->interceptor,
+        GUM_INVOCATION_LISTENER (listener));
+    g_object_unref (listener);
+  }
+
+  done = TRUE;
+  g_thread_join (th);
+
+  gum_interceptor_detach_listener (fixture->interceptor,
+      GUM_INVOCATION_LISTENER (base_listener));
+  g_object_unref (base_listener);
+}
+
+#if defined (HAVE_I386) && GLIB_SIZEOF_VOID_P == 8
+
+INTERCEPTOR_TESTCASE (probe_counts_calls)
+{
+  GumProbeCounter * counter;
+  guint i;
+
+  counter = gum_probe_counter_new ();
+
+  g_assert_cmpint (gum_interceptor_attach_probe (fixture->interceptor,
+      target_nop_function_a, counter), ==, GUM_ATTACH_OK);
+  g_assert_cmpint (gum_interceptor_attach_probe (fixture->interceptor,
+      target_nop_function_b, counter), ==, GUM_ATTACH_OK);
+  g_assert_cmpint (gum_interceptor_attach_probe (fixture->interceptor,
+      target_nop_function_a, counter), ==, GUM_ATTACH_ALREADY_ATTACHED);
+  g_assert_cmpint (interceptor_fixture_try_attaching_listener (fixture, 0,
+      target_nop_function_a, 'a', 'b'), ==, GUM_ATTACH_ALREADY_ATTACHED);
+
+  for (i = 0; i != 10; i++)
+  {
+    g_assert_cmphex (GPOINTER_TO_SIZE (target_nop_function_a (NULL)),
+        ==, 0x1337);
+  }
+  for (i = 0; i != 5; i++)
+  {
+    g_assert_cmphex (GPOINTER_TO_SIZE (target_nop_function_b (NULL)),
+        ==, 2);
+  }
+  g_assert_cmpuint (gum_probe_counter_get_total (counter), ==, 15);
+
+  gum_interceptor_detach_probe (fixture->interceptor, target_nop_function_a);
+  gum_interceptor_detach_probe (fixture->interceptor, target_nop_function_b);
+
+  target_nop_function_a (NULL);
+  target_nop_function_b (NULL);
+  g_assert_cmpuint (gum_probe_counter_get_total (counter), ==, 15);
+  g_assert_cmpstr (fixture->result->str, ==, "");
+
+  gum_probe_counter_free (counter);
+}
+
+INTERCEPTOR_TESTCASE (probe_can_be_detached_under_load)
+{
+  volatile gboolean done = FALSE;
+  GThread * th;
+  guint i;
+
+  th = g_thread_new ("interceptor-test-probe", hit_nop_function_repeatedly,
+      (gpointer) &done);
+
+  for (i = 0; i != 1000; i++)
+  {
+    GumProbeCounter * counter;
+
+    counter = gum_probe_counter_new ();
+    g_assert_cmpint (gum_interceptor_attach_probe (fixture->interceptor,
+        target_nop_function_a, counter), ==, GUM_ATTACH_OK);
+    gum_interceptor_detach_probe (fixture->interceptor, target_nop_function_a);
+    gum_probe_counter_free (counter);
+  }
+
+  done = TRUE;
+  g_thread_join (th);
+}
+
+INTERCEPTOR_TESTCASE (probe_conflicts_in_transaction)
+{
+  GumProbeCounter * counter;
+
+  counter = gum_probe_counter_new ();
+
+  interceptor_fixture_attach_listener (fixture, 0, target_nop_function_a,
+      'a', 'b');
+
+  gum_interceptor_begin_transaction (fixture->interceptor);
+  interceptor_fixture_detach_listener (fixture, 0);
+  g_assert_cmpint (gum_interceptor_attach_probe (fixture->interceptor,
+      target_nop_function_a, counter), ==, GUM_ATTACH_ALREADY_ATTACHED);
+  gum_interceptor_end_transaction (fixture->interceptor);
+
+  g_assert_cmpint (gum_interceptor_attach_probe (fixture->interceptor,
+      target_nop_function_a, counter), ==, GUM_ATTACH_OK);
+  gum_interceptor_detach_probe (fixture->interceptor, target_nop_function_a);
+
+  gum_probe_counter_free (counter);
+}
+
+#endif
+
 #ifdef HAVE_I386
 
 INTERCEPTOR_TESTCASE (cpu_register_clobber)
@@ -912,6 +1164,20 @@ INTERCEPTOR_TESTCASE (already_replaced)
         target_function, malloc, NULL), ==, GUM_REPLACE_ALREADY_REPLACED);
 }
 
+static gpointer
+hit_nop_function_repeatedly (gpointer data)
+{
+  volatile gboolean * done = (gboolean *) data;
+
+  do
+  {
+    target_nop_function_a (NULL);
+  }
+  while (!*done);
+
+  return NULL;
+}
+
 #ifdef G_OS_WIN32
 
 static gpointer
@@ -935,6 +1201,84 @@ hit_target_function_repeatedly (gpointer data)
 
 #endif
 
+typedef gsize (* ManyArgumentsFunc) (gsize a, gsize b, gsize c, gsize d,
+    gsize e, gsize f, gdouble g);
+
+/*
+ * With the SysV ABI the last three arguments travel in r8, r9 and xmm0, and
+ * with the Microsoft one c and d are in r8 and r9, so the outcome depends on
+ * the thunks preserving caller-saved registers across the C code they call.
+ */
+gsize GUM_NOINLINE
+target_function_with_many_arguments (gsize a,
+                                     gsize b,
+                                     gsize c,
+                                     gsize d,
+                                     gsize e,
+                                     gsize f,
+                                     gdouble g)
+{
+  return a + (b << 4) + (c << 8) + (d << 12) + (e << 16) + (f << 20) +
+      ((gsize) g << 24);
+}
+
+INTERCEPTOR_TESTCASE (replace_function_with_minimal_listener)
+{
+  volatile ManyArgumentsFunc func = target_function_with_many_arguments;
+  TestCallbackListener * listener;
+  guint counter = 0;
+
+  listener = test_callback_listener_new ();
+  listener->requirements = GUM_INVOCATION_REQUIRES_NOTHING;
+  g_assert_cmpint (gum_interceptor_attach_listener (fixture->interceptor,
+      target_function_with_many_arguments,
+      GUM_INVOCATION_LISTENER (listener), NULL), ==, GUM_ATTACH_OK);
+
+  g_assert_cmphex (func (1, 2, 3, 4, 5, 6, 7.0), ==, 0x7654321);
+
+  g_assert_cmpint (gum_interceptor_replace_function (fixture->interceptor,
+      target_function_with_many_arguments,
+      replacement_function_with_many_arguments, &counter),
+      ==, GUM_REPLACE_OK);
+  g_assert_cmphex (func (1, 2, 3, 4, 5, 6, 7.0), ==, 0x7654321);
+  g_assert_cmpuint (counter, ==, 1);
+
+  gum_interceptor_revert_function (fixture->interceptor,
+      target_function_with_many_arguments);
+  g_assert_cmphex (func (1, 2, 3, 4, 5, 6, 7.0), ==, 0x7654321);
+  g_assert_cmpuint (counter, ==, 1);
+
+  gum_interceptor_detach_listener (fixture->interceptor,
+      GUM_INVOCATION_LISTENER (listener));
+  g_object_unref (listener);
+}
+
+static gsize
+replacement_function_with_many_arguments (gsize a,
+                                          gsize b,
+                                          gsize c,
+                                          gsize d,
+                                          gsize e,
+                                          gsize f,
+                                          gdouble g)
+{
+  GumInvocationContext * ctx;
+  guint * counter;
+
+  ctx = gum_interceptor_get_current_invocation ();
+  g_assert (ctx != NULL);
+
+  counter = (guint *)
+      gum_invocation_context_get_replacement_function_data (ctx);
+  (*counter)++;
+
+  g_assert_cmpuint (e, ==, 5);
+  g_assert_cmpuint (f, ==, 6);
+  g_assert (g == 7.0);
+
+  return target_function_with_many_arguments (a, b, c, d, e, f, g);
+}
+
 typedef gpointer (* MallocFunc) (gsize size);
 
 static gpointer
@@ -8,6 +8,14 @@
 
 #include "gummemory-priv.h"
 
+#include <string.h>
+
+#ifdef HAVE_LINUX
+# include "gumlinux.h"
+
+# include <sys/mman.h>
+#endif
+
 #define MEMORY_TESTCASE(NAME) \
     void test_memory_ ## NAME (void)
 #define MEMORY_TESTENTRY(NAME) \
@@ -24,10 +32,20 @@ TEST_LIST_BEGIN (memory)
   MEMORY_TESTENTRY (match_pattern_from_string_does_proper_validation)
   MEMORY_TESTENTRY (scan_range_finds_three_exact_matches)
   MEMORY_TESTENTRY (scan_range_finds_three_wildcarded_matches)
+  MEMORY_TESTENTRY (scan_range_finds_matches_across_vector_boundaries)
+  MEMORY_TESTENTRY (scan_ranges_reports_matches_in_address_order)
+  MEMORY_TESTENTRY (scan_performance)
+  MEMORY_TESTENTRY (scan_many_reports_pattern_ids_and_addresses)
+  MEMORY_TESTENTRY (scan_many_agrees_with_individual_scans)
   MEMORY_TESTENTRY (is_memory_readable_handles_mixed_page_protections)
+#ifdef HAVE_LINUX
+  MEMORY_TESTENTRY (is_memory_readable_tracks_protection_changes)
+#endif
   MEMORY_TESTENTRY (alloc_n_pages_returns_aligned_rw_address)
   MEMORY_TESTENTRY (alloc_n_pages_near_returns_aligned_rw_address_within_range)
   MEMORY_TESTENTRY (mprotect_handles_page_boundaries)
+  MEMORY_TESTENTRY (private_heap_recycles_small_blocks)
+  MEMORY_TESTENTRY (private_heap_handles_frees_from_other_threads)
 TEST_LIST_END ()
 
 typedef struct _TestForEachContext {
@@ -38,8 +56,15 @@ typedef struct _TestForEachContext {
   guint expected_size;
 } TestForEachContext;
 
+static gpointer allocate_small_blocks (gpointer data);
 static gboolean match_found_cb (GumAddress address, gsize size,
     gpointer user_data);
+static gboolean store_match_cb (GumAddress address, gsize size,
+    gpointer user_data);
+static gboolean count_first_match_cb (GumAddress address, gsize size,
+    gpointer user_data);
+static gboolean store_many_match_cb (guint pattern_id, GumAddress address,
+    gsize size, gpointer user_data);
 
 MEMORY_TESTCASE (read_from_valid_address_should_succeed)
 {
@@ -304,6 +329,281 @@ MEMORY_TESTCASE (scan_range_finds_three_wildcarded_matches)
   gum_match_pattern_free (pattern);
 }
 
+MEMORY_TESTCASE (scan_range_finds_matches_across_vector_boundaries)
+{
+  guint8 buf[100] = { 0, };
+  const guint offsets[] = { 0, 14, 31, 62, 96 };
+  GumMemoryRange range;
+  GumMatchPattern * pattern;
+  GArray * matches;
+  guint i;
+
+  for (i = 0; i != G_N_ELEMENTS (offsets); i++)
+  {
+    buf[offsets[i] + 0] = 0x13;
+    buf[offsets[i] + 1] = 0x37;
+    buf[offsets[i] + 3] = 0x42;
+  }
+
+  range.base_address = GUM_ADDRESS (buf);
+  range.size = sizeof (buf);
+
+  pattern = gum_match_pattern_new_from_string ("13 37 ?? 42");
+  g_assert (pattern != NULL);
+
+  matches = g_array_new (FALSE, FALSE, sizeof (GumAddress));
+  gum_memory_scan (&range, pattern, store_match_cb, matches);
+
+  g_assert_cmpuint (matches->len, ==, G_N_ELEMENTS (offsets));
+  for (i = 0; i != G_N_ELEMENTS (offsets); i++)
+  {
+    g_assert_cmphex (g_array_index (matches, GumAddress, i), ==,
+        GUM_ADDRESS (buf + offsets[i]));
+  }
+
+  g_array_free (matches, TRUE);
+  gum_match_pattern_free (pattern);
+}
+
+MEMORY_TESTCASE (scan_ranges_reports_matches_in_address_order)
+{
+  const gsize big_size = 40 * 1024 * 1024;
+  const guint8 overlapping[] = { 0xaa, 0xbb, 0xaa, 0xbb, 0xaa };
+  guint8 * big;
+  guint8 small[32] = { 0, };
+  GumMemoryRange ranges[2];
+  GumMatchPattern * pattern;
+  GArray * expected, * actual;
+  guint i, count;
+
+  big = g_malloc0 (big_size);
+  memcpy (big, overlapping, sizeof (overlapping));
+  memcpy (big + (16 * 1024 * 1024) - 2, overlapping, sizeof (overlapping));
+  memcpy (big + big_size - sizeof (overlapping), overlapping,
+      sizeof (overlapping));
+  memcpy (small + 7, overlapping, sizeof (overlapping));
+
+  ranges[0].base_address = GUM_ADDRESS (big);
+  ranges[0].size = big_size;
+  ranges[1].base_address = GUM_ADDRESS (small);
+  ranges[1].size = sizeof (small);
+
+  pattern = gum_match_pattern_new_from_string ("aa bb aa");
+  g_assert (pattern != NULL);
+
+  expected = g_array_new (FALSE, FALSE, sizeof (GumAddress));
+  for (i = 0; i != G_N_ELEMENTS (ranges); i++)
+    gum_memory_scan (&ranges[i], pattern, store_match_cb, expected);
+  g_assert_cmpuint (expected->len, ==, 4);
+
+  actual = g_array_new (FALSE, FALSE, sizeof (GumAddress));
+  gum_memory_scan_ranges (ranges, G_N_ELEMENTS (ranges), pattern,
+      store_match_cb, actual);
+
+  g_assert_cmpuint (actual->len, ==, expected->len);
+  for (i = 0; i != expected->len; i++)
+  {
+    g_assert_cmphex (g_array_index (actual, GumAddress, i), ==,
+        g_array_index (expected, GumAddress, i));
+  }
+
+  count = 0;
+  gum_memory_scan_ranges (ranges, G_N_ELEMENTS (ranges), pattern,
+      count_first_match_cb, &count);
+  g_assert_cmpuint (count, ==, 1);
+
+  g_array_free (actual, TRUE);
+  g_array_free (expected, TRUE);
+  gum_match_pattern_free (pattern);
+  g_free (big);
+}
+
+MEMORY_TESTCASE (scan_many_reports_pattern_ids_and_addresses)
+{
+  guint8 buf[] = {
+    0x13, 0x37, 0x12, 0x34,
+    0xaa, 0x13, 0x37, 0x12,
+    0x34, 0x56, 0x00, 0x13,
+    0xff, 0x37, 0x12, 0x34
+  };
+  const gchar * patterns[] = {
+    "13 37 12 34",
+    "37 12 34",
+    "13 ?? 37 12",
+    "12 34 56"
+  };
+  const guint expected_offsets[][3] = {
+    { 0, 5, G_MAXUINT },
+    { 1, 6, 13 },
+    { 11, G_MAXUINT, G_MAXUINT },
+    { 7, G_MAXUINT, G_MAXUINT }
+  };
+  GumMemoryRange range;
+  GumMatchPatternSet * set;
+  GArray * matches[G_N_ELEMENTS (patterns)];
+  guint i, j;
+
+  range.base_address = GUM_ADDRESS (buf);
+  range.size = sizeof (buf);
+
+  set = gum_match_pattern_set_new ();
+  for (i = 0; i != G_N_ELEMENTS (patterns); i++)
+  {
+    GumMatchPattern * pattern;
+
+    pattern = gum_match_pattern_new_from_string (patterns[i]);
+    g_assert (pattern != NULL);
+    g_assert_cmpuint (gum_match_pattern_set_add (set, pattern), ==, i);
+
+    matches[i] = g_array_new (FALSE, FALSE, sizeof (GumAddress));
+  }
+  g_assert_cmpuint (gum_match_pattern_set_size (set), ==,
+      G_N_ELEMENTS (patterns));
+
+  gum_memory_scan_many (&range, set, store_many_match_cb, matches);
+
+  for (i = 0; i != G_N_ELEMENTS (patterns); i++)
+  {
+    guint n = 0;
+
+    for (j = 0; j != G_N_ELEMENTS (expected_offsets[i]); j++)
+    {
+      if (expected_offsets[i][j] == G_MAXUINT)
+        break;
+      g_assert_cmpuint (matches[i]->len, >, j);
+      g_assert_cmphex (g_array_index (matches[i], GumAddress, j), ==,
+          GUM_ADDRESS (buf + expected_offsets[i][j]));
+      n++;
+    }
+    g_assert_cmpuint (matches[i]->len, ==, n);
+
+    g_array_free (matches[i], TRUE);
+  }
+
+  gum_match_pattern_set_free (set);
+}
+
+MEMORY_TESTCASE (scan_many_agrees_with_individual_scans)
+{
+  const gchar * patterns[] = {
+    "01 02",
+    "02 ?? 01",
+    "01 01 01",
+    "03 ?? ?? 03",
+    "02 03 01 02",
+    "00 01 02 03 00"
+  };
+  const gsize size = 64 * 1024;
+  guint8 * buf;
+  GRand * rand;
+  GumMemoryRange range;
+  GumMatchPatternSet * set;
+  GArray * matches[G_N_ELEMENTS (patterns)];
+  guint i, j;
+
+  buf = g_malloc (size);
+  rand = g_rand_new_with_seed (1337);
+  for (i = 0; i != size; i++)
+    buf[i] = g_rand_int_range (rand, 0, 4);
+  g_rand_free (rand);
+
+  range.base_address = GUM_ADDRESS (buf);
+  range.size = size;
+
+  set = gum_match_pattern_set_new ();
+  for (i = 0; i != G_N_ELEMENTS (patterns); i++)
+  {
+    gum_match_pattern_set_add (set,
+        gum_match_pattern_new_from_string (patterns[i]));
+    matches[i] = g_array_new (FALSE, FALSE, sizeof (GumAddress));
+  }
+
+  gum_memory_scan_many (&range, set, store_many_match_cb, matches);
+
+  for (i = 0; i != G_N_ELEMENTS (patterns); i++)
+  {
+    GumMatchPattern * pattern;
+    GArray * expected;
+
+    pattern = gum_match_pattern_new_from_string (patterns[i]);
+    expected = g_array_new (FALSE, FALSE, sizeof (GumAddress));
+    gum_memory_scan (&range, pattern, store_match_cb, expected);
+
+    g_assert_cmpuint (expected->len, >, 0);
+    g_assert_cmpuint (matches[i]->len, ==, expected->len);
+    for (j = 0; j != expected->len; j++)
+    {
+      g_assert_cmphex (g_array_index (matches[i], GumAddress, j), ==,
+          g_array_index (expected, GumAddress, j));
+    }
+
+    g_array_free (expected, TRUE);
+    gum_match_pattern_free (pattern);
+    g_array_free (matches[i], TRUE);
+  }
+
+  gum_match_pattern_set_free (set);
+  g_free (buf);
+}
+
+MEMORY_TESTCASE (scan_performance)
+{
+  const gsize size = 1024 * 1024 * 1024;
+  guint8 * buf;
+  guint32 seed;
+  gsize i;
+  GumMemoryRange range;
+  GumMatchPattern * pattern;
+  GTimer * timer;
+  guint count_serial, count_parallel;
+  gdouble duration_serial, duration_parallel;
+
+  if (!g_test_slow ())
+  {
+    g_print ("<skipping, run in slow mode> ");
+    return;
+  }
+
+  buf = g_malloc (size);
+  seed = 1337;
+  for (i = 0; i != size; i += 4)
+  {
+    seed = (seed * 1103515245) + 12345;
+    *((guint32 *) (buf + i)) = seed;
+  }
+  memcpy (buf + size - 8, "\x55\x48\x89\xe5\x41\x57\x41\x56", 8);
+
+  range.base_address = GUM_ADDRESS (buf);
+  range.size = size;
+
+  pattern = gum_match_pattern_new_from_string ("55 48 89 e5 41 ?? 41 56");
+  g_assert (pattern != NULL);
+
+  timer = g_timer_new ();
+
+  count_serial = 0;
+  g_timer_reset (timer);
+  gum_memory_scan (&range, pattern, count_first_match_cb, &count_serial);
+  duration_serial = g_timer_elapsed (timer, NULL);
+
+  count_parallel = 0;
+  g_timer_reset (timer);
+  gum_memory_scan_ranges (&range, 1, pattern, count_first_match_cb,
+      &count_parallel);
+  duration_parallel = g_timer_elapsed (timer, NULL);
+
+  g_timer_destroy (timer);
+
+  g_assert_cmpuint (count_serial, >=, 1);
+  g_assert_cmpuint (count_parallel, ==, count_serial);
+
+  g_print ("<serial=%f parallel=%f MB/s=%f> ", duration_serial,
+      duration_parallel, (size / (1024.0 * 1024.0)) / duration_serial);
+
+  gum_match_pattern_free (pattern);
+  g_free (buf);
+}
+
 MEMORY_TESTCASE (is_memory_readable_handles_mixed_page_protections)
 {
   guint8 * pages;
@@ -339,6 +639,39 @@ MEMORY_TESTCASE (is_memory_readable_handles_mixed_page_protections)
   gum_free_pages (pages);
 }
 
+#ifdef HAVE_LINUX
+
+MEMORY_TESTCASE (is_memory_readable_tracks_protection_changes)
+{
+  gpointer pages;
+  guint page_size;
+  GumAddress first_page, second_page;
+
+  pages = gum_alloc_n_pages (2, GUM_PAGE_RW);
+
+  page_size = gum_query_page_size ();
+
+  first_page = GUM_ADDRESS (pages);
+  second_page = first_page + page_size;
+
+  g_assert (gum_memory_is_readable (first_page, 2 * page_size));
+
+  gum_mprotect (GSIZE_TO_POINTER (second_page), page_size, GUM_PAGE_NO_ACCESS);
+  g_assert (gum_memory_is_readable (first_page, page_size));
+  g_assert (!gum_memory_is_readable (second_page, 1));
+
+  mprotect (GSIZE_TO_POINTER (second_page), page_size, PROT_READ);
+  gum_linux_invalidate_maps_cache ();
+  g_assert (gum_memory_is_readable (second_page, 1));
+  g_assert (gum_memory_is_readable (first_page, 2 * page_size));
+
+  gum_free_pages (pages);
+
+  g_assert (!gum_memory_is_readable (first_page, 1));
+}
+
+#endif
+
 MEMORY_TESTCASE (alloc_n_pages_returns_aligned_rw_address)
 {
   gpointer page;
@@ -404,6 +737,67 @@ MEMORY_TESTCASE (mprotect_handles_page_boundaries)
   gum_free_pages (pages);
 }
 
+MEMORY_TESTCASE (private_heap_recycles_small_blocks)
+{
+  guint usage_before;
+  gpointer a, b;
+
+  usage_before = gum_peek_private_memory_usage ();
+
+  a = gum_malloc (40);
+  g_assert_cmpuint (gum_peek_private_memory_usage (), >, usage_before);
+  gum_free (a);
+  g_assert_cmpuint (gum_peek_private_memory_usage (), ==, usage_before);
+
+  b = gum_malloc0 (40);
+  g_assert (b == a);
+  g_assert_cmpuint (((guint8 *) b)[39], ==, 0);
+  gum_free (b);
+}
+
+#define SMALL_BLOCK_COUNT 1000
+
+MEMORY_TESTCASE (private_heap_handles_frees_from_other_threads)
+{
+  guint usage_before, i;
+  GThread * thread;
+  gpointer * blocks;
+
+  usage_before = gum_peek_private_memory_usage ();
+
+  thread = g_thread_new ("memory-test-allocator", allocate_small_blocks,
+      NULL);
+  blocks = g_thread_join (thread);
+
+  g_assert_cmpuint (gum_peek_private_memory_usage (), >, usage_before);
+  for (i = 0; i != SMALL_BLOCK_COUNT; i++)
+  {
+    g_assert_cmpuint (*((guint *) blocks[i]), ==, i);
+    gum_free (blocks[i]);
+  }
+  g_free (blocks);
+
+  g_assert_cmpuint (gum_peek_private_memory_usage (), ==, usage_before);
+}
+
+static gpointer
+allocate_small_blocks (gpointer data)
+{
+  gpointer * blocks;
+  guint i;
+
+  (void) data;
+
+  blocks = g_new (gpointer, SMALL_BLOCK_COUNT);
+  for (i = 0; i != SMALL_BLOCK_COUNT; i++)
+  {
+    blocks[i] = gum_malloc (sizeof (guint) + (i % 256));
+    *((guint *) blocks[i]) = i;
+  }
+
+  return blocks;
+}
+
 static gboolean
 match_found_cb (GumAddress address,
                 gsize size,
@@ -421,3 +815,47 @@ match_found_cb (GumAddress address,
 
   return ctx->value_to_return;
 }
+
+static gboolean
+store_match_cb (GumAddress address,
+                gsize size,
+                gpointer user_data)
+{
+  GArray * matches = (GArray *) user_data;
+
+  (void) size;
+
+  g_array_append_val (matches, address);
+
+  return TRUE;
+}
+
+static gboolean
+count_first_match_cb (GumAddress address,
+                      gsize size,
+                      gpointer user_data)
+{
+  guint * count = (guint *) user_data;
+
+  (void) address;
+  (void) size;
+
+  (*count)++;
+
+  return FALSE;
+}
+
+static gboolean
+store_many_match_cb (guint pattern_id,
+                     GumAddress address,
+                     gsize size,
+                     gpointer user_data)
+{
+  GArray ** matches = (GArray **) user_data;
+
+  (void) size;
+
+  g_array_append_val (matches[pattern_id], address);
+
+  return TRUE;
+}
@@ -4,6 +4,7 @@
  * Licence: wxWindows Library Licence, Version 3.1
  */
 
+#include "gumexceptor.h"
 #include "gummemoryaccessmonitor.h"
 
 #include "testutil.h"
@@ -26,6 +27,8 @@ typedef struct _TestMAMonitorFixture
 
   volatile guint number_of_notifies;
   volatile GumMemoryAccessDetails last_details;
+
+  volatile guint number_of_violations;
 } TestMAMonitorFixture;
 
 static void
@@ -42,6 +45,7 @@ test_memory_access_monitor_fixture_setup (TestMAMonitorFixture * fixture,
       GUM_POINTER_TO_FUNCPTR (GCallback, fixture->range.base_address);
 
   fixture->number_of_notifies = 0;
+  fixture->number_of_violations = 0;
 
   fixture->monitor = NULL;
 }
@@ -67,6 +71,26 @@ memory_access_notify_cb (GumMemoryAccessMonitor * monitor,
   fixture->last_details = *details;
 }
 
+#ifdef HAVE_LINUX
+
+static gboolean
+access_violation_cb (GumExceptionDetails * details,
+                     gpointer user_data)
+{
+  TestMAMonitorFixture * fixture = (TestMAMonitorFixture *) user_data;
+
+  if (details->type != GUM_EXCEPTION_ACCESS_VIOLATION)
+    return FALSE;
+
+  fixture->number_of_violations++;
+  gum_mprotect (GSIZE_TO_POINTER (fixture->range.base_address),
+      fixture->range.size, GUM_PAGE_RW);
+
+  return TRUE;
+}
+
+#endif
+
 #define ENABLE_MONITOR() \
     g_assert (fixture->monitor == NULL); \
     fixture->monitor = gum_memory_access_monitor_new (&fixture->range, 1, \
@@ -12,6 +12,12 @@ TEST_LIST_BEGIN (memoryaccessmonitor)
   MAMONITOR_TESTENTRY (notify_on_execute_access)
   MAMONITOR_TESTENTRY (notify_should_include_progress)
   MAMONITOR_TESTENTRY (disable)
+  MAMONITOR_TESTENTRY (many_ranges)
+#ifdef HAVE_LINUX
+  MAMONITOR_TESTENTRY (notify_on_first_write_only)
+  MAMONITOR_TESTENTRY (notify_on_every_access_without_auto_reset)
+  MAMONITOR_TESTENTRY (genuine_violation_without_auto_reset_should_not_loop)
+#endif
 TEST_LIST_END ()
 
 MAMONITOR_TESTCASE (notify_on_read_access)
@@ -125,3 +131,147 @@ MAMONITOR_TESTCASE (disable)
   g_assert_cmpuint (fixture->number_of_notifies, ==, 0);
   g_assert_cmpuint (val, ==, 0x37);
 }
+
+MAMONITOR_TESTCASE (many_ranges)
+{
+  const guint num_pages = 16;
+  guint page_size, i;
+  guint8 * pages;
+  GumMemoryRange ranges[8];
+  volatile GumMemoryAccessDetails * d = &fixture->last_details;
+
+  page_size = gum_query_page_size ();
+  pages = gum_alloc_n_pages (num_pages, GUM_PAGE_RW);
+
+  /* every other page, in descending order */
+  for (i = 0; i != G_N_ELEMENTS (ranges); i++)
+  {
+    ranges[i].base_address =
+        GUM_ADDRESS (pages + ((num_pages - 2 - (i * 2)) * page_size));
+    ranges[i].size = page_size;
+  }
+
+  fixture->monitor = gum_memory_access_monitor_new (ranges,
+      G_N_ELEMENTS (ranges), GUM_PAGE_RWX, TRUE, memory_access_notify_cb,
+      fixture, NULL);
+  g_assert (gum_memory_access_monitor_enable (fixture->monitor, NULL));
+
+  for (i = 0; i != num_pages; i++)
+  {
+    guint range_index = (num_pages - 2 - i) / 2;
+
+    pages[(i * page_size) + 1] = 0x42;
+
+    if (i % 2 == 0)
+    {
+      g_assert_cmpuint (fixture->number_of_notifies, ==, (i / 2) + 1);
+      g_assert_cmpuint (d->range_index, ==, range_index);
+      g_assert_cmpuint (d->page_index, ==, 0);
+      g_assert_cmpuint (d->pages_completed, ==, (i / 2) + 1);
+      g_assert_cmpuint (d->pages_total, ==, G_N_ELEMENTS (ranges));
+      g_assert (d->address == pages + (i * page_size) + 1);
+    }
+    else
+    {
+      g_assert_cmpuint (fixture->number_of_notifies, ==, (i / 2) + 1);
+    }
+  }
+
+  DISABLE_MONITOR ();
+  g_object_unref (fixture->monitor);
+  fixture->monitor = NULL;
+
+  gum_free_pages (pages);
+}
+
+#ifdef HAVE_LINUX
+
+MAMONITOR_TESTCASE (notify_on_first_write_only)
+{
+  volatile guint8 * bytes = (guint8 *) fixture->range.base_address;
+  guint8 val;
+  volatile GumMemoryAccessDetails * d = &fixture->last_details;
+
+  bytes[fixture->offset_in_second_page] = 0x13;
+
+  fixture->monitor = gum_memory_access_monitor_new (&fixture->range, 1,
+      GUM_PAGE_WRITE, TRUE, memory_access_notify_cb, fixture, NULL);
+  g_assert (gum_memory_access_monitor_enable (fixture->monitor, NULL));
+
+  val = bytes[fixture->offset_in_second_page];
+  g_assert_cmpuint (fixture->number_of_notifies, ==, 0);
+  g_assert_cmpuint (val, ==, 0x13);
+
+  bytes[fixture->offset_in_second_page] = 0x14;
+  g_assert_cmpuint (fixture->number_of_notifies, ==, 1);
+  g_assert_cmpint (d->operation, ==, GUM_MEMOP_WRITE);
+  g_assert_cmpuint (d->page_index, ==, 1);
+  g_assert_cmpuint (d->pages_completed, ==, 1);
+
+  bytes[fixture->offset_in_second_page] = 0x15;
+  g_assert_cmpuint (fixture->number_of_notifies, ==, 1);
+  g_assert_cmpuint (bytes[fixture->offset_in_second_page], ==, 0x15);
+}
+
+MAMONITOR_TESTCASE (notify_on_every_access_without_auto_reset)
+{
+  volatile guint8 * bytes = (guint8 *) fixture->range.base_address;
+  guint8 val;
+  volatile GumMemoryAccessDetails * d = &fixture->last_details;
+
+  bytes[fixture->offset_in_first_page] = 0x13;
+
+  fixture->monitor = gum_memory_access_monitor_new (&fixture->range, 1,
+      GUM_PAGE_WRITE, FALSE, memory_access_notify_cb, fixture, NULL);
+  g_assert (gum_memory_access_monitor_enable (fixture->monitor, NULL));
+
+  val = bytes[fixture->offset_in_first_page];
+  g_assert_cmpuint (fixture->number_of_notifies, ==, 0);
+  g_assert_cmpuint (val, ==, 0x13);
+
+  bytes[fixture->offset_in_first_page] = 0x14;
+  g_assert_cmpuint (fixture->number_of_notifies, ==, 1);
+  g_assert_cmpint (d->operation, ==, GUM_MEMOP_WRITE);
+  g_assert (d->address == bytes + fixture->offset_in_first_page);
+
+  bytes[fixture->offset_in_first_page] = 0x15;
+  g_assert_cmpuint (fixture->number_of_notifies, ==, 2);
+  g_assert_cmpuint (d->pages_completed, ==, 1);
+
+  DISABLE_MONITOR ();
+
+  bytes[fixture->offset_in_first_page] = 0x16;
+  g_assert_cmpuint (fixture->number_of_notifies, ==, 2);
+  g_assert_cmpuint (bytes[fixture->offset_in_first_page], ==, 0x16);
+}
+
+MAMONITOR_TESTCASE (genuine_violation_without_auto_reset_should_not_loop)
+{
+  volatile guint8 * bytes = (guint8 *) fixture->range.base_address;
+  GumExceptor * exceptor;
+
+  bytes[fixture->offset_in_first_page] = 0x13;
+  gum_mprotect (GSIZE_TO_POINTER (fixture->range.base_address),
+      fixture->range.size, GUM_PAGE_READ);
+
+  fixture->monitor = gum_memory_access_monitor_new (&fixture->range, 1,
+      GUM_PAGE_READ, FALSE, memory_access_notify_cb, fixture, NULL);
+  g_assert (gum_memory_access_monitor_enable (fixture->monitor, NULL));
+
+  /* Added after the monitor's handler, so only sees what it passes on. */
+  exceptor = gum_exceptor_obtain ();
+  gum_exceptor_add (exceptor, access_violation_cb, fixture);
+
+  bytes[fixture->offset_in_first_page] = 0x14;
+  g_assert_cmpuint (fixture->number_of_violations, ==, 1);
+  g_assert_cmpuint (fixture->number_of_notifies, ==, 0);
+
+  gum_exceptor_remove (exceptor, access_violation_cb, fixture);
+  g_object_unref (exceptor);
+
+  DISABLE_MONITOR ();
+
+  g_assert_cmpuint (bytes[fixture->offset_in_first_page], ==, 0x14);
+}
+
+#endif
@@ -25,6 +25,7 @@
 TEST_LIST_BEGIN (process)
 #if !defined(HAVE_ANDROID) && !(defined(HAVE_LINUX) && defined(HAVE_ARM))
   PROCESS_TESTENTRY (process_threads)
+  PROCESS_TESTENTRY (process_threads_can_be_enumerated_with_flags)
 #endif
   PROCESS_TESTENTRY (process_modules)
   PROCESS_TESTENTRY (process_ranges)
@@ -34,6 +35,11 @@ TEST_LIST_BEGIN (process)
   PROCESS_TESTENTRY (module_base)
   PROCESS_TESTENTRY (module_export_can_be_found)
   PROCESS_TESTENTRY (module_export_matches_system_lookup)
+#if defined (HAVE_LINUX) && !defined (HAVE_ANDROID)
+  PROCESS_TESTENTRY (module_exports_match_system_lookup)
+#endif
+  PROCESS_TESTENTRY (module_map_finds_module_by_address)
+  PROCESS_TESTENTRY (memory_map_contains_mapped_ranges_only)
 #ifdef G_OS_WIN32
   PROCESS_TESTENTRY (get_set_system_error)
   PROCESS_TESTENTRY (get_current_thread_id)
@@ -75,6 +81,10 @@ static gboolean export_found_cb (const GumExportDetails * details,
     gpointer user_data);
 static gboolean range_found_cb (const GumRangeDetails * details,
     gpointer user_data);
+#if defined (HAVE_LINUX) && !defined (HAVE_ANDROID)
+static gboolean check_export_against_dlsym (const GumExportDetails * details,
+    gpointer user_data);
+#endif
 static gboolean range_check_cb (const GumRangeDetails * details,
     gpointer user_data);
 #ifdef HAVE_DARWIN
@@ -108,6 +118,42 @@ PROCESS_TESTCASE (process_threads)
   g_thread_join (thread);
 }
 
+PROCESS_TESTCASE (process_threads_can_be_enumerated_with_flags)
+{
+  GThread * threads[16];
+  gboolean done = FALSE;
+  TestForEachContext ctx;
+  guint i;
+
+  for (i = 0; i != G_N_ELEMENTS (threads); i++)
+  {
+    threads[i] = g_thread_new ("process-test-sleeping-dummy", sleeping_dummy,
+        &done);
+  }
+
+  ctx.number_of_calls = 0;
+  ctx.value_to_return = TRUE;
+  gum_process_enumerate_threads_full (GUM_THREAD_FLAGS_CPU_CONTEXT,
+      thread_found_cb, &ctx);
+  g_assert_cmpuint (ctx.number_of_calls, >, G_N_ELEMENTS (threads));
+
+  ctx.number_of_calls = 0;
+  ctx.value_to_return = TRUE;
+  gum_process_enumerate_threads_full (GUM_THREAD_FLAGS_NONE,
+      thread_found_cb, &ctx);
+  g_assert_cmpuint (ctx.number_of_calls, >, G_N_ELEMENTS (threads));
+
+  ctx.number_of_calls = 0;
+  ctx.value_to_return = FALSE;
+  gum_process_enumerate_threads_full (GUM_THREAD_FLAGS_NONE,
+      thread_found_cb, &ctx);
+  g_assert_cmpuint (ctx.number_of_calls, ==, 1);
+
+  done = TRUE;
+  for (i = 0; i != G_N_ELEMENTS (threads); i++)
+    g_thread_join (threads[i]);
+}
+
 #endif
 
 PROCESS_TESTCASE (process_modules)
@@ -319,6 +365,98 @@ PROCESS_TESTCASE (module_export_matches_system_lookup)
 #endif
 }
 
+#if defined (HAVE_LINUX) && !defined (HAVE_ANDROID)
+
+PROCESS_TESTCASE (module_exports_match_system_lookup)
+{
+  void * lib;
+
+  lib = dlopen (SYSTEM_MODULE_NAME, RTLD_NOW | RTLD_GLOBAL);
+  g_assert (lib != NULL);
+
+  gum_module_enumerate_exports (SYSTEM_MODULE_NAME, check_export_against_dlsym,
+      lib);
+
+  dlclose (lib);
+}
+
+static gboolean
+check_export_against_dlsym (const GumExportDetails * details,
+                            gpointer user_data)
+{
+  void * lib = user_data;
+
+  if (details->type != GUM_EXPORT_FUNCTION)
+    return TRUE;
+
+  g_assert_cmphex (gum_module_find_export_by_name (SYSTEM_MODULE_NAME,
+      details->name), ==, GPOINTER_TO_SIZE (dlsym (lib, details->name)));
+
+  return TRUE;
+}
+
+#endif
+
+PROCESS_TESTCASE (module_map_finds_module_by_address)
+{
+  GumModuleMap * map;
+  GumAddress base, export;
+  const GumModuleDetails * details;
+  guint i;
+
+  base = gum_module_find_base_address (SYSTEM_MODULE_NAME);
+  export = gum_module_find_export_by_name (SYSTEM_MODULE_NAME,
+      SYSTEM_MODULE_EXPORT);
+  g_assert (base != 0);
+  g_assert (export != 0);
+
+  map = gum_module_map_new ();
+
+  for (i = 0; i != 2; i++)
+  {
+    details = gum_module_map_find (map, base);
+    g_assert (details != NULL);
+    g_assert_cmphex (details->range->base_address, ==, base);
+
+    details = gum_module_map_find (map, export);
+    g_assert (details != NULL);
+    g_assert_cmphex (details->range->base_address, ==, base);
+
+    g_assert (gum_module_map_find (map, 8) == NULL);
+  }
+
+  g_object_unref (map);
+}
+
+PROCESS_TESTCASE (memory_map_contains_mapped_ranges_only)
+{
+  GumMemoryMap * map;
+  guint page_size;
+  guint8 * pages;
+  GumMemoryRange range;
+
+  page_size = gum_query_page_size ();
+  pages = gum_alloc_n_pages (2, GUM_PAGE_RW);
+
+  map = gum_memory_map_new (GUM_PAGE_RW);
+
+  range.base_address = GUM_ADDRESS (pages);
+  range.size = 2 * page_size;
+  g_assert (gum_memory_map_contains (map, &range));
+
+  range.base_address = GUM_ADDRESS (pages + page_size - 4);
+  range.size = 8;
+  g_assert (gum_memory_map_contains (map, &range));
+
+  range.base_address = 8;
+  range.size = 8;
+  g_assert (!gum_memory_map_contains (map, &range));
+
+  g_object_unref (map);
+
+  gum_free_pages (pages);
+}
+
 #ifdef G_OS_WIN32
 PROCESS_TESTCASE (get_current_thread_id)
 {
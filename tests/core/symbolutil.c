@@ -7,6 +7,10 @@
 
 #include "testutil.h"
 
+#ifdef HAVE_LINUX
+# include <glib/gstdio.h>
+#endif
+
 #ifdef HAVE_ANDROID
 # define SYMUTIL_TESTCASE(NAME) \
     static void test_symbolutil_run_ ## NAME (void); \
@@ -34,6 +38,10 @@ TEST_LIST_BEGIN (symbolutil)
   SYMUTIL_TESTENTRY (find_local_static_function)
   SYMUTIL_TESTENTRY (find_functions_named)
   SYMUTIL_TESTENTRY (find_functions_matching)
+  SYMUTIL_TESTENTRY (symbolicate_batch_resolves_every_address)
+#ifdef HAVE_LINUX
+  SYMUTIL_TESTENTRY (symbol_index_can_be_cached_on_disk)
+#endif
 TEST_LIST_END ()
 
 static void GUM_CDECL gum_dummy_function_0 (void);
@@ -114,6 +122,107 @@ SYMUTIL_TESTCASE (find_functions_matching)
   g_array_free (functions, TRUE);
 }
 
+SYMUTIL_TESTCASE (symbolicate_batch_resolves_every_address)
+{
+  const guint n = 400;
+  GumReturnAddress * addresses;
+  GumReturnAddressDetails * details;
+  gboolean * resolved;
+  guint i, n_resolved;
+
+  addresses = g_new (GumReturnAddress, n);
+  for (i = 0; i != n; i++)
+  {
+    switch (i % 4)
+    {
+      case 0: addresses[i] = gum_dummy_function_0; break;
+      case 1: addresses[i] = gum_dummy_function_1; break;
+      case 2: addresses[i] = GSIZE_TO_POINTER (8 + i); break;
+      case 3: addresses[i] = ((guint8 *) gum_dummy_function_0) + 1; break;
+    }
+  }
+  details = g_new (GumReturnAddressDetails, n);
+  resolved = g_new (gboolean, n);
+
+  n_resolved = gum_symbolicate_batch (addresses, n, details, resolved);
+  g_assert_cmpuint (n_resolved, ==, n - (n / 4));
+
+  for (i = 0; i != n; i++)
+  {
+    g_assert (details[i].address == addresses[i]);
+
+    switch (i % 4)
+    {
+      case 0:
+      case 3:
+        g_assert (resolved[i]);
+        g_assert_cmpstr (details[i].function_name, ==, "gum_dummy_function_0");
+        break;
+      case 1:
+        g_assert (resolved[i]);
+        g_assert_cmpstr (details[i].function_name, ==, "gum_dummy_function_1");
+        break;
+      case 2:
+        g_assert (!resolved[i]);
+        g_assert_cmpstr (details[i].function_name, ==, "");
+        break;
+    }
+  }
+
+  g_free (resolved);
+  g_free (details);
+  g_free (addresses);
+}
+
+#ifdef HAVE_LINUX
+
+SYMUTIL_TESTCASE (symbol_index_can_be_cached_on_disk)
+{
+  gchar * cache_dir;
+  GDir * dir;
+  const gchar * name;
+  guint num_files;
+  GumSymbolDetails details;
+
+  cache_dir = g_dir_make_tmp ("gum-symbols-XXXXXX", NULL);
+  g_assert (cache_dir != NULL);
+
+  gum_symbol_util_set_cache_directory (cache_dir);
+
+  g_assert (gum_symbol_details_from_address (gum_dummy_function_0, &details));
+  g_assert_cmpstr (details.symbol_name, ==, "gum_dummy_function_0");
+
+  num_files = 0;
+  dir = g_dir_open (cache_dir, 0, NULL);
+  while (g_dir_read_name (dir) != NULL)
+    num_files++;
+  g_dir_close (dir);
+  g_assert_cmpuint (num_files, >=, 1);
+
+  /* Drops the in-memory indexes, so this lookup is served from disk. */
+  gum_symbol_util_set_cache_directory (cache_dir);
+
+  g_assert (gum_symbol_details_from_address (gum_dummy_function_1, &details));
+  g_assert_cmpstr (details.symbol_name, ==, "gum_dummy_function_1");
+  assert_basename_equals (__FILE__, details.file_name);
+  g_assert_cmpuint (details.line_number, >, 0);
+
+  gum_symbol_util_set_cache_directory (NULL);
+
+  dir = g_dir_open (cache_dir, 0, NULL);
+  while ((name = g_dir_read_name (dir)) != NULL)
+  {
+    gchar * path = g_build_filename (cache_dir, name, NULL);
+    g_unlink (path);
+    g_free (path);
+  }
+  g_dir_close (dir);
+  g_rmdir (cache_dir);
+  g_free (cache_dir);
+}
+
+#endif
+
 static void GUM_CDECL
 gum_dummy_function_0 (void)
 {
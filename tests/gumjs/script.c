@@ -95,6 +95,7 @@ TEST_LIST_BEGIN (script)
   SCRIPT_TESTENTRY (memory_can_be_scanned)
   SCRIPT_TESTENTRY (memory_scan_should_be_interruptible)
   SCRIPT_TESTENTRY (memory_scan_handles_unreadable_memory)
+  SCRIPT_TESTENTRY (memory_can_be_scanned_for_many_patterns)
 #ifdef G_OS_WIN32
   SCRIPT_TESTENTRY (memory_access_can_be_monitored)
 #endif
@@ -1879,6 +1880,26 @@ SCRIPT_TESTCASE (memory_scan_handles_unreadable_memory)
   EXPECT_SEND_MESSAGE_WITH ("\"onComplete\"");
 }
 
+SCRIPT_TESTCASE (memory_can_be_scanned_for_many_patterns)
+{
+  guint8 haystack[] = { 0x01, 0x02, 0x13, 0x37, 0x03, 0x13, 0x37 };
+  COMPILE_AND_LOAD_SCRIPT (
+      "Memory.scanMany(" GUM_PTR_CONST ", 7, ['13 37', '02 ?? 37', '03 13'], {"
+        "onMatch: function (address, size, index) {"
+        "  send('onMatch index=' + index + ' offset=' + address.sub("
+             GUM_PTR_CONST ").toInt32() + ' size=' + size);"
+        "},"
+        "onComplete: function () {"
+        "  send('onComplete');"
+        "}"
+      "});", haystack, haystack);
+  EXPECT_SEND_MESSAGE_WITH ("\"onMatch index=1 offset=1 size=3\"");
+  EXPECT_SEND_MESSAGE_WITH ("\"onMatch index=0 offset=2 size=2\"");
+  EXPECT_SEND_MESSAGE_WITH ("\"onMatch index=2 offset=4 size=2\"");
+  EXPECT_SEND_MESSAGE_WITH ("\"onMatch index=0 offset=5 size=2\"");
+  EXPECT_SEND_MESSAGE_WITH ("\"onComplete\"");
+}
+
 #ifdef G_OS_WIN32
 
 SCRIPT_TESTCASE (memory_access_can_be_monitored)
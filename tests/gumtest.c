@@ -98,6 +98,7 @@ main (gint argc, gchar * argv[])
   TEST_RUN_LIST (testutil);
   TEST_RUN_LIST (tls);
   TEST_RUN_LIST (memory);
+  TEST_RUN_LIST (code_allocator);
   TEST_RUN_LIST (process);
 #if !defined (HAVE_QNX) && !(defined (HAVE_ANDROID) && defined (HAVE_ARM64))
   TEST_RUN_LIST (symbolutil);
@@ -115,7 +116,7 @@ main (gint argc, gchar * argv[])
   if (cs_support (CS_ARCH_ARM64))
     TEST_RUN_LIST (arm64relocator);
   TEST_RUN_LIST (interceptor);
-#if defined (HAVE_I386) && defined (G_OS_WIN32)
+#if defined (HAVE_I386) && (defined (G_OS_WIN32) || defined (HAVE_LINUX))
   TEST_RUN_LIST (memoryaccessmonitor);
 #endif
 #ifdef HAVE_I386
@@ -165,6 +166,9 @@ main (gint argc, gchar * argv[])
 #ifdef G_OS_WIN32
   TEST_RUN_LIST (profiler);
 #endif
+#ifdef HAVE_LINUX
+  TEST_RUN_LIST (sampling_profiler);
+#endif
 
 #if defined (HAVE_GUMJS) && !defined (HAVE_QNX)
   /* GumJS */
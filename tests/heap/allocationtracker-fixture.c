@@ -11,6 +11,8 @@
 #include "gumhash.h"
 #include "testutil.h"
 
+#include <stdlib.h>
+
 #define ALLOCTRACKER_TESTCASE(NAME) \
     void test_allocation_tracker_ ## NAME ( \
         TestAllocationTrackerFixture * fixture, gconstpointer data)
@@ -57,5 +59,9 @@ static const GumReturnAddress dummy_return_addresses_b[] =
   GUINT_TO_POINTER (0x4321),
 };
 
+#define WORKER_ITERATIONS  100000
+#define WORKER_LIVE_BLOCKS 64
+
+static gpointer malloc_and_free_worker (gpointer data);
 static gboolean filter_cb (GumAllocationTracker * tracker, gpointer address,
     guint size, gpointer user_data);
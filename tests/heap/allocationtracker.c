@@ -16,8 +16,12 @@ TEST_LIST_BEGIN (allocation_tracker)
   ALLOCTRACKER_TESTENTRY (block_list_sizes)
   ALLOCTRACKER_TESTENTRY (block_list_backtraces)
   ALLOCTRACKER_TESTENTRY (block_groups)
+  ALLOCTRACKER_TESTENTRY (call_sites)
 
   ALLOCTRACKER_TESTENTRY (filter_function)
+  ALLOCTRACKER_TESTENTRY (sampling_should_give_unbiased_estimates)
+  ALLOCTRACKER_TESTENTRY (sampling_of_blocks_near_interval_should_be_unbiased)
+  ALLOCTRACKER_TESTENTRY (realloc_of_sampled_block_should_keep_its_weight)
 
   ALLOCTRACKER_TESTENTRY (realloc_new_block)
   ALLOCTRACKER_TESTENTRY (realloc_unknown_block)
@@ -26,6 +30,7 @@ TEST_LIST_BEGIN (allocation_tracker)
 
   ALLOCTRACKER_TESTENTRY (memory_usage_without_backtracer_should_be_sensible)
   ALLOCTRACKER_TESTENTRY (memory_usage_with_backtracer_should_be_sensible)
+  ALLOCTRACKER_TESTENTRY (multithreaded_probe_throughput)
 
 #ifdef G_OS_WIN32
   ALLOCTRACKER_TESTENTRY (backtracer_gtype_interop)
@@ -286,6 +291,44 @@ ALLOCTRACKER_TESTCASE (block_groups)
   gum_allocation_group_list_free (groups);
 }
 
+ALLOCTRACKER_TESTCASE (call_sites)
+{
+  GumBacktracer * backtracer;
+  GumAllocationTracker * t;
+  GumList * sites;
+  GumAllocationCallSite * site;
+
+  backtracer = gum_fake_backtracer_new (dummy_return_addresses_a,
+      G_N_ELEMENTS (dummy_return_addresses_a));
+  t = gum_allocation_tracker_new_with_backtracer (backtracer);
+
+  gum_allocation_tracker_begin (t);
+
+  g_assert (gum_allocation_tracker_peek_call_sites (t) == NULL);
+
+  gum_allocation_tracker_on_malloc (t, DUMMY_BLOCK_A, 42);
+  gum_allocation_tracker_on_malloc (t, DUMMY_BLOCK_B, 24);
+  gum_allocation_tracker_on_realloc (t, DUMMY_BLOCK_B, DUMMY_BLOCK_C, 30);
+
+  sites = gum_allocation_tracker_peek_call_sites (t);
+  g_assert_cmpuint (gum_list_length (sites), ==, 1);
+  site = (GumAllocationCallSite *) sites->data;
+  g_assert_cmpuint (site->return_addresses.len, ==, 2);
+  g_assert (site->return_addresses.items[0] == dummy_return_addresses_a[0]);
+  g_assert (site->return_addresses.items[1] == dummy_return_addresses_a[1]);
+  g_assert_cmpuint (site->alive_now, ==, 2);
+  g_assert_cmpuint (site->alive_size, ==, 72);
+  gum_allocation_call_site_list_free (sites);
+
+  gum_allocation_tracker_on_free (t, DUMMY_BLOCK_A);
+  gum_allocation_tracker_on_free (t, DUMMY_BLOCK_C);
+
+  g_assert (gum_allocation_tracker_peek_call_sites (t) == NULL);
+
+  g_object_unref (t);
+  g_object_unref (backtracer);
+}
+
 ALLOCTRACKER_TESTCASE (filter_function)
 {
   GumBacktracer * backtracer;
@@ -329,6 +372,109 @@ filter_cb (GumAllocationTracker * tracker,
   return (size == 1337);
 }
 
+ALLOCTRACKER_TESTCASE (sampling_should_give_unbiased_estimates)
+{
+  GumAllocationTracker * t = fixture->tracker;
+  const guint num_allocations = 100000;
+  const guint block_size = 64;
+  guint expected_total_size, i;
+  GumList * blocks;
+
+  gum_allocation_tracker_set_sample_interval (t, 1024);
+  gum_allocation_tracker_begin (t);
+
+  for (i = 0; i != num_allocations; i++)
+  {
+    gum_allocation_tracker_on_malloc (t,
+        GUINT_TO_POINTER (0x50000 + (i * block_size)), block_size);
+  }
+
+  blocks = gum_allocation_tracker_peek_block_list (t);
+  g_assert_cmpuint (gum_list_length (blocks), <, num_allocations / 4);
+  gum_allocation_block_list_free (blocks);
+
+  g_assert_cmpuint (gum_allocation_tracker_peek_block_count (t), >,
+      num_allocations * 9 / 10);
+  g_assert_cmpuint (gum_allocation_tracker_peek_block_count (t), <,
+      num_allocations * 11 / 10);
+  expected_total_size = num_allocations * block_size;
+  g_assert_cmpuint (gum_allocation_tracker_peek_block_total_size (t), >,
+      expected_total_size / 10 * 9);
+  g_assert_cmpuint (gum_allocation_tracker_peek_block_total_size (t), <,
+      expected_total_size / 10 * 11);
+
+  for (i = 0; i != num_allocations; i++)
+  {
+    gum_allocation_tracker_on_free (t,
+        GUINT_TO_POINTER (0x50000 + (i * block_size)));
+  }
+
+  g_assert_cmpuint (gum_allocation_tracker_peek_block_count (t), ==, 0);
+  g_assert_cmpuint (gum_allocation_tracker_peek_block_total_size (t), ==, 0);
+}
+
+ALLOCTRACKER_TESTCASE (sampling_of_blocks_near_interval_should_be_unbiased)
+{
+  GumAllocationTracker * t = fixture->tracker;
+  const guint num_allocations = 20000;
+  const guint block_size = 1024;
+  guint expected_total_size, i;
+
+  /* each sampled block weighs ~1.58, which rounds to a 26% overestimate */
+  gum_allocation_tracker_set_sample_interval (t, block_size);
+  gum_allocation_tracker_begin (t);
+
+  for (i = 0; i != num_allocations; i++)
+  {
+    gum_allocation_tracker_on_malloc (t,
+        GUINT_TO_POINTER (0x50000 + (i * block_size)), block_size);
+  }
+
+  g_assert_cmpuint (gum_allocation_tracker_peek_block_count (t), >,
+      num_allocations * 95 / 100);
+  g_assert_cmpuint (gum_allocation_tracker_peek_block_count (t), <,
+      num_allocations * 105 / 100);
+  expected_total_size = num_allocations * block_size;
+  g_assert_cmpuint (gum_allocation_tracker_peek_block_total_size (t), >,
+      expected_total_size / 100 * 95);
+  g_assert_cmpuint (gum_allocation_tracker_peek_block_total_size (t), <,
+      expected_total_size / 100 * 105);
+}
+
+ALLOCTRACKER_TESTCASE (realloc_of_sampled_block_should_keep_its_weight)
+{
+  GumAllocationTracker * t = fixture->tracker;
+  const guint num_allocations = 20000;
+  const guint block_size = 1024;
+  const guint new_block_size = 16;
+  guint expected_total_size, i;
+
+  gum_allocation_tracker_set_sample_interval (t, block_size);
+  gum_allocation_tracker_begin (t);
+
+  for (i = 0; i != num_allocations; i++)
+  {
+    gum_allocation_tracker_on_malloc (t,
+        GUINT_TO_POINTER (0x50000 + (i * block_size)), block_size);
+  }
+  for (i = 0; i != num_allocations; i++)
+  {
+    gpointer address = GUINT_TO_POINTER (0x50000 + (i * block_size));
+
+    gum_allocation_tracker_on_realloc (t, address, address, new_block_size);
+  }
+
+  g_assert_cmpuint (gum_allocation_tracker_peek_block_count (t), >,
+      num_allocations * 95 / 100);
+  g_assert_cmpuint (gum_allocation_tracker_peek_block_count (t), <,
+      num_allocations * 105 / 100);
+  expected_total_size = num_allocations * new_block_size;
+  g_assert_cmpuint (gum_allocation_tracker_peek_block_total_size (t), >,
+      expected_total_size / 100 * 95);
+  g_assert_cmpuint (gum_allocation_tracker_peek_block_total_size (t), <,
+      expected_total_size / 100 * 105);
+}
+
 ALLOCTRACKER_TESTCASE (realloc_new_block)
 {
   GumAllocationTracker * t = fixture->tracker;
@@ -444,6 +590,94 @@ ALLOCTRACKER_TESTCASE (memory_usage_with_backtracer_should_be_sensible)
   g_object_unref (t);
 }
 
+ALLOCTRACKER_TESTCASE (multithreaded_probe_throughput)
+{
+  GumAllocationTracker * t = fixture->tracker;
+  GumInterceptor * interceptor;
+  GumAllocatorProbe * probe;
+  GThread * threads[8];
+  guint thread_count;
+  GTimer * timer;
+
+  if (!g_test_slow ())
+  {
+    g_print ("<skipping, run in slow mode> ");
+    return;
+  }
+
+  gum_allocation_tracker_begin (t);
+
+  probe = gum_allocator_probe_new ();
+  g_object_set (probe, "allocation-tracker", t, NULL);
+  gum_allocator_probe_attach_to_apis (probe, test_util_heap_apis ());
+
+  /* only the workers' blocks should come and go */
+  interceptor = gum_interceptor_obtain ();
+  gum_interceptor_ignore_current_thread (interceptor);
+
+  timer = g_timer_new ();
+
+  for (thread_count = 1; thread_count <= G_N_ELEMENTS (threads);
+      thread_count *= 2)
+  {
+    guint block_count, total_size, i;
+    gdouble duration;
+
+    block_count = gum_allocation_tracker_peek_block_count (t);
+    total_size = gum_allocation_tracker_peek_block_total_size (t);
+
+    g_timer_reset (timer);
+    for (i = 0; i != thread_count; i++)
+    {
+      threads[i] = g_thread_new ("alloc-tracker-worker", malloc_and_free_worker,
+          NULL);
+    }
+    for (i = 0; i != thread_count; i++)
+      g_thread_join (threads[i]);
+    duration = g_timer_elapsed (timer, NULL);
+
+    g_assert_cmpuint (gum_allocation_tracker_peek_block_count (t), ==,
+        block_count);
+    g_assert_cmpuint (gum_allocation_tracker_peek_block_total_size (t), ==,
+        total_size);
+
+    g_print ("<%u: %.0f ops/s> ", thread_count,
+        (thread_count * WORKER_ITERATIONS * 2) / duration);
+  }
+
+  g_timer_destroy (timer);
+
+  gum_interceptor_unignore_current_thread (interceptor);
+  g_object_unref (interceptor);
+
+  gum_allocator_probe_detach (probe);
+  g_object_unref (probe);
+
+  gum_allocation_tracker_end (t);
+}
+
+static gpointer
+malloc_and_free_worker (gpointer data)
+{
+  gpointer blocks[WORKER_LIVE_BLOCKS] = { NULL, };
+  guint i;
+
+  (void) data;
+
+  for (i = 0; i != WORKER_ITERATIONS; i++)
+  {
+    guint slot = i % WORKER_LIVE_BLOCKS;
+
+    free (blocks[slot]);
+    blocks[slot] = malloc (16 + (i % 8) * 16);
+  }
+
+  for (i = 0; i != WORKER_LIVE_BLOCKS; i++)
+    free (blocks[i]);
+
+  return NULL;
+}
+
 #ifdef G_OS_WIN32
 
 ALLOCTRACKER_TESTCASE (backtracer_gtype_interop)
@@ -189,6 +189,51 @@ assert_same_xml (TestProfileReportFixture * fixture,
   g_free (generated_xml);
 }
 
+static guint64
+read_uleb128 (const guint8 ** cursor)
+{
+  guint64 value = 0;
+  guint shift = 0;
+  guint8 byte;
+
+  do
+  {
+    byte = *(*cursor)++;
+    value |= (guint64) (byte & 0x7f) << shift;
+    shift += 7;
+  }
+  while ((byte & 0x80) != 0);
+
+  return value;
+}
+
+static void
+assert_call_graph_name (const guint8 ** cursor,
+                        const gchar * expected_name)
+{
+  guint length;
+
+  length = (guint) read_uleb128 (cursor);
+  g_assert_cmpuint (length, ==, strlen (expected_name));
+  g_assert (memcmp (*cursor, expected_name, length) == 0);
+  *cursor += length;
+}
+
+static void
+assert_call_graph_node (const guint8 ** cursor,
+                        guint depth,
+                        guint function_index,
+                        guint64 total_calls,
+                        GumSample total_duration,
+                        GumSample self_duration)
+{
+  g_assert_cmpuint (read_uleb128 (cursor), ==, depth);
+  g_assert_cmpuint (read_uleb128 (cursor), ==, function_index);
+  g_assert_cmpuint (read_uleb128 (cursor), ==, total_calls);
+  g_assert_cmpuint (read_uleb128 (cursor), ==, total_duration);
+  g_assert_cmpuint (read_uleb128 (cursor), ==, self_duration);
+}
+
 /*
  * Guinea pig functions:
  */
@@ -202,6 +247,7 @@ static void GUM_NOINLINE example_cyclic_b (GumFakeSampler * sampler,
 static void deep_recursive_caller (gint count);
 static void GUM_NOINLINE example_b_dynamic (GumFakeSampler * sampler,
     guint cost);
+static void example_fan_out (GumFakeSampler * sampler, guint depth);
 
 gint dummy_variable_to_trick_optimizer = 0;
 
@@ -276,6 +322,54 @@ example_cyclic_b (GumFakeSampler * sampler,
   example_cyclic_a (sampler, flag);
 }
 
+/*
+ * Every fan-out function calls all of them again until the depth runs out,
+ * which yields FAN_OUT_WIDTH^depth distinct call paths from a handful of
+ * instrumented functions.
+ */
+#define FAN_OUT_WIDTH 10
+
+#define DEFINE_FAN_OUT_FUNCTION(N) \
+    static void GUM_NOINLINE \
+    example_fan_out_ ## N (GumFakeSampler * sampler, \
+                           guint depth) \
+    { \
+      gum_fake_sampler_advance (sampler, N + 1); \
+      example_fan_out (sampler, depth); \
+    }
+
+DEFINE_FAN_OUT_FUNCTION (0)
+DEFINE_FAN_OUT_FUNCTION (1)
+DEFINE_FAN_OUT_FUNCTION (2)
+DEFINE_FAN_OUT_FUNCTION (3)
+DEFINE_FAN_OUT_FUNCTION (4)
+DEFINE_FAN_OUT_FUNCTION (5)
+DEFINE_FAN_OUT_FUNCTION (6)
+DEFINE_FAN_OUT_FUNCTION (7)
+DEFINE_FAN_OUT_FUNCTION (8)
+DEFINE_FAN_OUT_FUNCTION (9)
+
+static void (* const example_fan_out_functions[FAN_OUT_WIDTH]) (
+    GumFakeSampler * sampler, guint depth) =
+{
+  example_fan_out_0, example_fan_out_1, example_fan_out_2, example_fan_out_3,
+  example_fan_out_4, example_fan_out_5, example_fan_out_6, example_fan_out_7,
+  example_fan_out_8, example_fan_out_9
+};
+
+static void
+example_fan_out (GumFakeSampler * sampler,
+                 guint depth)
+{
+  guint i;
+
+  if (depth == 0)
+    return;
+
+  for (i = 0; i != FAN_OUT_WIDTH; i++)
+    example_fan_out_functions[i] (sampler, depth - 1);
+}
+
 static gboolean
 exclude_simple_stdcall_50 (const gchar * match,
                            gpointer user_data)
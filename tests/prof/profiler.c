@@ -17,12 +17,16 @@ TEST_LIST_BEGIN (profiler)
 
   PROFILER_TESTENTRY (flat_function)
   PROFILER_TESTENTRY (two_calls)
+  PROFILER_TESTENTRY (many_threads)
   PROFILER_TESTENTRY (profile_matching_functions)
   PROFILER_TESTENTRY (recursion)
   PROFILER_TESTENTRY (deep_recursion)
   PROFILER_TESTENTRY (worst_case_duration)
   PROFILER_TESTENTRY (worst_case_info)
   PROFILER_TESTENTRY (worst_case_info_on_recursion)
+  PROFILER_TESTENTRY (call_graph_folded_stacks)
+  PROFILER_TESTENTRY (call_graph_binary)
+  PROFILER_TESTENTRY (call_graph_export_performance)
 
   PROFILEREPORT_TESTENTRY (bottleneck)
   PROFILEREPORT_TESTENTRY (bottlenecks)
@@ -99,6 +103,25 @@ PROFILER_TESTCASE (two_calls)
       &sleepy_function), ==, 2 * 1000);
 }
 
+PROFILER_TESTCASE (many_threads)
+{
+  GumProfiler * prof = fixture->profiler;
+  guint i;
+
+  gum_profiler_instrument_function (prof, &sleepy_function, fixture->sampler);
+
+  for (i = 0; i != GUM_MAX_THREADS + 1; i++)
+  {
+    g_thread_join (g_thread_new ("profiler-test-many-threads",
+        (GThreadFunc) sleepy_function, fixture->fake_sampler));
+  }
+
+  g_assert_cmpuint (gum_profiler_get_total_duration_of (prof, 0,
+      &sleepy_function), ==, 1000);
+  g_assert_cmpuint (gum_profiler_get_total_duration_of (prof, GUM_MAX_THREADS,
+      &sleepy_function), ==, 1000);
+}
+
 PROFILEREPORT_TESTCASE (bottleneck)
 {
   instrument_example_functions (fixture);
@@ -365,4 +388,119 @@ PROFILER_TESTCASE (worst_case_info_on_recursion)
       &example_worst_case_recursive), ==, "2");
 }
 
+PROFILER_TESTCASE (call_graph_folded_stacks)
+{
+  gchar * folded;
+
+  gum_profiler_enable_call_graph (fixture->profiler, fixture->sampler);
+  INSTRUMENT_FUNCTION (example_a);
+  INSTRUMENT_FUNCTION (example_b);
+  INSTRUMENT_FUNCTION (example_c);
+  INSTRUMENT_FUNCTION (example_d);
+
+  example_a (fixture->fake_sampler);
+  example_d (fixture->fake_sampler);
+
+  folded = gum_profiler_emit_folded_stacks (fixture->profiler);
+  g_assert_cmpstr (folded, ==,
+      "example_a 2\n"
+      "example_a;example_c 4\n"
+      "example_a;example_b 3\n"
+      "example_d 7\n"
+      "example_d;example_c 4\n");
+  g_free (folded);
+}
+
+PROFILER_TESTCASE (call_graph_binary)
+{
+  GByteArray * graph;
+  const guint8 * cursor;
+
+  gum_profiler_enable_call_graph (fixture->profiler, fixture->sampler);
+  INSTRUMENT_FUNCTION (example_cyclic_a);
+  INSTRUMENT_FUNCTION (example_cyclic_b);
+
+  example_cyclic_a (fixture->fake_sampler, 1);
+
+  graph = gum_profiler_emit_call_graph (fixture->profiler);
+  cursor = graph->data;
+
+  g_assert (memcmp (cursor, "GCG1", 4) == 0);
+  cursor += 4;
+
+  g_assert_cmpuint (read_uleb128 (&cursor), ==, 2);
+  assert_call_graph_name (&cursor, "example_cyclic_a");
+  assert_call_graph_name (&cursor, "example_cyclic_b");
+
+  g_assert_cmpuint (read_uleb128 (&cursor), ==, 1);
+  read_uleb128 (&cursor);
+  g_assert_cmpuint (read_uleb128 (&cursor), ==, 3);
+  assert_call_graph_node (&cursor, 0, 0, 1, 4, 1);
+  assert_call_graph_node (&cursor, 1, 1, 1, 3, 2);
+  assert_call_graph_node (&cursor, 2, 0, 1, 1, 1);
+
+  g_assert (cursor == graph->data + graph->len);
+
+  g_byte_array_unref (graph);
+}
+
+PROFILER_TESTCASE (call_graph_export_performance)
+{
+  const guint depth = 5;
+  guint i;
+  GTimer * timer;
+  gchar * folded;
+  gdouble folded_duration, binary_duration;
+  GByteArray * graph;
+  const guint8 * cursor;
+  guint64 name_count, node_count;
+
+  if (!g_test_slow ())
+  {
+    g_print ("<skipping, run in slow mode> ");
+    return;
+  }
+
+  gum_profiler_enable_call_graph (fixture->profiler, fixture->sampler);
+  for (i = 0; i != FAN_OUT_WIDTH; i++)
+  {
+    g_assert_cmpint (INSTRUMENT_FUNCTION (example_fan_out_functions[i]), ==,
+        GUM_INSTRUMENT_OK);
+  }
+
+  example_fan_out (fixture->fake_sampler, depth);
+
+  timer = g_timer_new ();
+
+  folded = gum_profiler_emit_folded_stacks (fixture->profiler);
+  folded_duration = g_timer_elapsed (timer, NULL);
+  g_assert (folded != NULL);
+  g_free (folded);
+
+  g_timer_start (timer);
+  graph = gum_profiler_emit_call_graph (fixture->profiler);
+  binary_duration = g_timer_elapsed (timer, NULL);
+
+  g_timer_destroy (timer);
+
+  cursor = graph->data + 4;
+  name_count = read_uleb128 (&cursor);
+  g_assert_cmpuint (name_count, ==, FAN_OUT_WIDTH);
+  for (i = 0; i != name_count; i++)
+    cursor += read_uleb128 (&cursor);
+  g_assert_cmpuint (read_uleb128 (&cursor), ==, 1);
+  read_uleb128 (&cursor);
+  node_count = read_uleb128 (&cursor);
+  /* 10 + 100 + 1000 + 10000 + 100000 call paths */
+  g_assert_cmpuint (node_count, ==, 111110);
+
+  g_byte_array_unref (graph);
+
+  g_print ("<nodes=%" G_GINT64_MODIFIER "u folded=%.1f ms binary=%.1f ms> ",
+      node_count, folded_duration * 1000.0, binary_duration * 1000.0);
+
+  g_assert_cmpfloat (folded_duration, <, 1.0);
+  g_assert_cmpfloat (binary_duration, <, 1.0);
+}
+
 #endif /* G_OS_WIN32 */
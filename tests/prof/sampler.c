@@ -13,9 +13,11 @@ TEST_LIST_BEGIN (sampler)
   SAMPLER_TESTENTRY (malloc_count)
   SAMPLER_TESTENTRY (multiple_call_counters)
   SAMPLER_TESTENTRY (wallclock)
+  SAMPLER_TESTENTRY (sample_cost)
 TEST_LIST_END ()
 
 static void spin_for_one_tenth_second (void);
+static gdouble measure_sample_cost (GumSampler * sampler);
 static gpointer malloc_count_helper_thread (gpointer data);
 static void nop_function_a (void);
 static void nop_function_b (void);
@@ -138,6 +140,76 @@ SAMPLER_TESTCASE (wallclock)
   g_assert_cmpuint (sample_b, >, sample_a);
 }
 
+SAMPLER_TESTCASE (sample_cost)
+{
+  GumSampler * samplers[5];
+  const gchar * names[5];
+  guint i;
+
+  if (!g_test_slow ())
+  {
+    g_print ("<skipping, run in slow mode> ");
+    return;
+  }
+
+  samplers[0] = gum_cycle_sampler_new ();
+  names[0] = "cycle";
+  if (!gum_cycle_sampler_is_available (GUM_CYCLE_SAMPLER (samplers[0])))
+  {
+    g_object_unref (samplers[0]);
+    samplers[0] = NULL;
+  }
+  samplers[1] = gum_busy_cycle_sampler_new ();
+  names[1] = "busy_cycle";
+  if (!gum_busy_cycle_sampler_is_available (
+      GUM_BUSY_CYCLE_SAMPLER (samplers[1])))
+  {
+    g_object_unref (samplers[1]);
+    samplers[1] = NULL;
+  }
+  samplers[2] = gum_malloc_count_sampler_new ();
+  names[2] = "malloc_count";
+  samplers[3] = gum_call_count_sampler_new (nop_function_a, NULL);
+  names[3] = "call_count";
+  samplers[4] = gum_wallclock_sampler_new ();
+  names[4] = "wallclock";
+
+  for (i = 0; i != G_N_ELEMENTS (samplers); i++)
+  {
+    if (samplers[i] == NULL)
+    {
+      g_print ("<%s=n/a> ", names[i]);
+      continue;
+    }
+
+    g_print ("<%s=%.1f ns> ", names[i], measure_sample_cost (samplers[i]));
+
+    g_object_unref (samplers[i]);
+  }
+}
+
+static gdouble
+measure_sample_cost (GumSampler * sampler)
+{
+  const guint num_samples = 1000000;
+  GTimer * timer;
+  volatile GumSample sample;
+  guint i;
+  gdouble duration;
+
+  sample = gum_sampler_sample (sampler);
+
+  timer = g_timer_new ();
+  for (i = 0; i != num_samples; i++)
+    sample = gum_sampler_sample (sampler);
+  duration = g_timer_elapsed (timer, NULL);
+  g_timer_destroy (timer);
+
+  (void) sample;
+
+  return (duration * G_USEC_PER_SEC * 1000.0) / num_samples;
+}
+
 static void
 spin_for_one_tenth_second (void)
 {
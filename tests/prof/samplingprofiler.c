@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "gumsamplingprofiler.h"
+
+#include "testutil.h"
+
+#include <string.h>
+
+#define SAMPLING_PROFILER_TESTCASE(NAME) \
+    void test_sampling_profiler_ ## NAME ( \
+        TestSamplingProfilerFixture * fixture, gconstpointer data)
+#define SAMPLING_PROFILER_TESTENTRY(NAME) \
+    TEST_ENTRY_WITH_FIXTURE ("Prof/SamplingProfiler", test_sampling_profiler, \
+        NAME, TestSamplingProfilerFixture)
+
+typedef struct _TestSamplingProfilerFixture
+{
+  GumSamplingProfiler * profiler;
+} TestSamplingProfilerFixture;
+
+static void
+test_sampling_profiler_fixture_setup (TestSamplingProfilerFixture * fixture,
+                                      gconstpointer data)
+{
+  fixture->profiler = gum_sampling_profiler_new ();
+}
+
+static void
+test_sampling_profiler_fixture_teardown (TestSamplingProfilerFixture * fixture,
+                                         gconstpointer data)
+{
+  g_object_unref (fixture->profiler);
+}
+
+TEST_LIST_BEGIN (sampling_profiler)
+  SAMPLING_PROFILER_TESTENTRY (busy_thread_is_sampled)
+  SAMPLING_PROFILER_TESTENTRY (only_one_instance_can_run)
+TEST_LIST_END ()
+
+static guint64 sum_folded_stack_counts (const gchar * folded);
+static void GUM_NOINLINE spin_for (gdouble seconds);
+
+SAMPLING_PROFILER_TESTCASE (busy_thread_is_sampled)
+{
+  guint64 sample_count;
+  gchar * folded;
+
+  gum_sampling_profiler_set_interval (fixture->profiler, 500);
+  g_assert (gum_sampling_profiler_start (fixture->profiler));
+  spin_for (0.2);
+  gum_sampling_profiler_stop (fixture->profiler);
+
+  sample_count = gum_sampling_profiler_get_sample_count (fixture->profiler);
+  g_assert_cmpuint (sample_count, >, 0);
+
+  folded = gum_sampling_profiler_emit_folded_stacks (fixture->profiler);
+  g_assert_cmpuint (sum_folded_stack_counts (folded), ==, sample_count);
+  g_assert (strstr (folded, "spin_for") != NULL);
+  g_free (folded);
+}
+
+SAMPLING_PROFILER_TESTCASE (only_one_instance_can_run)
+{
+  GumSamplingProfiler * other;
+
+  other = gum_sampling_profiler_new ();
+
+  g_assert (gum_sampling_profiler_start (fixture->profiler));
+  g_assert (!gum_sampling_profiler_start (other));
+  gum_sampling_profiler_stop (fixture->profiler);
+
+  g_assert (gum_sampling_profiler_start (other));
+  gum_sampling_profiler_stop (other);
+
+  g_object_unref (other);
+}
+
+static guint64
+sum_folded_stack_counts (const gchar * folded)
+{
+  guint64 total = 0;
+  gchar ** lines;
+  guint i;
+
+  lines = g_strsplit (folded, "\n", -1);
+  for (i = 0; lines[i] != NULL; i++)
+  {
+    const gchar * count;
+
+    if (lines[i][0] == '\0')
+      continue;
+
+    count = strrchr (lines[i], ' ');
+    g_assert (count != NULL);
+    total += g_ascii_strtoull (count + 1, NULL, 10);
+  }
+  g_strfreev (lines);
+
+  return total;
+}
+
+static void GUM_NOINLINE
+spin_for (gdouble seconds)
+{
+  GTimer * timer;
+  guint i;
+  volatile guint b = 0;
+
+  timer = g_timer_new ();
+
+  do
+  {
+    for (i = 0; i != 1000000; i++)
+      b += i * i;
+  }
+  while (g_timer_elapsed (timer, NULL) < seconds);
+
+  g_timer_destroy (timer);
+}
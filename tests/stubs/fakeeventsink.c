@@ -12,6 +12,8 @@ static void gum_fake_event_sink_finalize (GObject * obj);
 static GumEventType gum_fake_event_sink_query_mask (GumEventSink * sink);
 static void gum_fake_event_sink_process (GumEventSink * sink,
     const GumEvent * ev);
+static void gum_fake_event_sink_process_batch (GumEventSink * sink,
+    const GumEvent * events, guint n_events);
 
 G_DEFINE_TYPE_EXTENDED (GumFakeEventSink,
                         gum_fake_event_sink,
@@ -36,6 +38,7 @@ gum_fake_event_sink_iface_init (gpointer g_iface,
 
   iface->query_mask = gum_fake_event_sink_query_mask;
   iface->process = gum_fake_event_sink_process;
+  iface->process_batch = gum_fake_event_sink_process_batch;
 }
 
 static void
@@ -69,6 +72,7 @@ gum_fake_event_sink_reset (GumFakeEventSink * self)
 {
   self->mask = 0;
   g_array_set_size (self->events, 0);
+  self->batch_count = 0;
 }
 
 const GumCallEvent *
@@ -146,3 +150,14 @@ gum_fake_event_sink_process (GumEventSink * sink,
 
   g_array_append_val (self->events, *ev);
 }
+
+static void
+gum_fake_event_sink_process_batch (GumEventSink * sink,
+                                   const GumEvent * events,
+                                   guint n_events)
+{
+  GumFakeEventSink * self = GUM_FAKE_EVENT_SINK (sink);
+
+  g_array_append_vals (self->events, events, n_events);
+  self->batch_count++;
+}
@@ -31,6 +31,7 @@ struct _GumFakeEventSink
 
   GumEventType mask;
   GArray * events;
+  guint batch_count;
 };
 
 struct _GumFakeEventSinkClass